@@ -0,0 +1,78 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_ACCELERATOR_H_
+#define HINTLESS_PIR_HINTLESS_SIMPLEPIR_ACCELERATOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "hintless_simplepir/block_matrix.h"
+#include "lwe/types.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+// A device, e.g. a GPU, that computes the products of a `Database` with its
+// data matrices, which it keeps resident in its own memory: the online
+// products with the query vectors, and the hint matrices.
+//
+// The data matrices are stored by columns, with every plaintext value in a slot
+// of `packed_value_bits` bits at the offset given by
+// `internal::PackedValueShift`, and all products are modulo 2^k for k-bit
+// `lwe::Integer`. The database falls back to its CPU kernels whenever a method
+// returns an error, so implementations may support only some shapes, or return
+// `absl::UnavailableError` while the device is busy or lost.
+//
+// The const methods may be called concurrently, by requests handled on several
+// threads, but not concurrently with the uploads.
+class DatabaseAccelerator {
+ public:
+  virtual ~DatabaseAccelerator() = default;
+
+  // Copies the data matrices, one per shard, each of `num_rows` rows, to the
+  // device, replacing the ones copied before.
+  virtual absl::Status UploadData(
+      absl::Span<const internal::BlockMatrix> data_matrices, int64_t num_rows,
+      int packed_value_bits) = 0;
+
+  // Copies the columns at `col_indices` of all data matrices to the device
+  // again, after records in them changed.
+  virtual absl::Status UploadColumns(
+      absl::Span<const internal::BlockMatrix> data_matrices,
+      absl::Span<const int64_t> col_indices) = 0;
+
+  // Writes the products between the data matrices and every one of `queries`
+  // to `results`, indexed by query first and shard second, i.e. the product
+  // with query q and shard i to `results[q * num_shards + i]`, which holds one
+  // value per row.
+  virtual absl::Status InnerProductBatch(
+      absl::Span<const absl::Span<const lwe::Integer>> queries,
+      absl::Span<const absl::Span<lwe::Integer>> results) const = 0;
+
+  // Writes the products between the data matrices and `pad`, which has one row
+  // per column of the data matrices and `num_pad_cols` columns and is stored
+  // by rows, to `hints`, which holds one matrix per shard stored by rows and
+  // sized to hold the products.
+  virtual absl::Status MatrixProduct(
+      absl::Span<const lwe::Integer> pad, int64_t num_pad_cols,
+      absl::Span<std::vector<std::vector<lwe::Integer>>> hints) const = 0;
+};
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_HINTLESS_SIMPLEPIR_ACCELERATOR_H_
@@ -0,0 +1,108 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hintless_simplepir/block_matrix.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "absl/log/check.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace internal {
+namespace {
+
+// Matrices of at least this many bytes are aligned to, and advised to be
+// backed by, huge pages.
+constexpr size_t kHugePageSize = size_t{2} << 20;
+
+inline size_t RoundUp(size_t x, size_t y) { return (x + y - 1) / y * y; }
+
+}  // namespace
+
+BlockMatrix::BlockMatrix(int64_t num_cols, int64_t num_blocks_per_col)
+    : num_cols_(num_cols),
+      num_blocks_per_col_(num_blocks_per_col),
+      col_stride_(ColumnStride(num_blocks_per_col)) {
+  CHECK_GE(num_cols, 0);
+  CHECK_GE(num_blocks_per_col, 0);
+
+  size_t num_bytes = num_cols_ * col_stride_ * sizeof(BlockType);
+  size_t alignment = num_bytes >= kHugePageSize ? kHugePageSize : kAlignment;
+  // std::aligned_alloc requires the size to be a multiple of the alignment.
+  num_bytes = RoundUp(std::max<size_t>(num_bytes, 1), alignment);
+  void* ptr = std::aligned_alloc(alignment, num_bytes);
+  CHECK(ptr != nullptr) << "Failed to allocate " << num_bytes << " bytes.";
+#ifdef MADV_HUGEPAGE
+  if (alignment == kHugePageSize) {
+    // This is only a hint, so failures are ignored.
+    madvise(ptr, num_bytes, MADV_HUGEPAGE);
+  }
+#endif
+  std::memset(ptr, 0, num_bytes);
+  storage_ = std::shared_ptr<void>(ptr, std::free);
+  data_ = static_cast<BlockType*>(ptr);
+}
+
+BlockMatrix BlockMatrix::View(std::shared_ptr<void> owner, BlockType* data,
+                              int64_t num_cols, int64_t num_blocks_per_col) {
+  return View(std::move(owner), data, num_cols, num_blocks_per_col,
+              ColumnStride(num_blocks_per_col));
+}
+
+BlockMatrix BlockMatrix::View(std::shared_ptr<void> owner, BlockType* data,
+                              int64_t num_cols, int64_t num_blocks_per_col,
+                              int64_t col_stride) {
+  CHECK_EQ(reinterpret_cast<uintptr_t>(data) % kAlignment, 0);
+  CHECK_GE(col_stride, ColumnStride(num_blocks_per_col));
+  CHECK_EQ(col_stride % ColumnStride(1), 0);
+  BlockMatrix matrix;
+  matrix.num_cols_ = num_cols;
+  matrix.num_blocks_per_col_ = num_blocks_per_col;
+  matrix.col_stride_ = col_stride;
+  matrix.storage_ = std::move(owner);
+  matrix.data_ = data;
+  return matrix;
+}
+
+BlockMatrix BlockMatrix::Clone() const {
+  BlockMatrix copy(num_cols_, num_blocks_per_col_);
+  if (data_ == nullptr) {
+    return copy;
+  }
+  if (col_stride_ == copy.col_stride_) {
+    std::copy_n(data_, num_cols_ * col_stride_, copy.data_);
+    return copy;
+  }
+  // The copy of a strided view is dense.
+  for (int64_t i = 0; i < num_cols_; ++i) {
+    std::copy_n(data_ + i * col_stride_, copy.col_stride_,
+                copy.data_ + i * copy.col_stride_);
+  }
+  return copy;
+}
+
+}  // namespace internal
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
@@ -0,0 +1,132 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_BLOCK_MATRIX_H_
+#define HINTLESS_PIR_HINTLESS_SIMPLEPIR_BLOCK_MATRIX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/numeric/int128.h"
+#include "absl/types/span.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace internal {
+
+using BlockType = absl::uint128;
+using BlockVector = std::vector<BlockType>;
+
+// A matrix of packed plaintext values, stored by columns in a single zeroed,
+// cache-line aligned allocation. Each column holds `NumBlocksPerColumn()`
+// blocks, and consecutive columns are `ColumnStride()` blocks apart, where the
+// stride is padded to a multiple of the largest SIMD vector width. Large
+// matrices are backed by transparent huge pages where available. A matrix can
+// also view storage owned elsewhere, e.g. a memory-mapped file, or every n-th
+// column of a larger matrix.
+class BlockMatrix {
+ public:
+  // The alignment in bytes of every column.
+  static constexpr size_t kAlignment = 64;
+
+  BlockMatrix() = default;
+  BlockMatrix(int64_t num_cols, int64_t num_blocks_per_col);
+
+  // Returns a matrix using `data` as its storage, which must be aligned to
+  // `kAlignment` bytes and hold `num_cols` * ColumnStride(num_blocks_per_col)
+  // blocks. `owner` keeps `data` alive for the lifetime of the matrix.
+  static BlockMatrix View(std::shared_ptr<void> owner, BlockType* data,
+                          int64_t num_cols, int64_t num_blocks_per_col);
+
+  // As above, but with consecutive columns `col_stride` blocks apart, which
+  // must be a multiple of ColumnStride(1) and at least
+  // ColumnStride(num_blocks_per_col). `data` must hold the blocks up to the end
+  // of the last column.
+  static BlockMatrix View(std::shared_ptr<void> owner, BlockType* data,
+                          int64_t num_cols, int64_t num_blocks_per_col,
+                          int64_t col_stride);
+
+  // Returns the column stride used for `num_blocks_per_col` blocks per column.
+  static int64_t ColumnStride(int64_t num_blocks_per_col) {
+    constexpr int64_t kBlocksPerAlignment = kAlignment / sizeof(BlockType);
+    return (num_blocks_per_col + kBlocksPerAlignment - 1) /
+           kBlocksPerAlignment * kBlocksPerAlignment;
+  }
+
+  BlockMatrix(BlockMatrix&& other) noexcept
+      : num_cols_(std::exchange(other.num_cols_, 0)),
+        num_blocks_per_col_(std::exchange(other.num_blocks_per_col_, 0)),
+        col_stride_(std::exchange(other.col_stride_, 0)),
+        storage_(std::move(other.storage_)),
+        data_(std::exchange(other.data_, nullptr)) {}
+  BlockMatrix& operator=(BlockMatrix&& other) noexcept {
+    num_cols_ = std::exchange(other.num_cols_, 0);
+    num_blocks_per_col_ = std::exchange(other.num_blocks_per_col_, 0);
+    col_stride_ = std::exchange(other.col_stride_, 0);
+    storage_ = std::move(other.storage_);
+    data_ = std::exchange(other.data_, nullptr);
+    return *this;
+  }
+
+  // Copies are explicit, as the matrix may take gigabytes.
+  BlockMatrix(const BlockMatrix&) = delete;
+  BlockMatrix& operator=(const BlockMatrix&) = delete;
+  BlockMatrix Clone() const;
+
+  // Returns the blocks of the `col_idx`-th column.
+  absl::Span<const BlockType> operator[](int64_t col_idx) const {
+    return absl::MakeConstSpan(data_ + col_idx * col_stride_,
+                               num_blocks_per_col_);
+  }
+  absl::Span<BlockType> operator[](int64_t col_idx) {
+    return absl::MakeSpan(data_ + col_idx * col_stride_, num_blocks_per_col_);
+  }
+
+  // The number of columns.
+  size_t size() const { return num_cols_; }
+  bool empty() const { return num_cols_ == 0; }
+
+  int64_t NumBlocksPerColumn() const { return num_blocks_per_col_; }
+  int64_t ColumnStride() const { return col_stride_; }
+
+  // Returns the whole storage, including the padding of the columns. For a
+  // view with a larger column stride, this includes the blocks between its
+  // columns, and ends with the padding of the last column.
+  absl::Span<const BlockType> Blocks() const {
+    if (num_cols_ == 0) {
+      return absl::MakeConstSpan(data_, 0);
+    }
+    return absl::MakeConstSpan(data_, (num_cols_ - 1) * col_stride_ +
+                                          ColumnStride(num_blocks_per_col_));
+  }
+
+ private:
+  int64_t num_cols_ = 0;
+  int64_t num_blocks_per_col_ = 0;
+  int64_t col_stride_ = 0;
+
+  // Keeps the storage alive; `data_` points into it.
+  std::shared_ptr<void> storage_;
+  BlockType* data_ = nullptr;
+};
+
+}  // namespace internal
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_HINTLESS_SIMPLEPIR_BLOCK_MATRIX_H_
@@ -0,0 +1,121 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hintless_simplepir/block_matrix.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "absl/numeric/int128.h"
+#include "gtest/gtest.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace internal {
+namespace {
+
+TEST(BlockMatrix, DefaultIsEmpty) {
+  BlockMatrix matrix;
+  EXPECT_TRUE(matrix.empty());
+  EXPECT_EQ(matrix.size(), 0);
+}
+
+TEST(BlockMatrix, ColumnsAreZeroedAndAligned) {
+  BlockMatrix matrix(/*num_cols=*/5, /*num_blocks_per_col=*/7);
+  ASSERT_EQ(matrix.size(), 5);
+  ASSERT_EQ(matrix.NumBlocksPerColumn(), 7);
+  EXPECT_EQ(matrix.ColumnStride() * sizeof(BlockType) % BlockMatrix::kAlignment,
+            0);
+  for (int j = 0; j < matrix.size(); ++j) {
+    ASSERT_EQ(matrix[j].size(), 7);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(matrix[j].data()) %
+                  BlockMatrix::kAlignment,
+              0);
+    for (BlockType block : matrix[j]) {
+      EXPECT_EQ(block, 0);
+    }
+  }
+}
+
+TEST(BlockMatrix, ColumnsDoNotOverlap) {
+  BlockMatrix matrix(/*num_cols=*/3, /*num_blocks_per_col=*/5);
+  for (int j = 0; j < matrix.size(); ++j) {
+    for (int i = 0; i < matrix.NumBlocksPerColumn(); ++i) {
+      matrix[j][i] = absl::MakeUint128(j, i);
+    }
+  }
+  for (int j = 0; j < matrix.size(); ++j) {
+    for (int i = 0; i < matrix.NumBlocksPerColumn(); ++i) {
+      EXPECT_EQ(matrix[j][i], absl::MakeUint128(j, i));
+    }
+  }
+}
+
+TEST(BlockMatrix, CloneAndMove) {
+  BlockMatrix matrix(/*num_cols=*/2, /*num_blocks_per_col=*/3);
+  matrix[1][2] = 42;
+  BlockMatrix copy = matrix.Clone();
+  matrix[1][2] = 0;
+  EXPECT_EQ(copy[1][2], 42);
+
+  BlockMatrix moved = std::move(copy);
+  ASSERT_EQ(moved.size(), 2);
+  EXPECT_EQ(moved[1][2], 42);
+  EXPECT_TRUE(copy.empty());
+
+  BlockMatrix assigned;
+  assigned = std::move(moved);
+  ASSERT_EQ(assigned.size(), 2);
+  EXPECT_EQ(assigned[1][2], 42);
+  EXPECT_TRUE(moved.empty());
+
+  // Vectors of matrices move them when growing, rather than failing to copy.
+  static_assert(std::is_nothrow_move_constructible_v<BlockMatrix>);
+  static_assert(std::is_nothrow_move_assignable_v<BlockMatrix>);
+}
+
+TEST(BlockMatrix, StridedViewsInterleaveColumns) {
+  // Two views taking the even and the odd columns of `matrix`.
+  BlockMatrix matrix(/*num_cols=*/6, /*num_blocks_per_col=*/3);
+  int64_t col_stride = matrix.ColumnStride();
+  BlockMatrix even = BlockMatrix::View(/*owner=*/nullptr, matrix[0].data(),
+                                       /*num_cols=*/3, /*num_blocks_per_col=*/3,
+                                       2 * col_stride);
+  BlockMatrix odd = BlockMatrix::View(/*owner=*/nullptr, matrix[1].data(),
+                                      /*num_cols=*/3, /*num_blocks_per_col=*/3,
+                                      2 * col_stride);
+  for (int j = 0; j < 3; ++j) {
+    even[j][2] = 2 * j;
+    odd[j][2] = 2 * j + 1;
+  }
+  for (int j = 0; j < matrix.size(); ++j) {
+    EXPECT_EQ(matrix[j][2], j);
+  }
+  // The blocks of a view end at the end of its last column.
+  EXPECT_EQ(odd.Blocks().data() + odd.Blocks().size(),
+            matrix.Blocks().data() + matrix.Blocks().size());
+
+  BlockMatrix copy = odd.Clone();
+  ASSERT_EQ(copy.size(), 3);
+  EXPECT_EQ(copy.ColumnStride(), col_stride);
+  for (int j = 0; j < copy.size(); ++j) {
+    EXPECT_EQ(copy[j][2], 2 * j + 1);
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
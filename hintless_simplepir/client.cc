@@ -16,16 +16,21 @@
 
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "Eigen/Core"
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/serialization.pb.h"
 #include "hintless_simplepir/utils.h"
@@ -38,17 +43,54 @@
 #include "shell_encryption/prng/single_thread_hkdf_prng.h"
 #include "shell_encryption/rns/crt_interpolation.h"
 #include "shell_encryption/status_macros.h"
+#include "util/metrics.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 
+namespace {
+
+// Returns a fresh PRNG seed for `prng_type`.
+absl::StatusOr<std::string> GeneratePrngSeed(rlwe::PrngType prng_type) {
+  if (prng_type == rlwe::PRNG_TYPE_HKDF) {
+    return rlwe::SingleThreadHkdfPrng::GenerateSeed();
+  }
+  return rlwe::SingleThreadChaChaPrng::GenerateSeed();
+}
+
+// Returns a PRNG of `prng_type` created from `prng_seed`.
+absl::StatusOr<std::unique_ptr<rlwe::SecurePrng>> CreatePrng(
+    rlwe::PrngType prng_type, absl::string_view prng_seed) {
+  std::unique_ptr<rlwe::SecurePrng> prng;
+  if (prng_type == rlwe::PRNG_TYPE_HKDF) {
+    RLWE_ASSIGN_OR_RETURN(prng, rlwe::SingleThreadHkdfPrng::Create(prng_seed));
+  } else {
+    RLWE_ASSIGN_OR_RETURN(prng,
+                          rlwe::SingleThreadChaChaPrng::Create(prng_seed));
+  }
+  return prng;
+}
+
+}  // namespace
+
 absl::StatusOr<std::unique_ptr<Client>> Client::Create(
     const Parameters& params,
-    const HintlessPirServerPublicParams& public_params) {
+    const HintlessPirServerPublicParams& public_params, PadMode pad_mode) {
   if (!(params.prng_type == rlwe::PRNG_TYPE_HKDF ||
         params.prng_type == rlwe::PRNG_TYPE_CHACHA)) {
     return absl::InvalidArgumentError("Invalid PRNG type in `params`.");
   }
+  RLWE_RETURN_IF_ERROR(CheckForValidLweModulusBitSize(params));
+  // The server decides whether its LWE responses are modulus switched.
+  Parameters client_params = params;
+  client_params.lwe_response_bit_size = public_params.lwe_response_bit_size();
+  if (client_params.lwe_response_bit_size != 0 &&
+      (client_params.lwe_response_bit_size <= params.lwe_plaintext_bit_size ||
+       client_params.lwe_response_bit_size > params.lwe_modulus_bit_size)) {
+    return absl::InvalidArgumentError(
+        "`public_params` contains an invalid LWE response bit size.");
+  }
+
   // Create LinPir clients, one per plaintext modulus in `ts`.
   auto const& rlwe_params = params.linpir_params;
   int num_linpir_instances = rlwe_params.ts.size();
@@ -84,214 +126,243 @@ absl::StatusOr<std::unique_ptr<Client>> Client::Create(
       RlweRnsContext crt_context,
       RlweRnsContext::Create(rlwe_params.log_n, rlwe_params.ts, /*ps=*/{}, 2));
 
-  return absl::WrapUnique(
-      new Client(params, public_params.prng_seed_lwe_query_pad(),
-                 std::move(rlwe_contexts), std::move(rlwe_moduli),
-                 std::move(linpir_clients), std::move(crt_context)));
+  // Expand the LWE query pad once for all requests if asked to.
+  std::unique_ptr<const lwe::Matrix> lwe_query_pad;
+  if (pad_mode == PadMode::kMaterialized) {
+    RLWE_ASSIGN_OR_RETURN(
+        std::unique_ptr<rlwe::SecurePrng> pad_prng,
+        CreatePrng(params.prng_type, public_params.prng_seed_lwe_query_pad()));
+    RLWE_ASSIGN_OR_RETURN(lwe::Matrix pad,
+                          lwe::ExpandPad(params.db_cols, params.lwe_secret_dim,
+                                         pad_prng.get()));
+    lwe_query_pad = std::make_unique<const lwe::Matrix>(std::move(pad));
+  }
+
+  return absl::WrapUnique(new Client(
+      std::move(client_params), public_params.epoch_id(),
+      public_params.prng_seed_lwe_query_pad(),
+      std::move(lwe_query_pad),
+      std::move(rlwe_contexts), std::move(rlwe_moduli),
+      std::move(linpir_clients), std::move(crt_context)));
 }
 
 absl::StatusOr<HintlessPirRequest> Client::GenerateRequest(int64_t index) {
+  RequestHandle handle;
+  RLWE_ASSIGN_OR_RETURN(HintlessPirRequest request,
+                        GenerateRequest(index, handle));
+  state_ = std::move(handle);
+  return request;
+}
+
+absl::StatusOr<HintlessPirRequest> Client::GenerateRequest(
+    int64_t index, RequestHandle& handle) {
   if (index < 0 || index >= params_.db_rows * params_.db_cols) {
     return absl::InvalidArgumentError("`index` out of range.");
   }
 
-  // Step 1. Encrypting the selection vector under LWE.
-  lwe::Matrix lwe_pad;
-  std::unique_ptr<rlwe::SecurePrng> lwe_enc_prng;
-  std::string prng_seed_linpir_sk;
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(auto pad_prng, rlwe::SingleThreadHkdfPrng::Create(
-                                             prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        lwe_pad, lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim,
-                                pad_prng.get()));
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadHkdfPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_enc));
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_sk,
-                          rlwe::SingleThreadHkdfPrng::GenerateSeed());
-
-  } else {
-    RLWE_ASSIGN_OR_RETURN(auto pad_prng, rlwe::SingleThreadChaChaPrng::Create(
-                                             prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        lwe_pad, lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim,
-                                pad_prng.get()));
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadChaChaPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_enc));
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_sk,
-                          rlwe::SingleThreadChaChaPrng::GenerateSeed());
-  }
-  RLWE_ASSIGN_OR_RETURN(
-      lwe::SymmetricLweKey lwe_secret_key,
-      lwe::SymmetricLweKey::Sample(params_.lwe_secret_dim, lwe_enc_prng.get()));
-
-  // Choosing the largest scaling factor that supports our plaintext space
-  int log_scaling_factor =
-      params_.lwe_modulus_bit_size - params_.lwe_plaintext_bit_size;
-
-  // Plaintext is a selection vector for col_idx
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientRequestGeneration);
   int64_t row_idx = index / params_.db_cols;
   int64_t col_idx = index % params_.db_cols;
-  lwe::Vector query_vector = lwe::Vector::Zero(params_.db_cols);
-  query_vector[col_idx] = 1;
-
-  RLWE_RETURN_IF_ERROR(lwe_secret_key.EncryptFromPadInPlace(
-      query_vector, lwe_pad, log_scaling_factor, lwe_enc_prng.get()));
-
-  // Cache the per request state.
-  state_ = ClientState{.row_idx = row_idx,
-                       .col_idx = col_idx,
-                       .prng_seed_linpir_sk = std::move(prng_seed_linpir_sk)};
-
-  HintlessPirRequest request;
-  *request.mutable_ct_query_vector() = SerializeLweCiphertext(query_vector);
-
-  // Step 2. Encrypting the LWE secret using LinPir.
-  RLWE_RETURN_IF_ERROR(
-      GenerateLinPirRequestInPlace(request, lwe_secret_key.Key()));
+  std::string prng_seed_linpir_sk;
+  RLWE_ASSIGN_OR_RETURN(HintlessPirRequest request,
+                        GenerateColumnRequest(col_idx, prng_seed_linpir_sk));
+
+  handle = RequestHandle{.row_idx = row_idx,
+                         .prng_seed_linpir_sk = std::move(prng_seed_linpir_sk)};
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientRequestGeneration, 0,
+                               request.ByteSizeLong());
+  }
   return request;
 }
 
-absl::StatusOr<std::tuple<lwe::Vector, lwe::SymmetricLweKey>> Client::Compute_A_times_s() {
-  double start, end;
-  start = currentDateTime();
-  // Step 1. Encrypting the selection vector under LWE.
-  lwe::Matrix lwe_pad;
-  std::unique_ptr<rlwe::SecurePrng> lwe_enc_prng;
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(auto pad_prng, rlwe::SingleThreadHkdfPrng::Create(
-                                             prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        lwe_pad, lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim,
-                                pad_prng.get()));
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadHkdfPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_enc));
-
-  } else {
-    RLWE_ASSIGN_OR_RETURN(auto pad_prng, rlwe::SingleThreadChaChaPrng::Create(
-                                             prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        lwe_pad, lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim,
-                                pad_prng.get()));
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadChaChaPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_enc));
-  }
-  end = currentDateTime();
-  std::cout << "[==> TIMER  <==] Client expanding A from seed time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
-
-  start = currentDateTime();
-
-  RLWE_ASSIGN_OR_RETURN(
-      lwe::SymmetricLweKey lwe_secret_key,
-      lwe::SymmetricLweKey::Sample(params_.lwe_secret_dim, lwe_enc_prng.get()));
-
-  RLWE_ASSIGN_OR_RETURN(auto As, lwe_secret_key.MultiplySkWithA(lwe_pad));
-  
-  end = currentDateTime();
-  std::cout << "[==> TIMER  <==] Client A*s time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
-
-  return std::make_tuple(As, lwe_secret_key);
+absl::StatusOr<HintlessPirBatchRequest> Client::GenerateBatchRequest(
+    absl::Span<const int64_t> indices) {
+  BatchRequestHandle handle;
+  RLWE_ASSIGN_OR_RETURN(HintlessPirBatchRequest batch_request,
+                        GenerateBatchRequest(indices, handle));
+  batch_state_ = std::move(handle);
+  return batch_request;
 }
 
-absl::StatusOr<HintlessPirRequest> Client::PrepareLinPirGivenS(lwe::SymmetricLweKey& s_lwe) {
-
-  std::string prng_seed_linpir_sk;
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_sk,
-                          rlwe::SingleThreadHkdfPrng::GenerateSeed());
-
-  } else {
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_sk,
-                          rlwe::SingleThreadChaChaPrng::GenerateSeed());
+absl::StatusOr<HintlessPirBatchRequest> Client::GenerateBatchRequest(
+    absl::Span<const int64_t> indices, BatchRequestHandle& handle) {
+  if (indices.empty()) {
+    return absl::InvalidArgumentError("`indices` must not be empty.");
+  }
+  for (int64_t index : indices) {
+    if (index < 0 || index >= params_.db_rows * params_.db_cols) {
+      return absl::InvalidArgumentError("`index` out of range.");
+    }
   }
-  
-
-  // Cache the per request state.
-  state_ = ClientState{.row_idx = 0,
-                       .col_idx = 0,
-                       .prng_seed_linpir_sk = std::move(prng_seed_linpir_sk)};
-
-  HintlessPirRequest prepare_request;
 
-  RLWE_RETURN_IF_ERROR(
-      GenerateLinPirRequestInPlace(prepare_request, s_lwe.Key()));
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientRequestGeneration);
+
+  // Records in the same column are retrieved by the same request, so there is
+  // one request per distinct column, in the order of their first index.
+  BatchRequestHandle batch_state;
+  batch_state.requests_and_rows.reserve(indices.size());
+  absl::flat_hash_map<int64_t, int> request_of_col;
+  HintlessPirBatchRequest batch_request;
+  for (int64_t index : indices) {
+    int64_t row_idx = index / params_.db_cols;
+    int64_t col_idx = index % params_.db_cols;
+    auto [it, inserted] =
+        request_of_col.try_emplace(col_idx, batch_request.requests_size());
+    if (inserted) {
+      std::string prng_seed_linpir_sk;
+      RLWE_ASSIGN_OR_RETURN(
+          *batch_request.add_requests(),
+          GenerateColumnRequest(col_idx, prng_seed_linpir_sk));
+      batch_state.prng_seeds_linpir_sk.push_back(
+          std::move(prng_seed_linpir_sk));
+    }
+    batch_state.requests_and_rows.push_back({it->second, row_idx});
+  }
 
-  return prepare_request;
+  handle = std::move(batch_state);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientRequestGeneration, 0,
+                               batch_request.ByteSizeLong());
+  }
+  return batch_request;
 }
 
-absl::StatusOr<std::pair<HintlessPirRequest, lwe::Vector>> Client::GenerateRequestGivenAsSkipLinPir(int64_t index, lwe::Vector& As, lwe::SymmetricLweKey& s_lwe) {
-  if (index < 0 || index >= params_.db_rows * params_.db_cols) {
-    return absl::InvalidArgumentError("`index` out of range.");
+absl::StatusOr<HintlessPirRequest> Client::GenerateColumnRequest(
+    int64_t col_idx, std::string& prng_seed_linpir_sk) {
+  // Take the LWE secret, the pad * LWE secret and the LinPir request from the
+  // precomputed ones if there is any, or compute them now.
+  std::optional<PrecomputedRequest> precomputed;
+  {
+    absl::MutexLock lock(&pool_mutex_);
+    if (!precomputed_requests_.empty()) {
+      precomputed.emplace(std::move(precomputed_requests_.front()));
+      precomputed_requests_.pop_front();
+    }
+  }
+  if (!precomputed.has_value()) {
+    RLWE_ASSIGN_OR_RETURN(PrecomputedRequest fresh,
+                          GeneratePrecomputedRequest());
+    precomputed.emplace(std::move(fresh));
   }
 
   // Step 1. Encrypting the selection vector under LWE.
-  std::unique_ptr<rlwe::SecurePrng> lwe_enc_prng;
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadHkdfPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_enc));
+  RLWE_ASSIGN_OR_RETURN(
+      SerializedLweCiphertext ct_query_vector,
+      EncryptColumnSelection(col_idx, precomputed->lwe_secret_key,
+                             precomputed->pad_times_key));
+  prng_seed_linpir_sk = std::move(precomputed->prng_seed_linpir_sk);
+
+  // Step 2. The LWE secret encrypted using LinPir.
+  HintlessPirRequest request = std::move(precomputed->linpir_request);
+  *request.mutable_ct_query_vector() = std::move(ct_query_vector);
+  return request;
+}
 
-  } else {
-    RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
-                          rlwe::SingleThreadChaChaPrng::GenerateSeed());
-    RLWE_ASSIGN_OR_RETURN(lwe_enc_prng,
-                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_enc));
-  }
+absl::StatusOr<SerializedLweCiphertext> Client::EncryptColumnSelection(
+    int64_t col_idx, const lwe::SymmetricLweKey& lwe_secret_key,
+    const lwe::Vector& pad_times_key) const {
+  RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
+                        GeneratePrngSeed(params_.prng_type));
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<rlwe::SecurePrng> lwe_enc_prng,
+                        CreatePrng(params_.prng_type, prng_seed_enc));
 
   // Choosing the largest scaling factor that supports our plaintext space
   int log_scaling_factor =
       params_.lwe_modulus_bit_size - params_.lwe_plaintext_bit_size;
 
   // Plaintext is a selection vector for col_idx
-  int64_t row_idx = index / params_.db_cols;
-  int64_t col_idx = index % params_.db_cols;
   lwe::Vector query_vector = lwe::Vector::Zero(params_.db_cols);
   query_vector[col_idx] = 1;
+  RLWE_RETURN_IF_ERROR(lwe_secret_key.EncryptFromPadInPlaceGivenAs(
+      query_vector, pad_times_key, log_scaling_factor, lwe_enc_prng.get()));
+  return SerializeLweCiphertext(query_vector);
+}
 
-  RLWE_RETURN_IF_ERROR(s_lwe.EncryptFromPadInPlaceGivenAs(
-      query_vector, As, log_scaling_factor, lwe_enc_prng.get()));
+absl::Status Client::Precompute(int num_requests) {
+  if (num_requests < 0) {
+    return absl::InvalidArgumentError("`num_requests` must be non-negative.");
+  }
+  for (int i = 0; i < num_requests; ++i) {
+    RLWE_ASSIGN_OR_RETURN(PrecomputedRequest precomputed,
+                          GeneratePrecomputedRequest());
+    absl::MutexLock lock(&pool_mutex_);
+    precomputed_requests_.push_back(std::move(precomputed));
+  }
+  return absl::OkStatus();
+}
 
-  // Cache the per request state.
-  state_.row_idx = row_idx;
-  state_.col_idx = col_idx;
+int Client::NumPrecomputedRequests() const {
+  absl::MutexLock lock(&pool_mutex_);
+  return precomputed_requests_.size();
+}
 
-  HintlessPirRequest request;
-  *request.mutable_ct_query_vector() = SerializeLweCiphertext(query_vector);
+absl::StatusOr<Client::PrecomputedRequest>
+Client::GeneratePrecomputedRequest() const {
+  RLWE_ASSIGN_OR_RETURN(std::string prng_seed_key,
+                        GeneratePrngSeed(params_.prng_type));
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<rlwe::SecurePrng> prng_key,
+                        CreatePrng(params_.prng_type, prng_seed_key));
+  RLWE_ASSIGN_OR_RETURN(
+      lwe::SymmetricLweKey lwe_secret_key,
+      lwe::SymmetricLweKey::Sample(params_.lwe_secret_dim, prng_key.get()));
+  RLWE_ASSIGN_OR_RETURN(lwe::Vector pad_times_key,
+                        PadTimesKey(lwe_secret_key.Key()));
+
+  // Every request is encrypted under a fresh LinPir secret key: the random
+  // pads of the LinPir ciphertexts are fixed by the public parameters, so two
+  // requests under the same key would reveal the difference of their LWE
+  // secrets, and in turn that of their query vectors.
+  RLWE_ASSIGN_OR_RETURN(std::string prng_seed_linpir_sk,
+                        GeneratePrngSeed(params_.prng_type));
+  HintlessPirRequest linpir_request;
+  if (epoch_id_ > 0) {
+    linpir_request.set_epoch_id(epoch_id_);
+  }
+  RLWE_RETURN_IF_ERROR(GenerateLinPirRequestInPlace(
+      linpir_request, lwe_secret_key.Key(), prng_seed_linpir_sk));
+  return PrecomputedRequest{.lwe_secret_key = std::move(lwe_secret_key),
+                            .pad_times_key = std::move(pad_times_key),
+                            .prng_seed_linpir_sk =
+                                std::move(prng_seed_linpir_sk),
+                            .linpir_request = std::move(linpir_request)};
+}
 
-  return std::make_pair(request, query_vector);
+absl::StatusOr<lwe::Vector> Client::PadTimesKey(
+    const lwe::Vector& lwe_secret) const {
+  if (lwe_query_pad_ != nullptr) {
+    lwe::Vector product = *lwe_query_pad_ * lwe_secret;
+    return product;
+  }
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientPadExpansion);
+  RLWE_ASSIGN_OR_RETURN(
+      std::unique_ptr<rlwe::SecurePrng> pad_prng,
+      CreatePrng(params_.prng_type, prng_seed_lwe_query_pad_));
+  return lwe::ExpandPadAndMultiply(params_.db_cols, lwe_secret,
+                                   pad_prng.get());
 }
 
 absl::Status Client::GenerateLinPirRequestInPlace(
-    HintlessPirRequest& request, const lwe::Vector& lwe_secret) const {
+    HintlessPirRequest& request, const lwe::Vector& lwe_secret,
+    absl::string_view prng_seed_linpir_sk) const {
   if (linpir_clients_.empty()) {
     return absl::InvalidArgumentError("No LinPir client available.");
   }
 
   // Encode the LWE secret vector using LinPir plaintext moduli, and also
   // generate a GaloisKey which is shared by all LinPir requests.
-  RlweInteger lwe_modulus = RlweInteger{1} << params_.lwe_modulus_bit_size;
   for (int k = 0; k < linpir_clients_.size(); ++k) {
     RlweInteger plaintext_modulus = rlwe_contexts_[k]->PlaintextModulus();
-    std::vector<RlweInteger> lwe_secret_mod_t =
-        EncodeLweVector(lwe_secret, lwe_modulus, plaintext_modulus);
-    RLWE_ASSIGN_OR_RETURN(
-        auto ct, linpir_clients_[k]->EncryptQuery(lwe_secret_mod_t,
-                                                  state_.prng_seed_linpir_sk));
+    std::vector<RlweInteger> lwe_secret_mod_t = EncodeLweVector(
+        lwe_secret, params_.lwe_modulus_bit_size, plaintext_modulus);
+    RLWE_ASSIGN_OR_RETURN(auto ct, linpir_clients_[k]->EncryptQueryWithSeed(
+                                       lwe_secret_mod_t, prng_seed_linpir_sk));
     RLWE_ASSIGN_OR_RETURN(auto ct_b, ct.Component(0));
     RLWE_ASSIGN_OR_RETURN(*request.add_linpir_ct_bs(),
                           ct_b.Serialize(rlwe_moduli_));
   }
-  RLWE_ASSIGN_OR_RETURN(auto gk, linpir_clients_[0]->GenerateGaloisKey(
-                                     state_.prng_seed_linpir_sk));
+  RLWE_ASSIGN_OR_RETURN(
+      auto gk, linpir_clients_[0]->GenerateGaloisKey(prng_seed_linpir_sk));
   for (auto const& gk_b : gk.GetKeyB()) {
     RLWE_ASSIGN_OR_RETURN(*request.add_linpir_gk_bs(),
                           gk_b.Serialize(rlwe_moduli_));
@@ -300,86 +371,154 @@ absl::Status Client::GenerateLinPirRequestInPlace(
 }
 
 std::vector<Client::RlweInteger> Client::EncodeLweVector(
-    const lwe::Vector& lwe_vector, RlweInteger lwe_modulus,
+    const lwe::Vector& lwe_vector, int lwe_modulus_bits,
     RlweInteger encode_modulus) {
-  RlweInteger lwe_modulus_half = lwe_modulus >> 1;
+  // Converts on the wider of the LWE and RLWE integers, as either one may be
+  // 64 bits wide.
+  using WideInteger = std::common_type_t<lwe::Integer, RlweInteger>;
   std::vector<RlweInteger> lwe_vector_mod_t(lwe_vector.size(), 0);
   for (int i = 0; i < lwe_vector.size(); ++i) {
-    RlweInteger x = lwe_vector[i];
-    lwe_vector_mod_t[i] =
-        ConvertModulus(x, lwe_modulus, encode_modulus, lwe_modulus_half);
+    lwe_vector_mod_t[i] = static_cast<RlweInteger>(
+        ConvertFromPowerOfTwoModulus(WideInteger{lwe_vector[i]},
+                                     lwe_modulus_bits,
+                                     WideInteger{encode_modulus}));
   }
   return lwe_vector_mod_t;
 }
 
 absl::StatusOr<std::string> Client::RecoverRecord(
     const HintlessPirResponse& response) {
+  return RecoverRecord(response, state_);
+}
+
+absl::StatusOr<std::string> Client::RecoverRecord(
+    const HintlessPirResponse& response, const RequestHandle& handle) const {
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientDecode);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientDecode, response.ByteSizeLong(),
+                               0);
+  }
+
   int num_shards =
       DivAndRoundUp(params_.db_record_bit_size, params_.lwe_plaintext_bit_size);
   if (response.ct_records_size() != num_shards) {
     return absl::InvalidArgumentError("`response` has incorrect size.");
   }
 
-  // Recover decryption_parts = Hint * LWE secret = Database * A * LWE secret.
-  RLWE_ASSIGN_OR_RETURN(std::vector<lwe::Vector> decryption_parts,
-                        RecoverLweDecryptionParts(response));
+  // Recover decryption_parts = Hint * LWE secret = Database * A * LWE secret,
+  // only for the row of the record.
+  RLWE_ASSIGN_OR_RETURN(
+      std::vector<lwe::Vector> decryption_parts,
+      RecoverLweDecryptionParts(response, handle.prng_seed_linpir_sk,
+                                absl::MakeConstSpan(&handle.row_idx, 1)));
+  std::vector<lwe::Integer> row_decryption_parts;
+  row_decryption_parts.reserve(decryption_parts.size());
+  for (auto const& decryption_part : decryption_parts) {
+    row_decryption_parts.push_back(decryption_part[0]);
+  }
+  return DecryptRecord(response, handle.row_idx, row_decryption_parts);
+}
 
-  // Decrypt the LWE ciphertexts in response.
-  std::vector<lwe::Integer> values;
-  values.reserve(response.ct_records_size());
-  for (int i = 0; i < response.ct_records_size(); ++i) {
-    std::vector<lwe::Integer> ct_records =
-        DeserializeLweCiphertext(response.ct_records(i));
-    if (ct_records.size() != params_.db_rows) {
-      return absl::InvalidArgumentError(absl::StrCat(
-          "The server response has incorrect dimension; got ",
-          ct_records.size(), " but expecting ", params_.db_rows, "."));
-    }
+absl::StatusOr<std::vector<std::string>> Client::RecoverRecords(
+    const HintlessPirBatchResponse& batch_response) {
+  return RecoverRecords(batch_response, batch_state_);
+}
 
-    // Remove hint * s from the server response, which gives us \Delta * m + e.
-    lwe::Vector noisy_plaintext{{ct_records[state_.row_idx]}};
-    noisy_plaintext[0] -= decryption_parts[i][state_.row_idx];
+absl::StatusOr<std::vector<std::string>> Client::RecoverRecords(
+    const HintlessPirBatchResponse& batch_response,
+    const BatchRequestHandle& handle) const {
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientDecode);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientDecode,
+                               batch_response.ByteSizeLong(), 0);
+  }
 
-    // Remove the error e.
-    int log_scaling_factor =
-        params_.lwe_modulus_bit_size - params_.lwe_plaintext_bit_size;
-    RLWE_RETURN_IF_ERROR(
-        lwe::RemoveErrorInPlace(noisy_plaintext, log_scaling_factor));
+  int num_requests = handle.prng_seeds_linpir_sk.size();
+  if (batch_response.responses_size() != num_requests) {
+    return absl::InvalidArgumentError(
+        "`batch_response` has incorrect number of responses.");
+  }
 
-    // Extracting the coefficient from the 1 x 1 matrix noisy_plaintext.
-    values.push_back(noisy_plaintext.eval()(0));
+  // The rows to retrieve from every response, so that the LinPir blocks and
+  // the CRT interpolation are shared by the records in the same column.
+  std::vector<std::vector<int64_t>> rows_per_request(num_requests);
+  std::vector<int> position_in_request;
+  position_in_request.reserve(handle.requests_and_rows.size());
+  for (auto const& [request_idx, row_idx] : handle.requests_and_rows) {
+    position_in_request.push_back(rows_per_request[request_idx].size());
+    rows_per_request[request_idx].push_back(row_idx);
+  }
+  int num_shards =
+      DivAndRoundUp(params_.db_record_bit_size, params_.lwe_plaintext_bit_size);
+  std::vector<std::vector<lwe::Vector>> decryption_parts;
+  decryption_parts.reserve(num_requests);
+  for (int j = 0; j < num_requests; ++j) {
+    const HintlessPirResponse& response = batch_response.responses(j);
+    if (response.ct_records_size() != num_shards) {
+      return absl::InvalidArgumentError("`response` has incorrect size.");
+    }
+    RLWE_ASSIGN_OR_RETURN(
+        std::vector<lwe::Vector> request_decryption_parts,
+        RecoverLweDecryptionParts(response, handle.prng_seeds_linpir_sk[j],
+                                  rows_per_request[j]));
+    decryption_parts.push_back(std::move(request_decryption_parts));
   }
 
-  return ReconstructRecord(values, params_);
+  std::vector<std::string> records;
+  records.reserve(handle.requests_and_rows.size());
+  std::vector<lwe::Integer> row_decryption_parts(num_shards);
+  for (int i = 0; i < handle.requests_and_rows.size(); ++i) {
+    auto [request_idx, row_idx] = handle.requests_and_rows[i];
+    for (int k = 0; k < num_shards; ++k) {
+      row_decryption_parts[k] =
+          decryption_parts[request_idx][k][position_in_request[i]];
+    }
+    RLWE_ASSIGN_OR_RETURN(
+        std::string record,
+        DecryptRecord(batch_response.responses(request_idx), row_idx,
+                      row_decryption_parts));
+    records.push_back(std::move(record));
+  }
+  return records;
 }
 
-absl::StatusOr<std::string> Client::RecoverRecordGivenHs(
-    const HintlessPirResponse& response, const std::vector<lwe::Vector>& decryption_parts) {
+absl::StatusOr<std::string> Client::DecryptRecord(
+    const HintlessPirResponse& response, int64_t row_idx,
+    absl::Span<const lwe::Integer> row_decryption_parts) const {
   int num_shards =
       DivAndRoundUp(params_.db_record_bit_size, params_.lwe_plaintext_bit_size);
-  if (response.ct_records_size() != num_shards) {
+  if (response.ct_records_size() != num_shards ||
+      row_decryption_parts.size() != num_shards) {
     return absl::InvalidArgumentError("`response` has incorrect size.");
   }
 
   // Decrypt the LWE ciphertexts in response.
+  int log_scaling_factor =
+      params_.lwe_modulus_bit_size - params_.lwe_plaintext_bit_size;
   std::vector<lwe::Integer> values;
   values.reserve(response.ct_records_size());
   for (int i = 0; i < response.ct_records_size(); ++i) {
-    std::vector<lwe::Integer> ct_records =
-        DeserializeLweCiphertext(response.ct_records(i));
-    if (ct_records.size() != params_.db_rows) {
+    const SerializedLweCiphertext& ct_records = response.ct_records(i);
+    int bit_size = ct_records.has_bit_size() ? ct_records.bit_size() : 0;
+    if (bit_size != params_.lwe_response_bit_size) {
+      return absl::InvalidArgumentError(
+          "The server response has an unexpected LWE response bit size.");
+    }
+    RLWE_ASSIGN_OR_RETURN(int64_t num_ct_records,
+                          LweCiphertextSize(ct_records));
+    if (num_ct_records != params_.db_rows) {
       return absl::InvalidArgumentError(absl::StrCat(
-          "The server response has incorrect dimension; got ",
-          ct_records.size(), " but expecting ", params_.db_rows, "."));
+          "The server response has incorrect dimension; got ", num_ct_records,
+          " but expecting ", params_.db_rows, "."));
     }
 
     // Remove hint * s from the server response, which gives us \Delta * m + e.
-    lwe::Vector noisy_plaintext{{ct_records[state_.row_idx]}};
-    noisy_plaintext[0] -= decryption_parts[i][state_.row_idx];
+    // Only the coefficient of the record's row is read.
+    lwe::Vector noisy_plaintext{
+        {LweCiphertextCoefficient(ct_records, row_idx)}};
+    noisy_plaintext[0] -= row_decryption_parts[i];
 
     // Remove the error e.
-    int log_scaling_factor =
-        params_.lwe_modulus_bit_size - params_.lwe_plaintext_bit_size;
     RLWE_RETURN_IF_ERROR(
         lwe::RemoveErrorInPlace(noisy_plaintext, log_scaling_factor));
 
@@ -390,18 +529,9 @@ absl::StatusOr<std::string> Client::RecoverRecordGivenHs(
   return ReconstructRecord(values, params_);
 }
 
-absl::StatusOr<std::vector<lwe::Vector>> Client::RecoverHsPreparePhase(
-    const HintlessPirResponse& response) {
-  // Recover decryption_parts = Hint * LWE secret = Database * A * LWE secret.
-  RLWE_ASSIGN_OR_RETURN(std::vector<lwe::Vector> decryption_parts,
-                        RecoverLweDecryptionParts(response));
-
-  std::cout << "H*s recovered from RLWE" << std::endl;
-  return decryption_parts;
-}
-
 absl::StatusOr<std::vector<lwe::Vector>> Client::RecoverLweDecryptionParts(
-    const HintlessPirResponse& response) const {
+    const HintlessPirResponse& response, absl::string_view prng_seed_linpir_sk,
+    std::optional<absl::Span<const int64_t>> row_indices) const {
   using BigInteger = rlwe::uint256;
 
   auto plaintext_moduli = crt_context_.MainPrimeModuli();
@@ -427,9 +557,24 @@ absl::StatusOr<std::vector<lwe::Vector>> Client::RecoverLweDecryptionParts(
     h.resize(num_linpir_plaintext_moduli);
   }
   for (int k = 0; k < num_linpir_plaintext_moduli; ++k) {
-    RLWE_ASSIGN_OR_RETURN(
-        auto hint_values_mod_tk,
-        linpir_clients_[k]->Recover(response.linpir_responses(k)));
+    // Decrypt under the LinPir secret key of the request, and only the
+    // LinPir blocks holding `row_indices` if it is set.
+    std::vector<std::vector<RlweInteger>> hint_values_mod_tk;
+    if (row_indices.has_value()) {
+      RLWE_ASSIGN_OR_RETURN(
+          hint_values_mod_tk,
+          linpir_clients_[k]->RecoverRows(response.linpir_responses(k),
+                                          prng_seed_linpir_sk, *row_indices));
+    } else {
+      RLWE_ASSIGN_OR_RETURN(
+          hint_values_mod_tk,
+          linpir_clients_[k]->Recover(response.linpir_responses(k),
+                                      prng_seed_linpir_sk));
+    }
+    if (hint_values_mod_tk.size() != num_shards) {
+      return absl::InvalidArgumentError(
+          "`response` contains an expected number of shards.");
+    }
     auto mod_params_tk = plaintext_moduli[k]->ModParams();
     for (int i = 0; i < num_shards; ++i) {
       hint_crt_values[i][k].reserve(hint_values_mod_tk[i].size());
@@ -467,7 +612,7 @@ absl::StatusOr<std::vector<lwe::Vector>> Client::RecoverLweDecryptionParts(
     for (int i = 0; i < hint_values.size(); ++i) {
       BigInteger x = hint_values[i] % p;
       hint[i] =
-          static_cast<RlweInteger>(ConvertModulus(x, p, lwe_modulus, p_half));
+          static_cast<lwe::Integer>(ConvertModulus(x, p, lwe_modulus, p_half));
     }
     hint_vectors.push_back(std::move(hint));
   }
@@ -17,14 +17,19 @@
 #define HINTLESS_PIR_HINTLESS_SIMPLEPIR_CLIENT_H_
 
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/serialization.pb.h"
 #include "linpir/client.h"
@@ -33,6 +38,7 @@
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/rns/rns_context.h"
 #include "shell_encryption/rns/rns_modulus.h"
+#include "util/metrics.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
@@ -40,86 +46,204 @@ namespace hintless_simplepir {
 // The client part of the HintlessPir protocol.
 class Client {
  public:
+  // How the client computes the products between the LWE query pad "A" and
+  // its LWE secrets.
+  enum class PadMode {
+    // Expand the pad from its PRNG seed once when the client is created and
+    // keep it, so that every request only computes a matrix-vector product.
+    // Holds db_cols * lwe_secret_dim integers for the lifetime of the client.
+    kMaterialized,
+    // Regenerate the pad rows from the PRNG seed for every product and discard
+    // them right away, so that the pad is never held in memory.
+    kStreamed,
+  };
+
   // Creates a client from the given protocol parameters `params` and the
-  // server's public parameters `public_params`.
+  // server's public parameters `public_params`. A client serves the LWE query
+  // pad of one set of public parameters; a new client should be created when
+  // the server refreshes them.
   static absl::StatusOr<std::unique_ptr<Client>> Create(
       const Parameters& params,
-      const HintlessPirServerPublicParams& public_params);
+      const HintlessPirServerPublicParams& public_params,
+      PadMode pad_mode = PadMode::kStreamed);
 
-  // Returns the request for accessing database[index].
+  // The state of a request that is kept by the caller until its response is
+  // received:
+  //
+  // 1) as in SimplePIR, the row index of the client's desired query index
+  // i = (row_idx * cols) + col_idx.
+  //
+  // 2) a PRNG seed expanding to the LinPir secret key for encrypting the LWE
+  // secret used by the request.
+  struct RequestHandle {
+    int64_t row_idx = 0;
+    std::string prng_seed_linpir_sk;
+  };
+
+  // The state of a batch request until its response is received: the PRNG
+  // seed of the LinPir secret key of every request in the batch, and for every
+  // requested index, its request and its row.
+  struct BatchRequestHandle {
+    std::vector<std::string> prng_seeds_linpir_sk;
+    std::vector<std::pair<int, int64_t>> requests_and_rows;
+  };
+
+  // Returns the request for accessing database[index]. Uses one of the
+  // requests computed by `Precompute` if there is any left. The state of the
+  // request is kept in the client until `RecoverRecord`, so a client built
+  // this way handles one request at a time.
   absl::StatusOr<HintlessPirRequest> GenerateRequest(int64_t index);
 
-  absl::StatusOr<std::tuple<lwe::Vector, lwe::SymmetricLweKey>> Compute_A_times_s();
+  // Same as above, but returns the state of the request in `handle` rather
+  // than keeping it, to be passed to `RecoverRecord` with the response. This
+  // may be called from multiple threads at the same time, so that one client
+  // can have any number of requests in flight.
+  absl::StatusOr<HintlessPirRequest> GenerateRequest(int64_t index,
+                                                     RequestHandle& handle);
+
+  // Returns the batch request for accessing database[index] for every index in
+  // `indices`. There is one request per distinct database column among the
+  // indices, in the order of their first index, so records in the same column
+  // share the LWE and the LinPir computation of their request. Requests of
+  // distinct columns must not share their LWE secret, since the server could
+  // then learn the difference between their selection vectors.
+  absl::StatusOr<HintlessPirBatchRequest> GenerateBatchRequest(
+      absl::Span<const int64_t> indices);
 
-  absl::StatusOr<std::pair<HintlessPirRequest, lwe::Vector>> GenerateRequestGivenAsSkipLinPir(int64_t index, lwe::Vector& As, lwe::SymmetricLweKey& s_lwe);
+  // Same as above, but returns the state of the batch request in `handle`.
+  // This may be called from multiple threads at the same time.
+  absl::StatusOr<HintlessPirBatchRequest> GenerateBatchRequest(
+      absl::Span<const int64_t> indices, BatchRequestHandle& handle);
 
-  absl::StatusOr<HintlessPirRequest> PrepareLinPirGivenS(lwe::SymmetricLweKey& s_lwe);
+  // Computes `num_requests` LWE secrets together with their products with the
+  // LWE query pad and their LinPir requests, which do not depend on the index
+  // to retrieve, and keeps them for later calls to `GenerateRequest`. This may
+  // be called from a background thread while `GenerateRequest` is called.
+  absl::Status Precompute(int num_requests);
 
-  // Returns the retrieved record from the server response.
+  // Returns the number of precomputed requests not used yet.
+  int NumPrecomputedRequests() const;
+
+  // Returns the retrieved record from the server response to the last
+  // request.
   absl::StatusOr<std::string> RecoverRecord(
       const HintlessPirResponse& response);
 
-  absl::StatusOr<std::string> RecoverRecordGivenHs(
-    const HintlessPirResponse& response, const std::vector<lwe::Vector>& decryption_parts);
+  // Returns the record retrieved from the response to the request of `handle`.
+  // This may be called from multiple threads at the same time.
+  absl::StatusOr<std::string> RecoverRecord(const HintlessPirResponse& response,
+                                            const RequestHandle& handle) const;
+
+  // Returns the records retrieved from the response to the last batch request,
+  // in the order of the indices passed to `GenerateBatchRequest`.
+  absl::StatusOr<std::vector<std::string>> RecoverRecords(
+      const HintlessPirBatchResponse& batch_response);
+
+  // Same as above, for the batch request of `handle`.
+  absl::StatusOr<std::vector<std::string>> RecoverRecords(
+      const HintlessPirBatchResponse& batch_response,
+      const BatchRequestHandle& handle) const;
 
-  absl::StatusOr<std::vector<lwe::Vector>> RecoverHsPreparePhase(
-    const HintlessPirResponse& response);
+  // Records the latencies and sizes of generating requests and decoding
+  // responses in `sink`, or nothing if `sink` is null. Does not take ownership.
+  void SetMetricsSink(MetricsSink* sink) { metrics_sink_ = sink; }
 
  private:
+  // Sessions prepare requests and decrypt responses using the internals below.
+  friend class Session;
+
   using RlweInteger = Parameters::RlweInteger;
   using RlweModularInt = rlwe::MontgomeryInt<RlweInteger>;
   using RlweRnsContext = rlwe::RnsContext<RlweModularInt>;
   using RlwePrimeModulus = rlwe::PrimeModulus<RlweModularInt>;
   using LinPirClient = linpir::Client<RlweInteger>;
 
-  // HintlessPir client state, which is cached for each request until the
-  // corresponding response is received:
-  //
-  // 1) as in SimplePIR, a pair of indices (row_idx, col_idx) representing the
-  // client's desired query index i = (row_idx * cols) + col_idx.
-  //
-  // 2) a PRNG seed expanding to the LinPir secret key for encrypting the LWE
-  // secret used by the request.
-  struct ClientState {
-    int64_t row_idx;
-    int64_t col_idx;
+  // The part of a request that does not depend on the index to retrieve.
+  struct PrecomputedRequest {
+    lwe::SymmetricLweKey lwe_secret_key;
+    // The LWE query pad times `lwe_secret_key`.
+    lwe::Vector pad_times_key;
     std::string prng_seed_linpir_sk;
+    // Holds the LinPir requests encrypting `lwe_secret_key`.
+    HintlessPirRequest linpir_request;
   };
 
   explicit Client(
-      Parameters params, absl::string_view prng_seed_lwe_query_pad,
+      Parameters params, int64_t epoch_id,
+      absl::string_view prng_seed_lwe_query_pad,
+      std::unique_ptr<const lwe::Matrix> lwe_query_pad,
       std::vector<std::unique_ptr<const RlweRnsContext>> rlwe_contexts,
       std::vector<const RlwePrimeModulus*> rlwe_moduli,
       std::vector<std::unique_ptr<LinPirClient>> linpir_clients,
       RlweRnsContext crt_context)
       : params_(std::move(params)),
+        epoch_id_(epoch_id),
         prng_seed_lwe_query_pad_(std::string(prng_seed_lwe_query_pad)),
+        lwe_query_pad_(std::move(lwe_query_pad)),
         rlwe_contexts_(std::move(rlwe_contexts)),
         rlwe_moduli_(std::move(rlwe_moduli)),
         linpir_clients_(std::move(linpir_clients)),
         crt_context_(std::move(crt_context)) {}
 
+  // Returns the mod-2^lwe_modulus_bits entries of `lwe_vector` mod
+  // `encode_modulus`, in balanced representation.
   static std::vector<RlweInteger> EncodeLweVector(const lwe::Vector& lwe_vector,
-                                                  RlweInteger lwe_modulus,
+                                                  int lwe_modulus_bits,
                                                   RlweInteger encode_modulus);
 
-  // Encrypts the LWE secret vector using LinPir clients and update `request`
-  // with the LinPir requests.
+  // Encrypts the LWE secret vector using LinPir clients under the secret key
+  // expanded from `prng_seed_linpir_sk`, and update `request` with the LinPir
+  // requests.
   absl::Status GenerateLinPirRequestInPlace(
-      HintlessPirRequest& request, const lwe::Vector& lwe_secret) const;
+      HintlessPirRequest& request, const lwe::Vector& lwe_secret,
+      absl::string_view prng_seed_linpir_sk) const;
+
+  // Returns a request retrieving the records in column `col_idx`, and sets
+  // `prng_seed_linpir_sk` to the seed of its LinPir secret key.
+  absl::StatusOr<HintlessPirRequest> GenerateColumnRequest(
+      int64_t col_idx, std::string& prng_seed_linpir_sk);
+
+  // Returns the LWE encryption of the selection vector of column `col_idx`
+  // under `lwe_secret_key`, given the LWE query pad times the key.
+  absl::StatusOr<SerializedLweCiphertext> EncryptColumnSelection(
+      int64_t col_idx, const lwe::SymmetricLweKey& lwe_secret_key,
+      const lwe::Vector& pad_times_key) const;
 
-  
+  // Samples a fresh LWE secret and computes the rest of `PrecomputedRequest`.
+  absl::StatusOr<PrecomputedRequest> GeneratePrecomputedRequest() const;
+
+  // Returns the LWE query pad times `lwe_secret`, using the materialized pad
+  // if there is one.
+  absl::StatusOr<lwe::Vector> PadTimesKey(const lwe::Vector& lwe_secret) const;
 
   // CRT interpolates the LinPir responses to recover the LWE decryption parts,
-  // which are the inner products hint * LWE secrets.
+  // which are the inner products hint * LWE secrets, decrypting under the
+  // LinPir secret key expanded from `prng_seed_linpir_sk`. If `row_indices` is
+  // set, only decrypts the LinPir blocks holding these rows and interpolates
+  // their parts, so every returned vector has the size of `row_indices`.
   absl::StatusOr<std::vector<lwe::Vector>> RecoverLweDecryptionParts(
-      const HintlessPirResponse& response) const;
+      const HintlessPirResponse& response, absl::string_view prng_seed_linpir_sk,
+      std::optional<absl::Span<const int64_t>> row_indices =
+          std::nullopt) const;
+
+  // Decrypts the LWE responses at `row_idx`, given the decryption parts of that
+  // row, one per shard, and returns the record.
+  absl::StatusOr<std::string> DecryptRecord(
+      const HintlessPirResponse& response, int64_t row_idx,
+      absl::Span<const lwe::Integer> row_decryption_parts) const;
 
   const Parameters params_;
 
+  // The epoch of the server's public parameters, set in every request so that
+  // the server answers it with these parameters; 0 if they have none.
+  const int64_t epoch_id_;
+
   // PRNG seed for generating the "A" matrix for LWE query ciphertext.
   std::string prng_seed_lwe_query_pad_;
 
+  // The expanded LWE query pad in `PadMode::kMaterialized`, or null.
+  const std::unique_ptr<const lwe::Matrix> lwe_query_pad_;
+
   const std::vector<std::unique_ptr<const RlweRnsContext>> rlwe_contexts_;
 
   // The RLWE RNS moduli common to all LinPir clients.
@@ -129,8 +253,18 @@ class Client {
 
   const RlweRnsContext crt_context_;
 
-  // Per request state.
-  ClientState state_;
+  // The state of the last request generated without a handle.
+  RequestHandle state_;
+
+  // The state of the last batch request generated without a handle.
+  BatchRequestHandle batch_state_;
+
+  mutable absl::Mutex pool_mutex_;
+  std::deque<PrecomputedRequest> precomputed_requests_
+      ABSL_GUARDED_BY(pool_mutex_);
+
+  // Receives the client metrics; may be null. Does not own the object.
+  MetricsSink* metrics_sink_ = nullptr;
 };
 
 }  // namespace hintless_simplepir
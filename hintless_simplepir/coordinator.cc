@@ -0,0 +1,255 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hintless_simplepir/coordinator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
+#include "hintless_simplepir/server.h"
+#include "hintless_simplepir/utils.h"
+#include "linpir/serialization.pb.h"
+#include "shell_encryption/status_macros.h"
+#include "util/thread_pool.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+namespace {
+
+// Appends the LWE records and the LinPir blocks of `part`, the response of the
+// worker holding the rows right after those of `whole`, to `whole`.
+absl::Status AppendResponse(HintlessPirResponse& part,
+                            HintlessPirResponse* whole) {
+  if (part.ct_records_size() != whole->ct_records_size() ||
+      part.linpir_responses_size() != whole->linpir_responses_size()) {
+    return absl::InternalError("Workers returned mismatching responses.");
+  }
+  for (int i = 0; i < part.ct_records_size(); ++i) {
+    RLWE_RETURN_IF_ERROR(AppendLweCiphertext(part.ct_records(i),
+                                             whole->mutable_ct_records(i)));
+  }
+  for (int k = 0; k < part.linpir_responses_size(); ++k) {
+    LinPirResponse* part_linpir = part.mutable_linpir_responses(k);
+    LinPirResponse* whole_linpir = whole->mutable_linpir_responses(k);
+    if (part_linpir->ct_inner_products_size() !=
+        whole_linpir->ct_inner_products_size()) {
+      return absl::InternalError("Workers returned mismatching responses.");
+    }
+    for (int d = 0; d < part_linpir->ct_inner_products_size(); ++d) {
+      auto* part_inner_product = part_linpir->mutable_ct_inner_products(d);
+      auto* whole_inner_product = whole_linpir->mutable_ct_inner_products(d);
+      for (auto& ct_block : *part_inner_product->mutable_ct_blocks()) {
+        *whole_inner_product->add_ct_blocks() = std::move(ct_block);
+      }
+      for (auto& ct_block :
+           *part_inner_product->mutable_mod_switched_ct_blocks()) {
+        *whole_inner_product->add_mod_switched_ct_blocks() =
+            std::move(ct_block);
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<Coordinator>> Coordinator::Create(
+    const Parameters& params, std::vector<WorkerRows> workers) {
+  if (workers.empty()) {
+    return absl::InvalidArgumentError("`workers` must not be empty.");
+  }
+  int64_t rows_per_block = params.linpir_params.rows_per_block;
+  int64_t row_end = 0;
+  for (auto const& worker : workers) {
+    if (worker.worker == nullptr) {
+      return absl::InvalidArgumentError("`workers` must not be null.");
+    }
+    if (worker.row_begin != row_end || worker.row_end <= worker.row_begin ||
+        worker.row_begin % rows_per_block != 0) {
+      return absl::InvalidArgumentError(
+          "`workers` must hold consecutive ranges of rows starting at "
+          "multiples of `rows_per_block`.");
+    }
+    row_end = worker.row_end;
+  }
+  if (row_end != params.db_rows) {
+    return absl::InvalidArgumentError("`workers` must hold all rows.");
+  }
+  return absl::WrapUnique(new Coordinator(params, std::move(workers)));
+}
+
+Parameters Coordinator::WorkerParameters(const Parameters& params,
+                                         int64_t row_begin, int64_t row_end) {
+  Parameters worker_params = params;
+  worker_params.db_rows = row_end - row_begin;
+  return worker_params;
+}
+
+std::vector<std::pair<int64_t, int64_t>> Coordinator::SplitRows(
+    const Parameters& params, int num_workers) {
+  int64_t rows_per_block = params.linpir_params.rows_per_block;
+  int64_t num_blocks = DivAndRoundUp(params.db_rows, rows_per_block);
+  int64_t num_ranges =
+      std::max<int64_t>(1, std::min<int64_t>(num_workers, num_blocks));
+  std::vector<std::pair<int64_t, int64_t>> ranges;
+  ranges.reserve(num_ranges);
+  for (int64_t i = 0; i < num_ranges; ++i) {
+    int64_t row_begin = num_blocks * i / num_ranges * rows_per_block;
+    int64_t row_end = std::min(
+        params.db_rows, num_blocks * (i + 1) / num_ranges * rows_per_block);
+    ranges.emplace_back(row_begin, row_end);
+  }
+  return ranges;
+}
+
+absl::Status Coordinator::ForEachWorker(
+    absl::FunctionRef<absl::Status(int64_t)> fn) const {
+  return ParallelForWithStatus(workers_.size(), thread_pool_.get(), fn);
+}
+
+absl::Status Coordinator::Preprocess() {
+  RLWE_RETURN_IF_ERROR(PrepareNextEpoch());
+  RLWE_RETURN_IF_ERROR(ActivateNextEpoch());
+  RetirePreviousEpoch();
+  return absl::OkStatus();
+}
+
+absl::Status Coordinator::PrepareNextEpoch() {
+  RLWE_ASSIGN_OR_RETURN(HintlessPirServerPublicParams public_params,
+                        Server::GeneratePublicParams(params_));
+  {
+    absl::MutexLock lock(&mutex_);
+    public_params.set_epoch_id(++last_epoch_id_);
+  }
+  RLWE_RETURN_IF_ERROR(ForEachWorker([&](int64_t i) {
+    return workers_[i].worker->PrepareNextEpoch(public_params);
+  }));
+  absl::MutexLock lock(&mutex_);
+  next_public_params_ = std::make_unique<HintlessPirServerPublicParams>(
+      std::move(public_params));
+  return absl::OkStatus();
+}
+
+absl::Status Coordinator::ActivateNextEpoch() {
+  int64_t epoch_id;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (next_public_params_ == nullptr) {
+      return absl::FailedPreconditionError("No epoch has been prepared.");
+    }
+    epoch_id = next_public_params_->epoch_id();
+  }
+  // Activating an epoch only fails on a worker that has not prepared it, so
+  // check all workers first rather than leave them on different epochs.
+  for (int i = 0; i < workers_.size(); ++i) {
+    if (workers_[i].worker->NextEpochId() != epoch_id) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Worker ", i, " has not prepared epoch ", epoch_id, "."));
+    }
+  }
+  RLWE_RETURN_IF_ERROR(ForEachWorker([&](int64_t i) -> absl::Status {
+    absl::Status status = workers_[i].worker->ActivateNextEpoch();
+    if (!status.ok()) {
+      return absl::Status(status.code(), absl::StrCat("Worker ", i, ": ",
+                                                      status.message()));
+    }
+    return absl::OkStatus();
+  }));
+  absl::MutexLock lock(&mutex_);
+  current_public_params_ = std::move(*next_public_params_);
+  next_public_params_.reset();
+  return absl::OkStatus();
+}
+
+void Coordinator::RetirePreviousEpoch() {
+  for (auto& worker : workers_) {
+    worker.worker->RetirePreviousEpoch();
+  }
+}
+
+absl::Status Coordinator::UpdateRecords(absl::Span<const int64_t> indices,
+                                        absl::Span<const std::string> records) {
+  if (indices.size() != records.size()) {
+    return absl::InvalidArgumentError(
+        "`indices` and `records` must have the same size.");
+  }
+
+  // Records are stored by rows, so the records of a worker are those at the
+  // indices [row_begin * db_cols, row_end * db_cols).
+  std::vector<std::vector<int64_t>> worker_indices(workers_.size());
+  std::vector<std::vector<std::string>> worker_records(workers_.size());
+  for (int i = 0; i < indices.size(); ++i) {
+    if (indices[i] < 0 || indices[i] >= params_.db_rows * params_.db_cols) {
+      return absl::InvalidArgumentError("`index` is out of range.");
+    }
+    int64_t row_idx = indices[i] / params_.db_cols;
+    auto it = std::upper_bound(
+        workers_.begin(), workers_.end(), row_idx,
+        [](int64_t row, const WorkerRows& worker) {
+          return row < worker.row_begin;
+        });
+    int w = std::distance(workers_.begin(), it) - 1;
+    worker_indices[w].push_back(indices[i] -
+                                workers_[w].row_begin * params_.db_cols);
+    worker_records[w].push_back(records[i]);
+  }
+  return ForEachWorker([&](int64_t i) -> absl::Status {
+    if (worker_indices[i].empty()) {
+      return absl::OkStatus();
+    }
+    return workers_[i].worker->UpdateRecords(worker_indices[i],
+                                             worker_records[i]);
+  });
+}
+
+absl::StatusOr<HintlessPirResponse> Coordinator::HandleRequest(
+    const HintlessPirRequest& request) const {
+  std::vector<HintlessPirResponse> responses(workers_.size());
+  RLWE_RETURN_IF_ERROR(ForEachWorker([&](int64_t i) -> absl::Status {
+    RLWE_ASSIGN_OR_RETURN(responses[i],
+                          workers_[i].worker->HandleRequest(request));
+    return absl::OkStatus();
+  }));
+
+  // The workers hold consecutive rows, so their LWE records and LinPir blocks
+  // are concatenated in order.
+  HintlessPirResponse response = std::move(responses[0]);
+  for (int i = 1; i < responses.size(); ++i) {
+    RLWE_RETURN_IF_ERROR(AppendResponse(responses[i], &response));
+  }
+  return response;
+}
+
+HintlessPirServerPublicParams Coordinator::GetPublicParams() const {
+  absl::MutexLock lock(&mutex_);
+  return current_public_params_;
+}
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
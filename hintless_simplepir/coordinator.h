@@ -0,0 +1,214 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_COORDINATOR_H_
+#define HINTLESS_PIR_HINTLESS_SIMPLEPIR_COORDINATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
+#include "hintless_simplepir/server.h"
+#include "util/thread_pool.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+// A worker of a `Coordinator`, holding a contiguous range of rows of the
+// database together with their hints and LinPir blocks, i.e. a `Server` for
+// the parameters returned by `Coordinator::WorkerParameters`. Records are
+// indexed within the rows of the worker. Implementations may forward the calls
+// to a server in another process or on another machine; `LocalWorker` holds
+// the server itself.
+class Worker {
+ public:
+  virtual ~Worker() = default;
+
+  // Same as `Server::PrepareNextEpoch(public_params)`.
+  virtual absl::Status PrepareNextEpoch(
+      const HintlessPirServerPublicParams& public_params) = 0;
+
+  // Same as `Server::ActivateNextEpoch`.
+  virtual absl::Status ActivateNextEpoch() = 0;
+
+  // Same as `Server::NextEpochId`.
+  virtual int64_t NextEpochId() const = 0;
+
+  // Same as `Server::RetirePreviousEpoch`.
+  virtual void RetirePreviousEpoch() = 0;
+
+  // Same as `Server::UpdateRecords`.
+  virtual absl::Status UpdateRecords(absl::Span<const int64_t> indices,
+                                     absl::Span<const std::string> records) = 0;
+
+  // Same as `Server::HandleRequest`. Must be thread-safe.
+  virtual absl::StatusOr<HintlessPirResponse> HandleRequest(
+      const HintlessPirRequest& request) const = 0;
+};
+
+// A worker holding its server in the process of the coordinator.
+class LocalWorker : public Worker {
+ public:
+  explicit LocalWorker(std::unique_ptr<Server> server)
+      : server_(std::move(server)) {}
+
+  absl::Status PrepareNextEpoch(
+      const HintlessPirServerPublicParams& public_params) override {
+    return server_->PrepareNextEpoch(public_params);
+  }
+
+  absl::Status ActivateNextEpoch() override {
+    return server_->ActivateNextEpoch();
+  }
+
+  int64_t NextEpochId() const override { return server_->NextEpochId(); }
+
+  void RetirePreviousEpoch() override { server_->RetirePreviousEpoch(); }
+
+  absl::Status UpdateRecords(absl::Span<const int64_t> indices,
+                             absl::Span<const std::string> records) override {
+    return server_->UpdateRecords(indices, records);
+  }
+
+  absl::StatusOr<HintlessPirResponse> HandleRequest(
+      const HintlessPirRequest& request) const override {
+    return server_->HandleRequest(request);
+  }
+
+  Server* GetServer() const { return server_.get(); }
+
+ private:
+  std::unique_ptr<Server> server_;
+};
+
+// Serves one logical database whose rows are split over several workers, so
+// that it may exceed the memory of a single machine. The product between the
+// database and the LWE query vector, and the LinPir blocks of the hints, only
+// depend on the rows of every worker, so the coordinator sends every request
+// to all workers and concatenates the LWE records and the LinPir blocks of
+// their responses, which clients cannot tell apart from the response of a
+// single server holding all rows.
+//
+// The coordinator generates the PRNG seeds of every epoch and the workers
+// build their epochs from them, so that they all answer the requests generated
+// for the public parameters of the coordinator.
+//
+// `HandleRequest` is const and thread-safe, as for `Server`; the other methods
+// must not be called concurrently with each other.
+class Coordinator {
+ public:
+  // A worker, and the rows [row_begin, row_end) of the database it holds.
+  struct WorkerRows {
+    int64_t row_begin;
+    int64_t row_end;
+    std::unique_ptr<Worker> worker;
+  };
+
+  // Creates a coordinator for the database of `params`, held by `workers`. The
+  // row ranges of the workers must be in order and cover all rows, and all but
+  // the last one must hold a multiple of `params.linpir_params.rows_per_block`
+  // rows, so that the LinPir blocks of the workers line up with those of the
+  // whole database.
+  static absl::StatusOr<std::unique_ptr<Coordinator>> Create(
+      const Parameters& params, std::vector<WorkerRows> workers);
+
+  // Returns the parameters of the server of a worker holding the rows
+  // [row_begin, row_end) of the database of `params`.
+  static Parameters WorkerParameters(const Parameters& params,
+                                     int64_t row_begin, int64_t row_end);
+
+  // Splits the rows of the database of `params` into at most `num_workers`
+  // ranges of about the same size that `Create` accepts.
+  static std::vector<std::pair<int64_t, int64_t>> SplitRows(
+      const Parameters& params, int num_workers);
+
+  // Same as `Server::Preprocess`, on all workers.
+  absl::Status Preprocess();
+
+  // Generates the PRNG seeds of a new epoch and has every worker build it, as
+  // `Server::PrepareNextEpoch` does.
+  absl::Status PrepareNextEpoch();
+
+  // Activates the epoch built by `PrepareNextEpoch` on every worker, then
+  // makes its public parameters the ones returned by `GetPublicParams`. The
+  // workers keep answering requests for the former epoch meanwhile, so
+  // requests do not fail while some workers are activated and others not yet.
+  // Returns an error naming the first worker that has not prepared the epoch
+  // before activating any of them, so that all workers stay on the current
+  // epoch. If a worker still fails to activate, the others may have activated
+  // the epoch while the public parameters stay those of the former one, and
+  // the returned error names the failing worker.
+  absl::Status ActivateNextEpoch();
+
+  // Same as `Server::RetirePreviousEpoch`, on all workers.
+  void RetirePreviousEpoch();
+
+  // Replaces the records at `indices` of the whole database by `records`, on
+  // the workers holding them.
+  absl::Status UpdateRecords(absl::Span<const int64_t> indices,
+                             absl::Span<const std::string> records);
+
+  // Sends `request` to all workers concurrently and returns their responses
+  // concatenated, as `Server::HandleRequest` does for a single server.
+  absl::StatusOr<HintlessPirResponse> HandleRequest(
+      const HintlessPirRequest& request) const;
+
+  // Returns the public parameters of the current epoch that are sent to the
+  // clients.
+  HintlessPirServerPublicParams GetPublicParams() const;
+
+  int NumWorkers() const { return workers_.size(); }
+
+ private:
+  explicit Coordinator(Parameters params, std::vector<WorkerRows> workers)
+      : params_(std::move(params)),
+        workers_(std::move(workers)),
+        thread_pool_(workers_.size() > 1
+                         ? std::make_unique<ThreadPool>(workers_.size())
+                         : nullptr) {}
+
+  // Runs `fn(i)` for every worker i concurrently, and returns the first error.
+  absl::Status ForEachWorker(
+      absl::FunctionRef<absl::Status(int64_t)> fn) const;
+
+  const Parameters params_;
+  std::vector<WorkerRows> workers_;
+
+  // Calls the workers concurrently; null with a single worker.
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  mutable absl::Mutex mutex_;
+  HintlessPirServerPublicParams current_public_params_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<HintlessPirServerPublicParams> next_public_params_
+      ABSL_GUARDED_BY(mutex_);
+
+  // The id of the last epoch generated.
+  int64_t last_epoch_id_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_HINTLESS_SIMPLEPIR_COORDINATOR_H_
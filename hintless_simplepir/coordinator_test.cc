@@ -0,0 +1,200 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hintless_simplepir/coordinator.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "hintless_simplepir/client.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/server.h"
+#include "hintless_simplepir/testing.h"
+#include "shell_encryption/testing/status_matchers.h"
+#include "shell_encryption/testing/status_testing.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace {
+
+using ::rlwe::testing::StatusIs;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::Pair;
+
+const Parameters kParameters{
+    .db_rows = 1024,
+    .db_cols = 1024,
+    .db_record_bit_size = 8,
+    .lwe_secret_dim = 1408,
+    .lwe_modulus_bit_size = 32,
+    .lwe_plaintext_bit_size = 8,
+    .lwe_error_variance = 8,
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/512),
+    .prng_type = rlwe::PRNG_TYPE_HKDF,
+};
+
+// Creates workers holding random records for the row ranges of `SplitRows`,
+// and returns the servers of the workers in `servers`.
+std::vector<Coordinator::WorkerRows> CreateWorkers(
+    const Parameters& params, int num_workers, std::vector<Server*>& servers) {
+  std::vector<Coordinator::WorkerRows> workers;
+  for (auto [row_begin, row_end] :
+       Coordinator::SplitRows(params, num_workers)) {
+    auto server = Server::CreateWithRandomDatabaseRecords(
+                      Coordinator::WorkerParameters(params, row_begin, row_end))
+                      .value();
+    servers.push_back(server.get());
+    workers.push_back(Coordinator::WorkerRows{
+        .row_begin = row_begin,
+        .row_end = row_end,
+        .worker = std::make_unique<LocalWorker>(std::move(server))});
+  }
+  return workers;
+}
+
+TEST(Coordinator, SplitRowsAtBlockBoundaries) {
+  Parameters params = kParameters;
+  params.db_rows = 1500;
+  EXPECT_THAT(Coordinator::SplitRows(params, 2),
+              ElementsAre(Pair(0, 512), Pair(512, 1500)));
+  EXPECT_THAT(Coordinator::SplitRows(params, 3),
+              ElementsAre(Pair(0, 512), Pair(512, 1024), Pair(1024, 1500)));
+  // There are no more ranges than LinPir blocks.
+  EXPECT_THAT(Coordinator::SplitRows(params, 8),
+              ElementsAre(Pair(0, 512), Pair(512, 1024), Pair(1024, 1500)));
+}
+
+TEST(Coordinator, CreateFailsWithInvalidRowRanges) {
+  EXPECT_THAT(Coordinator::Create(kParameters, {}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must not be empty")));
+
+  std::vector<Server*> servers;
+  std::vector<Coordinator::WorkerRows> workers =
+      CreateWorkers(kParameters, 2, servers);
+  workers[1].row_begin = 256;
+  EXPECT_THAT(Coordinator::Create(kParameters, std::move(workers)),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("consecutive ranges of rows")));
+
+  workers = CreateWorkers(kParameters, 1, servers);
+  workers[0].row_end = 512;
+  EXPECT_THAT(Coordinator::Create(kParameters, std::move(workers)),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must hold all rows")));
+}
+
+TEST(Coordinator, EndToEndTest) {
+  std::vector<Server*> servers;
+  ASSERT_OK_AND_ASSIGN(
+      auto coordinator,
+      Coordinator::Create(kParameters, CreateWorkers(kParameters, 2, servers)));
+  ASSERT_EQ(coordinator->NumWorkers(), 2);
+  ASSERT_OK(coordinator->Preprocess());
+  auto public_params = coordinator->GetPublicParams();
+  EXPECT_EQ(public_params.epoch_id(), 1);
+
+  // The client cannot tell the coordinator from a single server.
+  ASSERT_OK_AND_ASSIGN(auto client, Client::Create(kParameters, public_params));
+  for (int64_t index : {int64_t{3}, 700 * 1024 + 5}) {
+    ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+    ASSERT_OK_AND_ASSIGN(auto response, coordinator->HandleRequest(request));
+    ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+    int worker_idx = index < 512 * 1024 ? 0 : 1;
+    ASSERT_OK_AND_ASSIGN(
+        auto expected,
+        servers[worker_idx]->GetDatabase()->Record(index -
+                                                   worker_idx * 512 * 1024));
+    EXPECT_EQ(record, expected);
+  }
+
+  // Updates go to the worker holding the record.
+  const int64_t index = 1023 * 1024 + 1023;
+  std::string new_record = testing::GenerateRandomRecord(kParameters);
+  ASSERT_OK(coordinator->UpdateRecords({index}, {new_record}));
+  ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+  ASSERT_OK_AND_ASSIGN(auto response, coordinator->HandleRequest(request));
+  ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+  EXPECT_EQ(record, new_record);
+}
+
+TEST(Coordinator, EndToEndEpochRotationTest) {
+  for (int lwe_response_bit_size : {0, 12}) {
+    Parameters params = kParameters;
+    params.lwe_response_bit_size = lwe_response_bit_size;
+    std::vector<Server*> servers;
+    ASSERT_OK_AND_ASSIGN(
+        auto coordinator,
+        Coordinator::Create(params, CreateWorkers(params, 2, servers)));
+    ASSERT_OK(coordinator->Preprocess());
+    ASSERT_OK_AND_ASSIGN(
+        auto old_client,
+        Client::Create(params, coordinator->GetPublicParams()));
+
+    // Requests for the former epoch are still answered by all workers after
+    // the rotation.
+    ASSERT_OK(coordinator->PrepareNextEpoch());
+    ASSERT_OK(coordinator->ActivateNextEpoch());
+    EXPECT_EQ(coordinator->GetPublicParams().epoch_id(), 2);
+    ASSERT_OK_AND_ASSIGN(
+        auto new_client,
+        Client::Create(params, coordinator->GetPublicParams()));
+    const int64_t index = 600 * 1024 + 17;
+    ASSERT_OK_AND_ASSIGN(auto expected,
+                         servers[1]->GetDatabase()->Record(index - 512 * 1024));
+    for (Client* client : {old_client.get(), new_client.get()}) {
+      ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+      ASSERT_OK_AND_ASSIGN(auto response,
+                           coordinator->HandleRequest(request));
+      ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+      EXPECT_EQ(record, expected);
+    }
+
+    coordinator->RetirePreviousEpoch();
+    ASSERT_OK_AND_ASSIGN(auto request, old_client->GenerateRequest(index));
+    EXPECT_THAT(coordinator->HandleRequest(request),
+                StatusIs(absl::StatusCode::kFailedPrecondition,
+                         HasSubstr("no longer served")));
+  }
+}
+
+TEST(Coordinator, ActivateNextEpochChecksAllWorkersFirst) {
+  std::vector<Server*> servers;
+  ASSERT_OK_AND_ASSIGN(
+      auto coordinator,
+      Coordinator::Create(kParameters, CreateWorkers(kParameters, 2, servers)));
+  ASSERT_OK(coordinator->Preprocess());
+  ASSERT_OK(coordinator->PrepareNextEpoch());
+  EXPECT_EQ(servers[0]->NextEpochId(), 2);
+  EXPECT_EQ(servers[1]->NextEpochId(), 2);
+
+  // The second worker has lost its prepared epoch, so no worker activates it.
+  ASSERT_OK(servers[1]->ActivateNextEpoch());
+  EXPECT_THAT(coordinator->ActivateNextEpoch(),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("Worker 1 has not prepared epoch 2")));
+  EXPECT_EQ(servers[0]->CurrentEpochId(), 1);
+  EXPECT_EQ(coordinator->GetPublicParams().epoch_id(), 1);
+}
+
+}  // namespace
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
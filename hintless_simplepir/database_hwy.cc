@@ -14,61 +14,409 @@
 
 #include "hintless_simplepir/database_hwy.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstdint>
-#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
-#include <ctime>
-#include <iostream>
 
 #include "absl/memory/memory.h"
+#include "absl/numeric/int128.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "hintless_simplepir/block_matrix.h"
 #include "hintless_simplepir/inner_product_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/utils.h"
 #include "lwe/types.h"
 #include "shell_encryption/status_macros.h"
+#include "util/numa.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 namespace {
 
-static inline Database::RawMatrix CreateZeroRawMatrix(size_t num_rows,
-                                                      size_t num_cols) {
-  size_t num_values_per_block =
-      sizeof(internal::BlockType) / sizeof(lwe::PlainInteger);
-  size_t num_blocks_per_col = DivAndRoundUp(num_rows, num_values_per_block);
-  Database::RawMatrix matrix(num_cols);
-  for (int i = 0; i < num_cols; ++i) {
-    matrix[i].resize(num_blocks_per_col, 0);
+// The number of rows per column handled by one task of the parallel inner
+// product. The accumulator of a task takes 16KB, which stays in the L1/L2
+// cache while the task walks over all the columns.
+constexpr int64_t kNumRowsPerTask = 4096;
+
+// The number of hint rows computed by one task of `UpdateHints`. The packed
+// values of these rows in a panel of columns stay in the L2 cache while they
+// are multiplied with all the columns of the LWE query pad.
+constexpr int64_t kNumHintRowsPerTask = 256;
+
+// The number of columns written by one task of `AppendBatch`, `LoadColumns`
+// and `FillRandom`, and the number of blocks per column they write before
+// moving to the next column. The records of such a tile stay in the L2 cache
+// while they are split, even when they are read across rows.
+constexpr int64_t kNumIngestColsPerTask = 64;
+constexpr int64_t kNumIngestBlocksPerTile = 16;
+
+// The most bytes of a data matrix the candidate configurations of the online
+// products are timed on by `AutotuneInnerProduct`. This exceeds the last level
+// caches, so the runs are bound by memory bandwidth as the whole products are.
+constexpr int64_t kAutotuneMaxBytes = int64_t{64} << 20;
+
+// The minimum number of runs, and of time spent running, per candidate.
+constexpr int kAutotuneMinRuns = 3;
+constexpr absl::Duration kAutotuneMinTime = absl::Milliseconds(20);
+
+// The tile sizes in blocks tried by `AutotuneInnerProduct`, 0 being untiled.
+constexpr int64_t kAutotuneTileBlocks[] = {0, 64, 256, 1024};
+
+inline absl::Status CheckForValidNumThreads(const Parameters& params) {
+  if (params.num_threads < 1) {
+    return absl::InvalidArgumentError("`num_threads` must be positive.");
   }
-  return matrix;
+  if (params.num_numa_nodes < -1) {
+    return absl::InvalidArgumentError(
+        "`num_numa_nodes` must be non-negative, or -1 for all nodes.");
+  }
+  if (params.interleave_shards && params.num_numa_nodes != 0) {
+    return absl::InvalidArgumentError(
+        "`interleave_shards` cannot be combined with `num_numa_nodes`.");
+  }
+  return absl::OkStatus();
 }
 
-static inline Database::RawMatrix CreateRandomRawMatrix(size_t num_rows,
-                                                        size_t num_cols,
-                                                        size_t plain_bits) {
-  size_t num_values_per_block =
-      sizeof(internal::BlockType) / sizeof(lwe::PlainInteger);
-  size_t num_blocks_per_col = DivAndRoundUp(num_rows, num_values_per_block);
-  lwe::Integer mask = (lwe::Integer{1} << plain_bits) - 1;
-  Database::RawMatrix matrix(num_cols);
-  for (int i = 0; i < num_cols; ++i) {
-    matrix[i].resize(num_blocks_per_col, 0);
-    for (int j = 0; j < num_blocks_per_col; ++j) {
-      for (int k = 0, b = 0; k < num_values_per_block;
-           ++k, b += 8 * sizeof(lwe::PlainInteger)) {
-        lwe::Integer r = std::rand();
-        matrix[i][j] |= static_cast<internal::BlockType>(r & mask) << b;
-      }
+inline absl::Status CheckForValidPlaintextBitSize(const Parameters& params) {
+  if (params.lwe_plaintext_bit_size < 1 || params.lwe_plaintext_bit_size > 16) {
+    return absl::InvalidArgumentError(
+        "`lwe_plaintext_bit_size` must be in [1, 16].");
+  }
+  return absl::OkStatus();
+}
+
+// Returns the number of values packed in a block with `value_bits` bits each.
+int64_t NumValuesPerBlock(int value_bits) {
+  return 8 * sizeof(internal::BlockType) / value_bits;
+}
+
+// Calls `fn` with a value of the plaintext type of the kernels storing values
+// in slots of `value_bits` bits, i.e. `internal::Nibble`, `uint8_t` or
+// `uint16_t`.
+template <typename Fn>
+decltype(auto) VisitPlainInteger(int value_bits, Fn&& fn) {
+  if (value_bits == internal::kPackedValueBits<internal::Nibble>) {
+    return fn(internal::Nibble{});
+  }
+  if (value_bits == internal::kPackedValueBits<uint8_t>) {
+    return fn(uint8_t{});
+  }
+  return fn(uint16_t{});
+}
+
+// Returns the configurations of the online products tried by
+// `AutotuneInnerProduct` for values in slots of `value_bits` bits.
+std::vector<internal::InnerProductConfig> InnerProductCandidates(
+    int value_bits) {
+  std::vector<internal::InnerProductConfig> candidates = {
+      {.kernel = internal::InnerProductKernel::kNoHwy}};
+  for (int unroll : {1, 2, 4, 8}) {
+    // The nibble kernel does not unroll.
+    if (value_bits == internal::kPackedValueBits<internal::Nibble> &&
+        unroll != internal::InnerProductConfig().unroll) {
+      continue;
+    }
+    for (int64_t tile_blocks : kAutotuneTileBlocks) {
+      candidates.push_back({.kernel = internal::InnerProductKernel::kHwy,
+                            .unroll = unroll,
+                            .tile_blocks = tile_blocks});
     }
   }
-  return matrix;
+  if (value_bits == internal::kPackedValueBits<uint8_t>) {
+    for (int64_t tile_blocks : kAutotuneTileBlocks) {
+      candidates.push_back(
+          {.kernel = internal::InnerProductKernel::kHwyDotProduct,
+           .tile_blocks = tile_blocks});
+    }
+  }
+  return candidates;
+}
+
+// The autotuning cache is a text file with a line per tuned configuration:
+//   <hwy target> <value bits> <db_rows> <db_cols> <kernel> <unroll> <tiles>
+// where the first four fields are the key, and the kernel is one of
+// `kKernelNames`.
+std::string AutotuneCacheKey(const Parameters& params, int value_bits) {
+  return absl::StrCat(internal::HwyTargetName(), " ", value_bits, " ",
+                      params.db_rows, " ", params.db_cols);
+}
+
+constexpr int kNumAutotuneCacheKeyFields = 4;
+
+constexpr std::pair<internal::InnerProductKernel, absl::string_view>
+    kKernelNames[] = {
+        {internal::InnerProductKernel::kHwy, "hwy"},
+        {internal::InnerProductKernel::kNoHwy, "nohwy"},
+        {internal::InnerProductKernel::kHwyDotProduct, "hwy_dot"},
+};
+
+absl::string_view KernelName(internal::InnerProductKernel kernel) {
+  for (auto const& [known_kernel, name] : kKernelNames) {
+    if (known_kernel == kernel) {
+      return name;
+    }
+  }
+  return "";
+}
+
+// Returns the lines of the autotuning cache at `path`, or none if the file
+// does not exist.
+std::vector<std::string> ReadAutotuneCache(absl::string_view path) {
+  std::vector<std::string> lines;
+  std::ifstream file{std::string(path)};
+  for (std::string line; std::getline(file, line);) {
+    if (!line.empty()) {
+      lines.push_back(std::move(line));
+    }
+  }
+  return lines;
+}
+
+// Returns the key fields of a line of the autotuning cache.
+std::string AutotuneCacheLineKey(absl::string_view line) {
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(line, ' ', absl::SkipEmpty());
+  fields.resize(std::min<size_t>(fields.size(), kNumAutotuneCacheKeyFields));
+  return absl::StrJoin(fields, " ");
+}
+
+// Returns the configuration in a line of the autotuning cache.
+absl::StatusOr<internal::InnerProductConfig> ParseAutotuneCacheLine(
+    absl::string_view line) {
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(line, ' ', absl::SkipEmpty());
+  internal::InnerProductConfig config;
+  const auto* kernel_name =
+      fields.size() != kNumAutotuneCacheKeyFields + 3
+          ? std::end(kKernelNames)
+          : std::find_if(std::begin(kKernelNames), std::end(kKernelNames),
+                         [&](auto const& kernel_name) {
+                           return kernel_name.second == fields[4];
+                         });
+  if (kernel_name == std::end(kKernelNames) ||
+      !absl::SimpleAtoi(fields[5], &config.unroll) ||
+      !absl::SimpleAtoi(fields[6], &config.tile_blocks)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid autotuning cache line `", line, "`."));
+  }
+  config.kernel = kernel_name->first;
+  RLWE_RETURN_IF_ERROR(internal::ValidateInnerProductConfig(config));
+  return config;
+}
+
+// Sets the configuration of `key` in the autotuning cache at `path`. The file
+// is replaced by renaming, so concurrent readers see either version.
+absl::Status WriteAutotuneCache(absl::string_view path, absl::string_view key,
+                                const internal::InnerProductConfig& config) {
+  std::vector<std::string> lines = ReadAutotuneCache(path);
+  lines.erase(std::remove_if(lines.begin(), lines.end(),
+                             [&](const std::string& line) {
+                               return AutotuneCacheLineKey(line) == key;
+                             }),
+              lines.end());
+  lines.push_back(absl::StrCat(key, " ", KernelName(config.kernel), " ",
+                               config.unroll, " ", config.tile_blocks));
+
+  std::string tmp_path = absl::StrCat(path, ".tmp.", getpid());
+  std::ofstream file(tmp_path, std::ios::trunc);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Cannot create `", tmp_path, "`."));
+  }
+  for (auto const& line : lines) {
+    file << line << "\n";
+  }
+  file.close();
+  if (!file || std::rename(tmp_path.c_str(), std::string(path).c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return absl::InternalError(absl::StrCat("Failed to write `", path, "`."));
+  }
+  return absl::OkStatus();
+}
+
+// The layout of a database file, in the native byte order of the machine:
+// - `FileHeader`, zero-padded to `kFileHeaderSize` bytes;
+// - the data matrix of every shard, each stored by columns, with
+//   `col_stride` blocks per column;
+// - the hint matrix of every shard, each stored by rows;
+// - the PRNG seed of the LWE query pad.
+// The data matrices start at a page boundary, so they can be mapped in place.
+constexpr char kFileMagic[8] = {'H', 'P', 'I', 'R', 'D', 'B', '\0', '\0'};
+constexpr uint32_t kFileVersion = 2;
+constexpr int64_t kFileHeaderSize = 4096;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;          // sizeof(BlockType)
+  uint32_t lwe_integer_size;    // sizeof(lwe::Integer)
+  uint32_t packed_value_bits;   // The bits of the slot of every value.
+  int64_t db_rows;
+  int64_t db_cols;
+  int64_t db_record_bit_size;
+  int64_t lwe_plaintext_bit_size;
+  int64_t lwe_secret_dim;
+  int64_t num_shards;
+  int64_t num_records;
+  int64_t num_blocks_per_col;
+  int64_t col_stride;
+  int64_t seed_size;
+};
+static_assert(sizeof(FileHeader) <= kFileHeaderSize);
+
+// Returns an error if the `header` does not describe a database file for
+// `params`.
+absl::Status CheckFileHeader(const FileHeader& header,
+                             const Parameters& params) {
+  if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+    return absl::InvalidArgumentError("Not a database file.");
+  }
+  if (header.version != kFileVersion) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unsupported database file version ", header.version));
+  }
+  if (header.block_size != sizeof(internal::BlockType) ||
+      header.lwe_integer_size != sizeof(lwe::Integer) ||
+      header.packed_value_bits !=
+          Database::PackedValueBits(params.lwe_plaintext_bit_size)) {
+    return absl::InvalidArgumentError(
+        "Database file uses different integer types.");
+  }
+  int64_t num_shards =
+      DivAndRoundUp(params.db_record_bit_size, params.lwe_plaintext_bit_size);
+  if (header.db_rows != params.db_rows || header.db_cols != params.db_cols ||
+      header.db_record_bit_size != params.db_record_bit_size ||
+      header.lwe_plaintext_bit_size != params.lwe_plaintext_bit_size ||
+      header.lwe_secret_dim != params.lwe_secret_dim ||
+      header.num_shards != num_shards) {
+    return absl::InvalidArgumentError(
+        "Database file does not match `parameters`.");
+  }
+  int64_t num_values_per_block = NumValuesPerBlock(
+      Database::PackedValueBits(params.lwe_plaintext_bit_size));
+  int64_t num_blocks_per_col =
+      DivAndRoundUp<int64_t>(params.db_rows, num_values_per_block);
+  if (header.num_blocks_per_col != num_blocks_per_col ||
+      header.col_stride !=
+          internal::BlockMatrix::ColumnStride(num_blocks_per_col) ||
+      header.num_records < 0 ||
+      header.num_records > params.db_rows * params.db_cols ||
+      header.seed_size < 0) {
+    return absl::InvalidArgumentError("Database file is corrupted.");
+  }
+  return absl::OkStatus();
+}
+
+static inline int64_t NumBlocksPerColumn(int64_t num_rows, int plain_bits) {
+  return DivAndRoundUp<int64_t>(
+      num_rows, NumValuesPerBlock(Database::PackedValueBits(plain_bits)));
+}
+
+// Returns the `counter`'th output of the SplitMix64 generator seeded with
+// `seed`. Every output only depends on its counter, so random data expanded
+// this way can be generated in any order and on any number of threads. This is
+// not a cryptographic PRNG, and is only meant for test data.
+inline uint64_t CounterBasedRandom(uint64_t seed, uint64_t counter) {
+  uint64_t z = seed + (counter + 1) * 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// Distinguishes the random hints of `ComputeHintsFake` from the random records
+// of `CreateRandom` expanded from the same seed.
+constexpr uint64_t kFakeHintsDomain = 0x68696e7473;
+
+// Splits records into their plaintext values as `SplitRecord` does, but reads
+// every value with a load of at most three bytes, a shift and a mask instead of
+// bit by bit, and without allocating.
+class RecordSplitter {
+ public:
+  explicit RecordSplitter(const Parameters& params) {
+    int record_size = DivAndRoundUp(params.db_record_bit_size, 8);
+    int num_shards =
+        DivAndRoundUp(params.db_record_bit_size, params.lwe_plaintext_bit_size);
+    fields_.reserve(num_shards);
+    for (int i = 0; i < num_shards; ++i) {
+      int bit_idx = i * params.lwe_plaintext_bit_size;
+      int num_bits = std::min(params.lwe_plaintext_bit_size,
+                              params.db_record_bit_size - bit_idx);
+      int byte_offset = bit_idx / 8;
+      fields_.push_back(Field{
+          .byte_offset = byte_offset,
+          .num_bytes = std::min(3, record_size - byte_offset),
+          .shift = bit_idx % 8,
+          .mask = (uint32_t{1} << num_bits) - 1,
+      });
+    }
+  }
+
+  // Returns the plaintext value of the `shard_idx`'th shard of `record`.
+  uint32_t Value(const char* record, int shard_idx) const {
+    const Field& field = fields_[shard_idx];
+    const auto* bytes =
+        reinterpret_cast<const uint8_t*>(record) + field.byte_offset;
+    // Values have at most 16 bits starting within a byte, so they span at most
+    // three bytes.
+    uint32_t word = bytes[0];
+    if (field.num_bytes > 1) word |= uint32_t{bytes[1]} << 8;
+    if (field.num_bytes > 2) word |= uint32_t{bytes[2]} << 16;
+    return (word >> field.shift) & field.mask;
+  }
+
+ private:
+  struct Field {
+    int byte_offset;
+    int num_bytes;
+    int shift;
+    uint32_t mask;
+  };
+  std::vector<Field> fields_;
+};
+
+// Returns zeroed data matrices for `params`, one per shard. With
+// `params.interleave_shards`, they view `interleaved`, which is allocated with
+// column j of shard i at column j * num_shards + i.
+static inline std::vector<Database::RawMatrix> CreateZeroRawMatrices(
+    const Parameters& params, int num_shards, Database::RawMatrix& interleaved) {
+  int64_t num_blocks_per_col =
+      NumBlocksPerColumn(params.db_rows, params.lwe_plaintext_bit_size);
+  std::vector<Database::RawMatrix> matrices(num_shards);
+  if (!params.interleave_shards) {
+    for (auto& matrix : matrices) {
+      matrix = Database::RawMatrix(params.db_cols, num_blocks_per_col);
+    }
+    return matrices;
+  }
+  interleaved =
+      Database::RawMatrix(params.db_cols * num_shards, num_blocks_per_col);
+  for (int i = 0; i < num_shards; ++i) {
+    matrices[i] = Database::RawMatrix::View(
+        /*owner=*/nullptr, interleaved[i].data(), params.db_cols,
+        num_blocks_per_col, num_shards * interleaved.ColumnStride());
+  }
+  return matrices;
 }
 
 static inline Database::LweMatrix CreateZeroMatrix(size_t num_rows,
@@ -80,155 +428,1115 @@ static inline Database::LweMatrix CreateZeroMatrix(size_t num_rows,
   return matrix;
 }
 
-// Assume both `plain_matrix` and `lwe_matrix` are stored by columns.
-static inline absl::StatusOr<Database::LweMatrix> MatrixProduct(
-    const Database::RawMatrix& plain_matrix,
-    const Database::LweMatrix& lwe_matrix, size_t num_rows) {
-  Database::LweMatrix cols;
-  cols.reserve(lwe_matrix.size());
-  for (int i = 0; i < lwe_matrix.size(); ++i) {
-    RLWE_ASSIGN_OR_RETURN(
-        Database::LweVector col,
-        internal::InnerProduct<lwe::PlainInteger>(plain_matrix, lwe_matrix[i]));
-    cols.push_back(col);
+}  // namespace
+
+int Database::PackedValueBits(int plaintext_bit_size) {
+  if (plaintext_bit_size <= internal::kPackedValueBits<internal::Nibble>) {
+    return internal::kPackedValueBits<internal::Nibble>;
   }
-  // return `matrix` organized by rows.
-  Database::LweMatrix matrix(num_rows);
-  for (int i = 0; i < num_rows; ++i) {
-    matrix[i].resize(lwe_matrix.size());
-    for (int j = 0; j < lwe_matrix.size(); ++j) {
-      matrix[i][j] = cols[j][i];
-    }
+  if (plaintext_bit_size <= internal::kPackedValueBits<uint8_t>) {
+    return internal::kPackedValueBits<uint8_t>;
   }
-  return matrix;
+  return internal::kPackedValueBits<uint16_t>;
 }
 
-}  // namespace
-
 absl::StatusOr<std::unique_ptr<Database>> Database::Create(
     const Parameters& parameters) {
+  RLWE_RETURN_IF_ERROR(CheckForValidNumThreads(parameters));
+  RLWE_RETURN_IF_ERROR(CheckForValidPlaintextBitSize(parameters));
+
   // Initialize the data and the hint matrices for all shards.
   int num_shards = DivAndRoundUp(parameters.db_record_bit_size,
                                  parameters.lwe_plaintext_bit_size);
-  std::vector<RawMatrix> data_matrices(num_shards);
+  RawMatrix interleaved_data;
+  std::vector<RawMatrix> data_matrices =
+      CreateZeroRawMatrices(parameters, num_shards, interleaved_data);
   std::vector<LweMatrix> hint_matrices(num_shards);
   for (int i = 0; i < num_shards; ++i) {
-    data_matrices[i] =
-        CreateZeroRawMatrix(parameters.db_rows, parameters.db_cols);
     hint_matrices[i] =
         CreateZeroMatrix(parameters.db_rows, parameters.lwe_secret_dim);
   }
-  return absl::WrapUnique(
-      new Database(parameters, /*lwe_query_pad=*/nullptr, /*num_records=*/0,
-                   std::move(data_matrices), std::move(hint_matrices)));
+  return absl::WrapUnique(new Database(
+      parameters, /*lwe_query_pad=*/nullptr, /*num_records=*/0,
+      std::move(data_matrices), std::move(hint_matrices),
+      std::move(interleaved_data)));
 }
 
 absl::StatusOr<std::unique_ptr<Database>> Database::CreateRandom(
-    const Parameters& parameters) {
-  // Initialize the data and the hint matrices for all shards.
-  int num_shards = DivAndRoundUp(parameters.db_record_bit_size,
-                                 parameters.lwe_plaintext_bit_size);
-  std::vector<RawMatrix> data_matrices(num_shards);
-  std::vector<LweMatrix> hint_matrices(num_shards);
-  for (int i = 0; i < num_shards; ++i) {
-    data_matrices[i] =
-        CreateRandomRawMatrix(parameters.db_rows, parameters.db_cols,
-                              parameters.lwe_plaintext_bit_size);
-    hint_matrices[i] =
-        CreateZeroMatrix(parameters.db_rows, parameters.lwe_secret_dim);
+    const Parameters& parameters, uint64_t seed) {
+  // Fill the data matrices once they are placed, using the workers of the
+  // database.
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Database> database, Create(parameters));
+  database->FillRandom(seed);
+  database->num_records_ = parameters.db_rows * parameters.db_cols;
+  return database;
+}
+
+void Database::FillRandom(uint64_t seed) {
+  accelerator_in_sync_ = false;
+  // Every block takes two outputs of the PRNG, indexed by the position of the
+  // block in shard-major, column-major order, and is masked down to the bits
+  // of the plaintexts in its slots. The slots of the rows past `db_rows` are
+  // padding, and stay zero as with the other write paths.
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+  BlockType value_mask = (BlockType{1} << params_.lwe_plaintext_bit_size) - 1;
+  int64_t num_full_blocks = params_.db_rows / num_values_per_block;
+  BlockType block_mask = 0;
+  BlockType last_block_mask = 0;
+  for (int64_t k = 0; k < num_values_per_block; ++k) {
+    BlockType slot_mask =
+        value_mask << internal::PackedValueShift(packed_value_bits_, k);
+    block_mask |= slot_mask;
+    if (k < params_.db_rows % num_values_per_block) {
+      last_block_mask |= slot_mask;
+    }
+  }
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_cols = params_.db_cols;
+  int64_t num_tasks_per_shard =
+      DivAndRoundUp<int64_t>(num_cols, kNumIngestColsPerTask);
+  ParallelFor(
+      num_shards * num_tasks_per_shard, thread_pool_.get(),
+      [&](int64_t task_idx) {
+        int64_t shard_idx = task_idx / num_tasks_per_shard;
+        int64_t col_begin =
+            (task_idx % num_tasks_per_shard) * kNumIngestColsPerTask;
+        int64_t col_end = std::min(col_begin + kNumIngestColsPerTask, num_cols);
+        RawMatrix& matrix = data_matrices_[shard_idx];
+        int64_t num_blocks = matrix.NumBlocksPerColumn();
+        for (int64_t col_idx = col_begin; col_idx < col_end; ++col_idx) {
+          absl::Span<BlockType> column = matrix[col_idx];
+          uint64_t counter = 2 * (shard_idx * num_cols + col_idx) * num_blocks;
+          for (int64_t j = 0; j < num_blocks; ++j, counter += 2) {
+            BlockType mask = j < num_full_blocks    ? block_mask
+                             : j == num_full_blocks ? last_block_mask
+                                                    : BlockType{0};
+            column[j] =
+                absl::MakeUint128(CounterBasedRandom(seed, counter),
+                                  CounterBasedRandom(seed, counter + 1)) &
+                mask;
+          }
+        }
+      });
+}
+
+absl::StatusOr<std::unique_ptr<Database>> Database::OpenMapped(
+    const Parameters& parameters, absl::string_view path) {
+  RLWE_RETURN_IF_ERROR(CheckForValidNumThreads(parameters));
+  RLWE_RETURN_IF_ERROR(CheckForValidPlaintextBitSize(parameters));
+
+  std::string filename(path);
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("Cannot open `", path, "`."));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return absl::InternalError(absl::StrCat("Cannot stat `", path, "`."));
+  }
+  int64_t file_size = file_stat.st_size;
+  if (file_size < kFileHeaderSize) {
+    close(fd);
+    return absl::InvalidArgumentError("Not a database file.");
+  }
+  // Map the file privately, so that the pages are shared with other processes
+  // until the database is modified.
+  void* addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, /*offset=*/0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return absl::InternalError(absl::StrCat("Cannot map `", path, "`."));
+  }
+  std::shared_ptr<void> mapping(
+      addr, [file_size](void* ptr) { munmap(ptr, file_size); });
+  char* bytes = static_cast<char*>(addr);
+
+  FileHeader header;
+  std::memcpy(&header, bytes, sizeof(header));
+  RLWE_RETURN_IF_ERROR(CheckFileHeader(header, parameters));
+  int64_t data_size =
+      header.db_cols * header.col_stride * sizeof(internal::BlockType);
+  int64_t hint_size =
+      header.db_rows * header.lwe_secret_dim * sizeof(lwe::Integer);
+  int64_t expected_file_size = kFileHeaderSize +
+                               header.num_shards * (data_size + hint_size) +
+                               header.seed_size;
+  if (file_size != expected_file_size) {
+    return absl::InvalidArgumentError("Database file has incorrect size.");
+  }
+
+  std::vector<RawMatrix> data_matrices;
+  data_matrices.reserve(header.num_shards);
+  char* data_ptr = bytes + kFileHeaderSize;
+  for (int i = 0; i < header.num_shards; ++i, data_ptr += data_size) {
+    data_matrices.push_back(RawMatrix::View(
+        mapping, reinterpret_cast<BlockType*>(data_ptr), header.db_cols,
+        header.num_blocks_per_col));
+  }
+  std::vector<LweMatrix> hint_matrices(header.num_shards);
+  const char* hint_ptr = data_ptr;
+  for (auto& hint_matrix : hint_matrices) {
+    hint_matrix.resize(header.db_rows);
+    for (auto& row : hint_matrix) {
+      row.resize(header.lwe_secret_dim);
+      std::memcpy(row.data(), hint_ptr, row.size() * sizeof(lwe::Integer));
+      hint_ptr += row.size() * sizeof(lwe::Integer);
+    }
+  }
+  std::string prng_seed(hint_ptr, header.seed_size);
+
+  auto database = absl::WrapUnique(new Database(
+      parameters, /*lwe_query_pad=*/nullptr, header.num_records,
+      std::move(data_matrices), std::move(hint_matrices)));
+  database->prng_seed_lwe_query_pad_ = std::move(prng_seed);
+  return database;
+}
+
+absl::Status Database::WriteToFile(
+    absl::string_view path, absl::string_view prng_seed_lwe_query_pad) const {
+  if (hint_matrices_.size() != data_matrices_.size()) {
+    return absl::FailedPreconditionError("The hints have been released.");
+  }
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kFileVersion;
+  header.block_size = sizeof(BlockType);
+  header.lwe_integer_size = sizeof(lwe::Integer);
+  header.packed_value_bits = packed_value_bits_;
+  header.db_rows = params_.db_rows;
+  header.db_cols = params_.db_cols;
+  header.db_record_bit_size = params_.db_record_bit_size;
+  header.lwe_plaintext_bit_size = params_.lwe_plaintext_bit_size;
+  header.lwe_secret_dim = params_.lwe_secret_dim;
+  header.num_shards = data_matrices_.size();
+  header.num_records = num_records_;
+  header.num_blocks_per_col =
+      data_matrices_.empty() ? 0 : data_matrices_[0].NumBlocksPerColumn();
+  header.col_stride = RawMatrix::ColumnStride(header.num_blocks_per_col);
+  header.seed_size = prng_seed_lwe_query_pad.size();
+
+  std::ofstream file(std::string(path), std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Cannot create `", path, "`."));
+  }
+  std::string header_bytes(kFileHeaderSize, '\0');
+  std::memcpy(header_bytes.data(), &header, sizeof(header));
+  file.write(header_bytes.data(), header_bytes.size());
+  // The file holds one shard after the other, whatever the layout in memory.
+  for (auto const& data_matrix : data_matrices_) {
+    for (int64_t j = 0; j < data_matrix.size(); ++j) {
+      file.write(reinterpret_cast<const char*>(data_matrix[j].data()),
+                 header.col_stride * sizeof(BlockType));
+    }
+  }
+  for (auto const& hint_matrix : hint_matrices_) {
+    for (auto const& row : hint_matrix) {
+      file.write(reinterpret_cast<const char*>(row.data()),
+                 row.size() * sizeof(lwe::Integer));
+    }
+  }
+  file.write(prng_seed_lwe_query_pad.data(), prng_seed_lwe_query_pad.size());
+  file.close();
+  if (!file) {
+    return absl::InternalError(absl::StrCat("Failed to write `", path, "`."));
   }
-  int64_t num_records = parameters.db_rows * parameters.db_cols;
-  return absl::WrapUnique(new Database(parameters, /*lwe_query_pad=*/nullptr,
-                                       num_records, std::move(data_matrices),
-                                       std::move(hint_matrices)));
+  return absl::OkStatus();
 }
 
 absl::Status Database::UpdateLweQueryPad(const lwe::Matrix* lwe_query_pad) {
   if (lwe_query_pad == nullptr) {
     return absl::InvalidArgumentError("`lwe_query_pad` must not be null.");
   }
+  if (lwe_query_pad != lwe_query_pad_) {
+    hints_are_up_to_date_ = false;
+  }
   lwe_query_pad_ = lwe_query_pad;
   return absl::OkStatus();
 }
 
-absl::Status Database::Append(absl::string_view record) {
+absl::Status Database::CheckRecordSize(absl::string_view record) const {
   if (record.size() * 8 >= params_.db_record_bit_size + 8 ||
       record.size() * 8 < params_.db_record_bit_size) {
     return absl::InvalidArgumentError("`record` has incorrect size.");
   }
-  if (num_records_ >= params_.db_rows * params_.db_cols) {
-    return absl::InvalidArgumentError("Database is full.");
-  }
+  return absl::OkStatus();
+}
+
+void Database::WriteRecord(int64_t index, absl::string_view record) {
+  accelerator_in_sync_ = false;
   int64_t row_idx, col_idx;
-  std::tie(row_idx, col_idx) = MatrixCoordinate(num_records_);
-  int64_t num_values_per_block = sizeof(BlockType) / sizeof(lwe::PlainInteger);
+  std::tie(row_idx, col_idx) = MatrixCoordinate(index);
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
   int64_t block_idx = row_idx / num_values_per_block;
   int64_t block_pos = row_idx % num_values_per_block;
-  int64_t base_bits = block_pos * 8 * sizeof(lwe::PlainInteger);
+  int64_t base_bits = internal::PackedValueShift(packed_value_bits_, block_pos);
+  BlockType slot_mask = ((BlockType{1} << packed_value_bits_) - 1) << base_bits;
 
-  num_records_++;
   std::vector<lwe::Integer> values = SplitRecord(record, params_);
   for (int i = 0; i < values.size(); ++i) {
-    BlockType block = static_cast<BlockType>(values[i]) << base_bits;
-    data_matrices_[i][col_idx][block_idx] |= block;
+    BlockType& block = data_matrices_[i][col_idx][block_idx];
+    auto old_value = static_cast<lwe::Integer>((block & slot_mask) >> base_bits);
+    block = (block & ~slot_mask) |
+            (static_cast<BlockType>(values[i]) << base_bits);
+
+    // The hint row changes by (new - old) * A[col_idx, :].
+    lwe::Integer delta = values[i] - old_value;
+    if (hints_are_up_to_date_ && delta != 0) {
+      LweVector& hint_row = hint_matrices_[i][row_idx];
+      for (int j = 0; j < hint_row.size(); ++j) {
+        hint_row[j] += delta * (*lwe_query_pad_)(col_idx, j);
+      }
+    }
+  }
+}
+
+absl::Status Database::Append(absl::string_view record) {
+  RLWE_RETURN_IF_ERROR(CheckRecordSize(record));
+  if (num_records_ >= params_.db_rows * params_.db_cols) {
+    return absl::InvalidArgumentError("Database is full.");
   }
+  WriteRecord(num_records_, record);
+  num_records_++;
   return absl::OkStatus();
 }
 
+void Database::WriteRecordColumns(const char* records, int64_t index_begin,
+                                  int64_t index_end, int64_t row_stride,
+                                  int64_t col_stride) {
+  accelerator_in_sync_ = false;
+  RecordSplitter splitter(params_);
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_cols = params_.db_cols;
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+  std::vector<int64_t> shifts(num_values_per_block);
+  for (int64_t k = 0; k < num_values_per_block; ++k) {
+    shifts[k] = internal::PackedValueShift(packed_value_bits_, k);
+  }
+  BlockType value_mask = (BlockType{1} << packed_value_bits_) - 1;
+  int64_t first_offset = (index_begin / num_cols) * row_stride +
+                         (index_begin % num_cols) * col_stride;
+  int64_t block_begin = index_begin / num_cols / num_values_per_block;
+  int64_t block_end = DivAndRoundUp<int64_t>(
+      DivAndRoundUp<int64_t>(index_end, num_cols), num_values_per_block);
+
+  // Every task writes whole blocks of all shards down a range of columns, so
+  // tasks never write to the same block.
+  int64_t num_tasks = DivAndRoundUp<int64_t>(num_cols, kNumIngestColsPerTask);
+  ParallelFor(num_tasks, thread_pool_.get(), [&](int64_t task_idx) {
+    int64_t col_begin = task_idx * kNumIngestColsPerTask;
+    int64_t col_end = std::min(col_begin + kNumIngestColsPerTask, num_cols);
+    std::vector<BlockType> blocks(num_shards);
+    for (int64_t tile_begin = block_begin; tile_begin < block_end;
+         tile_begin += kNumIngestBlocksPerTile) {
+      int64_t tile_end =
+          std::min(tile_begin + kNumIngestBlocksPerTile, block_end);
+      for (int64_t col_idx = col_begin; col_idx < col_end; ++col_idx) {
+        // The rows of this column whose indices are in the range.
+        int64_t row_begin = DivAndRoundUp<int64_t>(
+            std::max<int64_t>(index_begin - col_idx, 0), num_cols);
+        int64_t row_end = DivAndRoundUp<int64_t>(
+            std::max<int64_t>(index_end - col_idx, 0), num_cols);
+        for (int64_t block_idx = tile_begin; block_idx < tile_end;
+             ++block_idx) {
+          int64_t block_row = block_idx * num_values_per_block;
+          int64_t first_row = std::max(block_row, row_begin);
+          int64_t last_row =
+              std::min(block_row + num_values_per_block, row_end);
+          if (first_row >= last_row) {
+            continue;
+          }
+
+          // Assemble the blocks of all shards, then write each of them once.
+          std::fill(blocks.begin(), blocks.end(), BlockType{0});
+          BlockType slot_mask = 0;
+          for (int64_t row_idx = first_row; row_idx < last_row; ++row_idx) {
+            const char* record =
+                records +
+                (row_idx * row_stride + col_idx * col_stride - first_offset);
+            int64_t shift = shifts[row_idx - block_row];
+            for (int i = 0; i < num_shards; ++i) {
+              blocks[i] |= static_cast<BlockType>(splitter.Value(record, i))
+                           << shift;
+            }
+            slot_mask |= value_mask << shift;
+          }
+          if (last_row - first_row == num_values_per_block) {
+            for (int i = 0; i < num_shards; ++i) {
+              data_matrices_[i][col_idx][block_idx] = blocks[i];
+            }
+          } else {
+            for (int i = 0; i < num_shards; ++i) {
+              BlockType& block = data_matrices_[i][col_idx][block_idx];
+              block = (block & ~slot_mask) | blocks[i];
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+absl::Status Database::AppendBatch(absl::string_view records) {
+  int64_t record_size = DivAndRoundUp(params_.db_record_bit_size, 8);
+  if (records.size() % record_size != 0) {
+    return absl::InvalidArgumentError(
+        "`records` must hold a whole number of records.");
+  }
+  int64_t num_new_records = records.size() / record_size;
+  if (num_new_records > params_.db_rows * params_.db_cols - num_records_) {
+    return absl::InvalidArgumentError("Database is full.");
+  }
+  if (hints_are_up_to_date_) {
+    for (int64_t i = 0; i < num_new_records; ++i) {
+      WriteRecord(num_records_ + i,
+                  records.substr(i * record_size, record_size));
+    }
+  } else {
+    WriteRecordColumns(records.data(), num_records_,
+                       num_records_ + num_new_records,
+                       /*row_stride=*/params_.db_cols * record_size,
+                       /*col_stride=*/record_size);
+  }
+  num_records_ += num_new_records;
+  return absl::OkStatus();
+}
+
+absl::Status Database::LoadColumns(absl::string_view records) {
+  int64_t record_size = DivAndRoundUp(params_.db_record_bit_size, 8);
+  int64_t num_records = params_.db_rows * params_.db_cols;
+  if (records.size() != num_records * record_size) {
+    return absl::InvalidArgumentError(
+        "`records` must hold `db_rows * db_cols` records.");
+  }
+  hints_are_up_to_date_ = false;
+  WriteRecordColumns(records.data(), /*index_begin=*/0, num_records,
+                     /*row_stride=*/record_size,
+                     /*col_stride=*/params_.db_rows * record_size);
+  num_records_ = num_records;
+  return absl::OkStatus();
+}
+
+absl::Status Database::Update(int64_t index, absl::string_view record) {
+  RLWE_RETURN_IF_ERROR(CheckRecordSize(record));
+  if (index < 0 || index >= num_records_) {
+    return absl::InvalidArgumentError("`index` is out of range.");
+  }
+  bool was_in_sync = accelerator_in_sync_;
+  WriteRecord(index, record);
+  SyncAcceleratorRecords({index}, was_in_sync);
+  return absl::OkStatus();
+}
+
+absl::Status Database::Update(absl::Span<const int64_t> indices,
+                              absl::Span<const std::string> records) {
+  if (indices.size() != records.size()) {
+    return absl::InvalidArgumentError(
+        "`indices` and `records` must have the same size.");
+  }
+  for (int i = 0; i < indices.size(); ++i) {
+    RLWE_RETURN_IF_ERROR(CheckRecordSize(records[i]));
+    if (indices[i] < 0 || indices[i] >= num_records_) {
+      return absl::InvalidArgumentError("`index` is out of range.");
+    }
+  }
+  bool was_in_sync = accelerator_in_sync_;
+  for (int i = 0; i < indices.size(); ++i) {
+    WriteRecord(indices[i], records[i]);
+  }
+  SyncAcceleratorRecords(indices, was_in_sync);
+  return absl::OkStatus();
+}
+
+absl::Status Database::SetAccelerator(
+    std::unique_ptr<DatabaseAccelerator> accelerator) {
+  accelerator_ = std::move(accelerator);
+  accelerator_in_sync_ = false;
+  if (accelerator_ == nullptr) {
+    return absl::OkStatus();
+  }
+  return SyncAccelerator();
+}
+
+absl::Status Database::SyncAccelerator() {
+  if (accelerator_ == nullptr) {
+    return absl::FailedPreconditionError("No accelerator is set.");
+  }
+  accelerator_in_sync_ = false;
+  RLWE_RETURN_IF_ERROR(accelerator_->UploadData(
+      data_matrices_, params_.db_rows, packed_value_bits_));
+  accelerator_in_sync_ = true;
+  return absl::OkStatus();
+}
+
+void Database::SyncAcceleratorRecords(absl::Span<const int64_t> indices,
+                                      bool was_in_sync) {
+  if (accelerator_ == nullptr || !was_in_sync) {
+    return;
+  }
+  std::vector<int64_t> col_indices;
+  col_indices.reserve(indices.size());
+  for (int64_t index : indices) {
+    col_indices.push_back(MatrixCoordinate(index).second);
+  }
+  std::sort(col_indices.begin(), col_indices.end());
+  col_indices.erase(std::unique(col_indices.begin(), col_indices.end()),
+                    col_indices.end());
+  accelerator_in_sync_ =
+      accelerator_->UploadColumns(data_matrices_, col_indices).ok();
+}
+
+absl::Status Database::ComputeHintsInto(const lwe::Matrix& lwe_query_pad,
+                                        std::vector<LweMatrix>& hints) const {
+  // Import the LWE query pad once, stored by rows, for all shards.
+  int64_t num_cols = params_.lwe_secret_dim;
+  std::vector<lwe::Integer> pad(params_.db_cols * num_cols);
+  for (int64_t i = 0; i < params_.db_cols; ++i) {
+    for (int64_t j = 0; j < num_cols; ++j) {
+      pad[i * num_cols + j] = lwe_query_pad(i, j);
+    }
+  }
+
+  // Every task computes a range of rows of the hint of a shard, writing
+  // them in place.
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_tasks_per_shard = std::max<int64_t>(
+      DivAndRoundUp<int64_t>(params_.db_rows, kNumHintRowsPerTask), 1);
+  hints.resize(num_shards);
+  for (auto& hint : hints) {
+    hint.resize(params_.db_rows);
+    for (auto& row : hint) {
+      row.resize(num_cols);
+    }
+  }
+  if (const DatabaseAccelerator* accelerator = ActiveAccelerator();
+      accelerator != nullptr &&
+      accelerator->MatrixProduct(pad, num_cols, absl::MakeSpan(hints)).ok()) {
+    return absl::OkStatus();
+  }
+  return ParallelForWithStatus(
+      num_shards * num_tasks_per_shard, thread_pool_.get(),
+      [&](int64_t task_idx) -> absl::Status {
+        int64_t shard_idx = task_idx / num_tasks_per_shard;
+        int64_t row_begin =
+            (task_idx % num_tasks_per_shard) * kNumHintRowsPerTask;
+        int64_t row_end =
+            std::min<int64_t>(row_begin + kNumHintRowsPerTask, params_.db_rows);
+        auto result = absl::MakeSpan(hints[shard_idx]).subspan(row_begin);
+        return VisitPlainInteger(packed_value_bits_, [&](auto plain_integer) {
+          return internal::MatrixProductRange<decltype(plain_integer)>(
+              data_matrices_[shard_idx], pad, num_cols, row_begin, row_end,
+              result);
+        });
+      });
+}
+
+absl::StatusOr<std::vector<Database::LweMatrix>> Database::ComputeHints(
+    const lwe::Matrix& lwe_query_pad) const {
+  std::vector<LweMatrix> hints;
+  RLWE_RETURN_IF_ERROR(ComputeHintsInto(lwe_query_pad, hints));
+  return hints;
+}
+
+std::vector<Database::LweMatrix> Database::ComputeHintsFake(
+    uint64_t seed) const {
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_cols = params_.lwe_secret_dim;
+  std::vector<LweMatrix> hints(num_shards,
+                               LweMatrix(params_.db_rows, LweVector(num_cols)));
+  int64_t num_tasks_per_shard = std::max<int64_t>(
+      DivAndRoundUp<int64_t>(params_.db_rows, kNumHintRowsPerTask), 1);
+  ParallelFor(
+      num_shards * num_tasks_per_shard, thread_pool_.get(),
+      [&](int64_t task_idx) {
+        int64_t shard_idx = task_idx / num_tasks_per_shard;
+        int64_t row_begin =
+            (task_idx % num_tasks_per_shard) * kNumHintRowsPerTask;
+        int64_t row_end =
+            std::min<int64_t>(row_begin + kNumHintRowsPerTask, params_.db_rows);
+        for (int64_t i = row_begin; i < row_end; ++i) {
+          LweVector& row = hints[shard_idx][i];
+          uint64_t counter = (shard_idx * params_.db_rows + i) * num_cols;
+          for (int64_t j = 0; j < num_cols; ++j) {
+            row[j] = static_cast<lwe::Integer>(
+                CounterBasedRandom(seed ^ kFakeHintsDomain, counter + j));
+          }
+        }
+      });
+  return hints;
+}
+
 absl::Status Database::UpdateHints() {
   if (lwe_query_pad_ == nullptr) {
     return absl::FailedPreconditionError("LWE query pad not set.");
   }
-  for (int i = 0; i < data_matrices_.size(); ++i) {
-    LweMatrix lwe_matrix = ImportLweMatrix(*lwe_query_pad_);
-    RLWE_ASSIGN_OR_RETURN(
-        hint_matrices_[i],
-        MatrixProduct(data_matrices_[i], lwe_matrix, params_.db_rows));
-  }
+  hints_are_up_to_date_ = false;
+  RLWE_RETURN_IF_ERROR(ComputeHintsInto(*lwe_query_pad_, hint_matrices_));
+  hints_are_up_to_date_ = true;
   return absl::OkStatus();
 }
 
-absl::Status Database::UpdateHintsFake() {
-  std::cout << "Generating FAKE hint" << std::endl;
+absl::Status Database::UpdateHintsFake(uint64_t seed) {
   if (lwe_query_pad_ == nullptr) {
     return absl::FailedPreconditionError("LWE query pad not set.");
   }
-  int rows = params_.db_rows;
-  int cols = params_.lwe_secret_dim;
-  for (int i = 0; i < data_matrices_.size(); ++i) {
-    for (int r = 0; r < rows; r++) {
-      for (int c = 0; c < cols; c++) {
-        hint_matrices_[i][r][c] = static_cast<lwe::Integer>(std::rand()) * static_cast<lwe::Integer>(std::rand()); // To ensure result is at 64-bits on all machines
+  hints_are_up_to_date_ = false;
+  hint_matrices_ = ComputeHintsFake(seed);
+  return absl::OkStatus();
+}
+
+absl::Status Database::SetHints(std::vector<LweMatrix> hints) {
+  if (hints.size() != data_matrices_.size()) {
+    return absl::InvalidArgumentError(
+        "`hints` has incorrect number of shards.");
+  }
+  for (auto const& hint : hints) {
+    if (hint.size() != params_.db_rows) {
+      return absl::InvalidArgumentError("`hints` has incorrect dimensions.");
+    }
+    for (auto const& row : hint) {
+      if (row.size() != params_.lwe_secret_dim) {
+        return absl::InvalidArgumentError("`hints` has incorrect dimensions.");
       }
     }
   }
+  hint_matrices_ = std::move(hints);
+  hints_are_up_to_date_ = lwe_query_pad_ != nullptr;
   return absl::OkStatus();
 }
 
+void Database::ReleaseHints() {
+  // Swapping with empty vectors frees their storage, unlike `clear`.
+  std::vector<LweMatrix>().swap(hint_matrices_);
+  lwe_query_pad_ = nullptr;
+  hints_are_up_to_date_ = false;
+}
+
+Database::MemoryBreakdown Database::MemoryUsage() const {
+  MemoryBreakdown usage;
+  if (!interleaved_data_.empty()) {
+    usage.data_bytes = interleaved_data_.Blocks().size() * sizeof(BlockType);
+  } else {
+    for (auto const& data_matrix : data_matrices_) {
+      usage.data_bytes += data_matrix.Blocks().size() * sizeof(BlockType);
+    }
+  }
+  for (auto const& hint_matrix : hint_matrices_) {
+    for (auto const& row : hint_matrix) {
+      usage.hint_bytes += row.size() * sizeof(lwe::Integer);
+    }
+  }
+  return usage;
+}
+
 absl::StatusOr<std::vector<Database::LweVector>> Database::InnerProductWith(
-    const LweVector& query) const {
-  std::vector<LweVector> results;
-  results.reserve(data_matrices_.size());
-  for (auto const& matrix : data_matrices_) {
-    RLWE_ASSIGN_OR_RETURN(
-        LweVector result,
-        internal::InnerProduct<lwe::PlainInteger>(matrix, query));
-    result.resize(params_.db_rows);
-    results.push_back(result);
+    absl::Span<const lwe::Integer> query) const {
+  int64_t num_shards = data_matrices_.size();
+  std::vector<LweVector> results(num_shards, LweVector(params_.db_rows));
+  std::vector<absl::Span<lwe::Integer>> result_spans;
+  result_spans.reserve(num_shards);
+  for (auto& result : results) {
+    result_spans.push_back(absl::MakeSpan(result));
+  }
+  RLWE_RETURN_IF_ERROR(InnerProductWithInto(query, result_spans));
+  return results;
+}
+
+absl::Status Database::InnerProductWithInto(
+    absl::Span<const lwe::Integer> query,
+    absl::Span<const absl::Span<lwe::Integer>> results) const {
+  int64_t num_shards = data_matrices_.size();
+  if (results.size() != num_shards) {
+    return absl::InvalidArgumentError(
+        "`results` must hold one span per shard.");
+  }
+  for (auto const& result : results) {
+    if (result.size() != params_.db_rows) {
+      return absl::InvalidArgumentError(
+          "`results` must hold `db_rows` values per shard.");
+    }
+  }
+  if (num_shards == 0) {
+    return absl::OkStatus();
+  }
+  int64_t num_blocks = data_matrices_[0].NumBlocksPerColumn();
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+
+  if (const DatabaseAccelerator* accelerator = ActiveAccelerator();
+      accelerator != nullptr && query.size() == params_.db_cols) {
+    absl::Span<const lwe::Integer> queries[] = {query};
+    if (accelerator->InnerProductBatch(queries, results).ok()) {
+      return absl::OkStatus();
+    }
+  }
+  if (!numa_partitions_.empty()) {
+    return InnerProductWithIntoOnNumaNodes(query, results);
+  }
+  if (!interleaved_data_.empty()) {
+    return InnerProductWithIntoInterleaved(query, results);
+  }
+
+  // Split every shard into ranges of blocks when running on multiple threads.
+  // Each task writes to a disjoint part of the results, so no synchronization
+  // is needed between tasks.
+  int64_t num_blocks_per_task = num_blocks;
+  if (thread_pool_ != nullptr) {
+    num_blocks_per_task =
+        std::min(num_blocks, kNumRowsPerTask / num_values_per_block);
+  }
+  int64_t num_tasks_per_shard =
+      num_blocks_per_task == 0
+          ? 1
+          : DivAndRoundUp(num_blocks, num_blocks_per_task);
+
+  return ParallelForWithStatus(
+      num_shards * num_tasks_per_shard, thread_pool_.get(),
+      [&](int64_t task_idx) -> absl::Status {
+        int64_t shard_idx = task_idx / num_tasks_per_shard;
+        int64_t block_begin =
+            (task_idx % num_tasks_per_shard) * num_blocks_per_task;
+        int64_t block_end =
+            std::min(block_begin + num_blocks_per_task, num_blocks);
+        return InnerProductRangeInto(data_matrices_[shard_idx], query,
+                                     block_begin, block_end,
+                                     results[shard_idx]);
+      });
+}
+
+absl::Status Database::InnerProductWithIntoInterleaved(
+    absl::Span<const lwe::Integer> query,
+    absl::Span<const absl::Span<lwe::Integer>> results) const {
+  // The columns j of all shards are adjacent in `interleaved_data_`, so they
+  // form column j of a matrix whose rows are the rows of every shard followed
+  // by its padding rows, one shard after the other. Its product with `query`
+  // is split into ranges of rows, each of which may span several shards, and
+  // computed by the same kernels as a single shard.
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+  int64_t shard_stride = interleaved_data_.ColumnStride();
+  int64_t shard_rows = shard_stride * num_values_per_block;
+  if (shard_stride == 0) {
+    return absl::OkStatus();
+  }
+  RawMatrix columns = RawMatrix::View(
+      /*owner=*/nullptr, const_cast<BlockType*>(interleaved_data_[0].data()),
+      params_.db_cols, num_shards * shard_stride);
+  int64_t num_blocks = columns.NumBlocksPerColumn();
+  int64_t num_blocks_per_task =
+      std::min(num_blocks, kNumRowsPerTask / num_values_per_block);
+  int64_t num_tasks = DivAndRoundUp(num_blocks, num_blocks_per_task);
+
+  return ParallelForWithStatus(
+      num_tasks, thread_pool_.get(), [&](int64_t task_idx) -> absl::Status {
+        int64_t block_begin = task_idx * num_blocks_per_task;
+        int64_t block_end =
+            std::min(block_begin + num_blocks_per_task, num_blocks);
+        int64_t row_begin = block_begin * num_values_per_block;
+        int64_t row_end = block_end * num_values_per_block;
+        std::unique_ptr<Workspace> workspace = AcquireWorkspace();
+        absl::Span<lwe::Integer> range_result = absl::MakeSpan(
+            workspace->kernel.AlignedBuffer(row_end - row_begin),
+            row_end - row_begin);
+        absl::Status status =
+            VisitPlainInteger(packed_value_bits_, [&](auto plain_integer) {
+              return internal::InnerProductRange<decltype(plain_integer)>(
+                  columns, query, block_begin, block_end, range_result,
+                  &workspace->kernel, inner_product_config_);
+            });
+        // Copy the rows of every shard in the range, skipping their padding.
+        for (int64_t row = row_begin; status.ok() && row < row_end;) {
+          int64_t shard_idx = row / shard_rows;
+          int64_t shard_row = row % shard_rows;
+          int64_t num_rows =
+              std::min(row_end - row, shard_rows - shard_row);
+          if (shard_row < params_.db_rows) {
+            int64_t num_copied =
+                std::min(num_rows, params_.db_rows - shard_row);
+            std::copy_n(range_result.begin() + (row - row_begin), num_copied,
+                        results[shard_idx].begin() + shard_row);
+          }
+          row += num_rows;
+        }
+        ReleaseWorkspace(std::move(workspace));
+        return status;
+      });
+}
+
+absl::Status Database::InnerProductWithIntoOnNumaNodes(
+    absl::Span<const lwe::Integer> query,
+    absl::Span<const absl::Span<lwe::Integer>> results) const {
+  int64_t num_shards = data_matrices_.size();
+  int64_t num_blocks = data_matrices_[0].NumBlocksPerColumn();
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+  int64_t num_blocks_per_task =
+      std::min(num_blocks, kNumRowsPerTask / num_values_per_block);
+  int64_t num_tasks_per_slice =
+      num_blocks_per_task == 0 ? 1
+                               : DivAndRoundUp(num_blocks, num_blocks_per_task);
+
+  // A slice holding all columns of its shard writes to the results directly,
+  // and the others to their own buffers, which are added up at the end. The
+  // buffers come from the workspace pool, so they are reused across queries.
+  std::unique_ptr<Workspace> scratch = AcquireWorkspace();
+  std::vector<std::vector<std::vector<lwe::Integer>>>& partial_results =
+      scratch->partial_results;
+  partial_results.resize(numa_partitions_.size());
+  for (int n = 0; n < numa_partitions_.size(); ++n) {
+    const std::vector<NumaSlice>& slices = numa_partitions_[n].slices;
+    partial_results[n].resize(slices.size());
+    for (int i = 0; i < slices.size(); ++i) {
+      bool is_whole_shard =
+          slices[i].col_begin == 0 && slices[i].col_end == params_.db_cols;
+      partial_results[n][i].resize(is_whole_shard ? 0 : params_.db_rows);
+    }
+  }
+
+  // Every node runs its tasks on its own workers, so that the data matrices
+  // are mostly read from the node holding them. The drivers of the nodes, and
+  // thus the calling thread, also work on the tasks, so the products make
+  // progress even when called from a worker while all workers are busy.
+  std::vector<absl::Status> statuses(numa_partitions_.size());
+  ParallelFor(numa_partitions_.size(), thread_pool_.get(), [&](int64_t n) {
+    const NumaPartition& partition = numa_partitions_[n];
+    statuses[n] = ParallelForWithStatus(
+        partition.slices.size() * num_tasks_per_slice, thread_pool_.get(),
+        /*group=*/n, [&](int64_t task_idx) -> absl::Status {
+          int64_t slice_idx = task_idx / num_tasks_per_slice;
+          const NumaSlice& slice = partition.slices[slice_idx];
+          int64_t block_begin =
+              (task_idx % num_tasks_per_slice) * num_blocks_per_task;
+          int64_t block_end =
+              std::min(block_begin + num_blocks_per_task, num_blocks);
+          std::vector<lwe::Integer>& partial_result =
+              partial_results[n][slice_idx];
+          return InnerProductRangeInto(
+              slice.columns,
+              query.subspan(slice.col_begin, slice.col_end - slice.col_begin),
+              block_begin, block_end,
+              partial_result.empty() ? results[slice.shard_idx]
+                                     : absl::MakeSpan(partial_result));
+        });
+  });
+  for (auto const& status : statuses) {
+    if (!status.ok()) {
+      ReleaseWorkspace(std::move(scratch));
+      return status;
+    }
+  }
+
+  // Add up the partial products of the shards split by columns. The sums wrap
+  // around mod 2^32, as the products do.
+  for (int64_t shard_idx = 0; shard_idx < num_shards; ++shard_idx) {
+    bool is_first = true;
+    for (int n = 0; n < numa_partitions_.size(); ++n) {
+      for (int i = 0; i < numa_partitions_[n].slices.size(); ++i) {
+        const std::vector<lwe::Integer>& partial_result =
+            partial_results[n][i];
+        if (numa_partitions_[n].slices[i].shard_idx != shard_idx ||
+            partial_result.empty()) {
+          continue;
+        }
+        absl::Span<lwe::Integer> result = results[shard_idx];
+        for (int64_t row = 0; row < params_.db_rows; ++row) {
+          result[row] =
+              is_first ? partial_result[row] : result[row] + partial_result[row];
+        }
+        is_first = false;
+      }
+    }
+  }
+  ReleaseWorkspace(std::move(scratch));
+  return absl::OkStatus();
+}
+
+absl::Status Database::InnerProductRangeInto(
+    const RawMatrix& matrix, absl::Span<const lwe::Integer> query,
+    int64_t block_begin, int64_t block_end,
+    absl::Span<lwe::Integer> result) const {
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+  int64_t row_begin = block_begin * num_values_per_block;
+  int64_t row_end = block_end * num_values_per_block;
+  std::unique_ptr<Workspace> workspace = AcquireWorkspace();
+  // The last block holds padding rows beyond `db_rows`, so the range ending
+  // with it goes through an aligned buffer.
+  bool is_padded = row_end > params_.db_rows;
+  absl::Span<lwe::Integer> range_result =
+      is_padded ? absl::MakeSpan(
+                      workspace->kernel.AlignedBuffer(row_end - row_begin),
+                      row_end - row_begin)
+                : result.subspan(row_begin, row_end - row_begin);
+  absl::Status status =
+      VisitPlainInteger(packed_value_bits_, [&](auto plain_integer) {
+        return internal::InnerProductRange<decltype(plain_integer)>(
+            matrix, query, block_begin, block_end, range_result,
+            &workspace->kernel, inner_product_config_);
+      });
+  if (status.ok() && is_padded) {
+    std::copy(range_result.begin(),
+              range_result.begin() + (params_.db_rows - row_begin),
+              result.begin() + row_begin);
+  }
+  ReleaseWorkspace(std::move(workspace));
+  return status;
+}
+
+absl::Status Database::SetInnerProductConfig(
+    const internal::InnerProductConfig& config) {
+  RLWE_RETURN_IF_ERROR(internal::ValidateInnerProductConfig(config));
+  inner_product_config_ = config;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::Duration> Database::TimeInnerProduct(
+    const RawMatrix& matrix, absl::Span<const lwe::Integer> query,
+    absl::Span<lwe::Integer> result) const {
+  int64_t num_blocks = matrix.NumBlocksPerColumn();
+  int64_t num_blocks_per_task = num_blocks;
+  if (thread_pool_ != nullptr) {
+    num_blocks_per_task = std::min(
+        num_blocks, kNumRowsPerTask / NumValuesPerBlock(packed_value_bits_));
+  }
+  absl::Duration fastest = absl::InfiniteDuration();
+  absl::Duration total = absl::ZeroDuration();
+  for (int run = 0; run < kAutotuneMinRuns || total < kAutotuneMinTime;
+       ++run) {
+    absl::Time start = absl::Now();
+    for (int64_t block_begin = 0; block_begin < num_blocks;
+         block_begin += num_blocks_per_task) {
+      RLWE_RETURN_IF_ERROR(InnerProductRangeInto(
+          matrix, query, block_begin,
+          std::min(block_begin + num_blocks_per_task, num_blocks), result));
+    }
+    absl::Duration elapsed = absl::Now() - start;
+    fastest = std::min(fastest, elapsed);
+    total += elapsed;
+  }
+  return fastest;
+}
+
+absl::StatusOr<internal::InnerProductConfig> Database::AutotuneInnerProduct(
+    absl::string_view cache_path) {
+  std::string key = AutotuneCacheKey(params_, packed_value_bits_);
+  if (!cache_path.empty()) {
+    for (auto const& line : ReadAutotuneCache(cache_path)) {
+      if (AutotuneCacheLineKey(line) == key) {
+        RLWE_ASSIGN_OR_RETURN(inner_product_config_,
+                              ParseAutotuneCacheLine(line));
+        return inner_product_config_;
+      }
+    }
+  }
+  if (data_matrices_.empty()) {
+    return inner_product_config_;
+  }
+
+  // Time the candidates on a prefix of the columns of the first shard, which
+  // has the rows of any shard.
+  const RawMatrix& data_matrix = data_matrices_[0];
+  int64_t num_cols = std::clamp<int64_t>(
+      kAutotuneMaxBytes /
+          std::max<int64_t>(1, data_matrix.ColumnStride() * sizeof(BlockType)),
+      1, data_matrix.size());
+  RawMatrix columns = RawMatrix::View(
+      /*owner=*/nullptr, const_cast<BlockType*>(data_matrix[0].data()),
+      num_cols, data_matrix.NumBlocksPerColumn(), data_matrix.ColumnStride());
+  std::vector<lwe::Integer> query(num_cols);
+  for (int64_t j = 0; j < num_cols; ++j) {
+    query[j] = static_cast<lwe::Integer>(j * 0x9E3779B9u + 1);
+  }
+  std::vector<lwe::Integer> result(params_.db_rows);
+
+  internal::InnerProductConfig fastest_config = inner_product_config_;
+  absl::Duration fastest = absl::InfiniteDuration();
+  for (auto const& candidate : InnerProductCandidates(packed_value_bits_)) {
+    inner_product_config_ = candidate;
+    absl::StatusOr<absl::Duration> elapsed =
+        TimeInnerProduct(columns, query, absl::MakeSpan(result));
+    if (!elapsed.ok()) {
+      inner_product_config_ = fastest_config;
+      return elapsed.status();
+    }
+    if (*elapsed < fastest) {
+      fastest = *elapsed;
+      fastest_config = candidate;
+    }
+  }
+  inner_product_config_ = fastest_config;
+  if (!cache_path.empty()) {
+    RLWE_RETURN_IF_ERROR(
+        WriteAutotuneCache(cache_path, key, inner_product_config_));
+  }
+  return inner_product_config_;
+}
+
+void Database::PlaceOnNumaNodes() {
+  int num_shards = data_matrices_.size();
+  if (params_.num_numa_nodes == 0 || num_shards == 0) {
+    return;
+  }
+  std::vector<NumaNode> host_nodes = NumaNodes();
+  int num_nodes = params_.num_numa_nodes < 0 ? host_nodes.size()
+                                             : params_.num_numa_nodes;
+  // Every node needs a worker of its own.
+  num_nodes = std::min(num_nodes, params_.num_threads);
+  if (num_nodes <= 1) {
+    return;
+  }
+
+  numa_partitions_.resize(num_nodes);
+  std::vector<std::vector<int>> cpus_per_node(num_nodes);
+  for (int n = 0; n < num_nodes; ++n) {
+    const NumaNode& host_node = host_nodes[n % host_nodes.size()];
+    numa_partitions_[n].node_id = host_node.id;
+    cpus_per_node[n] = host_node.cpus;
+  }
+  thread_pool_ = std::make_unique<ThreadPool>(params_.num_threads,
+                                              std::move(cpus_per_node));
+
+  // Every node holds whole shards if there are enough of them, and otherwise
+  // a range of the columns of every shard.
+  int64_t num_blocks = data_matrices_[0].NumBlocksPerColumn();
+  int64_t col_stride = data_matrices_[0].ColumnStride();
+  for (int shard_idx = 0; shard_idx < num_shards; ++shard_idx) {
+    int num_slices = num_shards >= num_nodes ? 1 : num_nodes;
+    for (int i = 0; i < num_slices; ++i) {
+      int64_t col_begin = params_.db_cols * i / num_slices;
+      int64_t col_end = params_.db_cols * (i + 1) / num_slices;
+      if (col_begin == col_end) {
+        continue;
+      }
+      NumaPartition& partition =
+          numa_partitions_[num_slices == 1 ? shard_idx % num_nodes : i];
+      BlockType* data = data_matrices_[shard_idx][col_begin].data();
+      // Binding is only an optimization, so the pages stay where they are if
+      // it fails, e.g. when not permitted in a container.
+      BindToNumaNode(data,
+                     (col_end - col_begin) * col_stride * sizeof(BlockType),
+                     partition.node_id)
+          .IgnoreError();
+      partition.slices.push_back(NumaSlice{
+          .shard_idx = shard_idx,
+          .col_begin = col_begin,
+          .col_end = col_end,
+          .columns = RawMatrix::View(/*owner=*/nullptr, data,
+                                     col_end - col_begin, num_blocks)});
+    }
+  }
+}
+
+absl::StatusOr<std::vector<std::vector<Database::LweVector>>>
+Database::InnerProductWithBatch(absl::Span<const LweVector> queries) const {
+  int64_t num_queries = queries.size();
+  int64_t num_shards = data_matrices_.size();
+  if (num_queries == 0 || num_shards == 0) {
+    return std::vector<std::vector<LweVector>>(num_queries);
+  }
+  int64_t num_blocks = data_matrices_[0].NumBlocksPerColumn();
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
+
+  if (const DatabaseAccelerator* accelerator = ActiveAccelerator();
+      accelerator != nullptr &&
+      std::all_of(queries.begin(), queries.end(), [&](const LweVector& query) {
+        return query.size() == params_.db_cols;
+      })) {
+    std::vector<std::vector<LweVector>> results(
+        num_queries,
+        std::vector<LweVector>(num_shards, LweVector(params_.db_rows)));
+    std::vector<absl::Span<const lwe::Integer>> query_spans;
+    std::vector<absl::Span<lwe::Integer>> result_spans;
+    for (int64_t q = 0; q < num_queries; ++q) {
+      query_spans.push_back(queries[q]);
+      for (auto& result : results[q]) {
+        result_spans.push_back(absl::MakeSpan(result));
+      }
+    }
+    if (accelerator->InnerProductBatch(query_spans, result_spans).ok()) {
+      return results;
+    }
+  }
+
+  // A task holds the accumulators for all queries, so scale down the number of
+  // blocks per task to keep them in cache.
+  int64_t num_blocks_per_task = num_blocks;
+  if (thread_pool_ != nullptr || num_queries > 1) {
+    num_blocks_per_task = std::min(
+        num_blocks,
+        std::max<int64_t>(
+            kNumRowsPerTask / num_values_per_block / num_queries, 1));
+  }
+  int64_t num_tasks_per_shard =
+      num_blocks_per_task == 0
+          ? 1
+          : DivAndRoundUp(num_blocks, num_blocks_per_task);
+
+  std::vector<std::vector<LweVector>> results(
+      num_queries,
+      std::vector<LweVector>(num_shards,
+                             LweVector(num_blocks * num_values_per_block)));
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_shards * num_tasks_per_shard, thread_pool_.get(),
+      [&](int64_t task_idx) -> absl::Status {
+        int64_t shard_idx = task_idx / num_tasks_per_shard;
+        int64_t block_begin =
+            (task_idx % num_tasks_per_shard) * num_blocks_per_task;
+        int64_t block_end =
+            std::min(block_begin + num_blocks_per_task, num_blocks);
+        int64_t num_rows = (block_end - block_begin) * num_values_per_block;
+        std::unique_ptr<Workspace> workspace = AcquireWorkspace();
+        std::vector<lwe::Integer>& tile = workspace->tile;
+        if (tile.size() < num_rows * num_queries) {
+          tile.resize(num_rows * num_queries);
+        }
+        absl::Status status =
+            VisitPlainInteger(packed_value_bits_, [&](auto plain_integer) {
+              return internal::InnerProductBatchRange<decltype(plain_integer)>(
+                  data_matrices_[shard_idx], queries, block_begin, block_end,
+                  absl::MakeSpan(tile), &workspace->kernel);
+            });
+        if (status.ok()) {
+          int64_t row_begin = block_begin * num_values_per_block;
+          for (int64_t q = 0; q < num_queries; ++q) {
+            std::copy_n(tile.begin() + q * num_rows, num_rows,
+                        results[q][shard_idx].begin() + row_begin);
+          }
+        }
+        ReleaseWorkspace(std::move(workspace));
+        return status;
+      }));
+  for (auto& results_per_query : results) {
+    for (auto& result : results_per_query) {
+      result.resize(params_.db_rows);
+    }
   }
   return results;
 }
 
+std::unique_ptr<Database::Workspace> Database::AcquireWorkspace() const {
+  absl::MutexLock lock(&workspace_mutex_);
+  if (workspaces_.empty()) {
+    return std::make_unique<Workspace>();
+  }
+  std::unique_ptr<Workspace> workspace = std::move(workspaces_.back());
+  workspaces_.pop_back();
+  return workspace;
+}
+
+void Database::ReleaseWorkspace(std::unique_ptr<Workspace> workspace) const {
+  absl::MutexLock lock(&workspace_mutex_);
+  workspaces_.push_back(std::move(workspace));
+}
+
 absl::StatusOr<std::string> Database::Record(int64_t index) const {
   if (index < 0 || index >= num_records_) {
     return absl::InvalidArgumentError("`index` is out of range.");
   }
   int64_t row_idx, col_idx;
   std::tie(row_idx, col_idx) = MatrixCoordinate(index);
-  int64_t num_values_per_block = sizeof(BlockType) / sizeof(lwe::PlainInteger);
+  int64_t num_values_per_block = NumValuesPerBlock(packed_value_bits_);
   int64_t block_idx = row_idx / num_values_per_block;
   int64_t block_pos = row_idx % num_values_per_block;
-  int64_t base_bits = block_pos * 8 * sizeof(lwe::PlainInteger);
+  int64_t base_bits = internal::PackedValueShift(packed_value_bits_, block_pos);
 
   BlockType mask = (BlockType{1} << params_.lwe_plaintext_bit_size) - 1;
   std::vector<lwe::Integer> values;
@@ -269,15 +1577,15 @@ lwe::Matrix ExportRawMatrix(const Database::RawMatrix& matrix, size_t num_rows,
                             size_t num_bits_per_value) {
   // Assume `matrix` organized by columns.
   int64_t num_cols = matrix.size();
-  int64_t num_values_per_block =
-      Database::kBlockBits / sizeof(lwe::PlainInteger);
+  int value_bits = Database::PackedValueBits(num_bits_per_value);
+  int64_t num_values_per_block = NumValuesPerBlock(value_bits);
   lwe::Integer mask = (lwe::Integer{1} << num_bits_per_value) - 1;
   lwe::Matrix results = lwe::Matrix::Zero(num_rows, num_cols);
   for (int64_t col_idx = 0; col_idx < num_cols; ++col_idx) {
     for (int64_t row_idx = 0; row_idx < num_rows; ++row_idx) {
       int64_t block_idx = row_idx / num_values_per_block;
       int64_t block_pos = row_idx % num_values_per_block;
-      int64_t base_bits = block_pos * 8 * sizeof(lwe::PlainInteger);
+      int64_t base_bits = internal::PackedValueShift(value_bits, block_pos);
       auto raw =
           static_cast<lwe::Integer>(matrix[col_idx][block_idx] >> base_bits);
       results(row_idx, col_idx) = raw & mask;
@@ -22,13 +22,19 @@
 #include <utility>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "hintless_simplepir/accelerator.h"
+#include "hintless_simplepir/block_matrix.h"
 #include "hintless_simplepir/inner_product_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "lwe/types.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
@@ -40,17 +46,52 @@ class Database {
   using LweVector = std::vector<lwe::Integer>;
   using LweMatrix = std::vector<LweVector>;
   using RawVector = internal::BlockVector;
-  using RawMatrix = std::vector<RawVector>;
+  using RawMatrix = internal::BlockMatrix;
 
   static constexpr size_t kBlockBits = sizeof(BlockType);
 
+  // Returns the number of bits of the slot storing every plaintext value of
+  // `plaintext_bit_size` bits in the data matrices. Plaintexts of up to 4 bits
+  // are packed two per byte, which halves the memory traffic of the online
+  // products, and larger ones take one or two bytes.
+  static int PackedValueBits(int plaintext_bit_size);
+
+  // The memory held by a database, in bytes.
+  struct MemoryBreakdown {
+    // The data matrices, including the padding of their columns. For a
+    // database opened by `OpenMapped`, these are pages of the mapped file.
+    int64_t data_bytes = 0;
+    // The hint matrices.
+    int64_t hint_bytes = 0;
+
+    int64_t TotalBytes() const { return data_bytes + hint_bytes; }
+  };
+
   // Returns an empty database supporting the given parameters.
   static absl::StatusOr<std::unique_ptr<Database>> Create(
       const Parameters& parameters);
 
-  // Returns a database with random records for the given parameters.
+  // Returns a database with random records for the given parameters. The
+  // records are expanded from `seed` by a counter-based PRNG, in parallel on
+  // the workers of the database, and do not depend on the number of workers
+  // or on the layout of the data matrices.
   static absl::StatusOr<std::unique_ptr<Database>> CreateRandom(
-      const Parameters& parameters);
+      const Parameters& parameters, uint64_t seed = 0);
+
+  // Returns a database stored in the file at `path` by `WriteToFile`. The data
+  // matrices are memory-mapped instead of read, so opening is fast, and
+  // processes opening the same file share its pages in the page cache. The
+  // mapping is private: later changes to the database are not written back.
+  // Returns an error if the file was written for different parameters.
+  static absl::StatusOr<std::unique_ptr<Database>> OpenMapped(
+      const Parameters& parameters, absl::string_view path);
+
+  // Writes the database to the file at `path` in the layout read by
+  // `OpenMapped`. It includes the data and the hint matrices, along with the
+  // PRNG seed the LWE query pad was expanded from, which must be given if the
+  // hints are to be reused.
+  absl::Status WriteToFile(absl::string_view path,
+                           absl::string_view prng_seed_lwe_query_pad) const;
 
   // Sets the LWE "A" matrix used by the SimplePIR protocol.
   absl::Status UpdateLweQueryPad(const lwe::Matrix* lwe_query_pad);
@@ -58,15 +99,127 @@ class Database {
   // Appends a record at the current end of the database.
   absl::Status Append(absl::string_view record);
 
+  // Appends the records in `records`, which holds consecutive records of
+  // `ceil(db_record_bit_size / 8)` bytes each, at the current end of the
+  // database. The records are split with one load per plaintext value, and
+  // every task writes whole blocks down a range of columns, so this is much
+  // faster than calling `Append` per record. If the hints are up to date, the
+  // records are appended one at a time to keep them up to date.
+  absl::Status AppendBatch(absl::string_view records);
+
+  // Replaces all records of the database by `records`, which holds
+  // `db_rows * db_cols` records given column by column, i.e. the record at row
+  // i and column j is the (j * db_rows + i)'th one. This matches the layout of
+  // the data matrices, so both the records and the matrices are read and
+  // written sequentially. The hints must then be updated by `UpdateHints`.
+  absl::Status LoadColumns(absl::string_view records);
+
+  // Replaces the record at `index`, which must have been appended.
+  // If the hints are up to date, i.e. computed by `UpdateHints` or given to
+  // `SetHints` since the LWE query pad was set, then `Append` and `Update`
+  // also add the change of the record times the LWE query pad to the affected
+  // hint rows, so that the hints stay up to date without calling
+  // `UpdateHints`. The cost is proportional to the number of changed records.
+  absl::Status Update(int64_t index, absl::string_view record);
+
+  // Replaces the records at `indices` by `records`. Either all records are
+  // replaced, or an error is returned and the database is unchanged.
+  absl::Status Update(absl::Span<const int64_t> indices,
+                      absl::Span<const std::string> records);
+
   // Updates the hint matrices. This must be called before the database is
   // ready for accepting client queries, or after a new LWE query pad is set.
   absl::Status UpdateHints();
-  absl::Status UpdateHintsFake();
+
+  // Replaces the hint matrices by `ComputeHintsFake(seed)`.
+  absl::Status UpdateHintsFake(uint64_t seed = 0);
+
+  // Returns the hint matrices for `lwe_query_pad`, i.e. the products between
+  // the data matrices and the pad, without changing the hints or the LWE query
+  // pad of the database. This only reads the data matrices, so it may run
+  // while the database handles queries.
+  absl::StatusOr<std::vector<LweMatrix>> ComputeHints(
+      const lwe::Matrix& lwe_query_pad) const;
+
+  // Returns random matrices of the dimensions of the hint matrices, expanded
+  // from `seed` as the records of `CreateRandom`.
+  std::vector<LweMatrix> ComputeHintsFake(uint64_t seed = 0) const;
+
+  // Replaces the hint matrices by `hints`, e.g. hints computed earlier for the
+  // same records and LWE query pad. Returns an error if `hints` has incorrect
+  // dimensions.
+  absl::Status SetHints(std::vector<LweMatrix> hints);
+
+  // Releases the hint matrices and forgets the LWE query pad, e.g. once the
+  // server holds the hints encoded in its LinPir databases. Records can still
+  // be appended and updated, without updating any hints, and `WriteToFile`
+  // fails until hints are given again by `SetHints` or `UpdateHints`.
+  void ReleaseHints();
 
   // Returns the products between the data matrices and the query vector, one
-  // per shard.
+  // per shard. When `params.num_threads` > 1, the rows of all shards are split
+  // into block ranges that are computed concurrently. When the data matrices
+  // are spread over NUMA nodes, every node computes the products with its part
+  // on its own workers, and the partial products of shards split by columns
+  // are added up. With `params.interleave_shards`, every task computes the
+  // rows of consecutive shards in one pass over their columns.
   absl::StatusOr<std::vector<LweVector>> InnerProductWith(
-      const LweVector& query) const;
+      absl::Span<const lwe::Integer> query) const;
+
+  // Same as `InnerProductWith`, but writes the product with every shard into
+  // `results`, which must hold one span of `params.db_rows` values per shard,
+  // e.g. the buffers of the response messages, so nothing is allocated for
+  // the results. Scratch buffers are reused across calls, and the kernels
+  // write directly into the spans that are suitably aligned.
+  absl::Status InnerProductWithInto(
+      absl::Span<const lwe::Integer> query,
+      absl::Span<const absl::Span<lwe::Integer>> results) const;
+
+  // Returns the products between the data matrices and each of the query
+  // vectors, indexed by query first and shard second. The database is read
+  // once for the whole batch, so this is faster than calling
+  // `InnerProductWith` for every query.
+  absl::StatusOr<std::vector<std::vector<LweVector>>> InnerProductWithBatch(
+      absl::Span<const LweVector> queries) const;
+
+  // Micro-benchmarks the configurations of the online products on this CPU
+  // and the data matrices of this database, i.e. the highway and the portable
+  // kernels with several unroll factors and tile sizes, and uses the fastest
+  // one for the later products. If `cache_path` is not empty, the file at
+  // `cache_path` is looked up first, and the result is added to it, keyed by
+  // the highway target of the CPU and the shape of the database, so hosts
+  // sharing the file only tune once per kind of CPU. Must not be called
+  // concurrently with the products.
+  absl::StatusOr<internal::InnerProductConfig> AutotuneInnerProduct(
+      absl::string_view cache_path = "");
+
+  // Uses `config` for the later online products. Must not be called
+  // concurrently with them.
+  absl::Status SetInnerProductConfig(
+      const internal::InnerProductConfig& config);
+
+  const internal::InnerProductConfig& GetInnerProductConfig() const {
+    return inner_product_config_;
+  }
+
+  // Offloads the online products and the computation of the hints to
+  // `accelerator`, after copying the data matrices to it, or computes them on
+  // the CPU again if `accelerator` is null. The CPU kernels remain the
+  // fallback for every product the accelerator fails. `Update` copies the
+  // changed columns to the accelerator, while other changes of the records,
+  // e.g. `Append`, leave it out of sync until `SyncAccelerator` is called, and
+  // the products run on the CPU meanwhile. Returns an error, and keeps
+  // computing on the CPU, if the data matrices cannot be copied. Must not be
+  // called concurrently with the products.
+  absl::Status SetAccelerator(std::unique_ptr<DatabaseAccelerator> accelerator);
+
+  // Copies the data matrices to the accelerator again. Must not be called
+  // concurrently with the products.
+  absl::Status SyncAccelerator();
+
+  // Whether the products are offloaded to an accelerator holding the current
+  // data matrices.
+  bool AcceleratorIsInSync() const { return ActiveAccelerator() != nullptr; }
 
   // Accessors.
   absl::StatusOr<std::string> Record(int64_t index) const;
@@ -74,27 +227,147 @@ class Database {
   absl::Span<const RawMatrix> Data() const { return data_matrices_; }
   absl::Span<const LweMatrix> Hints() const { return hint_matrices_; }
 
+  // The PRNG seed of the LWE query pad stored with the database, or an empty
+  // string if the database was not opened from a file.
+  const std::string& PrngSeedLweQueryPad() const {
+    return prng_seed_lwe_query_pad_;
+  }
+
+  // Returns the memory held by the data and the hint matrices.
+  MemoryBreakdown MemoryUsage() const;
+
   size_t NumShards() const { return data_matrices_.size(); }
   size_t NumRecords() const { return num_records_; }
+  bool HintsAreUpToDate() const { return hints_are_up_to_date_; }
+
+  // The workers of this database, which may also be shared with other
+  // computations of the server; null if running on a single thread.
+  ThreadPool* GetThreadPool() const { return thread_pool_.get(); }
+
+  // Returns the row and the column indices of the given database index to store
+  // a record in the data matrices.
+  std::pair<int64_t, int64_t> MatrixCoordinate(int64_t index) const {
+    int64_t row_idx = index / params_.db_cols;
+    int64_t col_idx = index % params_.db_cols;
+    return std::make_pair(row_idx, col_idx);
+  }
 
  private:
   explicit Database(Parameters params, const lwe::Matrix* lwe_query_pad,
                     int64_t num_records, std::vector<RawMatrix> data_matrices,
-                    std::vector<LweMatrix> hint_matrices)
+                    std::vector<LweMatrix> hint_matrices,
+                    RawMatrix interleaved_data = RawMatrix())
       : params_(std::move(params)),
         lwe_query_pad_(lwe_query_pad),
         num_records_(num_records),
+        interleaved_data_(std::move(interleaved_data)),
         data_matrices_(std::move(data_matrices)),
-        hint_matrices_(std::move(hint_matrices)) {}
+        hint_matrices_(std::move(hint_matrices)),
+        packed_value_bits_(PackedValueBits(params_.lwe_plaintext_bit_size)) {
+    PlaceOnNumaNodes();
+    if (thread_pool_ == nullptr && params_.num_threads > 1) {
+      thread_pool_ = std::make_unique<ThreadPool>(params_.num_threads);
+    }
+  }
 
-  // Returns the row and the column indices of the given database index to store
-  // a record in the data matrices.
-  std::pair<int64_t, int64_t> MatrixCoordinate(int64_t index) const {
-    int64_t row_idx = index / params_.db_cols;
-    int64_t col_idx = index % params_.db_cols;
-    return std::make_pair(row_idx, col_idx);
+  // The columns [col_begin, col_end) of the `shard_idx`'th data matrix, placed
+  // on a NUMA node. `columns` views them within the data matrix.
+  struct NumaSlice {
+    int64_t shard_idx;
+    int64_t col_begin;
+    int64_t col_end;
+    RawMatrix columns;
+  };
+
+  // A NUMA node holding slices of the data matrices. The n'th partition runs
+  // on the workers of group n of `thread_pool_`, which are pinned to the node.
+  struct NumaPartition {
+    int node_id;
+    std::vector<NumaSlice> slices;
+  };
+
+  // Splits the data matrices over `params_.num_numa_nodes` nodes, binds the
+  // pages of every slice to its node, and creates `thread_pool_` with its
+  // workers split into one group per node. Binding is best effort. Does
+  // nothing with a single node, or a single thread.
+  void PlaceOnNumaNodes();
+
+  // Same as `InnerProductWithInto`, with every NUMA node computing the
+  // products with its slices.
+  absl::Status InnerProductWithIntoOnNumaNodes(
+      absl::Span<const lwe::Integer> query,
+      absl::Span<const absl::Span<lwe::Integer>> results) const;
+
+  // Same as `InnerProductWithInto`, for data matrices viewing
+  // `interleaved_data_`.
+  absl::Status InnerProductWithIntoInterleaved(
+      absl::Span<const lwe::Integer> query,
+      absl::Span<const absl::Span<lwe::Integer>> results) const;
+
+  // Writes the rows in the blocks [block_begin, block_end) of `matrix` *
+  // `query` to `result`, which holds `params_.db_rows` values.
+  absl::Status InnerProductRangeInto(const RawMatrix& matrix,
+                                     absl::Span<const lwe::Integer> query,
+                                     int64_t block_begin, int64_t block_end,
+                                     absl::Span<lwe::Integer> result) const;
+
+  // Returns the fastest of several runs of the product between `matrix` and
+  // `query` on the calling thread, split into the block ranges of the tasks of
+  // `InnerProductWithInto`. `result` holds `params_.db_rows` values.
+  absl::StatusOr<absl::Duration> TimeInnerProduct(
+      const RawMatrix& matrix, absl::Span<const lwe::Integer> query,
+      absl::Span<lwe::Integer> result) const;
+
+  // The scratch buffers of one task computing the online products.
+  struct Workspace {
+    internal::InnerProductWorkspace kernel;
+    std::vector<lwe::Integer> tile;
+    // The products of the slices of every NUMA node, for the slices that do
+    // not hold all columns of their shard.
+    std::vector<std::vector<std::vector<lwe::Integer>>> partial_results;
+  };
+
+  // Returns the accelerator if it holds the current data matrices, or null.
+  const DatabaseAccelerator* ActiveAccelerator() const {
+    return accelerator_in_sync_ ? accelerator_.get() : nullptr;
   }
 
+  // Copies the columns of the records at `indices` to the accelerator if it
+  // was in sync before they were written, and marks it out of sync otherwise
+  // or if the copy fails.
+  void SyncAcceleratorRecords(absl::Span<const int64_t> indices,
+                              bool was_in_sync);
+
+  // Returns a workspace from the pool, or a new one if all of them are in use.
+  std::unique_ptr<Workspace> AcquireWorkspace() const;
+
+  // Returns `workspace` to the pool, to be reused by later tasks.
+  void ReleaseWorkspace(std::unique_ptr<Workspace> workspace) const;
+
+  // Writes the hint matrices for `lwe_query_pad` to `hints`, reusing its
+  // storage.
+  absl::Status ComputeHintsInto(const lwe::Matrix& lwe_query_pad,
+                                std::vector<LweMatrix>& hints) const;
+
+  // Fills all slots of the data matrices with random plaintexts expanded from
+  // `seed`.
+  void FillRandom(uint64_t seed);
+
+  // Returns an error if `record` does not have the size of a record.
+  absl::Status CheckRecordSize(absl::string_view record) const;
+
+  // Writes `record` to the slot at `index`, and updates the hint rows if they
+  // are up to date. The arguments must have been validated.
+  void WriteRecord(int64_t index, absl::string_view record);
+
+  // Writes the records at the indices [index_begin, index_end) without
+  // updating the hint rows. The record at row i and column j is read at
+  // `records` + i * `row_stride` + j * `col_stride` bytes, relative to the
+  // record at `index_begin`. The arguments must have been validated.
+  void WriteRecordColumns(const char* records, int64_t index_begin,
+                          int64_t index_end, int64_t row_stride,
+                          int64_t col_stride);
+
   // The parameters of the SimplePIR protocol.
   const Parameters params_;
 
@@ -105,11 +378,46 @@ class Database {
   // The number of records currently in the database.
   int64_t num_records_;
 
+  // With `params_.interleave_shards`, the storage of the data matrices, holding
+  // column j of shard i at column j * num_shards + i; empty otherwise.
+  RawMatrix interleaved_data_;
+
   // The database matrices, one per shard of the database. Stored by columns.
   std::vector<RawMatrix> data_matrices_;
 
   // The hint matrices, one per shard of the database. Stored by rows.
   std::vector<LweMatrix> hint_matrices_;
+
+  // The number of bits of the slot storing every plaintext value in the data
+  // matrices: 4, 8 or 16.
+  const int packed_value_bits_;
+
+  // The configuration of the kernels computing the online products.
+  internal::InnerProductConfig inner_product_config_;
+
+  // Whether `hint_matrices_` are the products of the data matrices and the
+  // current LWE query pad.
+  bool hints_are_up_to_date_ = false;
+
+  // The PRNG seed of the LWE query pad, if read from a file.
+  std::string prng_seed_lwe_query_pad_;
+
+  // Workers for the online products; null if running on a single thread.
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  // The device the products are offloaded to, if any, and whether it holds the
+  // current data matrices.
+  std::unique_ptr<DatabaseAccelerator> accelerator_;
+  bool accelerator_in_sync_ = false;
+
+  // The placement of the data matrices on NUMA nodes; empty if not placed.
+  std::vector<NumaPartition> numa_partitions_;
+
+  // Workspaces released by finished tasks. In steady state there is one per
+  // concurrent task, so the online products do not allocate scratch memory.
+  mutable absl::Mutex workspace_mutex_;
+  mutable std::vector<std::unique_ptr<Workspace>> workspaces_
+      ABSL_GUARDED_BY(workspace_mutex_);
 };
 
 // Returns a column-major matrix from an eigen3 matrix.
@@ -19,12 +19,14 @@
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "absl/strings/string_view.h"
 #include "benchmark/benchmark.h"
 #include "gtest/gtest.h"
 #include "hintless_simplepir/database_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/testing.h"
 #include "lwe/types.h"
+#include "shell_encryption/testing/status_testing.h"
 
 ABSL_FLAG(int, num_rows, 1024, "Number of rows");
 ABSL_FLAG(int, num_cols, 1024, "Number of cols");
@@ -66,6 +68,39 @@ void BM_InnerProductWith(benchmark::State& state) {
 }
 BENCHMARK(BM_InnerProductWith);
 
+// Appends all records one at a time (arg 0) or in a single batch (arg 1).
+void BM_AppendRecords(benchmark::State& state) {
+  Parameters params = kParameters;
+  params.db_rows = absl::GetFlag(FLAGS_num_rows);
+  params.db_cols = absl::GetFlag(FLAGS_num_cols);
+  params.db_record_bit_size = 256;
+  bool batched = state.range(0);
+
+  int64_t num_records = params.db_rows * params.db_cols;
+  std::string records;
+  for (int64_t i = 0; i < num_records; ++i) {
+    records += testing::GenerateRandomRecord(params);
+  }
+  int64_t record_size = records.size() / num_records;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto database = Database::Create(params).value();
+    state.ResumeTiming();
+    if (batched) {
+      ASSERT_OK(database->AppendBatch(records));
+    } else {
+      for (int64_t i = 0; i < num_records; ++i) {
+        ASSERT_OK(database->Append(
+            absl::string_view(records).substr(i * record_size, record_size)));
+      }
+    }
+    benchmark::DoNotOptimize(database);
+  }
+  state.SetBytesProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_AppendRecords)->ArgName("batched")->Arg(0)->Arg(1);
+
 }  // namespace
 }  // namespace hintless_simplepir
 }  // namespace hintless_pir
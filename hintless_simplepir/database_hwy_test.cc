@@ -14,7 +14,10 @@
 
 #include "hintless_simplepir/database_hwy.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <utility>
@@ -22,9 +25,12 @@
 
 #include "Eigen/Core"
 #include "absl/status/status.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/types/span.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "hintless_simplepir/accelerator.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/testing.h"
 #include "hintless_simplepir/utils.h"
@@ -152,6 +158,159 @@ TEST_F(DatabaseTest, AppendRecords) {
   ASSERT_EQ(database->Data().size(), num_shards);
 }
 
+TEST_F(DatabaseTest, AppendBatchFailsWithInvalidArguments) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  int record_size = DivAndRoundUp(kParameters.db_record_bit_size, 8);
+  EXPECT_THAT(database->AppendBatch(std::string(3 * record_size - 1, 0)),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("whole number of records")));
+  int64_t num_records = kParameters.db_rows * kParameters.db_cols;
+  EXPECT_THAT(
+      database->AppendBatch(std::string((num_records + 1) * record_size, 0)),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               HasSubstr("Database is full")));
+  EXPECT_THAT(database->LoadColumns(std::string(record_size, 0)),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`db_rows * db_cols` records")));
+  EXPECT_EQ(database->NumRecords(), 0);
+}
+
+TEST_F(DatabaseTest, AppendBatchAndLoadColumnsMatchAppend) {
+  // Records split across bytes, plaintexts packed as nibbles, bytes and 16-bit
+  // values, and batches starting and ending in the middle of rows and blocks.
+  for (int plaintext_bits : {3, 8, 12}) {
+    for (int num_threads : {1, 3}) {
+      for (bool interleave_shards : {false, true}) {
+        Parameters params = kParameters;
+        params.db_rows = 300;
+        params.db_cols = 70;
+        params.db_record_bit_size = 21;
+        params.lwe_plaintext_bit_size = plaintext_bits;
+        params.num_threads = num_threads;
+        params.interleave_shards = interleave_shards;
+        int64_t num_records = params.db_rows * params.db_cols;
+        std::vector<std::string> records(num_records);
+        ASSERT_OK_AND_ASSIGN(auto expected, Database::Create(params));
+        for (auto& record : records) {
+          record = testing::GenerateRandomRecord(params);
+          ASSERT_OK(expected->Append(record));
+        }
+
+        ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+        for (int64_t begin = 0, batch_size = 1; begin < num_records;
+             begin += batch_size, batch_size = batch_size * 3 + 1) {
+          int64_t end = std::min(begin + batch_size, num_records);
+          std::string batch;
+          for (int64_t i = begin; i < end; ++i) {
+            batch += records[i];
+          }
+          ASSERT_OK(database->AppendBatch(batch));
+          ASSERT_EQ(database->NumRecords(), end);
+        }
+
+        std::string columns;
+        for (int64_t j = 0; j < params.db_cols; ++j) {
+          for (int64_t i = 0; i < params.db_rows; ++i) {
+            columns += records[i * params.db_cols + j];
+          }
+        }
+        ASSERT_OK_AND_ASSIGN(auto loaded, Database::Create(params));
+        ASSERT_OK(loaded->LoadColumns(columns));
+        ASSERT_EQ(loaded->NumRecords(), num_records);
+
+        for (int i = 0; i < expected->NumShards(); ++i) {
+          lwe::Matrix expected_data = ExportRawMatrix(
+              expected->Data()[i], params.db_rows, plaintext_bits);
+          EXPECT_EQ(ExportRawMatrix(database->Data()[i], params.db_rows,
+                                    plaintext_bits),
+                    expected_data);
+          EXPECT_EQ(ExportRawMatrix(loaded->Data()[i], params.db_rows,
+                                    plaintext_bits),
+                    expected_data);
+        }
+        for (int64_t i = 0; i < num_records; i += 97) {
+          ASSERT_OK_AND_ASSIGN(std::string retrieved, database->Record(i));
+          EXPECT_EQ(retrieved, records[i]);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(DatabaseTest, AppendBatchKeepsHintsUpToDate) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  ASSERT_OK(database->UpdateHints());
+  std::string batch;
+  for (int i = 0; i < 3 * kParameters.db_cols / 2; ++i) {
+    batch += testing::GenerateRandomRecord(kParameters);
+  }
+  ASSERT_OK(database->AppendBatch(batch));
+  ASSERT_TRUE(database->HintsAreUpToDate());
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweMatrix> expected,
+                       database->ComputeHints(*this->lwe_query_pad_));
+  for (int i = 0; i < database->NumShards(); ++i) {
+    EXPECT_EQ(database->Hints()[i], expected[i]);
+  }
+}
+
+TEST(Database, CreateRandomIsReproducible) {
+  // The records only depend on the seed, not on the workers or the layout.
+  for (int plaintext_bits : {3, 7, 12}) {
+    Parameters params = kParameters;
+    params.db_rows = 300;
+    params.db_cols = 70;
+    params.lwe_plaintext_bit_size = plaintext_bits;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params, 7));
+    EXPECT_EQ(database->NumRecords(), params.db_rows * params.db_cols);
+    Parameters other_params = params;
+    other_params.num_threads = 3;
+    other_params.interleave_shards = true;
+    ASSERT_OK_AND_ASSIGN(auto same, Database::CreateRandom(other_params, 7));
+    ASSERT_OK_AND_ASSIGN(auto other, Database::CreateRandom(params, 8));
+    for (int i = 0; i < database->NumShards(); ++i) {
+      lwe::Matrix data = ExportRawMatrix(database->Data()[i], params.db_rows,
+                                         plaintext_bits);
+      EXPECT_EQ(ExportRawMatrix(same->Data()[i], params.db_rows,
+                                plaintext_bits),
+                data);
+      EXPECT_NE(ExportRawMatrix(other->Data()[i], params.db_rows,
+                                plaintext_bits),
+                data);
+      // All slots hold values of `plaintext_bits` bits.
+      int value_bits = Database::PackedValueBits(plaintext_bits);
+      EXPECT_EQ(ExportRawMatrix(database->Data()[i], params.db_rows,
+                                value_bits),
+                data);
+    }
+
+    EXPECT_EQ(database->ComputeHintsFake(3), same->ComputeHintsFake(3));
+    EXPECT_NE(database->ComputeHintsFake(3), database->ComputeHintsFake(4));
+  }
+}
+
+TEST(Database, CreateRandomLeavesPaddingZero) {
+  // The slots of the rows past `db_rows` are padding, which the other write
+  // paths leave zero.
+  for (int plaintext_bits : {3, 7, 12}) {
+    Parameters params = kParameters;
+    params.db_rows = 300;
+    params.db_cols = 70;
+    params.lwe_plaintext_bit_size = plaintext_bits;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params, 7));
+    int value_bits = Database::PackedValueBits(plaintext_bits);
+    int64_t num_values_per_block =
+        8 * sizeof(Database::BlockType) / value_bits;
+    for (auto const& matrix : database->Data()) {
+      int64_t num_rows = matrix.NumBlocksPerColumn() * num_values_per_block;
+      ASSERT_GT(num_rows, params.db_rows);
+      lwe::Matrix data = ExportRawMatrix(matrix, num_rows, value_bits);
+      EXPECT_TRUE(data.bottomRows(num_rows - params.db_rows).isZero())
+          << "plaintext_bits = " << plaintext_bits;
+    }
+  }
+}
+
 TEST_F(DatabaseTest, UpdateHintsFailsIfLweQueryPadIsNotSet) {
   ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
   EXPECT_THAT(database->UpdateHints(),
@@ -179,6 +338,177 @@ TEST_F(DatabaseTest, UpdateHints) {
   }
 }
 
+TEST_F(DatabaseTest, ComputeHintsLeavesDatabaseUnchanged) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  ASSERT_OK(database->UpdateHints());
+  std::vector<Database::LweMatrix> hints(database->Hints().begin(),
+                                         database->Hints().end());
+
+  // Compute the hints for another pad.
+  Prng prng(2);
+  ASSERT_OK_AND_ASSIGN(
+      lwe::Matrix other_pad,
+      lwe::ExpandPad(kParameters.db_cols, kParameters.lwe_secret_dim, &prng));
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweMatrix> other_hints,
+                       database->ComputeHints(other_pad));
+  ASSERT_EQ(other_hints.size(), database->Data().size());
+  for (int i = 0; i < other_hints.size(); ++i) {
+    lwe::Matrix data_matrix =
+        ExportRawMatrix(database->Data()[i], kParameters.db_rows,
+                        kParameters.lwe_plaintext_bit_size);
+    EXPECT_EQ(ExportLweMatrix(other_hints[i]).transpose(),
+              data_matrix * other_pad);
+  }
+  EXPECT_TRUE(database->HintsAreUpToDate());
+  EXPECT_EQ(std::vector<Database::LweMatrix>(database->Hints().begin(),
+                                             database->Hints().end()),
+            hints);
+}
+
+TEST(Database, MultiThreadedUpdateHints) {
+  // Use dimensions that are not multiples of the tiles of the hint kernel.
+  Parameters params = kParameters;
+  params.db_rows = 1000;
+  params.db_cols = 300;
+  params.lwe_secret_dim = 38;
+  params.num_threads = 4;
+  Prng prng(1);
+  ASSERT_OK_AND_ASSIGN(
+      lwe::Matrix lwe_query_pad,
+      lwe::ExpandPad(params.db_cols, params.lwe_secret_dim, &prng));
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+  for (int64_t i = 0; i < params.db_rows * params.db_cols; ++i) {
+    ASSERT_OK(database->Append(testing::GenerateRandomRecord(params)));
+  }
+  ASSERT_OK(database->UpdateLweQueryPad(&lwe_query_pad));
+  ASSERT_OK(database->UpdateHints());
+
+  absl::Span<const Database::RawMatrix> data_matrices = database->Data();
+  absl::Span<const Database::LweMatrix> hint_matrices = database->Hints();
+  ASSERT_EQ(data_matrices.size(), hint_matrices.size());
+  for (int i = 0; i < data_matrices.size(); ++i) {
+    lwe::Matrix data_matrix = ExportRawMatrix(
+        data_matrices[i], params.db_rows, params.lwe_plaintext_bit_size);
+    lwe::Matrix hint_matrix = ExportLweMatrix(hint_matrices[i]).transpose();
+    lwe::Matrix expected_hint = data_matrix * lwe_query_pad;
+    EXPECT_EQ(hint_matrix, expected_hint);
+  }
+}
+
+TEST_F(DatabaseTest, UpdateFailsWithInvalidArguments) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  std::string record = testing::GenerateRandomRecord(kParameters);
+  ASSERT_OK(database->Append(record));
+  EXPECT_THAT(database->Update(1, record),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("out of range")));
+  EXPECT_THAT(database->Update(0, ""),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect size")));
+  std::vector<int64_t> indices = {0, 1};
+  std::vector<std::string> records = {record, record};
+  EXPECT_THAT(database->Update(indices, records),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("out of range")));
+  EXPECT_THAT(database->Update(indices, {record}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("same size")));
+}
+
+TEST_F(DatabaseTest, UpdateKeepsHintsUpToDate) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  for (int64_t i = 0; i < kParameters.db_rows * kParameters.db_cols; ++i) {
+    ASSERT_OK(database->Append(testing::GenerateRandomRecord(kParameters)));
+  }
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  EXPECT_FALSE(database->HintsAreUpToDate());
+  ASSERT_OK(database->UpdateHints());
+  EXPECT_TRUE(database->HintsAreUpToDate());
+
+  std::string record = testing::GenerateRandomRecord(kParameters);
+  ASSERT_OK(database->Update(7, record));
+  EXPECT_EQ(database->Record(7).value(), record);
+  std::vector<int64_t> indices = {0, 100, 101, 4000};
+  std::vector<std::string> records;
+  for (int i = 0; i < indices.size(); ++i) {
+    records.push_back(testing::GenerateRandomRecord(kParameters));
+  }
+  ASSERT_OK(database->Update(indices, records));
+  for (int i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(database->Record(indices[i]).value(), records[i]);
+  }
+
+  absl::Span<const Database::RawMatrix> data_matrices = database->Data();
+  absl::Span<const Database::LweMatrix> hint_matrices = database->Hints();
+  for (int i = 0; i < data_matrices.size(); ++i) {
+    lwe::Matrix data_matrix =
+        ExportRawMatrix(data_matrices[i], kParameters.db_rows,
+                        kParameters.lwe_plaintext_bit_size);
+    lwe::Matrix hint_matrix = ExportLweMatrix(hint_matrices[i]).transpose();
+    lwe::Matrix expected_hint = data_matrix * (*this->lwe_query_pad_);
+    EXPECT_EQ(hint_matrix, expected_hint);
+  }
+}
+
+TEST_F(DatabaseTest, SetHints) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  ASSERT_OK(database->UpdateHints());
+  std::vector<Database::LweMatrix> hints(database->Hints().begin(),
+                                         database->Hints().end());
+
+  ASSERT_OK_AND_ASSIGN(auto other, Database::CreateRandom(kParameters));
+  EXPECT_THAT(other->SetHints({}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect number of shards")));
+  std::vector<Database::LweMatrix> short_hints = hints;
+  short_hints[0].pop_back();
+  EXPECT_THAT(other->SetHints(short_hints),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect dimensions")));
+  ASSERT_OK(other->SetHints(hints));
+  for (int i = 0; i < hints.size(); ++i) {
+    EXPECT_EQ(other->Hints()[i], hints[i]);
+  }
+}
+
+TEST_F(DatabaseTest, MemoryUsageAndReleaseHints) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  ASSERT_OK(database->UpdateHints());
+  int64_t num_shards = database->NumShards();
+  Database::MemoryBreakdown usage = database->MemoryUsage();
+  EXPECT_EQ(usage.data_bytes, num_shards * kParameters.db_cols *
+                                  database->Data()[0].ColumnStride() *
+                                  sizeof(Database::BlockType));
+  EXPECT_EQ(usage.hint_bytes, num_shards * kParameters.db_rows *
+                                  kParameters.lwe_secret_dim *
+                                  sizeof(lwe::Integer));
+
+  database->ReleaseHints();
+  EXPECT_FALSE(database->HintsAreUpToDate());
+  EXPECT_TRUE(database->Hints().empty());
+  EXPECT_EQ(database->MemoryUsage().hint_bytes, 0);
+  EXPECT_EQ(database->MemoryUsage().data_bytes, usage.data_bytes);
+  EXPECT_THAT(database->UpdateHints(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+  EXPECT_THAT(database->WriteToFile(::testing::TempDir() + "/released", ""),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("hints have been released")));
+
+  // Records can still be updated, and the hints computed again.
+  std::vector<int64_t> indices = {7};
+  std::vector<std::string> records = {
+      testing::GenerateRandomRecord(kParameters)};
+  ASSERT_OK(database->Update(indices, records));
+  ASSERT_OK_AND_ASSIGN(std::string record, database->Record(7));
+  EXPECT_EQ(record, records[0]);
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  ASSERT_OK(database->UpdateHints());
+  EXPECT_EQ(database->MemoryUsage().TotalBytes(), usage.TotalBytes());
+}
+
 TEST_F(DatabaseTest, AccessRecordWithInvalidIndex) {
   ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
   ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
@@ -203,6 +533,87 @@ TEST_F(DatabaseTest, AccessRecordWithInvalidIndex) {
                        HasSubstr("`index` is out of range")));
 }
 
+TEST(Database, CreateFailsWithInvalidNumThreads) {
+  Parameters params = kParameters;
+  params.num_threads = 0;
+  EXPECT_THAT(Database::Create(params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`num_threads` must be positive")));
+}
+
+TEST(Database, CreateFailsWithInvalidPlaintextBitSize) {
+  Parameters params = kParameters;
+  params.lwe_plaintext_bit_size = 17;
+  EXPECT_THAT(Database::Create(params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`lwe_plaintext_bit_size` must be in")));
+}
+
+TEST(Database, PackedPlaintexts) {
+  // 3- and 4-bit plaintexts are packed in nibbles, and 12- and 16-bit ones in
+  // uint16_t slots.
+  for (int plaintext_bit_size : {3, 4, 12, 16}) {
+    SCOPED_TRACE(plaintext_bit_size);
+    Parameters params = kParameters;
+    params.db_rows = 1000;
+    params.db_record_bit_size = 24;
+    params.lwe_plaintext_bit_size = plaintext_bit_size;
+    params.num_threads = 3;
+    Prng prng(2);
+    ASSERT_OK_AND_ASSIGN(
+        lwe::Matrix lwe_query_pad,
+        lwe::ExpandPad(params.db_cols, params.lwe_secret_dim, &prng));
+    ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+    std::vector<std::string> records;
+    for (int64_t i = 0; i < params.db_rows * params.db_cols; ++i) {
+      records.push_back(testing::GenerateRandomRecord(params));
+      ASSERT_OK(database->Append(records.back()));
+    }
+    for (int64_t i = 0; i < records.size(); i += 37) {
+      ASSERT_OK_AND_ASSIGN(std::string retrieved, database->Record(i));
+      EXPECT_EQ(retrieved, records[i]);
+    }
+
+    int value_bits = Database::PackedValueBits(plaintext_bit_size);
+    EXPECT_EQ(value_bits, plaintext_bit_size <= 4 ? 4 : 16);
+    int64_t num_values_per_block = 8 * sizeof(Database::BlockType) / value_bits;
+    absl::Span<const Database::RawMatrix> data_matrices = database->Data();
+    ASSERT_FALSE(data_matrices.empty());
+    EXPECT_EQ(data_matrices[0].NumBlocksPerColumn(),
+              DivAndRoundUp<int64_t>(params.db_rows, num_values_per_block));
+
+    ASSERT_OK(database->UpdateLweQueryPad(&lwe_query_pad));
+    ASSERT_OK(database->UpdateHints());
+    std::vector<Database::LweVector> queries(
+        2, Database::LweVector(params.db_cols));
+    for (int q = 0; q < queries.size(); ++q) {
+      for (int i = 0; i < params.db_cols; ++i) {
+        queries[q][i] = 0x9e3779b9u * (q * params.db_cols + i + 1);
+      }
+    }
+    ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> product,
+                         database->InnerProductWith(queries[0]));
+    ASSERT_OK_AND_ASSIGN(std::vector<std::vector<Database::LweVector>> products,
+                         database->InnerProductWithBatch(queries));
+    EXPECT_EQ(products[0], product);
+
+    absl::Span<const Database::LweMatrix> hint_matrices = database->Hints();
+    for (int i = 0; i < data_matrices.size(); ++i) {
+      lwe::Matrix data_matrix = ExportRawMatrix(
+          data_matrices[i], params.db_rows, plaintext_bit_size);
+      lwe::Matrix hint_matrix = ExportLweMatrix(hint_matrices[i]).transpose();
+      EXPECT_EQ(hint_matrix, data_matrix * lwe_query_pad);
+      for (int q = 0; q < queries.size(); ++q) {
+        lwe::Vector query =
+            Eigen::Map<const lwe::Vector>(queries[q].data(), params.db_cols);
+        lwe::Vector expected = data_matrix * query;
+        EXPECT_THAT(products[q][i], ::testing::ElementsAreArray(
+                                        expected.data(), expected.size()));
+      }
+    }
+  }
+}
+
 TEST_F(DatabaseTest, InnerProductWith) {
   ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
   ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
@@ -234,6 +645,566 @@ TEST_F(DatabaseTest, InnerProductWith) {
   }
 }
 
+TEST_F(DatabaseTest, MultiThreadedInnerProductMatchesSingleThreaded) {
+  // Use enough rows so that each shard is split into several tasks.
+  Parameters params = kParameters;
+  params.db_rows = 16 * 1024 + 3;
+  params.num_threads = 4;
+  Parameters single_thread_params = params;
+  single_thread_params.num_threads = 1;
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+  ASSERT_OK_AND_ASSIGN(auto expected_database,
+                       Database::Create(single_thread_params));
+  for (int64_t i = 0; i < params.db_rows * params.db_cols; ++i) {
+    std::string record = testing::GenerateRandomRecord(params);
+    ASSERT_OK(database->Append(record));
+    ASSERT_OK(expected_database->Append(record));
+  }
+
+  std::vector<lwe::Integer> query(params.db_cols);
+  for (int i = 0; i < params.db_cols; ++i) {
+    query[i] = 0x9e3779b9u * (i + 1);
+  }
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> product,
+                       database->InnerProductWith(query));
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> expected,
+                       expected_database->InnerProductWith(query));
+  EXPECT_EQ(product, expected);
+}
+
+TEST_F(DatabaseTest, InnerProductOnNumaNodesMatchesSingleThreaded) {
+  // With 3 shards, 2 nodes hold whole shards and 4 nodes split the columns.
+  // Nodes beyond those of the host wrap around, so this runs on any host.
+  Parameters single_thread_params = kParameters;
+  single_thread_params.db_rows = 16 * 1024 + 3;
+  ASSERT_OK_AND_ASSIGN(auto expected_database,
+                       Database::Create(single_thread_params));
+  std::vector<std::string> records;
+  for (int64_t i = 0;
+       i < single_thread_params.db_rows * single_thread_params.db_cols; ++i) {
+    records.push_back(testing::GenerateRandomRecord(single_thread_params));
+    ASSERT_OK(expected_database->Append(records.back()));
+  }
+  std::vector<lwe::Integer> query(single_thread_params.db_cols);
+  for (int i = 0; i < single_thread_params.db_cols; ++i) {
+    query[i] = 0x9e3779b9u * (i + 1);
+  }
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> expected,
+                       expected_database->InnerProductWith(query));
+
+  for (int num_numa_nodes : {2, 4}) {
+    Parameters params = single_thread_params;
+    params.num_threads = 4;
+    params.num_numa_nodes = num_numa_nodes;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+    for (auto const& record : records) {
+      ASSERT_OK(database->Append(record));
+    }
+    ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> product,
+                         database->InnerProductWith(query));
+    EXPECT_EQ(product, expected) << "num_numa_nodes = " << num_numa_nodes;
+  }
+}
+
+TEST(Database, CreateFailsWithInvalidNumNumaNodes) {
+  Parameters params = kParameters;
+  params.num_numa_nodes = -2;
+  EXPECT_THAT(Database::Create(params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`num_numa_nodes` must be non-negative")));
+}
+
+TEST_F(DatabaseTest, InnerProductWithBatchFailsIfQueryHasIncorrectSize) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  std::vector<Database::LweVector> queries = {
+      Database::LweVector(kParameters.db_cols, 1),
+      Database::LweVector(kParameters.db_cols + 1, 1)};
+  EXPECT_THAT(database->InnerProductWithBatch(queries),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must have matching dimensions")));
+}
+
+TEST_F(DatabaseTest, InnerProductWithBatchMatchesInnerProductWith) {
+  for (int num_threads : {1, 3}) {
+    Parameters params = kParameters;
+    params.db_rows = 4096 + 5;
+    params.num_threads = num_threads;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params));
+
+    std::vector<Database::LweVector> queries(5);
+    for (int q = 0; q < queries.size(); ++q) {
+      queries[q].resize(params.db_cols);
+      for (int i = 0; i < params.db_cols; ++i) {
+        queries[q][i] = 0x9e3779b9u * (q * params.db_cols + i + 1);
+      }
+    }
+    ASSERT_OK_AND_ASSIGN(std::vector<std::vector<Database::LweVector>> products,
+                         database->InnerProductWithBatch(queries));
+    ASSERT_EQ(products.size(), queries.size());
+    for (int q = 0; q < queries.size(); ++q) {
+      ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> expected,
+                           database->InnerProductWith(queries[q]));
+      EXPECT_EQ(products[q], expected);
+    }
+  }
+}
+
+TEST_F(DatabaseTest, InnerProductWithIntoMatchesInnerProductWithBatch) {
+  for (int num_threads : {1, 3}) {
+    Parameters params = kParameters;
+    params.db_rows = 16 * 1024 + 5;
+    params.num_threads = num_threads;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params));
+
+    Database::LweVector query(params.db_cols);
+    for (int i = 0; i < params.db_cols; ++i) {
+      query[i] = 0x9e3779b9u * (i + 1);
+    }
+    ASSERT_OK_AND_ASSIGN(std::vector<std::vector<Database::LweVector>> expected,
+                         database->InnerProductWithBatch({query}));
+
+    int num_shards = database->NumShards();
+    std::vector<Database::LweVector> results(num_shards,
+                                             Database::LweVector(params.db_rows));
+    std::vector<absl::Span<lwe::Integer>> result_spans;
+    for (auto& result : results) {
+      result_spans.push_back(absl::MakeSpan(result));
+    }
+    ASSERT_OK(database->InnerProductWithInto(query, result_spans));
+    EXPECT_EQ(results, expected[0]);
+
+    // The spans must match the number of shards and rows.
+    result_spans.pop_back();
+    EXPECT_THAT(database->InnerProductWithInto(query, result_spans),
+                StatusIs(absl::StatusCode::kInvalidArgument,
+                         HasSubstr("one span per shard")));
+    result_spans.push_back(absl::MakeSpan(results.back()).subspan(1));
+    EXPECT_THAT(database->InnerProductWithInto(query, result_spans),
+                StatusIs(absl::StatusCode::kInvalidArgument,
+                         HasSubstr("`db_rows` values")));
+  }
+}
+
+TEST_F(DatabaseTest, InnerProductWithIntoAlignedAndUnalignedSpans) {
+  Parameters params = kParameters;
+  params.db_rows = 4096 + 5;
+  params.num_threads = 3;
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params));
+  int num_shards = database->NumShards();
+
+  // Aligned spans are written by the kernels directly, and unaligned ones go
+  // through the pooled workspaces. Repeated calls reuse the workspaces.
+  std::vector<internal::InnerProductWorkspace> aligned_buffers(num_shards);
+  std::vector<Database::LweVector> unaligned_buffers(
+      num_shards, Database::LweVector(params.db_rows + 1));
+  std::vector<absl::Span<lwe::Integer>> aligned_spans, unaligned_spans;
+  for (int i = 0; i < num_shards; ++i) {
+    aligned_spans.push_back(absl::MakeSpan(
+        aligned_buffers[i].AlignedBuffer(params.db_rows), params.db_rows));
+    unaligned_spans.push_back(absl::MakeSpan(unaligned_buffers[i]).subspan(1));
+  }
+  for (int q = 0; q < 3; ++q) {
+    Database::LweVector query(params.db_cols);
+    for (int i = 0; i < params.db_cols; ++i) {
+      query[i] = 0x9e3779b9u * (q * params.db_cols + i + 1);
+    }
+    ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> expected,
+                         database->InnerProductWith(query));
+    ASSERT_OK(database->InnerProductWithInto(query, aligned_spans));
+    ASSERT_OK(database->InnerProductWithInto(query, unaligned_spans));
+    for (int i = 0; i < num_shards; ++i) {
+      EXPECT_THAT(aligned_spans[i], ::testing::ElementsAreArray(expected[i]));
+      EXPECT_THAT(unaligned_spans[i],
+                  ::testing::ElementsAreArray(expected[i]));
+    }
+  }
+}
+
+TEST_F(DatabaseTest, InterleavedShardsMatchShardMajor) {
+  // Rows spanning several tasks, whose ranges then cross the shards, and
+  // plaintexts packed as nibbles, bytes and 16-bit values.
+  for (int plaintext_bits : {4, 7, 9}) {
+    for (int num_threads : {1, 4}) {
+      Parameters expected_params = kParameters;
+      expected_params.db_rows = 5000;
+      expected_params.lwe_plaintext_bit_size = plaintext_bits;
+      expected_params.num_threads = num_threads;
+      Parameters params = expected_params;
+      params.interleave_shards = true;
+      ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+      ASSERT_OK_AND_ASSIGN(auto expected_database,
+                           Database::Create(expected_params));
+      ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+      ASSERT_OK(
+          expected_database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+      for (int64_t i = 0; i < params.db_rows * params.db_cols; ++i) {
+        std::string record = testing::GenerateRandomRecord(params);
+        ASSERT_OK(database->Append(record));
+        ASSERT_OK(expected_database->Append(record));
+      }
+      ASSERT_OK(database->UpdateHints());
+      ASSERT_OK(expected_database->UpdateHints());
+      for (int i = 0; i < database->NumShards(); ++i) {
+        EXPECT_EQ(database->Hints()[i], expected_database->Hints()[i]);
+      }
+
+      std::vector<lwe::Integer> query(params.db_cols);
+      for (int i = 0; i < params.db_cols; ++i) {
+        query[i] = 0x9e3779b9u * (i + 1);
+      }
+      ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> product,
+                           database->InnerProductWith(query));
+      ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> expected,
+                           expected_database->InnerProductWith(query));
+      EXPECT_EQ(product, expected) << "plaintext_bits = " << plaintext_bits
+                                   << ", num_threads = " << num_threads;
+
+      // The file layout does not depend on the layout in memory.
+      std::string path = ::testing::TempDir() + "/database_hwy_test.db";
+      ASSERT_OK(database->WriteToFile(path, "seed"));
+      ASSERT_OK_AND_ASSIGN(auto mapped,
+                           Database::OpenMapped(expected_params, path));
+      ASSERT_OK_AND_ASSIGN(std::vector<Database::LweVector> mapped_product,
+                           mapped->InnerProductWith(query));
+      EXPECT_EQ(mapped_product, expected);
+    }
+  }
+}
+
+TEST(Database, CreateFailsWithInterleavedShardsOnNumaNodes) {
+  Parameters params = kParameters;
+  params.interleave_shards = true;
+  params.num_numa_nodes = 2;
+  EXPECT_THAT(Database::Create(params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`interleave_shards` cannot be combined")));
+}
+
+TEST_F(DatabaseTest, WriteToFileAndOpenMapped) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+  int64_t num_records = kParameters.db_rows * kParameters.db_cols / 2;
+  for (int64_t i = 0; i < num_records; ++i) {
+    ASSERT_OK(database->Append(testing::GenerateRandomRecord(kParameters)));
+  }
+  ASSERT_OK(database->UpdateHints());
+
+  std::string path = ::testing::TempDir() + "/database_hwy_test.db";
+  ASSERT_OK(database->WriteToFile(path, "seed"));
+  ASSERT_OK_AND_ASSIGN(auto mapped, Database::OpenMapped(kParameters, path));
+  EXPECT_EQ(mapped->PrngSeedLweQueryPad(), "seed");
+  ASSERT_EQ(mapped->NumShards(), database->NumShards());
+  ASSERT_EQ(mapped->NumRecords(), num_records);
+  for (int64_t i = 0; i < num_records; ++i) {
+    ASSERT_OK_AND_ASSIGN(std::string expected, database->Record(i));
+    ASSERT_OK_AND_ASSIGN(std::string record, mapped->Record(i));
+    EXPECT_EQ(record, expected);
+  }
+  for (int i = 0; i < database->NumShards(); ++i) {
+    EXPECT_EQ(mapped->Hints()[i], database->Hints()[i]);
+  }
+
+  std::vector<lwe::Integer> query(kParameters.db_cols);
+  for (int i = 0; i < kParameters.db_cols; ++i) {
+    query[i] = 0x9e3779b9u * (i + 1);
+  }
+  ASSERT_OK_AND_ASSIGN(auto expected_product,
+                       database->InnerProductWith(query));
+  ASSERT_OK_AND_ASSIGN(auto product, mapped->InnerProductWith(query));
+  EXPECT_EQ(product, expected_product);
+
+  // The mapped database can still be appended to.
+  std::string record = testing::GenerateRandomRecord(kParameters);
+  ASSERT_OK(mapped->Append(record));
+  ASSERT_OK_AND_ASSIGN(std::string retrieved, mapped->Record(num_records));
+  EXPECT_EQ(retrieved, record);
+}
+
+TEST_F(DatabaseTest, OpenMappedFailsIfFileDoesNotExist) {
+  std::string path = ::testing::TempDir() + "/does_not_exist.db";
+  EXPECT_THAT(Database::OpenMapped(kParameters, path),
+              StatusIs(absl::StatusCode::kNotFound, HasSubstr("Cannot open")));
+}
+
+TEST_F(DatabaseTest, OpenMappedFailsWithDifferentParameters) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  std::string path = ::testing::TempDir() + "/database_hwy_test_params.db";
+  ASSERT_OK(database->WriteToFile(path, /*prng_seed_lwe_query_pad=*/""));
+
+  Parameters params = kParameters;
+  params.db_cols += 1;
+  EXPECT_THAT(Database::OpenMapped(params, path),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("does not match `parameters`")));
+}
+
+TEST_F(DatabaseTest, InnerProductConfigsMatchDefault) {
+  const std::vector<internal::InnerProductConfig> configs = {
+      {.kernel = internal::InnerProductKernel::kNoHwy},
+      {.kernel = internal::InnerProductKernel::kHwyDotProduct},
+      {.kernel = internal::InnerProductKernel::kHwyDotProduct,
+       .tile_blocks = 64},
+      {.unroll = 1},
+      {.unroll = 2, .tile_blocks = 1},
+      {.unroll = 8, .tile_blocks = 8},
+      {.unroll = 4, .tile_blocks = 64},
+  };
+  for (auto [plaintext_bit_size, db_cols] :
+       {std::pair{4, 32}, {8, 32}, {8, 35}, {16, 35}}) {
+    Parameters params = kParameters;
+    params.db_rows = 4 * 1024 + 5;
+    params.db_cols = db_cols;
+    params.lwe_plaintext_bit_size = plaintext_bit_size;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params));
+    std::vector<lwe::Integer> query(params.db_cols);
+    for (int i = 0; i < params.db_cols; ++i) {
+      query[i] = 0x9e3779b9u * (i + 1);
+    }
+    ASSERT_OK_AND_ASSIGN(auto expected, database->InnerProductWith(query));
+    for (auto const& config : configs) {
+      ASSERT_OK(database->SetInnerProductConfig(config));
+      ASSERT_OK_AND_ASSIGN(auto product, database->InnerProductWith(query));
+      EXPECT_EQ(product, expected);
+    }
+  }
+}
+
+TEST(Database, SetInnerProductConfigFailsWithInvalidConfig) {
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  EXPECT_THAT(database->SetInnerProductConfig({.unroll = 3}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`unroll` must be")));
+  EXPECT_THAT(database->SetInnerProductConfig({.tile_blocks = -1}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`tile_blocks` must be")));
+}
+
+TEST_F(DatabaseTest, AutotuneInnerProductUsesCache) {
+  std::string path = ::testing::TempDir() + "/database_hwy_test.autotune";
+  std::remove(path.c_str());
+  ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(kParameters));
+  ASSERT_OK_AND_ASSIGN(internal::InnerProductConfig config,
+                       database->AutotuneInnerProduct(path));
+  EXPECT_EQ(database->GetInnerProductConfig(), config);
+
+  // The file holds one line for the shape of the database, keyed by the
+  // target of this CPU.
+  std::ifstream file(path);
+  std::string line;
+  ASSERT_TRUE(std::getline(file, line));
+  EXPECT_THAT(line, ::testing::StartsWith(internal::HwyTargetName()));
+  std::string next_line;
+  EXPECT_FALSE(std::getline(file, next_line));
+  file.close();
+
+  // A database of the same shape reads the configuration from the cache.
+  std::vector<std::string> fields = absl::StrSplit(line, ' ');
+  ASSERT_EQ(fields.size(), 7);
+  fields[4] = "nohwy";
+  fields[5] = "2";
+  fields[6] = "16";
+  std::ofstream(path) << absl::StrJoin(fields, " ") << "\n";
+  ASSERT_OK_AND_ASSIGN(auto other_database, Database::Create(kParameters));
+  ASSERT_OK_AND_ASSIGN(config, other_database->AutotuneInnerProduct(path));
+  EXPECT_EQ(config.kernel, internal::InnerProductKernel::kNoHwy);
+  EXPECT_EQ(config.unroll, 2);
+  EXPECT_EQ(config.tile_blocks, 16);
+
+  // A different shape is tuned and added to the cache.
+  Parameters params = kParameters;
+  params.db_cols += 1;
+  ASSERT_OK_AND_ASSIGN(auto wider_database, Database::Create(params));
+  ASSERT_OK(wider_database->AutotuneInnerProduct(path).status());
+  std::ifstream updated_file(path);
+  int num_lines = 0;
+  while (std::getline(updated_file, line)) {
+    ++num_lines;
+  }
+  EXPECT_EQ(num_lines, 2);
+}
+
+// Computes the products of a database in host memory, on Eigen matrices, and
+// counts them. Fails all products if `fail` is true.
+class HostAccelerator : public DatabaseAccelerator {
+ public:
+  explicit HostAccelerator(bool fail = false) : fail_(fail) {}
+
+  absl::Status UploadData(absl::Span<const Database::RawMatrix> data_matrices,
+                          int64_t num_rows, int packed_value_bits) override {
+    num_rows_ = num_rows;
+    value_bits_ = packed_value_bits;
+    data_.clear();
+    for (const auto& matrix : data_matrices) {
+      data_.push_back(ExportRawMatrix(matrix, num_rows_, value_bits_));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status UploadColumns(
+      absl::Span<const Database::RawMatrix> data_matrices,
+      absl::Span<const int64_t> col_indices) override {
+    for (int i = 0; i < data_.size(); ++i) {
+      lwe::Matrix matrix =
+          ExportRawMatrix(data_matrices[i], num_rows_, value_bits_);
+      for (int64_t col_idx : col_indices) {
+        data_[i].col(col_idx) = matrix.col(col_idx);
+      }
+    }
+    num_uploaded_columns_ += col_indices.size();
+    return absl::OkStatus();
+  }
+
+  absl::Status InnerProductBatch(
+      absl::Span<const absl::Span<const lwe::Integer>> queries,
+      absl::Span<const absl::Span<lwe::Integer>> results) const override {
+    if (fail_) {
+      return absl::UnavailableError("Device lost.");
+    }
+    for (int q = 0; q < queries.size(); ++q) {
+      lwe::Vector query =
+          Eigen::Map<const lwe::Vector>(queries[q].data(), queries[q].size());
+      for (int i = 0; i < data_.size(); ++i) {
+        lwe::Vector product = data_[i] * query;
+        std::copy_n(product.data(), num_rows_,
+                    results[q * data_.size() + i].begin());
+      }
+    }
+    ++num_products_;
+    return absl::OkStatus();
+  }
+
+  absl::Status MatrixProduct(
+      absl::Span<const lwe::Integer> pad, int64_t num_pad_cols,
+      absl::Span<Database::LweMatrix> hints) const override {
+    if (fail_) {
+      return absl::UnavailableError("Device lost.");
+    }
+    using RowMajorMatrix = Eigen::Matrix<lwe::Integer, Eigen::Dynamic,
+                                         Eigen::Dynamic, Eigen::RowMajor>;
+    lwe::Matrix pad_matrix = Eigen::Map<const RowMajorMatrix>(
+        pad.data(), pad.size() / num_pad_cols, num_pad_cols);
+    for (int i = 0; i < data_.size(); ++i) {
+      lwe::Matrix product = data_[i] * pad_matrix;
+      for (int64_t r = 0; r < num_rows_; ++r) {
+        for (int64_t c = 0; c < num_pad_cols; ++c) {
+          hints[i][r][c] = product(r, c);
+        }
+      }
+    }
+    ++num_products_;
+    return absl::OkStatus();
+  }
+
+  int num_products() const { return num_products_; }
+  int64_t num_uploaded_columns() const { return num_uploaded_columns_; }
+
+ private:
+  const bool fail_;
+  int64_t num_rows_ = 0;
+  int value_bits_ = 0;
+  std::vector<lwe::Matrix> data_;
+  mutable int num_products_ = 0;
+  int64_t num_uploaded_columns_ = 0;
+};
+
+TEST_F(DatabaseTest, AcceleratorMatchesCpu) {
+  for (int plaintext_bits : {4, 7, 12}) {
+    Parameters params = kParameters;
+    params.lwe_plaintext_bit_size = plaintext_bits;
+    ASSERT_OK_AND_ASSIGN(auto database, Database::CreateRandom(params));
+    ASSERT_OK_AND_ASSIGN(auto expected_database,
+                         Database::CreateRandom(params));
+    ASSERT_OK(database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+    ASSERT_OK(
+        expected_database->UpdateLweQueryPad(this->lwe_query_pad_.get()));
+    auto accelerator = std::make_unique<HostAccelerator>();
+    HostAccelerator* device = accelerator.get();
+    ASSERT_OK(database->SetAccelerator(std::move(accelerator)));
+    EXPECT_TRUE(database->AcceleratorIsInSync());
+
+    ASSERT_OK(database->UpdateHints());
+    ASSERT_OK(expected_database->UpdateHints());
+    EXPECT_EQ(device->num_products(), 1);
+    for (int i = 0; i < database->NumShards(); ++i) {
+      EXPECT_EQ(database->Hints()[i], expected_database->Hints()[i]);
+    }
+
+    std::vector<Database::LweVector> queries(
+        3, Database::LweVector(params.db_cols));
+    for (int q = 0; q < queries.size(); ++q) {
+      for (int i = 0; i < params.db_cols; ++i) {
+        queries[q][i] = 0x9e3779b9u * (q * params.db_cols + i + 1);
+      }
+    }
+    ASSERT_OK_AND_ASSIGN(auto product, database->InnerProductWith(queries[0]));
+    ASSERT_OK_AND_ASSIGN(auto expected,
+                         expected_database->InnerProductWith(queries[0]));
+    EXPECT_EQ(product, expected);
+    ASSERT_OK_AND_ASSIGN(auto products,
+                         database->InnerProductWithBatch(queries));
+    ASSERT_OK_AND_ASSIGN(auto expected_products,
+                         expected_database->InnerProductWithBatch(queries));
+    EXPECT_EQ(products, expected_products);
+    EXPECT_EQ(device->num_products(), 3);
+
+    // Updates copy the changed columns, and keep the products on the device.
+    std::vector<int64_t> indices = {3, 5, 3 + params.db_cols};
+    std::vector<std::string> records;
+    for (int i = 0; i < indices.size(); ++i) {
+      records.push_back(testing::GenerateRandomRecord(params));
+    }
+    ASSERT_OK(database->Update(indices, records));
+    ASSERT_OK(expected_database->Update(indices, records));
+    EXPECT_TRUE(database->AcceleratorIsInSync());
+    EXPECT_EQ(device->num_uploaded_columns(), 2);
+    ASSERT_OK_AND_ASSIGN(product, database->InnerProductWith(queries[1]));
+    ASSERT_OK_AND_ASSIGN(expected,
+                         expected_database->InnerProductWith(queries[1]));
+    EXPECT_EQ(product, expected);
+    EXPECT_EQ(device->num_products(), 4);
+  }
+}
+
+TEST_F(DatabaseTest, AcceleratorFallsBackToCpu) {
+  Parameters params = kParameters;
+  params.db_rows = 100;
+  params.db_cols = 32;
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(params));
+  ASSERT_OK_AND_ASSIGN(auto expected_database, Database::Create(params));
+  auto accelerator = std::make_unique<HostAccelerator>();
+  HostAccelerator* device = accelerator.get();
+  ASSERT_OK(database->SetAccelerator(std::move(accelerator)));
+
+  // Appending records leaves the accelerator out of sync.
+  for (int64_t i = 0; i < params.db_rows * params.db_cols; ++i) {
+    std::string record = testing::GenerateRandomRecord(params);
+    ASSERT_OK(database->Append(record));
+    ASSERT_OK(expected_database->Append(record));
+  }
+  EXPECT_FALSE(database->AcceleratorIsInSync());
+  std::vector<lwe::Integer> query(params.db_cols, 7);
+  ASSERT_OK_AND_ASSIGN(auto expected,
+                       expected_database->InnerProductWith(query));
+  ASSERT_OK_AND_ASSIGN(auto product, database->InnerProductWith(query));
+  EXPECT_EQ(product, expected);
+  EXPECT_EQ(device->num_products(), 0);
+
+  ASSERT_OK(database->SyncAccelerator());
+  ASSERT_OK_AND_ASSIGN(product, database->InnerProductWith(query));
+  EXPECT_EQ(product, expected);
+  EXPECT_EQ(device->num_products(), 1);
+
+  // A failing device leaves the products to the CPU.
+  ASSERT_OK(database->SetAccelerator(
+      std::make_unique<HostAccelerator>(/*fail=*/true)));
+  ASSERT_OK_AND_ASSIGN(product, database->InnerProductWith(query));
+  EXPECT_EQ(product, expected);
+  ASSERT_OK(database->SetAccelerator(nullptr));
+  EXPECT_FALSE(database->AcceleratorIsInSync());
+  EXPECT_THAT(database->SyncAccelerator(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
 }  // namespace
 }  // namespace hintless_simplepir
 }  // namespace hintless_pir
@@ -25,7 +25,7 @@
 #include "hintless_simplepir/database_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/server.h"
-#include "linpir/parameters.h"
+#include "hintless_simplepir/testing.h"
 #include "shell_encryption/testing/status_testing.h"
 
 ABSL_FLAG(int, num_rows, 1024, "Number of rows");
@@ -35,7 +35,6 @@ namespace hintless_pir {
 namespace hintless_simplepir {
 namespace {
 
-using RlweInteger = Parameters::RlweInteger;
 
 const Parameters kParameters{
     .db_rows = 1024,
@@ -45,16 +44,7 @@ const Parameters kParameters{
     .lwe_modulus_bit_size = 32,
     .lwe_plaintext_bit_size = 8,
     .lwe_error_variance = 8,
-    .linpir_params =
-        linpir::RlweParameters<RlweInteger>{
-            .log_n = 12,
-            .qs = {35184371884033ULL, 35184371703809ULL},  // 90 bits
-            .ts = {2056193, 1990657},                      // 42 bits
-            .gadget_log_bs = {16, 16},
-            .error_variance = 8,
-            .prng_type = rlwe::PRNG_TYPE_HKDF,
-            .rows_per_block = 1024,
-        },
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/1024),
     .prng_type = rlwe::PRNG_TYPE_HKDF,
 };
 
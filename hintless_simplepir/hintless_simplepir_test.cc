@@ -12,27 +12,46 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <map>
+#include <vector>
 
 using namespace std;
 
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "gmock/gmock.h"
+#include "google/protobuf/arena.h"
 #include "gtest/gtest.h"
 #include "hintless_simplepir/client.h"
 #include "hintless_simplepir/database_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/server.h"
+#include "hintless_simplepir/session.h"
+#include "hintless_simplepir/testing.h"
 #include "hintless_simplepir/utils.h"
 #include "linpir/parameters.h"
+#include "linpir/server.h"
+#include "shell_encryption/montgomery.h"
+#include "shell_encryption/rns/rns_context.h"
+#include "shell_encryption/rns/rns_polynomial.h"
 #include "shell_encryption/testing/status_testing.h"
+#include "util/metrics.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 namespace {
 
-using RlweInteger = Parameters::RlweInteger;
+using ::rlwe::testing::StatusIs;
+using ::testing::HasSubstr;
 
 const Parameters kParameters{
     .db_rows = 1024,
@@ -42,16 +61,7 @@ const Parameters kParameters{
     .lwe_modulus_bit_size = 32,
     .lwe_plaintext_bit_size = 8,
     .lwe_error_variance = 8,
-    .linpir_params =
-        linpir::RlweParameters<RlweInteger>{
-            .log_n = 12,
-            .qs = {35184371884033ULL, 35184371703809ULL},  // 90 bits
-            .ts = {2056193, 1990657},                      // 42 bits
-            .gadget_log_bs = {16, 16},
-            .error_variance = 8,
-            .prng_type = rlwe::PRNG_TYPE_HKDF,
-            .rows_per_block = 1024,
-        },
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/1024),
     .prng_type = rlwe::PRNG_TYPE_HKDF,
 };
 
@@ -98,9 +108,6 @@ TEST(HintlessSimplePir, EndToEndTest) {
   dict[DIRECT_UP_KB] = 0;
   dict[DIRECT_DOWN_KB] = 0;
 
-#ifdef FAKE_RUN
-  std::cout << "\n          ----->>    Fake Run   <<-----           \n" << std::endl;
-#endif
   double start, end;
   // Create server and fill in random database records.
   ASSERT_OK_AND_ASSIGN(auto server,
@@ -120,8 +127,10 @@ TEST(HintlessSimplePir, EndToEndTest) {
   uint64_t hint_bytes = shards * H_vec[0].size() * H_vec[0][0].size() * sizeof(hintless_pir::lwe::Integer);
   dict[HINT_MB] += hint_bytes / (1ULL << 20);
 
-  // Create a client and issue request.
+  // Create a session and a client and issue requests.
   start = currentDateTime();
+  ASSERT_OK_AND_ASSIGN(auto session,
+                       Session::Create(kParameters, public_params));
   ASSERT_OK_AND_ASSIGN(auto client, Client::Create(kParameters, public_params));
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Client creation time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
@@ -129,24 +138,17 @@ TEST(HintlessSimplePir, EndToEndTest) {
   // Prepare phase
   double start_prepare, end_prepare;
   start_prepare = currentDateTime();
-  
-  start = currentDateTime();
-  ASSERT_OK_AND_ASSIGN(auto As_s_tuple, client->Compute_A_times_s());
-  end = currentDateTime();
-  //std::cout << "[==> TIMER  <==] Client A*s generation time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
-  dict[CLIENT_PREP_PRE_S] += (end-start)/1000;
-  
-  auto As = std::get<0>(As_s_tuple);
-  auto s_lwe = std::get<1>(As_s_tuple);
-  dict[ONLINE_STATE_KB] += (As.size() * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10);
-  dict[ONLINE_STATE_KB] += (s_lwe.Key().size() * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10);
+
+  // The session keeps A*s and s of every prepared secret.
+  dict[ONLINE_STATE_KB] += (kParameters.db_cols * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10);
+  dict[ONLINE_STATE_KB] += (kParameters.lwe_secret_dim * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10);
 
   start = currentDateTime();
-  ASSERT_OK_AND_ASSIGN(auto prepare_req, client->PrepareLinPirGivenS(s_lwe));
+  ASSERT_OK_AND_ASSIGN(auto prepare_req, session->GeneratePrepareRequest(1));
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Client prepare req gen time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
   dict[CLIENT_PREP_PRE_S] += (end-start)/1000;
-  
+
   std::cout << "[==> COMM. <==] Client prepare request KB " << (prepare_req.ByteSizeLong() / 1024) << std::endl;
   dict[PREPARE_UP_KB] += (prepare_req.ByteSizeLong() / 1024);
   std::cout << "[ONLINE PREPARE STATE]: Client prepare request (rotation keys, RLWE cipher of s_lwe) size " << (prepare_req.ByteSizeLong() / 1024) << " KB" << std::endl;
@@ -164,28 +166,28 @@ TEST(HintlessSimplePir, EndToEndTest) {
   dict[ONLINE_STATE_KB] += (prepare_response.ByteSizeLong() / 1024);
 
   start = currentDateTime();
-  ASSERT_OK_AND_ASSIGN(auto hs_vec, client->RecoverHsPreparePhase(prepare_response));
+  ASSERT_OK(session->ProcessPrepareResponse(prepare_response));
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Client prepare recover time (LinPir response decryption): " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
   dict[CLIENT_PREP_POST_S] += (end-start)/1000;
-  std::cout << "[ONLINE STATE]: Size of decrypted H*s (i.e. w) " << (hs_vec.size() * hs_vec[0].size() * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10) << " KB" << std::endl;
-  dict[ONLINE_STATE_KB] += (hs_vec.size() * hs_vec[0].size() * sizeof(hintless_pir::lwe::Integer))/(1ULL << 10);
+  EXPECT_EQ(session->NumPreparedSecrets(), 1);
+  uint64_t hs_bytes = shards * kParameters.db_rows * sizeof(hintless_pir::lwe::Integer);
+  std::cout << "[ONLINE STATE]: Size of decrypted H*s (i.e. w) " << hs_bytes/(1ULL << 10) << " KB" << std::endl;
+  dict[ONLINE_STATE_KB] += hs_bytes/(1ULL << 10);
 
   end_prepare = currentDateTime();
   std::cout << "[==> TIMER  <==] Prepare phase total (client + server) time: " << (end_prepare-start_prepare) << " ms | " << (end_prepare-start_prepare)/1000 << " sec" << std::endl;
   std::cout << "----------------------------------" << std::endl;
-  
+
   double start_online, end_online;
   start_online = currentDateTime();
 
   start = currentDateTime();
-  ASSERT_OK_AND_ASSIGN(auto request_and_query, client->GenerateRequestGivenAsSkipLinPir(1, As, s_lwe));
+  ASSERT_OK_AND_ASSIGN(auto request, session->GenerateRequest(1));
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Client online request generation time (skipped LinPir): " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
   dict[CLIENT_Q_REQ_GEN_MS] += (end-start);
-	
-  auto request = request_and_query.first;
-	auto query = request_and_query.second;
+  EXPECT_EQ(session->NumPreparedSecrets(), 0);
 
   std::cout << "[==> COMM. <==] Client online request (LWE only) KB " << (request.ByteSizeLong() / 1024) << std::endl;
   dict[QUERY_UP_KB] += (request.ByteSizeLong() / 1024);
@@ -195,7 +197,6 @@ TEST(HintlessSimplePir, EndToEndTest) {
 	// Server handles the HintlessPIR request
   start = currentDateTime();
   ASSERT_OK_AND_ASSIGN(auto response, server->HandleRequestSkipLinPir(request)); 
-  std::cout << "Request handled" << std::endl;
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Server-only Online time (only D*u): " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
   dict[SERVER_Q_RESP_S] += (end-start)/1000;
@@ -206,7 +207,7 @@ TEST(HintlessSimplePir, EndToEndTest) {
   dict[ONLINE_STATE_KB] += (response.ByteSizeLong() / 1024);
 
   start = currentDateTime();
-  ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecordGivenHs(response, hs_vec));
+  ASSERT_OK_AND_ASSIGN(auto record, session->RecoverRecord(response));
   end = currentDateTime();
   std::cout << "[==> TIMER  <==] Client record recovery time (given Hs already): " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
   dict[CLIENT_Q_DEC_MS] += (end-start);
@@ -253,6 +254,507 @@ TEST(HintlessSimplePir, EndToEndTest) {
   }
 }
 
+// Runs the end-to-end flow of the protocol: a server with random records is
+// preprocessed, and clients of its public parameters retrieve records, which
+// are checked against the database. Tests only add the parts of the flow
+// specific to the feature they cover.
+class HintlessSimplePirTest : public ::testing::Test {
+ protected:
+  // Creates `server_` with random records for `params`, reporting to
+  // `metrics_sink` if not null, and preprocesses it.
+  void SetUpServer(const Parameters& params = kParameters,
+                   MetricsSink* metrics_sink = nullptr) {
+    params_ = params;
+    ASSERT_OK_AND_ASSIGN(server_,
+                         Server::CreateWithRandomDatabaseRecords(params));
+    if (metrics_sink != nullptr) {
+      server_->SetMetricsSink(metrics_sink);
+    }
+    ASSERT_OK(server_->Preprocess());
+  }
+
+  // Returns a client of the current public parameters of `server_`.
+  absl::StatusOr<std::unique_ptr<Client>> CreateClient(
+      Client::PadMode pad_mode = Client::PadMode::kStreamed) const {
+    return Client::Create(params_, server_->GetPublicParams(), pad_mode);
+  }
+
+  // Checks that `record` is the record at `index` in the database.
+  void ExpectRecord(absl::string_view record, int64_t index) const {
+    ASSERT_OK_AND_ASSIGN(std::string expected,
+                         server_->GetDatabase()->Record(index));
+    EXPECT_EQ(record, expected) << "index = " << index;
+  }
+
+  // Retrieves the record at `index` with `client`, from the request to the
+  // recovered record, and checks it against the database.
+  void ExpectRetrieves(Client& client, int64_t index) const {
+    ASSERT_OK_AND_ASSIGN(auto request, client.GenerateRequest(index));
+    ASSERT_OK_AND_ASSIGN(auto response, server_->HandleRequest(request));
+    ASSERT_OK_AND_ASSIGN(auto record, client.RecoverRecord(response));
+    ExpectRecord(record, index);
+  }
+
+  Parameters params_ = kParameters;
+  std::unique_ptr<Server> server_;
+};
+
+TEST_F(HintlessSimplePirTest, EndToEndBatchTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+
+  // Each client in the batch retrieves a different record.
+  const std::vector<int64_t> indices = {1, 42, 1023 * 1024 + 7};
+  std::vector<std::unique_ptr<Client>> clients;
+  std::vector<HintlessPirRequest> requests;
+  for (int64_t index : indices) {
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+    ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+    clients.push_back(std::move(client));
+    requests.push_back(std::move(request));
+  }
+
+  ASSERT_OK_AND_ASSIGN(std::vector<HintlessPirResponse> responses,
+                       server_->HandleRequestBatch(requests));
+  ASSERT_EQ(responses.size(), indices.size());
+  for (int i = 0; i < indices.size(); ++i) {
+    ASSERT_OK_AND_ASSIGN(auto record, clients[i]->RecoverRecord(responses[i]));
+    ExpectRecord(record, indices[i]);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndSessionTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+  ASSERT_OK_AND_ASSIGN(auto session,
+                       Session::Create(params_, server_->GetPublicParams()));
+  EXPECT_THAT(session->GenerateRequest(0),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("No prepared LWE secret")));
+
+  // Prepare two secrets offline, then run two online queries with them.
+  ASSERT_OK_AND_ASSIGN(auto prepare_request, session->GeneratePrepareRequest(2));
+  ASSERT_OK_AND_ASSIGN(auto prepare_response,
+                       server_->HandlePrepareRequest(prepare_request));
+  ASSERT_OK(session->ProcessPrepareResponse(prepare_response));
+  EXPECT_EQ(session->NumPreparedSecrets(), 2);
+  for (int64_t index : {3, 1023 * 1024 + 1000}) {
+    ASSERT_OK_AND_ASSIGN(auto request, session->GenerateRequest(index));
+    EXPECT_EQ(request.linpir_ct_bs_size(), 0);
+    ASSERT_OK_AND_ASSIGN(auto response,
+                         server_->HandleRequestSkipLinPir(request));
+    ASSERT_OK_AND_ASSIGN(auto record, session->RecoverRecord(response));
+    ExpectRecord(record, index);
+  }
+  EXPECT_EQ(session->NumPreparedSecrets(), 0);
+  EXPECT_THAT(session->GenerateRequest(0),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("No prepared LWE secret")));
+
+  // Unchanged public parameters keep the prepared secrets, and new ones drop
+  // them.
+  ASSERT_OK_AND_ASSIGN(prepare_request, session->GeneratePrepareRequest(1));
+  ASSERT_OK_AND_ASSIGN(prepare_response,
+                       server_->HandlePrepareRequest(prepare_request));
+  ASSERT_OK(session->ProcessPrepareResponse(prepare_response));
+  ASSERT_OK(session->UpdatePublicParams(server_->GetPublicParams()));
+  EXPECT_EQ(session->NumPreparedSecrets(), 1);
+  ASSERT_OK(server_->Preprocess());
+  ASSERT_OK(session->UpdatePublicParams(server_->GetPublicParams()));
+  EXPECT_EQ(session->NumPreparedSecrets(), 0);
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndBatchRequestTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+  EXPECT_THAT(client->GenerateBatchRequest({}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must not be empty")));
+
+  // The first two indices and the duplicate share column 5, so three requests
+  // are enough.
+  const std::vector<int64_t> indices = {5, 3 * 1024 + 5, 1023 * 1024 + 900, 77,
+                                        5};
+  ASSERT_OK_AND_ASSIGN(HintlessPirBatchRequest batch_request,
+                       client->GenerateBatchRequest(indices));
+  EXPECT_EQ(batch_request.requests_size(), 3);
+  ASSERT_OK_AND_ASSIGN(HintlessPirBatchResponse batch_response,
+                       server_->HandleBatchRequest(batch_request));
+  ASSERT_OK_AND_ASSIGN(std::vector<std::string> records,
+                       client->RecoverRecords(batch_response));
+  ASSERT_EQ(records.size(), indices.size());
+  for (int i = 0; i < indices.size(); ++i) {
+    ExpectRecord(records[i], indices[i]);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndUpdateTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+
+  // Update records after preprocessing, without refreshing the public params.
+  const std::vector<int64_t> indices = {5, 42, 1023 * 1024 + 7};
+  std::vector<std::string> records;
+  for (int i = 0; i < indices.size(); ++i) {
+    records.push_back(testing::GenerateRandomRecord(params_));
+  }
+  ASSERT_OK(server_->UpdateRecords(indices, records));
+
+  for (int i = 0; i < indices.size(); ++i) {
+    ExpectRecord(records[i], indices[i]);
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+    ExpectRetrieves(*client, indices[i]);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndEpochRotationTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+  auto old_public_params = server_->GetPublicParams();
+  int64_t old_epoch_id = server_->CurrentEpochId();
+  EXPECT_EQ(old_public_params.epoch_id(), old_epoch_id);
+
+  ASSERT_OK_AND_ASSIGN(auto old_client, CreateClient());
+  ASSERT_OK(server_->PrepareNextEpoch());
+  // Preparing does not change the served epoch.
+  EXPECT_EQ(server_->CurrentEpochId(), old_epoch_id);
+  ASSERT_OK(server_->ActivateNextEpoch());
+  EXPECT_GT(server_->CurrentEpochId(), old_epoch_id);
+  EXPECT_NE(server_->GetPublicParams().prng_seed_lwe_query_pad(),
+            old_public_params.prng_seed_lwe_query_pad());
+
+  // Clients of both the previous and the current epoch are served.
+  ASSERT_OK_AND_ASSIGN(auto new_client, CreateClient());
+  for (Client* client : {old_client.get(), new_client.get()}) {
+    ExpectRetrieves(*client, 17);
+  }
+
+  // After the grace period, requests of the previous epoch are rejected.
+  server_->RetirePreviousEpoch();
+  ASSERT_OK_AND_ASSIGN(auto request, old_client->GenerateRequest(17));
+  EXPECT_THAT(server_->HandleRequest(request),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("no longer served")));
+  EXPECT_THAT(server_->ActivateNextEpoch(),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("No epoch has been prepared")));
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndFreshLinPirKeyTest) {
+  // The LinPir ciphertexts and Galois keys of all requests share the random
+  // pads of the public parameters, so two requests under one LinPir secret
+  // key would let the server subtract their LinPir ciphertexts and learn the
+  // difference of their LWE secrets. Under one key, the Galois keys of two
+  // requests would differ only by their small encryption errors.
+  using ModularInt = rlwe::MontgomeryInt<Parameters::RlweInteger>;
+  using RnsPolynomial = rlwe::RnsPolynomial<ModularInt>;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+  const std::vector<int64_t> indices = {5, 1023 * 1024 + 7};
+  std::vector<Client::RequestHandle> handles(indices.size());
+  ASSERT_OK_AND_ASSIGN(auto request0,
+                       client->GenerateRequest(indices[0], handles[0]));
+  ASSERT_OK_AND_ASSIGN(auto request1,
+                       client->GenerateRequest(indices[1], handles[1]));
+  ASSERT_GT(request0.linpir_gk_bs_size(), 0);
+  ASSERT_GT(request1.linpir_gk_bs_size(), 0);
+
+  const auto& linpir_params = kParameters.linpir_params;
+  ASSERT_OK_AND_ASSIGN(auto rns_context,
+                       rlwe::RnsContext<ModularInt>::
+                           CreateForBfvFiniteFieldEncoding(
+                               linpir_params.log_n, linpir_params.qs,
+                               /*ps=*/{}, linpir_params.ts[0]));
+  auto moduli = rns_context.MainPrimeModuli();
+  ASSERT_OK_AND_ASSIGN(
+      RnsPolynomial gk_b_diff,
+      RnsPolynomial::Deserialize(request0.linpir_gk_bs(0), moduli));
+  ASSERT_OK_AND_ASSIGN(
+      RnsPolynomial gk_b1,
+      RnsPolynomial::Deserialize(request1.linpir_gk_bs(0), moduli));
+  ASSERT_OK(gk_b_diff.SubInPlace(gk_b1, moduli));
+  if (gk_b_diff.IsNttForm()) {
+    ASSERT_OK(gk_b_diff.ConvertToCoeffForm(moduli));
+  }
+  Parameters::RlweInteger q = linpir_params.qs[0];
+  Parameters::RlweInteger error_bound = 1 << 10;
+  int num_small_coeffs = 0;
+  for (const ModularInt& coeff : gk_b_diff.Coeffs()[0]) {
+    Parameters::RlweInteger x = coeff.ExportInt(moduli[0]->ModParams());
+    if (std::min(x, q - x) < error_bound) {
+      ++num_small_coeffs;
+    }
+  }
+  EXPECT_LT(num_small_coeffs, gk_b_diff.Coeffs()[0].size() / 2);
+
+  // Both requests are answered.
+  const HintlessPirRequest* requests[] = {&request0, &request1};
+  for (int i = 0; i < indices.size(); ++i) {
+    ASSERT_OK_AND_ASSIGN(auto response, server_->HandleRequest(*requests[i]));
+    ASSERT_OK_AND_ASSIGN(auto record,
+                         client->RecoverRecord(response, handles[i]));
+    ExpectRecord(record, indices[i]);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndMultiThreadedTest) {
+  // The D*u pass and the LinPir instances of both plaintext moduli run
+  // concurrently on the server's workers.
+  Parameters params = kParameters;
+  params.num_threads = 4;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+  for (int64_t index : {3, 1023 * 1024 + 5}) {
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+    ExpectRetrieves(*client, index);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndConcurrentRequestsTest) {
+  // One server and one client handle many requests from concurrent callers,
+  // every caller keeping the handle of its own request.
+  Parameters params = kParameters;
+  params.num_threads = 2;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+
+  const std::vector<int64_t> indices = {1, 2, 1024 + 3, 1023 * 1024 + 9,
+                                        77, 500 * 1024, 1023, 12345};
+  std::vector<std::string> records(indices.size());
+  ThreadPool callers(4);
+  ParallelFor(indices.size(), &callers, [&](int64_t i) {
+    Client::RequestHandle handle;
+    ASSERT_OK_AND_ASSIGN(auto request,
+                         client->GenerateRequest(indices[i], handle));
+    ASSERT_OK_AND_ASSIGN(auto response, server_->HandleRequest(request));
+    ASSERT_OK_AND_ASSIGN(records[i], client->RecoverRecord(response, handle));
+  });
+  for (int i = 0; i < indices.size(); ++i) {
+    ExpectRecord(records[i], indices[i]);
+  }
+}
+
+// Assembles the parts of a streamed response into the full response.
+class AssemblingStream : public ResponseStream {
+ public:
+  void OnLweRecords(HintlessPirResponse lwe_response) override {
+    absl::MutexLock lock(&mutex_);
+    *response_.mutable_ct_records() =
+        std::move(*lwe_response.mutable_ct_records());
+  }
+
+  void OnLinPirBlock(int modulus_idx, int database_idx, int block_idx,
+                     LinPirResponseBlock ct_block) override {
+    absl::MutexLock lock(&mutex_);
+    while (response_.linpir_responses_size() <= modulus_idx) {
+      response_.add_linpir_responses();
+    }
+    auto* linpir_response = response_.mutable_linpir_responses(modulus_idx);
+    while (linpir_response->ct_inner_products_size() <= database_idx) {
+      linpir_response->add_ct_inner_products();
+    }
+    linpir::SetResponseBlock(
+        *linpir_response->mutable_ct_inner_products(database_idx), block_idx,
+        std::move(ct_block));
+  }
+
+  void OnDone(absl::Status status) override {
+    absl::MutexLock lock(&mutex_);
+    status_ = std::move(status);
+    done_.Notify();
+  }
+
+  // Waits for `OnDone` and returns the assembled response.
+  absl::StatusOr<HintlessPirResponse> Wait() {
+    done_.WaitForNotification();
+    absl::MutexLock lock(&mutex_);
+    if (!status_.ok()) {
+      return status_;
+    }
+    return response_;
+  }
+
+ private:
+  absl::Mutex mutex_;
+  HintlessPirResponse response_ ABSL_GUARDED_BY(mutex_);
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+  absl::Notification done_;
+};
+
+TEST_F(HintlessSimplePirTest, EndToEndAsyncTest) {
+  for (int num_threads : {1, 4}) {
+    Parameters params = kParameters;
+    params.num_threads = num_threads;
+    ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+
+    for (int64_t index : {4, 1023 * 1024 + 1}) {
+      ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+      AssemblingStream stream;
+      server_->HandleRequestAsync(std::move(request), &stream);
+      ASSERT_OK_AND_ASSIGN(auto response, stream.Wait());
+      ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+      ExpectRecord(record, index);
+    }
+
+    // Errors are reported to `OnDone`.
+    AssemblingStream stream;
+    server_->HandleRequestAsync(HintlessPirRequest(), &stream);
+    EXPECT_THAT(stream.Wait(),
+                StatusIs(absl::StatusCode::kInvalidArgument,
+                         HasSubstr("unexpected number of LinPir requests")));
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndNumaNodesTest) {
+  // Every node has a single worker, which also runs the LWE stage of the
+  // request, so the products must not wait for a driver scheduled on it.
+  Parameters params = kParameters;
+  params.num_threads = 2;
+  params.num_numa_nodes = 2;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+  ExpectRetrieves(*client, 1023 * 1024 + 6);
+
+  const int64_t index = 6;
+  ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+  AssemblingStream stream;
+  server_->HandleRequestAsync(std::move(request), &stream);
+  ASSERT_OK_AND_ASSIGN(auto response, stream.Wait());
+  ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+  ExpectRecord(record, index);
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndPrecomputedTest) {
+  ASSERT_NO_FATAL_FAILURE(SetUpServer());
+
+  // Both pad modes must produce requests the server can answer, whether or
+  // not they are drawn from the precomputed ones.
+  for (auto pad_mode :
+       {Client::PadMode::kMaterialized, Client::PadMode::kStreamed}) {
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient(pad_mode));
+    ASSERT_OK(client->Precompute(2));
+    EXPECT_EQ(client->NumPrecomputedRequests(), 2);
+    for (int64_t index : {7, 1023 * 1024 + 11, 100}) {
+      ExpectRetrieves(*client, index);
+    }
+    EXPECT_EQ(client->NumPrecomputedRequests(), 0);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndModSwitchedResponseTest) {
+  ASSERT_OK_AND_ASSIGN(auto full_server,
+                       Server::CreateWithRandomDatabaseRecords(kParameters));
+  ASSERT_OK(full_server->Preprocess());
+  Parameters params = kParameters;
+  params.lwe_response_bit_size = 16;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+  auto public_params = server_->GetPublicParams();
+  EXPECT_EQ(public_params.lwe_response_bit_size(), 16);
+
+  // The client learns the response modulus from the public parameters.
+  ASSERT_OK_AND_ASSIGN(auto client,
+                       Client::Create(kParameters, public_params));
+  ASSERT_OK_AND_ASSIGN(auto full_client,
+                       Client::Create(kParameters,
+                                      full_server->GetPublicParams()));
+  for (int64_t index : {9, 1023 * 1024 + 3}) {
+    ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(index));
+    ASSERT_OK_AND_ASSIGN(auto response, server_->HandleRequest(request));
+    ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+    ExpectRecord(record, index);
+
+    // The LWE part of the response shrinks to 16 bits per coefficient.
+    ASSERT_OK_AND_ASSIGN(auto full_request,
+                         full_client->GenerateRequest(index));
+    ASSERT_OK_AND_ASSIGN(auto full_response,
+                         full_server->HandleRequest(full_request));
+    EXPECT_LT(response.ct_records(0).ByteSizeLong(),
+              full_response.ct_records(0).ByteSizeLong() / 2);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndModSwitchedLinPirResponseTest) {
+  Parameters params = kParameters;
+  params.linpir_params.response_bit_size = 40;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+
+  // The LinPir blocks shrink from 90 to 40 bits per coefficient, both in
+  // buffered and in streamed responses.
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+  for (bool streamed : {false, true}) {
+    ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(1023 * 1024));
+    HintlessPirResponse response;
+    if (streamed) {
+      AssemblingStream stream;
+      server_->HandleRequestAsync(request, &stream);
+      ASSERT_OK_AND_ASSIGN(response, stream.Wait());
+    } else {
+      ASSERT_OK_AND_ASSIGN(response, server_->HandleRequest(request));
+    }
+    for (auto const& linpir_response : response.linpir_responses()) {
+      for (auto const& inner_product : linpir_response.ct_inner_products()) {
+        EXPECT_EQ(inner_product.ct_blocks_size(), 0);
+        EXPECT_GT(inner_product.mod_switched_ct_blocks_size(), 0);
+      }
+    }
+    ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+    ExpectRecord(record, 1023 * 1024);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndArenaTest) {
+  for (int lwe_response_bit_size : {0, 16}) {
+    Parameters params = kParameters;
+    params.lwe_response_bit_size = lwe_response_bit_size;
+    ASSERT_NO_FATAL_FAILURE(SetUpServer(params));
+    ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+
+    // The request and the response both live on the same arena.
+    const int64_t index = 2 * 1024 + 9;
+    google::protobuf::Arena arena;
+    auto* request = google::protobuf::Arena::Create<HintlessPirRequest>(&arena);
+    ASSERT_OK_AND_ASSIGN(*request, client->GenerateRequest(index));
+    ASSERT_OK_AND_ASSIGN(HintlessPirResponse* response,
+                         server_->HandleRequest(*request, &arena));
+    EXPECT_EQ(response->GetArena(), &arena);
+    ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(*response));
+    ExpectRecord(record, index);
+  }
+}
+
+TEST_F(HintlessSimplePirTest, EndToEndMetricsTest) {
+  MetricsRecorder server_metrics;
+  ASSERT_NO_FATAL_FAILURE(SetUpServer(kParameters, &server_metrics));
+
+  ASSERT_OK_AND_ASSIGN(auto client, CreateClient());
+  MetricsRecorder client_metrics;
+  client->SetMetricsSink(&client_metrics);
+  ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(7));
+  ASSERT_OK_AND_ASSIGN(auto response, server_->HandleRequest(request));
+  ASSERT_OK_AND_ASSIGN(auto record, client->RecoverRecord(response));
+  ExpectRecord(record, 7);
+
+  // Every LinPir instance records its own rotations and inner products.
+  int num_linpir_instances = kParameters.linpir_params.ts.size();
+  EXPECT_EQ(server_metrics.Get(Phase::kHintComputation).count, 1);
+  EXPECT_EQ(server_metrics.Get(Phase::kLinPirPreprocessing).count, 1);
+  EXPECT_EQ(server_metrics.Get(Phase::kRequestDeserialization).count, 1);
+  EXPECT_EQ(server_metrics.Get(Phase::kLweInnerProduct).count, 1);
+  EXPECT_EQ(server_metrics.Get(Phase::kLinPirRotations).count,
+            num_linpir_instances);
+  EXPECT_EQ(server_metrics.Get(Phase::kLinPirInnerProducts).count,
+            num_linpir_instances);
+  EXPECT_EQ(server_metrics.Get(Phase::kResponseSerialization).count, 1);
+  EXPECT_EQ(server_metrics.Get(Phase::kRequestDeserialization).bytes_in,
+            static_cast<int64_t>(request.ByteSizeLong()));
+  EXPECT_EQ(server_metrics.Get(Phase::kResponseSerialization).bytes_out,
+            static_cast<int64_t>(response.ByteSizeLong()));
+
+  EXPECT_EQ(client_metrics.Get(Phase::kClientPadExpansion).count, 1);
+  EXPECT_EQ(client_metrics.Get(Phase::kClientRequestGeneration).count, 1);
+  EXPECT_EQ(client_metrics.Get(Phase::kClientRequestGeneration).bytes_out,
+            static_cast<int64_t>(request.ByteSizeLong()));
+  EXPECT_EQ(client_metrics.Get(Phase::kClientDecode).count, 1);
+  EXPECT_EQ(client_metrics.Get(Phase::kClientDecode).bytes_in,
+            static_cast<int64_t>(response.ByteSizeLong()));
+}
+
 /*
 TEST(HintlessSimplePir, EndToEndTestWithChaChaPrng) {
   // Use ChaCha PRNG in both LinPIR and SimplePIR sub-protocols.
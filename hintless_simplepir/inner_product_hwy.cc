@@ -16,6 +16,8 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 #include "absl/base/optimization.h"
@@ -24,6 +26,7 @@
 #include "absl/types/span.h"
 #include "hwy/detect_targets.h"
 #include "lwe/types.h"
+#include "shell_encryption/status_macros.h"
 
 // Highway implementations.
 // clang-format off
@@ -35,6 +38,7 @@
 // Must come after foreach_target.h to avoid redefinition errors.
 #include "hwy/aligned_allocator.h"
 #include "hwy/highway.h"
+#include "hwy/targets.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace hintless_pir::hintless_simplepir::internal {
@@ -43,127 +47,609 @@ namespace HWY_NAMESPACE {
 #if HWY_TARGET == HWY_SCALAR
 
 template <typename PlainInteger>
-absl::StatusOr<std::vector<lwe::Integer>> InnerProductHwy(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
-  return InnerProductNoHwy<PlainInteger>(matrix, vec);
+absl::Status InnerProductRangeHwy(const BlockMatrix& matrix,
+                                  absl::Span<const lwe::Integer> vec,
+                                  int64_t block_begin, int64_t block_end,
+                                  int unroll, lwe::Integer* aligned_results) {
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<PlainInteger>;
+  return InnerProductRangeNoHwy<PlainInteger>(
+      matrix, vec, block_begin, block_end,
+      absl::MakeSpan(aligned_results, num_rows));
+}
+
+absl::Status InnerProductRangeDotHwy(const BlockMatrix& matrix,
+                                     absl::Span<const lwe::Integer> vec,
+                                     int64_t block_begin, int64_t block_end,
+                                     lwe::Integer* aligned_results) {
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<uint8_t>;
+  return InnerProductRangeNoHwy<uint8_t>(
+      matrix, vec, block_begin, block_end,
+      absl::MakeSpan(aligned_results, num_rows));
+}
+
+template <typename PlainInteger>
+absl::Status InnerProductBatchRangeHwy(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, int64_t stride, lwe::Integer* aligned_results) {
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<PlainInteger>;
+  for (int q = 0; q < vecs.size(); ++q) {
+    RLWE_RETURN_IF_ERROR(InnerProductRangeNoHwy<PlainInteger>(
+        matrix, vecs[q], block_begin, block_end,
+        absl::MakeSpan(aligned_results + q * stride, num_rows)));
+  }
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::Status MatrixProductRangeHwy(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  return MatrixProductRangeNoHwy<PlainInteger>(matrix, pad, num_cols,
+                                               row_begin, row_end, result);
 }
 
 #else
 
 namespace hn = hwy::HWY_NAMESPACE;
 
-template <typename PlainInteger>
-absl::StatusOr<std::vector<lwe::Integer>> InnerProductHwy(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
-  if (matrix.size() != vec.size()) {
-    return absl::InvalidArgumentError(
-        "`matrix` and `vec` must have matching dimensions.");
-  }
+// Returns whether hwy vectors of `num_lanes` LWE integers take a positive
+// multiple of 16 bytes, as the kernels below require.
+inline bool HasWholeVectorBlocks(int64_t num_lanes) {
+  int64_t num_bytes = num_lanes * sizeof(lwe::Integer);
+  return num_bytes >= 16 && num_bytes % 16 == 0;
+}
 
-  // Vector type used throughout this function: Largest byte vector
-  // available.
+// Adds `scalar` times the `num_rows` packed values at `values` to
+// `aligned_results`, `kUnroll` hwy vectors at a time. The accumulators of an
+// iteration are independent, so their loads and multiplications overlap.
+template <int kUnroll, typename PlainInteger>
+void MulAddColumn(const PlainInteger* values, lwe::Integer scalar,
+                  int64_t num_rows, lwe::Integer* aligned_results) {
   const hn::ScalableTag<lwe::Integer> d32;
   const hn::Rebind<PlainInteger, hn::ScalableTag<lwe::Integer>> d_plain;
   const int N = hn::Lanes(d32);
+  auto right32 = hn::Set(d32, scalar);
+
+  int64_t row_idx = 0;
+  // First, run kUnroll SIMD multiplications in each iteration.
+  for (; row_idx + N * kUnroll <= num_rows; row_idx += N * kUnroll) {
+    const PlainInteger* value_ptr = values + row_idx;
+    lwe::Integer* result_ptr = aligned_results + row_idx;
+    for (int u = 0; u < kUnroll; ++u) {
+      auto add32 = hn::Load(d32, result_ptr + u * N);
+      auto left32 = hn::PromoteTo(d32, hn::LoadU(d_plain, value_ptr + u * N));
+      hn::Store(hn::MulAdd(left32, right32, add32), d32, result_ptr + u * N);
+    }
+  }
+
+  // Next, run 1x per iteration.
+  for (; row_idx + N <= num_rows; row_idx += N) {
+    lwe::Integer* result_ptr = aligned_results + row_idx;
+    auto add32 = hn::Load(d32, result_ptr);
+    auto left = hn::LoadU(d_plain, values + row_idx);
+    auto left32 = hn::PromoteTo(d32, left);
+    auto mul32 = hn::MulAdd(left32, right32, add32);
+    hn::Store(mul32, d32, result_ptr);
+  }
+
+  // Handle the remaining rows that didn't take a full lane.
+  for (; row_idx < num_rows; ++row_idx) {
+    aligned_results[row_idx] +=
+        static_cast<lwe::Integer>(values[row_idx]) * scalar;
+  }
+}
+
+// Computes the rows packed in blocks [block_begin, block_end) of the product
+// `matrix` * `vec`, and stores them in `aligned_results`. The caller must have
+// validated the arguments, and `aligned_results` must be a hwy-aligned buffer
+// holding all rows in the range. Every column is accumulated `unroll` hwy
+// vectors at a time, for `unroll` in {1, 2, 4, 8}.
+template <typename PlainInteger>
+absl::Status InnerProductRangeHwy(const BlockMatrix& matrix,
+                                  absl::Span<const lwe::Integer> vec,
+                                  int64_t block_begin, int64_t block_end,
+                                  int unroll, lwe::Integer* aligned_results) {
+  const hn::ScalableTag<lwe::Integer> d32;
+  const int N = hn::Lanes(d32);
+
+  int64_t num_values_per_block = kNumValuesPerBlock<PlainInteger>;
+  int64_t num_rows = (block_end - block_begin) * num_values_per_block;
 
   // Do not run the highway version if
   // - the number of bytes in a hwy vector is less than 16, or
   // - the number of bytes in a hwy vector is not a multiple of 16.
-  if (ABSL_PREDICT_FALSE(N < 4 || N % 4 != 0)) {
-    return InnerProductNoHwy<PlainInteger>(matrix, vec);
+  if (ABSL_PREDICT_FALSE(!HasWholeVectorBlocks(N))) {
+    return InnerProductRangeNoHwy<PlainInteger>(
+        matrix, vec, block_begin, block_end,
+        absl::MakeSpan(aligned_results, num_rows));
   }
 
-  // Assume all columns have the same size.
-  int num_blocks = matrix[0].size();
-  int num_values_per_block = sizeof(BlockType) / sizeof(PlainInteger);
-  int num_rows = num_blocks * num_values_per_block;
-
-  // Allocate aligned buffers to hold the intermediate values of inner
-  // products.
-  hwy::AlignedFreeUniquePtr<lwe::Integer[]> aligned_results =
-      hwy::AllocateAligned<lwe::Integer>(num_rows);
-  std::fill_n(aligned_results.get(), num_rows, 0);
+  std::fill_n(aligned_results, num_rows, 0);
 
   for (int j = 0; j < vec.size(); ++j) {
-    int row_idx = 0;
-    const PlainInteger* value_ptr = 0;
-    // First, run 4x SIMD multiplication in each iteration.
-    for (; row_idx + N * 4 <= num_rows; row_idx += N * 4) {
-      if (row_idx % num_values_per_block == 0) {
-        int block_idx = row_idx / num_values_per_block;
-        value_ptr =
-            reinterpret_cast<const PlainInteger*>(&matrix[j][block_idx]);
-      } else {
-        value_ptr += N;
+    // The blocks of a column are contiguous, so the packed values in the range
+    // form a single array.
+    const PlainInteger* values =
+        reinterpret_cast<const PlainInteger*>(matrix[j].data() + block_begin);
+    switch (unroll) {
+      case 1:
+        MulAddColumn<1>(values, vec[j], num_rows, aligned_results);
+        break;
+      case 2:
+        MulAddColumn<2>(values, vec[j], num_rows, aligned_results);
+        break;
+      case 8:
+        MulAddColumn<8>(values, vec[j], num_rows, aligned_results);
+        break;
+      default:
+        MulAddColumn<4>(values, vec[j], num_rows, aligned_results);
+        break;
+    }
+  }
+  return absl::OkStatus();
+}
+
+// The number of rows whose digit sums `InnerProductRangeDotHwy` keeps at a
+// time. The sums of the four digits take 16KB, which stays in the L1 cache.
+constexpr int64_t kNumDotRowsPerChunk = 1024;
+
+// Adds the dot products between the quadruples of bytes of `quads` and those of
+// the digits `d0`..`d3` to the 32-bit sums at `sums` + l * `stride` for
+// digit l.
+template <class DI32, class VU8, class VI8>
+HWY_INLINE void AccumulateDigits(DI32 di32, VU8 quads, VI8 d0, VI8 d1, VI8 d2,
+                                 VI8 d3, int32_t* sums, int64_t stride) {
+  int32_t* s0 = sums;
+  int32_t* s1 = sums + stride;
+  int32_t* s2 = sums + 2 * stride;
+  int32_t* s3 = sums + 3 * stride;
+  hn::Store(hn::SumOfMulQuadAccumulate(di32, quads, d0, hn::Load(di32, s0)),
+            di32, s0);
+  hn::Store(hn::SumOfMulQuadAccumulate(di32, quads, d1, hn::Load(di32, s1)),
+            di32, s1);
+  hn::Store(hn::SumOfMulQuadAccumulate(di32, quads, d2, hn::Load(di32, s2)),
+            di32, s2);
+  hn::Store(hn::SumOfMulQuadAccumulate(di32, quads, d3, hn::Load(di32, s3)),
+            di32, s3);
+}
+
+// Same as `InnerProductRangeHwy<uint8_t>`, but multiplies the values with 8-bit
+// dot product instructions, e.g. VNNI on x86 and dot products on Arm, instead
+// of promoting them to 32 bits. Every entry of `vec` is split into four signed
+// digits d_l in [-128, 128), so that vec[j] = sum_l d_l * 2^(8l) mod 2^32. The
+// bytes of four consecutive columns are interleaved, so that one instruction
+// adds the products of a row of the four columns with their digit l to the
+// 32-bit sum of digit l for that row. The sums of a row are recombined mod 2^32
+// at the end, where wrapping around does not change the result.
+absl::Status InnerProductRangeDotHwy(const BlockMatrix& matrix,
+                                     absl::Span<const lwe::Integer> vec,
+                                     int64_t block_begin, int64_t block_end,
+                                     lwe::Integer* aligned_results) {
+  const hn::ScalableTag<int32_t> di32;
+  const hn::Repartition<uint8_t, decltype(di32)> du8;
+  const hn::Repartition<int8_t, decltype(di32)> di8;
+  const hn::Repartition<uint16_t, decltype(di32)> du16;
+  const int64_t N = hn::Lanes(di32);
+  // The rows of a column filling a vector of bytes.
+  const int64_t num_vector_rows = hn::Lanes(du8);
+  const int64_t num_chunk_rows =
+      kNumDotRowsPerChunk / num_vector_rows * num_vector_rows;
+
+  // Interleaving works on 128-bit blocks, which must hold whole quadruples,
+  // and the four digits only make up 32-bit integers.
+  if (sizeof(lwe::Integer) != sizeof(uint32_t) ||
+      ABSL_PREDICT_FALSE(N < 4 || N % 4 != 0 || num_chunk_rows == 0)) {
+    return InnerProductRangeHwy<uint8_t>(matrix, vec, block_begin, block_end,
+                                         /*unroll=*/4, aligned_results);
+  }
+
+  int64_t num_rows = (block_end - block_begin) * kNumValuesPerBlock<uint8_t>;
+  int64_t num_full_rows = num_rows / num_vector_rows * num_vector_rows;
+  int64_t num_cols = vec.size();
+  int64_t num_quad_cols = num_cols / 4 * 4;
+  auto column = [&](int64_t j) {
+    return reinterpret_cast<const uint8_t*>(matrix[j].data() + block_begin);
+  };
+
+  HWY_ALIGN int32_t sums[4 * kNumDotRowsPerChunk];
+  for (int64_t chunk_begin = 0; chunk_begin < num_full_rows;
+       chunk_begin += num_chunk_rows) {
+    int64_t chunk_rows = std::min(num_chunk_rows, num_full_rows - chunk_begin);
+    std::fill_n(sums, 4 * chunk_rows, 0);
+    for (int64_t j = 0; j < num_quad_cols; j += 4) {
+      // Byte k of the l-th digit quadruple is digit l of vec[j + k].
+      uint32_t digit_quads[4] = {0, 0, 0, 0};
+      for (int k = 0; k < 4; ++k) {
+        uint32_t value = vec[j + k];
+        for (int l = 0; l < 4; ++l) {
+          auto digit = static_cast<int8_t>(value & 0xFF);
+          value = (value - static_cast<uint32_t>(int32_t{digit})) >> 8;
+          digit_quads[l] |= uint32_t{static_cast<uint8_t>(digit)} << (8 * k);
+        }
+      }
+      auto d0 = hn::BitCast(
+          di8, hn::Set(di32, static_cast<int32_t>(digit_quads[0])));
+      auto d1 = hn::BitCast(
+          di8, hn::Set(di32, static_cast<int32_t>(digit_quads[1])));
+      auto d2 = hn::BitCast(
+          di8, hn::Set(di32, static_cast<int32_t>(digit_quads[2])));
+      auto d3 = hn::BitCast(
+          di8, hn::Set(di32, static_cast<int32_t>(digit_quads[3])));
+
+      const uint8_t* c0 = column(j) + chunk_begin;
+      const uint8_t* c1 = column(j + 1) + chunk_begin;
+      const uint8_t* c2 = column(j + 2) + chunk_begin;
+      const uint8_t* c3 = column(j + 3) + chunk_begin;
+      for (int64_t r = 0; r < chunk_rows; r += num_vector_rows) {
+        auto v0 = hn::LoadU(du8, c0 + r);
+        auto v1 = hn::LoadU(du8, c1 + r);
+        auto v2 = hn::LoadU(du8, c2 + r);
+        auto v3 = hn::LoadU(du8, c3 + r);
+        // Within every 128-bit block, the quadruple m of `quads_k` holds the
+        // row 4k + m of the block in the four columns.
+        auto lo01 = hn::BitCast(du16, hn::InterleaveLower(du8, v0, v1));
+        auto hi01 = hn::BitCast(du16, hn::InterleaveUpper(du8, v0, v1));
+        auto lo23 = hn::BitCast(du16, hn::InterleaveLower(du8, v2, v3));
+        auto hi23 = hn::BitCast(du16, hn::InterleaveUpper(du8, v2, v3));
+        auto quads_0 = hn::BitCast(du8, hn::InterleaveLower(du16, lo01, lo23));
+        auto quads_1 = hn::BitCast(du8, hn::InterleaveUpper(du16, lo01, lo23));
+        auto quads_2 = hn::BitCast(du8, hn::InterleaveLower(du16, hi01, hi23));
+        auto quads_3 = hn::BitCast(du8, hn::InterleaveUpper(du16, hi01, hi23));
+        int32_t* sums_ptr = sums + r;
+        AccumulateDigits(di32, quads_0, d0, d1, d2, d3, sums_ptr, chunk_rows);
+        AccumulateDigits(di32, quads_1, d0, d1, d2, d3, sums_ptr + N,
+                         chunk_rows);
+        AccumulateDigits(di32, quads_2, d0, d1, d2, d3, sums_ptr + 2 * N,
+                         chunk_rows);
+        AccumulateDigits(di32, quads_3, d0, d1, d2, d3, sums_ptr + 3 * N,
+                         chunk_rows);
+      }
+    }
+
+    // Recombine the digit sums, and undo the interleaving of the rows: lane
+    // 4b + m of the k-th sum vector holds row 16b + 4k + m.
+    lwe::Integer* chunk_results = aligned_results + chunk_begin;
+    for (int64_t r = 0; r < chunk_rows; r += num_vector_rows) {
+      for (int64_t k = 0; k < 4; ++k) {
+        for (int64_t i = 0; i < N; ++i) {
+          int64_t src = r + k * N + i;
+          uint32_t sum = static_cast<uint32_t>(sums[src]) +
+                         (static_cast<uint32_t>(sums[chunk_rows + src]) << 8) +
+                         (static_cast<uint32_t>(sums[2 * chunk_rows + src])
+                          << 16) +
+                         (static_cast<uint32_t>(sums[3 * chunk_rows + src])
+                          << 24);
+          chunk_results[r + i / 4 * 16 + 4 * k + i % 4] = sum;
+        }
       }
-      lwe::Integer* result_ptr = &aligned_results[row_idx];
-      auto add32_0 = hn::Load(d32, result_ptr);
-      auto add32_1 = hn::Load(d32, result_ptr + N);
-      auto add32_2 = hn::Load(d32, result_ptr + 2 * N);
-      auto add32_3 = hn::Load(d32, result_ptr + 3 * N);
+    }
+    // The columns beyond the last quadruple.
+    for (int64_t j = num_quad_cols; j < num_cols; ++j) {
+      MulAddColumn<4>(column(j) + chunk_begin, vec[j], chunk_rows,
+                      chunk_results);
+    }
+  }
+
+  // The rows that don't fill a vector of bytes.
+  std::fill(aligned_results + num_full_rows, aligned_results + num_rows, 0);
+  for (int64_t j = 0; j < num_cols; ++j) {
+    MulAddColumn<1>(column(j) + num_full_rows, vec[j],
+                    num_rows - num_full_rows, aligned_results + num_full_rows);
+  }
+  return absl::OkStatus();
+}
+
+// Computes the rows packed in blocks [block_begin, block_end) of the products
+// `matrix` * `vecs[q]`, and stores the q-th product at `aligned_results` +
+// q * `stride`. The caller must have validated the arguments, and `stride`
+// must keep every product aligned.
+template <typename PlainInteger>
+absl::Status InnerProductBatchRangeHwy(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, int64_t stride, lwe::Integer* aligned_results) {
+  const hn::ScalableTag<lwe::Integer> d32;
+  const hn::Rebind<PlainInteger, hn::ScalableTag<lwe::Integer>> d_plain;
+  const int N = hn::Lanes(d32);
 
-      auto left0 = hn::LoadU(d_plain, value_ptr);
-      auto left1 = hn::LoadU(d_plain, value_ptr + N);
-      auto left2 = hn::LoadU(d_plain, value_ptr + 2 * N);
-      auto left3 = hn::LoadU(d_plain, value_ptr + 3 * N);
+  int64_t num_values_per_block = kNumValuesPerBlock<PlainInteger>;
+  int64_t num_rows = (block_end - block_begin) * num_values_per_block;
+  int num_vecs = vecs.size();
 
-      auto left32_0 = hn::PromoteTo(d32, left0);
-      auto left32_1 = hn::PromoteTo(d32, left1);
-      auto left32_2 = hn::PromoteTo(d32, left2);
-      auto left32_3 = hn::PromoteTo(d32, left3);
+  if (ABSL_PREDICT_FALSE(!HasWholeVectorBlocks(N))) {
+    for (int q = 0; q < num_vecs; ++q) {
+      RLWE_RETURN_IF_ERROR(InnerProductRangeNoHwy<PlainInteger>(
+          matrix, vecs[q], block_begin, block_end,
+          absl::MakeSpan(aligned_results + q * stride, num_rows)));
+    }
+    return absl::OkStatus();
+  }
 
-      auto right32 = hn::Set(d32, vec[j]);
+  for (int q = 0; q < num_vecs; ++q) {
+    std::fill_n(aligned_results + q * stride, num_rows, 0);
+  }
 
-      auto mul32_0 = hn::MulAdd(left32_0, right32, add32_0);
-      auto mul32_1 = hn::MulAdd(left32_1, right32, add32_1);
-      auto mul32_2 = hn::MulAdd(left32_2, right32, add32_2);
-      auto mul32_3 = hn::MulAdd(left32_3, right32, add32_3);
+  for (int j = 0; j < matrix.size(); ++j) {
+    const PlainInteger* values =
+        reinterpret_cast<const PlainInteger*>(matrix[j].data() + block_begin);
 
-      hn::Store(mul32_0, d32, result_ptr);
-      hn::Store(mul32_1, d32, result_ptr + N);
-      hn::Store(mul32_2, d32, result_ptr + 2 * N);
-      hn::Store(mul32_3, d32, result_ptr + 3 * N);
+    int64_t row_idx = 0;
+    // Load and promote the packed values once, then accumulate them to the
+    // products with all vectors. The accumulators of a task cover only a range
+    // of rows, so they stay in cache across the columns.
+    for (; row_idx + N * 2 <= num_rows; row_idx += N * 2) {
+      auto left32_0 = hn::PromoteTo(d32, hn::LoadU(d_plain, values + row_idx));
+      auto left32_1 =
+          hn::PromoteTo(d32, hn::LoadU(d_plain, values + row_idx + N));
+      lwe::Integer* result_ptr = aligned_results + row_idx;
+      for (int q = 0; q < num_vecs; ++q, result_ptr += stride) {
+        auto right32 = hn::Set(d32, vecs[q][j]);
+        auto add32_0 = hn::Load(d32, result_ptr);
+        auto add32_1 = hn::Load(d32, result_ptr + N);
+        hn::Store(hn::MulAdd(left32_0, right32, add32_0), d32, result_ptr);
+        hn::Store(hn::MulAdd(left32_1, right32, add32_1), d32,
+                  result_ptr + N);
+      }
     }
 
-    // Next, run 1x per iteration.
     for (; row_idx + N <= num_rows; row_idx += N) {
-      if (row_idx % num_values_per_block == 0) {
-        int block_idx = row_idx / num_values_per_block;
-        value_ptr =
-            reinterpret_cast<const PlainInteger*>(&matrix[j][block_idx]);
-      } else {
-        value_ptr += N;
+      auto left32 = hn::PromoteTo(d32, hn::LoadU(d_plain, values + row_idx));
+      lwe::Integer* result_ptr = aligned_results + row_idx;
+      for (int q = 0; q < num_vecs; ++q, result_ptr += stride) {
+        auto right32 = hn::Set(d32, vecs[q][j]);
+        auto add32 = hn::Load(d32, result_ptr);
+        hn::Store(hn::MulAdd(left32, right32, add32), d32, result_ptr);
       }
-      lwe::Integer* result_ptr = &aligned_results[row_idx];
-      auto add32 = hn::Load(d32, result_ptr);
-      auto left = hn::LoadU(d_plain, value_ptr);
-      auto left32 = hn::PromoteTo(d32, left);
-      auto right32 = hn::Set(d32, vec[j]);
-      auto mul32 = hn::MulAdd(left32, right32, add32);
-      hn::Store(mul32, d32, result_ptr);
     }
 
     // Handle the remaining rows that didn't take a full lane.
-    if (row_idx < num_rows) {
-      int block_idx = row_idx / num_values_per_block;
-      const lwe::PlainInteger* block_as_values =
-          reinterpret_cast<const lwe::PlainInteger*>(&matrix[j][block_idx]);
-      for (; row_idx < num_rows; ++row_idx) {
-        if (row_idx % num_values_per_block == 0) {
-          // update the block pointer, which should be rate
-          block_idx = row_idx / num_values_per_block;
-          block_as_values =
-              reinterpret_cast<const lwe::PlainInteger*>(&matrix[j][block_idx]);
+    for (; row_idx < num_rows; ++row_idx) {
+      auto value = static_cast<lwe::Integer>(values[row_idx]);
+      for (int q = 0; q < num_vecs; ++q) {
+        aligned_results[q * stride + row_idx] += value * vecs[q][j];
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Same as the generic `InnerProductRangeHwy`, but loads half as many bytes per
+// value: every byte of a block is promoted once, and its low and high nibbles
+// are accumulated to the rows 16 apart. Every block fills a fixed number of
+// hwy vectors, so `unroll` is ignored.
+template <>
+absl::Status InnerProductRangeHwy<Nibble>(const BlockMatrix& matrix,
+                                          absl::Span<const lwe::Integer> vec,
+                                          int64_t block_begin,
+                                          int64_t block_end, int unroll,
+                                          lwe::Integer* aligned_results) {
+  const hn::ScalableTag<lwe::Integer> d32;
+  const hn::Rebind<uint8_t, hn::ScalableTag<lwe::Integer>> d8;
+  const int N = hn::Lanes(d32);
+  constexpr int kNumBytes = sizeof(BlockType);
+  int64_t num_blocks = block_end - block_begin;
+  int64_t num_rows = num_blocks * kNumValuesPerBlock<Nibble>;
+
+  // Both halves of a block must fill whole hwy vectors.
+  if (ABSL_PREDICT_FALSE(!HasWholeVectorBlocks(N) || kNumBytes % N != 0)) {
+    return InnerProductRangeNoHwy<Nibble>(
+        matrix, vec, block_begin, block_end,
+        absl::MakeSpan(aligned_results, num_rows));
+  }
+
+  std::fill_n(aligned_results, num_rows, 0);
+  const auto low_mask = hn::Set(d32, 0xF);
+  for (int j = 0; j < vec.size(); ++j) {
+    const uint8_t* bytes =
+        reinterpret_cast<const uint8_t*>(matrix[j].data() + block_begin);
+    auto right32 = hn::Set(d32, vec[j]);
+    for (int64_t b = 0; b < num_blocks; ++b) {
+      const uint8_t* block_bytes = bytes + b * kNumBytes;
+      lwe::Integer* result_ptr =
+          aligned_results + b * kNumValuesPerBlock<Nibble>;
+      for (int k = 0; k < kNumBytes; k += N) {
+        auto packed32 = hn::PromoteTo(d32, hn::LoadU(d8, block_bytes + k));
+        auto low32 = hn::And(packed32, low_mask);
+        auto high32 = hn::ShiftRight<4>(packed32);
+        auto add_low = hn::Load(d32, result_ptr + k);
+        auto add_high = hn::Load(d32, result_ptr + kNumBytes + k);
+        hn::Store(hn::MulAdd(low32, right32, add_low), d32, result_ptr + k);
+        hn::Store(hn::MulAdd(high32, right32, add_high), d32,
+                  result_ptr + kNumBytes + k);
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Same as the generic `InnerProductBatchRangeHwy`, with the nibbles unpacked
+// in registers as in `InnerProductRangeHwy<Nibble>`.
+template <>
+absl::Status InnerProductBatchRangeHwy<Nibble>(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, int64_t stride, lwe::Integer* aligned_results) {
+  const hn::ScalableTag<lwe::Integer> d32;
+  const hn::Rebind<uint8_t, hn::ScalableTag<lwe::Integer>> d8;
+  const int N = hn::Lanes(d32);
+  constexpr int kNumBytes = sizeof(BlockType);
+  int64_t num_blocks = block_end - block_begin;
+  int64_t num_rows = num_blocks * kNumValuesPerBlock<Nibble>;
+  int num_vecs = vecs.size();
+
+  if (ABSL_PREDICT_FALSE(!HasWholeVectorBlocks(N) || kNumBytes % N != 0)) {
+    for (int q = 0; q < num_vecs; ++q) {
+      RLWE_RETURN_IF_ERROR(InnerProductRangeNoHwy<Nibble>(
+          matrix, vecs[q], block_begin, block_end,
+          absl::MakeSpan(aligned_results + q * stride, num_rows)));
+    }
+    return absl::OkStatus();
+  }
+
+  for (int q = 0; q < num_vecs; ++q) {
+    std::fill_n(aligned_results + q * stride, num_rows, 0);
+  }
+  const auto low_mask = hn::Set(d32, 0xF);
+  for (int j = 0; j < matrix.size(); ++j) {
+    const uint8_t* bytes =
+        reinterpret_cast<const uint8_t*>(matrix[j].data() + block_begin);
+    for (int64_t b = 0; b < num_blocks; ++b) {
+      const uint8_t* block_bytes = bytes + b * kNumBytes;
+      for (int k = 0; k < kNumBytes; k += N) {
+        auto packed32 = hn::PromoteTo(d32, hn::LoadU(d8, block_bytes + k));
+        auto low32 = hn::And(packed32, low_mask);
+        auto high32 = hn::ShiftRight<4>(packed32);
+        lwe::Integer* result_ptr =
+            aligned_results + b * kNumValuesPerBlock<Nibble> + k;
+        for (int q = 0; q < num_vecs; ++q, result_ptr += stride) {
+          auto right32 = hn::Set(d32, vecs[q][j]);
+          auto add_low = hn::Load(d32, result_ptr);
+          auto add_high = hn::Load(d32, result_ptr + kNumBytes);
+          hn::Store(hn::MulAdd(low32, right32, add_low), d32, result_ptr);
+          hn::Store(hn::MulAdd(high32, right32, add_high), d32,
+                    result_ptr + kNumBytes);
         }
-        int block_pos = row_idx % num_values_per_block;
-        aligned_results.get()[row_idx] +=
-            static_cast<lwe::Integer>(block_as_values[block_pos]) * vec[j];
       }
     }
   }
+  return absl::OkStatus();
+}
 
-  return std::vector<lwe::Integer>(aligned_results.get(),
-                                   aligned_results.get() + num_rows);
+// The number of columns of the matrix, i.e. rows of the pad, processed
+// together by `MatrixProductRangeHwy`. The packed values of up to 256 rows in
+// these columns and a tile of the pad stay in cache while they are multiplied
+// with all the tiles of the other operand.
+constexpr int64_t kNumColsPerPanel = 256;
+
+// The number of result rows held in registers by `MatrixProductRangeHwy`.
+constexpr int kNumRowsPerTile = 4;
+
+// Computes the rows [row_begin, row_end) of `matrix` * `pad`. The caller must
+// have validated the arguments. Each lane holds a column of the result, so the
+// products are written directly to the rows of `result`.
+template <typename PlainInteger>
+absl::Status MatrixProductRangeHwy(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  const hn::ScalableTag<lwe::Integer> d32;
+  const int64_t N = hn::Lanes(d32);
+  if (ABSL_PREDICT_FALSE(!HasWholeVectorBlocks(N))) {
+    return MatrixProductRangeNoHwy<PlainInteger>(matrix, pad, num_cols,
+                                                 row_begin, row_end, result);
+  }
+
+  int64_t num_rows = row_end - row_begin;
+  for (int64_t i = 0; i < num_rows; ++i) {
+    std::fill_n(result[i].begin(), num_cols, 0);
+  }
+  int64_t num_tile_rows = num_rows / kNumRowsPerTile * kNumRowsPerTile;
+
+  // The packed values of column j start at `blocks + j * col_stride`.
+  const BlockType* blocks = matrix.Blocks().data();
+  int64_t col_stride = matrix.ColumnStride();
+
+  for (int64_t j_begin = 0; j_begin < matrix.size();
+       j_begin += kNumColsPerPanel) {
+    int64_t j_end =
+        std::min<int64_t>(j_begin + kNumColsPerPanel, matrix.size());
+
+    int64_t k = 0;
+    // First, compute tiles of 4 rows x 2 hwy vectors.
+    for (; k + 2 * N <= num_cols; k += 2 * N) {
+      int64_t i = 0;
+      for (; i < num_tile_rows; i += kNumRowsPerTile) {
+        lwe::Integer* row0 = result[i].data() + k;
+        lwe::Integer* row1 = result[i + 1].data() + k;
+        lwe::Integer* row2 = result[i + 2].data() + k;
+        lwe::Integer* row3 = result[i + 3].data() + k;
+        auto acc0_0 = hn::LoadU(d32, row0);
+        auto acc0_1 = hn::LoadU(d32, row0 + N);
+        auto acc1_0 = hn::LoadU(d32, row1);
+        auto acc1_1 = hn::LoadU(d32, row1 + N);
+        auto acc2_0 = hn::LoadU(d32, row2);
+        auto acc2_1 = hn::LoadU(d32, row2 + N);
+        auto acc3_0 = hn::LoadU(d32, row3);
+        auto acc3_1 = hn::LoadU(d32, row3 + N);
+        for (int64_t j = j_begin; j < j_end; ++j) {
+          const BlockType* col = blocks + j * col_stride;
+          int64_t row = row_begin + i;
+          const lwe::Integer* pad_row = pad.data() + j * num_cols + k;
+          auto right0 = hn::LoadU(d32, pad_row);
+          auto right1 = hn::LoadU(d32, pad_row + N);
+          auto left0 = hn::Set(d32, PackedValue<PlainInteger>(col, row));
+          auto left1 = hn::Set(d32, PackedValue<PlainInteger>(col, row + 1));
+          auto left2 = hn::Set(d32, PackedValue<PlainInteger>(col, row + 2));
+          auto left3 = hn::Set(d32, PackedValue<PlainInteger>(col, row + 3));
+          acc0_0 = hn::MulAdd(left0, right0, acc0_0);
+          acc0_1 = hn::MulAdd(left0, right1, acc0_1);
+          acc1_0 = hn::MulAdd(left1, right0, acc1_0);
+          acc1_1 = hn::MulAdd(left1, right1, acc1_1);
+          acc2_0 = hn::MulAdd(left2, right0, acc2_0);
+          acc2_1 = hn::MulAdd(left2, right1, acc2_1);
+          acc3_0 = hn::MulAdd(left3, right0, acc3_0);
+          acc3_1 = hn::MulAdd(left3, right1, acc3_1);
+        }
+        hn::StoreU(acc0_0, d32, row0);
+        hn::StoreU(acc0_1, d32, row0 + N);
+        hn::StoreU(acc1_0, d32, row1);
+        hn::StoreU(acc1_1, d32, row1 + N);
+        hn::StoreU(acc2_0, d32, row2);
+        hn::StoreU(acc2_1, d32, row2 + N);
+        hn::StoreU(acc3_0, d32, row3);
+        hn::StoreU(acc3_1, d32, row3 + N);
+      }
+      // The remaining rows that don't fill a tile.
+      for (; i < num_rows; ++i) {
+        lwe::Integer* row = result[i].data() + k;
+        auto acc_0 = hn::LoadU(d32, row);
+        auto acc_1 = hn::LoadU(d32, row + N);
+        for (int64_t j = j_begin; j < j_end; ++j) {
+          const lwe::Integer* pad_row = pad.data() + j * num_cols + k;
+          auto left = hn::Set(d32, PackedValue<PlainInteger>(
+                                       blocks + j * col_stride, row_begin + i));
+          acc_0 = hn::MulAdd(left, hn::LoadU(d32, pad_row), acc_0);
+          acc_1 = hn::MulAdd(left, hn::LoadU(d32, pad_row + N), acc_1);
+        }
+        hn::StoreU(acc_0, d32, row);
+        hn::StoreU(acc_1, d32, row + N);
+      }
+    }
+
+    // Next, one hwy vector of columns per iteration.
+    for (; k + N <= num_cols; k += N) {
+      for (int64_t i = 0; i < num_rows; ++i) {
+        lwe::Integer* row = result[i].data() + k;
+        auto acc = hn::LoadU(d32, row);
+        for (int64_t j = j_begin; j < j_end; ++j) {
+          auto left = hn::Set(d32, PackedValue<PlainInteger>(
+                                       blocks + j * col_stride, row_begin + i));
+          acc = hn::MulAdd(left, hn::LoadU(d32, pad.data() + j * num_cols + k),
+                           acc);
+        }
+        hn::StoreU(acc, d32, row);
+      }
+    }
+
+    // Handle the remaining columns that didn't take a full lane.
+    for (; k < num_cols; ++k) {
+      for (int64_t i = 0; i < num_rows; ++i) {
+        lwe::Integer sum = result[i][k];
+        for (int64_t j = j_begin; j < j_end; ++j) {
+          sum += PackedValue<PlainInteger>(blocks + j * col_stride,
+                                           row_begin + i) *
+                 pad[j * num_cols + k];
+        }
+        result[i][k] = sum;
+      }
+    }
+  }
+  return absl::OkStatus();
 }
 
 #endif  // HWY_TARGET == HWY_SCALAR
@@ -175,59 +661,493 @@ HWY_AFTER_NAMESPACE();
 #if HWY_ONCE || HWY_IDE
 namespace hintless_pir::hintless_simplepir::internal {
 
+lwe::Integer* InnerProductWorkspace::AlignedBuffer(int64_t num_values) {
+  // Over-allocate by one alignment unit, so that an aligned buffer of
+  // `num_values` integers always fits in the storage.
+  constexpr int64_t kAlignedValues = HWY_ALIGNMENT / sizeof(lwe::Integer);
+  int64_t num_storage_values =
+      std::max<int64_t>(num_values, 1) + kAlignedValues;
+  if (storage_.size() < num_storage_values) {
+    storage_.resize(num_storage_values);
+  }
+  uintptr_t address = reinterpret_cast<uintptr_t>(storage_.data());
+  uintptr_t offset = (HWY_ALIGNMENT - address % HWY_ALIGNMENT) % HWY_ALIGNMENT;
+  return storage_.data() + offset / sizeof(lwe::Integer);
+}
+
+absl::Status ValidateInnerProductConfig(const InnerProductConfig& config) {
+  if (config.unroll != 1 && config.unroll != 2 && config.unroll != 4 &&
+      config.unroll != 8) {
+    return absl::InvalidArgumentError("`unroll` must be 1, 2, 4 or 8.");
+  }
+  if (config.tile_blocks < 0) {
+    return absl::InvalidArgumentError("`tile_blocks` must be non-negative.");
+  }
+  return absl::OkStatus();
+}
+
+std::string HwyTargetName() {
+  // Better targets have lower bits, and the kernels dispatch to the best one
+  // that is both compiled in and supported by the CPU.
+  int64_t targets = hwy::SupportedTargets() & HWY_TARGETS;
+  return hwy::TargetName(targets & -targets);
+}
+
+namespace {
+
+absl::Status ValidateRange(const BlockMatrix& matrix,
+                           absl::Span<const lwe::Integer> vec,
+                           int64_t block_begin, int64_t block_end) {
+  if (matrix.size() != vec.size()) {
+    return absl::InvalidArgumentError(
+        "`matrix` and `vec` must have matching dimensions.");
+  }
+  // Assume all columns have the same size.
+  int64_t num_blocks = matrix.empty() ? 0 : matrix[0].size();
+  if (block_begin < 0 || block_begin > block_end || block_end > num_blocks) {
+    return absl::InvalidArgumentError("Invalid block range.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ValidateMatrixProductRange(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<const std::vector<lwe::Integer>> result,
+    int64_t num_values_per_block) {
+  if (num_cols < 0 || pad.size() != matrix.size() * num_cols) {
+    return absl::InvalidArgumentError(
+        "`matrix` and `pad` must have matching dimensions.");
+  }
+  int64_t num_rows = matrix.NumBlocksPerColumn() * num_values_per_block;
+  if (row_begin < 0 || row_begin > row_end || row_end > num_rows) {
+    return absl::InvalidArgumentError("Invalid row range.");
+  }
+  if (result.size() < row_end - row_begin) {
+    return absl::InvalidArgumentError("`result` is too small.");
+  }
+  for (int64_t i = 0; i < row_end - row_begin; ++i) {
+    if (result[i].size() < num_cols) {
+      return absl::InvalidArgumentError("`result` is too small.");
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+template <typename PlainInteger>
+absl::Status MatrixProductRangeNoHwy(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  constexpr int num_values_per_block = kNumValuesPerBlock<PlainInteger>;
+  RLWE_RETURN_IF_ERROR(ValidateMatrixProductRange(
+      matrix, pad, num_cols, row_begin, row_end, result, num_values_per_block));
+
+  for (int64_t i = 0; i < row_end - row_begin; ++i) {
+    std::fill_n(result[i].begin(), num_cols, 0);
+  }
+  for (int j = 0; j < matrix.size(); ++j) {
+    const BlockType* blocks = matrix[j].data();
+    const lwe::Integer* pad_row = pad.data() + j * num_cols;
+    for (int64_t i = 0; i < row_end - row_begin; ++i) {
+      lwe::Integer value = PackedValue<PlainInteger>(blocks, row_begin + i);
+      for (int64_t k = 0; k < num_cols; ++k) {
+        result[i][k] += value * pad_row[k];
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::Status InnerProductRangeNoHwy(const BlockMatrix& matrix,
+                                    absl::Span<const lwe::Integer> vec,
+                                    int64_t block_begin, int64_t block_end,
+                                    absl::Span<lwe::Integer> result) {
+  RLWE_RETURN_IF_ERROR(ValidateRange(matrix, vec, block_begin, block_end));
+  constexpr int num_values_per_block = kNumValuesPerBlock<PlainInteger>;
+  int64_t num_rows = (block_end - block_begin) * num_values_per_block;
+  if (result.size() < num_rows) {
+    return absl::InvalidArgumentError("`result` is too small.");
+  }
+
+  std::fill_n(result.begin(), num_rows, 0);
+  for (int j = 0; j < vec.size(); ++j) {
+    const BlockType* blocks = matrix[j].data() + block_begin;
+    for (int64_t i = 0; i < num_rows; ++i) {
+      result[i] += PackedValue<PlainInteger>(blocks, i) * vec[j];
+    }
+  }
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::Status InnerProductBatchRangeNoHwy(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result) {
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<PlainInteger>;
+  if (result.size() < num_rows * vecs.size()) {
+    return absl::InvalidArgumentError("`result` is too small.");
+  }
+  for (int q = 0; q < vecs.size(); ++q) {
+    RLWE_RETURN_IF_ERROR(InnerProductRangeNoHwy<PlainInteger>(
+        matrix, vecs[q], block_begin, block_end,
+        result.subspan(q * num_rows, num_rows)));
+  }
+  return absl::OkStatus();
+}
+
 template <typename PlainInteger>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProductNoHwy(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
   if (matrix.size() != vec.size()) {
     return absl::InvalidArgumentError(
         "`matrix` and `vec` must have matching dimensions.");
   }
+  int64_t num_blocks = matrix.empty() ? 0 : matrix[0].size();
+  int64_t num_rows = num_blocks * kNumValuesPerBlock<PlainInteger>;
+  std::vector<lwe::Integer> result(num_rows, 0);
+  RLWE_RETURN_IF_ERROR(InnerProductRangeNoHwy<PlainInteger>(
+      matrix, vec, /*block_begin=*/0, num_blocks, absl::MakeSpan(result)));
+  return result;
+}
 
-  constexpr int num_values_per_block =
-      sizeof(BlockType) / sizeof(lwe::PlainInteger);
+// Only instantiate the 4-bit, 8-bit and 16-bit versions, which are the choices
+// of LWE plaintext integer types we support.
+HWY_EXPORT_T(InnerProductRangeHwy4, InnerProductRangeHwy<Nibble>);
+HWY_EXPORT_T(InnerProductRangeHwy8, InnerProductRangeHwy<uint8_t>);
+HWY_EXPORT_T(InnerProductRangeHwy16, InnerProductRangeHwy<uint16_t>);
+HWY_EXPORT(InnerProductRangeDotHwy);
+HWY_EXPORT_T(InnerProductBatchRangeHwy4, InnerProductBatchRangeHwy<Nibble>);
+HWY_EXPORT_T(InnerProductBatchRangeHwy8, InnerProductBatchRangeHwy<uint8_t>);
+HWY_EXPORT_T(InnerProductBatchRangeHwy16, InnerProductBatchRangeHwy<uint16_t>);
+HWY_EXPORT_T(MatrixProductRangeHwy4, MatrixProductRangeHwy<Nibble>);
+HWY_EXPORT_T(MatrixProductRangeHwy8, MatrixProductRangeHwy<uint8_t>);
+HWY_EXPORT_T(MatrixProductRangeHwy16, MatrixProductRangeHwy<uint16_t>);
 
-  // Assume all columns have the same size.
-  int num_blocks = matrix[0].size();
-  int num_rows = num_blocks * sizeof(BlockType);
+namespace {
 
-  std::vector<lwe::Integer> result(num_rows, 0);
-  for (int j = 0; j < vec.size(); ++j) {
-    int i = 0;
-    for (int block_idx = 0; block_idx < num_blocks; ++block_idx) {
-      BlockType block = matrix[j][block_idx];
-      const lwe::PlainInteger* block_as_values =
-          reinterpret_cast<const lwe::PlainInteger*>(&block);
-      for (int block_pos = 0; block_pos < num_values_per_block && i < num_rows;
-           ++block_pos, ++i) {
-        result[i] +=
-            static_cast<lwe::Integer>(block_as_values[block_pos]) * vec[j];
+// Returns true if `ptr` is aligned for the highway kernels.
+bool IsAligned(const lwe::Integer* ptr) {
+  return reinterpret_cast<uintptr_t>(ptr) % HWY_ALIGNMENT == 0;
+}
+
+// Runs the highway kernel selected for the current CPU on the given block
+// range, accumulating into `aligned_results`, tile by tile and with the unroll
+// factor of `config`. The arguments must have been validated.
+template <typename PlainInteger>
+absl::Status RunRangeKernel(const BlockMatrix& matrix,
+                            absl::Span<const lwe::Integer> vec,
+                            int64_t block_begin, int64_t block_end,
+                            const InnerProductConfig& config,
+                            lwe::Integer* aligned_results) {
+  // Tiles are rounded up to whole alignment units of the results, so that
+  // every tile starts at an aligned address.
+  constexpr int64_t kNumValues = kNumValuesPerBlock<PlainInteger>;
+  constexpr int64_t kAlignedBlocks = std::max<int64_t>(
+      1, HWY_ALIGNMENT / sizeof(lwe::Integer) / kNumValues);
+  int64_t tile_blocks =
+      config.tile_blocks == 0
+          ? block_end - block_begin
+          : (config.tile_blocks + kAlignedBlocks - 1) / kAlignedBlocks *
+                kAlignedBlocks;
+  for (int64_t tile_begin = block_begin; tile_begin < block_end;
+       tile_begin += tile_blocks) {
+    int64_t tile_end = std::min(tile_begin + tile_blocks, block_end);
+    lwe::Integer* tile_results =
+        aligned_results + (tile_begin - block_begin) * kNumValues;
+    if constexpr (std::is_same_v<PlainInteger, Nibble>) {
+      RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductRangeHwy4)(
+          matrix, vec, tile_begin, tile_end, config.unroll, tile_results));
+    } else if constexpr (std::is_same_v<PlainInteger, uint8_t>) {
+      if (config.kernel == InnerProductKernel::kHwyDotProduct) {
+        RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(InnerProductRangeDotHwy)(
+            matrix, vec, tile_begin, tile_end, tile_results));
+      } else {
+        RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductRangeHwy8)(
+            matrix, vec, tile_begin, tile_end, config.unroll, tile_results));
       }
+    } else {
+      RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductRangeHwy16)(
+          matrix, vec, tile_begin, tile_end, config.unroll, tile_results));
     }
   }
-  return result;
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::StatusOr<std::vector<lwe::Integer>> DispatchInnerProduct(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
+  int64_t num_blocks = matrix.empty() ? 0 : matrix[0].size();
+  RLWE_RETURN_IF_ERROR(ValidateRange(matrix, vec, /*block_begin=*/0,
+                                     num_blocks));
+  int64_t num_rows = num_blocks * kNumValuesPerBlock<PlainInteger>;
+  hwy::AlignedFreeUniquePtr<lwe::Integer[]> aligned_results =
+      hwy::AllocateAligned<lwe::Integer>(std::max<int64_t>(num_rows, 1));
+  RLWE_RETURN_IF_ERROR(RunRangeKernel<PlainInteger>(
+      matrix, vec, /*block_begin=*/0, num_blocks, InnerProductConfig(),
+      aligned_results.get()));
+  return std::vector<lwe::Integer>(aligned_results.get(),
+                                   aligned_results.get() + num_rows);
 }
 
-// Only instantiate the 8-bit and 16-bit versions, which are the choices of
-// LWE plaintext integer types we support.
-HWY_EXPORT_T(InnerProductHwy8, InnerProductHwy<uint8_t>);
-HWY_EXPORT_T(InnerProductHwy16, InnerProductHwy<uint16_t>);
+template <typename PlainInteger>
+absl::Status DispatchInnerProductRange(const BlockMatrix& matrix,
+                                       absl::Span<const lwe::Integer> vec,
+                                       int64_t block_begin, int64_t block_end,
+                                       absl::Span<lwe::Integer> result,
+                                       InnerProductWorkspace* workspace,
+                                       const InnerProductConfig& config) {
+  RLWE_RETURN_IF_ERROR(ValidateInnerProductConfig(config));
+  if (config.kernel == InnerProductKernel::kNoHwy) {
+    return InnerProductRangeNoHwy<PlainInteger>(matrix, vec, block_begin,
+                                                block_end, result);
+  }
+  RLWE_RETURN_IF_ERROR(ValidateRange(matrix, vec, block_begin, block_end));
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<PlainInteger>;
+  if (result.size() < num_rows) {
+    return absl::InvalidArgumentError("`result` is too small.");
+  }
+  if (IsAligned(result.data())) {
+    return RunRangeKernel<PlainInteger>(matrix, vec, block_begin, block_end,
+                                        config, result.data());
+  }
+
+  hwy::AlignedFreeUniquePtr<lwe::Integer[]> allocated;
+  lwe::Integer* aligned_results;
+  if (workspace != nullptr) {
+    aligned_results = workspace->AlignedBuffer(num_rows);
+  } else {
+    allocated =
+        hwy::AllocateAligned<lwe::Integer>(std::max<int64_t>(num_rows, 1));
+    aligned_results = allocated.get();
+  }
+  RLWE_RETURN_IF_ERROR(RunRangeKernel<PlainInteger>(
+      matrix, vec, block_begin, block_end, config, aligned_results));
+  std::copy_n(aligned_results, num_rows, result.begin());
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::Status DispatchInnerProductBatchRange(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace) {
+  for (auto const& vec : vecs) {
+    RLWE_RETURN_IF_ERROR(ValidateRange(matrix, vec, block_begin, block_end));
+  }
+  int64_t num_vecs = vecs.size();
+  int64_t num_rows = (block_end - block_begin) *
+                     kNumValuesPerBlock<PlainInteger>;
+  if (result.size() < num_rows * num_vecs) {
+    return absl::InvalidArgumentError("`result` is too small.");
+  }
+
+  // Pad every product to a multiple of the alignment, so that all of them are
+  // aligned in the buffer.
+  constexpr int64_t kAlignedValues = HWY_ALIGNMENT / sizeof(lwe::Integer);
+  int64_t stride = (num_rows + kAlignedValues - 1) / kAlignedValues *
+                   kAlignedValues;
+  hwy::AlignedFreeUniquePtr<lwe::Integer[]> allocated;
+  lwe::Integer* aligned_results;
+  if (workspace != nullptr) {
+    aligned_results = workspace->AlignedBuffer(stride * num_vecs);
+  } else {
+    allocated = hwy::AllocateAligned<lwe::Integer>(
+        std::max<int64_t>(stride * num_vecs, 1));
+    aligned_results = allocated.get();
+  }
+  if constexpr (std::is_same_v<PlainInteger, Nibble>) {
+    RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductBatchRangeHwy4)(
+        matrix, vecs, block_begin, block_end, stride, aligned_results));
+  } else if constexpr (std::is_same_v<PlainInteger, uint8_t>) {
+    RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductBatchRangeHwy8)(
+        matrix, vecs, block_begin, block_end, stride, aligned_results));
+  } else {
+    RLWE_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH_T(InnerProductBatchRangeHwy16)(
+        matrix, vecs, block_begin, block_end, stride, aligned_results));
+  }
+  for (int64_t q = 0; q < num_vecs; ++q) {
+    std::copy_n(aligned_results + q * stride, num_rows,
+                result.begin() + q * num_rows);
+  }
+  return absl::OkStatus();
+}
+
+template <typename PlainInteger>
+absl::Status DispatchMatrixProductRange(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  RLWE_RETURN_IF_ERROR(ValidateMatrixProductRange(
+      matrix, pad, num_cols, row_begin, row_end, result,
+      kNumValuesPerBlock<PlainInteger>));
+  if constexpr (std::is_same_v<PlainInteger, Nibble>) {
+    return HWY_DYNAMIC_DISPATCH_T(MatrixProductRangeHwy4)(
+        matrix, pad, num_cols, row_begin, row_end, result);
+  } else if constexpr (std::is_same_v<PlainInteger, uint8_t>) {
+    return HWY_DYNAMIC_DISPATCH_T(MatrixProductRangeHwy8)(
+        matrix, pad, num_cols, row_begin, row_end, result);
+  } else {
+    return HWY_DYNAMIC_DISPATCH_T(MatrixProductRangeHwy16)(
+        matrix, pad, num_cols, row_begin, row_end, result);
+  }
+}
+
+}  // namespace
 
 template <typename PlainInteger>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProduct(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
   return InnerProductNoHwy<PlainInteger>(matrix, vec);
 }
 
+template <>
+absl::StatusOr<std::vector<lwe::Integer>> InnerProduct<Nibble>(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
+  return DispatchInnerProduct<Nibble>(matrix, vec);
+}
+
 template <>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProduct<uint8_t>(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
-  return HWY_DYNAMIC_DISPATCH_T(InnerProductHwy8)(matrix, vec);
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
+  return DispatchInnerProduct<uint8_t>(matrix, vec);
 }
 
 template <>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProduct<uint16_t>(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec) {
-  return HWY_DYNAMIC_DISPATCH_T(InnerProductHwy16)(matrix, vec);
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec) {
+  return DispatchInnerProduct<uint16_t>(matrix, vec);
+}
+
+template <typename PlainInteger>
+absl::Status InnerProductRange(const BlockMatrix& matrix,
+                               absl::Span<const lwe::Integer> vec,
+                               int64_t block_begin, int64_t block_end,
+                               absl::Span<lwe::Integer> result,
+                               InnerProductWorkspace* workspace,
+                               const InnerProductConfig& config) {
+  return InnerProductRangeNoHwy<PlainInteger>(matrix, vec, block_begin,
+                                              block_end, result);
+}
+
+template <>
+absl::Status InnerProductRange<Nibble>(const BlockMatrix& matrix,
+                                       absl::Span<const lwe::Integer> vec,
+                                       int64_t block_begin, int64_t block_end,
+                                       absl::Span<lwe::Integer> result,
+                                       InnerProductWorkspace* workspace,
+                                       const InnerProductConfig& config) {
+  return DispatchInnerProductRange<Nibble>(matrix, vec, block_begin, block_end,
+                                           result, workspace, config);
+}
+
+template <>
+absl::Status InnerProductRange<uint8_t>(const BlockMatrix& matrix,
+                                        absl::Span<const lwe::Integer> vec,
+                                        int64_t block_begin, int64_t block_end,
+                                        absl::Span<lwe::Integer> result,
+                                        InnerProductWorkspace* workspace,
+                                        const InnerProductConfig& config) {
+  return DispatchInnerProductRange<uint8_t>(matrix, vec, block_begin,
+                                            block_end, result, workspace,
+                                            config);
+}
+
+template <>
+absl::Status InnerProductRange<uint16_t>(const BlockMatrix& matrix,
+                                         absl::Span<const lwe::Integer> vec,
+                                         int64_t block_begin,
+                                         int64_t block_end,
+                                         absl::Span<lwe::Integer> result,
+                                         InnerProductWorkspace* workspace,
+                                         const InnerProductConfig& config) {
+  return DispatchInnerProductRange<uint16_t>(matrix, vec, block_begin,
+                                             block_end, result, workspace,
+                                             config);
+}
+
+template <typename PlainInteger>
+absl::Status InnerProductBatchRange(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace) {
+  return InnerProductBatchRangeNoHwy<PlainInteger>(matrix, vecs, block_begin,
+                                                   block_end, result);
+}
+
+template <>
+absl::Status InnerProductBatchRange<Nibble>(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace) {
+  return DispatchInnerProductBatchRange<Nibble>(matrix, vecs, block_begin,
+                                                block_end, result, workspace);
+}
+
+template <>
+absl::Status InnerProductBatchRange<uint8_t>(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace) {
+  return DispatchInnerProductBatchRange<uint8_t>(matrix, vecs, block_begin,
+                                                 block_end, result, workspace);
+}
+
+template <>
+absl::Status InnerProductBatchRange<uint16_t>(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace) {
+  return DispatchInnerProductBatchRange<uint16_t>(matrix, vecs, block_begin,
+                                                  block_end, result, workspace);
+}
+
+template <typename PlainInteger>
+absl::Status MatrixProductRange(const BlockMatrix& matrix,
+                                absl::Span<const lwe::Integer> pad,
+                                int64_t num_cols, int64_t row_begin,
+                                int64_t row_end,
+                                absl::Span<std::vector<lwe::Integer>> result) {
+  return MatrixProductRangeNoHwy<PlainInteger>(matrix, pad, num_cols,
+                                               row_begin, row_end, result);
+}
+
+template <>
+absl::Status MatrixProductRange<Nibble>(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  return DispatchMatrixProductRange<Nibble>(matrix, pad, num_cols, row_begin,
+                                            row_end, result);
+}
+
+template <>
+absl::Status MatrixProductRange<uint8_t>(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  return DispatchMatrixProductRange<uint8_t>(matrix, pad, num_cols, row_begin,
+                                             row_end, result);
+}
+
+template <>
+absl::Status MatrixProductRange<uint16_t>(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result) {
+  return DispatchMatrixProductRange<uint16_t>(matrix, pad, num_cols, row_begin,
+                                              row_end, result);
 }
 
 }  // namespace hintless_pir::hintless_simplepir::internal
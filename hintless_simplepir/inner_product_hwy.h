@@ -17,34 +17,194 @@
 
 #include <stdint.h>
 
+#include <cstdint>
+
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "absl/numeric/int128.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
+#include "hintless_simplepir/block_matrix.h"
 #include "lwe/types.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 namespace internal {
 
-using BlockType = absl::uint128;
-using BlockVector = std::vector<BlockType>;
+// The plaintext type of 4-bit values, packed two per byte. Byte i of a block
+// holds value i in its low nibble and value i + 16 in its high nibble, so that
+// the kernels unpack 16 consecutive values with a mask and a shift.
+struct Nibble {};
+
+// The number of bits of the slot holding every packed plaintext value.
+template <typename PlainInteger>
+inline constexpr int kPackedValueBits = 8 * sizeof(PlainInteger);
+template <>
+inline constexpr int kPackedValueBits<Nibble> = 4;
+
+// The number of plaintext values packed in a block.
+template <typename PlainInteger>
+inline constexpr int64_t kNumValuesPerBlock =
+    8 * sizeof(BlockType) / kPackedValueBits<PlainInteger>;
+
+// Returns the offset of the lowest bit of the `block_pos`-th value in a block
+// of values packed in slots of `value_bits` bits.
+inline constexpr int64_t PackedValueShift(int value_bits, int64_t block_pos) {
+  if (value_bits == kPackedValueBits<Nibble>) {
+    constexpr int64_t kNumBytes = sizeof(BlockType);
+    return block_pos < kNumBytes ? 8 * block_pos
+                                 : 8 * (block_pos - kNumBytes) + 4;
+  }
+  return block_pos * value_bits;
+}
+
+// Returns the row `row_idx` of the column starting at `blocks`.
+template <typename PlainInteger>
+inline lwe::Integer PackedValue(const BlockType* blocks, int64_t row_idx) {
+  if constexpr (std::is_same_v<PlainInteger, Nibble>) {
+    constexpr int64_t kNumBytes = sizeof(BlockType);
+    int64_t block_pos = row_idx % kNumValuesPerBlock<Nibble>;
+    uint8_t byte = reinterpret_cast<const uint8_t*>(
+        blocks)[row_idx / kNumValuesPerBlock<Nibble> * kNumBytes +
+                block_pos % kNumBytes];
+    return block_pos < kNumBytes ? byte & 0xF : byte >> 4;
+  } else {
+    return reinterpret_cast<const PlainInteger*>(blocks)[row_idx];
+  }
+}
+
+// The implementations of `InnerProductRange`.
+enum class InnerProductKernel {
+  kHwy,    // SIMD instructions via the highway library.
+  kNoHwy,  // Portable scalar code.
+  // 8-bit dot product instructions via the highway library, for values of 8
+  // bits; other values use `kHwy`.
+  kHwyDotProduct,
+};
+
+// The configuration of `InnerProductRange`, picked per host by autotuning, see
+// `Database::AutotuneInnerProduct`. The defaults are used otherwise.
+struct InnerProductConfig {
+  InnerProductKernel kernel = InnerProductKernel::kHwy;
+
+  // The number of hwy vectors of rows the highway kernel accumulates per
+  // iteration over a column: 1, 2, 4 or 8. Ignored for nibbles.
+  int unroll = 4;
+
+  // The number of blocks per column the highway kernel computes at a time
+  // before moving on to the next rows, so that their results stay in cache
+  // while it walks over all columns; 0 computes the whole range at once.
+  int64_t tile_blocks = 0;
+
+  bool operator==(const InnerProductConfig& other) const {
+    return kernel == other.kernel && unroll == other.unroll &&
+           tile_blocks == other.tile_blocks;
+  }
+};
+
+// Returns an error if `config` is not a valid configuration.
+absl::Status ValidateInnerProductConfig(const InnerProductConfig& config);
+
+// Returns the name of the highway target the kernels dispatch to on this CPU,
+// e.g. "AVX3" or "SVE".
+std::string HwyTargetName();
+
+// A scratch buffer for the highway kernels, which accumulate into aligned
+// memory. Reusing a workspace across calls avoids allocating and copying an
+// aligned buffer every time the output is not aligned itself. A workspace is
+// not thread-safe, so concurrent calls must use distinct workspaces.
+class InnerProductWorkspace {
+ public:
+  // Returns a buffer holding at least `num_values` integers, aligned for the
+  // highway kernels. It is valid until the next call, which reuses it if it is
+  // large enough.
+  lwe::Integer* AlignedBuffer(int64_t num_values);
+
+ private:
+  std::vector<lwe::Integer> storage_;
+};
 
 // Given a matrix represented by its columns in `matrix`, and a vector `vec`,
 // returns the product = `matrix` * `vec` (mod Q), where Q is the LWE modulus.
-// The matrix stores its elements in PlainInteger (uint8_t or uint16_t), packed
-// in BlockType; so each column is represented as a vector of BlockType.
+// The matrix stores its elements in PlainInteger (Nibble, uint8_t or
+// uint16_t), packed in BlockType; so each column is represented as a vector of
+// BlockType.
 // This version is implemented using SIMD instructions via the highway library.
 template <typename PlainInteger>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProduct(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec);
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec);
+
+// Computes the rows of `matrix` * `vec` (mod Q) that are packed in the blocks
+// [block_begin, block_end) of every column, and writes them to `result`, which
+// must hold at least (block_end - block_begin) *
+// kNumValuesPerBlock<PlainInteger> integers. Disjoint block ranges can be
+// computed concurrently. The highway kernels accumulate directly into `result`
+// if it is aligned, e.g. a buffer from `InnerProductWorkspace`, and otherwise
+// into the buffer of `workspace` if given, or into a freshly allocated one.
+// `config` selects the kernel and how it runs.
+template <typename PlainInteger>
+absl::Status InnerProductRange(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec,
+    int64_t block_begin, int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace = nullptr,
+    const InnerProductConfig& config = InnerProductConfig());
+
+// Computes the products between `matrix` and every vector in `vecs`, for the
+// rows packed in the blocks [block_begin, block_end) of every column. With R
+// rows in the range, the product with vecs[q] is written to the R integers of
+// `result` starting at q * R. Each packed value is loaded once and multiplied
+// with all vectors, so the memory traffic does not grow with the batch size.
+// The products are accumulated in the buffer of `workspace` if given, or in a
+// freshly allocated one.
+template <typename PlainInteger>
+absl::Status InnerProductBatchRange(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result,
+    InnerProductWorkspace* workspace = nullptr);
+
+// Computes the rows [row_begin, row_end) of the matrix product `matrix` * `pad`
+// (mod Q), where `pad` is a `matrix.size()` x `num_cols` matrix stored by rows.
+// Row `row_begin + i` of the product is written to `result[i]`, which must hold
+// `num_cols` integers. The product is cache blocked over the columns of
+// `matrix`, and register tiled over several rows and columns of the result, so
+// that every packed value is loaded once per tile of `pad` columns. Disjoint
+// row ranges can be computed concurrently.
+template <typename PlainInteger>
+absl::Status MatrixProductRange(const BlockMatrix& matrix,
+                                absl::Span<const lwe::Integer> pad,
+                                int64_t num_cols, int64_t row_begin,
+                                int64_t row_end,
+                                absl::Span<std::vector<lwe::Integer>> result);
 
 // Matrix-vector product implemented without using highway SIMD intrinsics.
 template <typename PlainInteger>
 absl::StatusOr<std::vector<lwe::Integer>> InnerProductNoHwy(
-    absl::Span<const BlockVector> matrix, absl::Span<const lwe::Integer> vec);
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> vec);
+
+// Same as `InnerProductRange`, but without using highway SIMD intrinsics.
+template <typename PlainInteger>
+absl::Status InnerProductRangeNoHwy(const BlockMatrix& matrix,
+                                    absl::Span<const lwe::Integer> vec,
+                                    int64_t block_begin, int64_t block_end,
+                                    absl::Span<lwe::Integer> result);
+
+// Same as `InnerProductBatchRange`, but without using highway SIMD intrinsics.
+template <typename PlainInteger>
+absl::Status InnerProductBatchRangeNoHwy(
+    const BlockMatrix& matrix,
+    absl::Span<const std::vector<lwe::Integer>> vecs, int64_t block_begin,
+    int64_t block_end, absl::Span<lwe::Integer> result);
+
+// Same as `MatrixProductRange`, but without using highway SIMD intrinsics.
+template <typename PlainInteger>
+absl::Status MatrixProductRangeNoHwy(
+    const BlockMatrix& matrix, absl::Span<const lwe::Integer> pad,
+    int64_t num_cols, int64_t row_begin, int64_t row_end,
+    absl::Span<std::vector<lwe::Integer>> result);
 
 }  // namespace internal
 }  // namespace hintless_simplepir
@@ -0,0 +1,276 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A closed-loop load generator for the HintlessPIR server. It runs
+// `--num_clients` simulated clients on their own threads, each of which issues
+// a request, waits for the response and recovers the record before issuing the
+// next one, for `--duration_s` seconds after a warm up of `--warmup_s` seconds.
+// It then reports the throughput, the latency percentiles of the requests, and
+// the bandwidth at which the server streamed the database matrices.
+//
+// With `--batch_size` > 1, every client retrieves that many records per batch
+// request, whose LWE part is a single pass over the database. With
+// `--num_threads` > 1, the server computes every request on that many workers.
+//
+// Example:
+//   bazel run -c opt //hintless_simplepir:load_generator -- \
+//     --db_rows=4096 --db_cols=4096 --num_clients=8 --num_threads=8
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "hintless_simplepir/client.h"
+#include "hintless_simplepir/database_hwy.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
+#include "hintless_simplepir/server.h"
+#include "hintless_simplepir/testing.h"
+#include "shell_encryption/status_macros.h"
+
+ABSL_FLAG(int64_t, db_rows, 1024, "Number of rows of the database.");
+ABSL_FLAG(int64_t, db_cols, 1024, "Number of columns of the database.");
+ABSL_FLAG(int, record_bits, 8, "Bit size of every record.");
+ABSL_FLAG(int, lwe_secret_dim, 1408, "Dimension of the LWE secrets.");
+ABSL_FLAG(int, rows_per_block, 1024, "Rows per block of the LinPir database.");
+ABSL_FLAG(int, num_threads, 1, "Number of server threads per request.");
+ABSL_FLAG(int, num_clients, 4, "Number of concurrent simulated clients.");
+ABSL_FLAG(int, batch_size, 1,
+          "Number of records retrieved by every request; batch requests are "
+          "used when larger than 1.");
+ABSL_FLAG(double, warmup_s, 2, "Seconds of load before measuring.");
+ABSL_FLAG(double, duration_s, 10, "Seconds of load measured.");
+ABSL_FLAG(double, peak_bandwidth_gbps, 0,
+          "Peak memory bandwidth of the host in GB/s, to report the share of "
+          "it streaming the database takes; ignored if 0.");
+ABSL_FLAG(uint64_t, seed, 0, "Seed of the random database records.");
+ABSL_FLAG(bool, fake_hints, false,
+          "Fill the hints with random values instead of computing them, which "
+          "makes preprocessing fast but the recovered records garbage; they "
+          "are then not checked.");
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace {
+
+
+const Parameters kParameters{
+    .db_rows = 1024,
+    .db_cols = 1024,
+    .db_record_bit_size = 8,
+    .lwe_secret_dim = 1408,
+    .lwe_modulus_bit_size = 32,
+    .lwe_plaintext_bit_size = 8,
+    .lwe_error_variance = 8,
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/1024),
+    .prng_type = rlwe::PRNG_TYPE_HKDF,
+};
+
+// What one simulated client measured.
+struct ClientStats {
+  std::vector<absl::Duration> latencies;
+  int64_t num_records = 0;
+  int64_t num_errors = 0;
+  int64_t num_incorrect_records = 0;
+};
+
+// Retrieves the records at `indices` from `server` as one request, or as one
+// batch request if there are several, and returns them.
+absl::StatusOr<std::vector<std::string>> Retrieve(
+    const Server& server, Client& client, const std::vector<int64_t>& indices) {
+  if (indices.size() == 1) {
+    Client::RequestHandle handle;
+    RLWE_ASSIGN_OR_RETURN(HintlessPirRequest request,
+                          client.GenerateRequest(indices[0], handle));
+    RLWE_ASSIGN_OR_RETURN(HintlessPirResponse response,
+                          server.HandleRequest(request));
+    RLWE_ASSIGN_OR_RETURN(std::string record,
+                          client.RecoverRecord(response, handle));
+    return std::vector<std::string>{std::move(record)};
+  }
+  Client::BatchRequestHandle handle;
+  RLWE_ASSIGN_OR_RETURN(HintlessPirBatchRequest request,
+                        client.GenerateBatchRequest(indices, handle));
+  RLWE_ASSIGN_OR_RETURN(HintlessPirBatchResponse response,
+                        server.HandleBatchRequest(request));
+  return client.RecoverRecords(response, handle);
+}
+
+// Issues requests for random records until `stop`, recording the ones that
+// finish after `measure_start` in `stats`.
+void RunClient(const Parameters& params, const Server& server, Client& client,
+               int batch_size, bool check_records, absl::Time measure_start,
+               const std::atomic<bool>& stop, ClientStats& stats) {
+  absl::BitGen bitgen;
+  const Database* database = server.GetDatabase();
+  int64_t num_records = params.db_rows * params.db_cols;
+  std::vector<int64_t> indices(batch_size);
+  while (!stop.load(std::memory_order_relaxed)) {
+    for (int64_t& index : indices) {
+      index = absl::Uniform<int64_t>(bitgen, 0, num_records);
+    }
+    absl::Time start = absl::Now();
+    absl::StatusOr<std::vector<std::string>> records =
+        Retrieve(server, client, indices);
+    absl::Time end = absl::Now();
+    if (start < measure_start) {
+      continue;
+    }
+    if (!records.ok()) {
+      ++stats.num_errors;
+      continue;
+    }
+    stats.latencies.push_back(end - start);
+    stats.num_records += records->size();
+    // Checking the records is not part of the latency.
+    for (int i = 0; check_records && i < indices.size(); ++i) {
+      absl::StatusOr<std::string> expected = database->Record(indices[i]);
+      if (!expected.ok() || (*records)[i] != *expected) {
+        ++stats.num_incorrect_records;
+      }
+    }
+  }
+}
+
+// Returns the `p`-quantile of the sorted `latencies`.
+absl::Duration Percentile(const std::vector<absl::Duration>& latencies,
+                          double p) {
+  if (latencies.empty()) {
+    return absl::ZeroDuration();
+  }
+  auto rank = static_cast<int64_t>(std::ceil(p * latencies.size()));
+  return latencies[std::clamp<int64_t>(rank - 1, 0, latencies.size() - 1)];
+}
+
+absl::Status RunLoad() {
+  Parameters params = kParameters;
+  params.db_rows = absl::GetFlag(FLAGS_db_rows);
+  params.db_cols = absl::GetFlag(FLAGS_db_cols);
+  params.db_record_bit_size = absl::GetFlag(FLAGS_record_bits);
+  params.lwe_secret_dim = absl::GetFlag(FLAGS_lwe_secret_dim);
+  params.linpir_params.rows_per_block = absl::GetFlag(FLAGS_rows_per_block);
+  params.num_threads = absl::GetFlag(FLAGS_num_threads);
+  int num_clients = absl::GetFlag(FLAGS_num_clients);
+  int batch_size = absl::GetFlag(FLAGS_batch_size);
+  if (num_clients < 1 || batch_size < 1) {
+    return absl::InvalidArgumentError(
+        "`num_clients` and `batch_size` must be positive.");
+  }
+
+  std::cout << "Preprocessing the server..." << std::endl;
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Server> server,
+                        Server::CreateWithRandomDatabaseRecords(
+                            params, absl::GetFlag(FLAGS_seed)));
+  bool fake_hints = absl::GetFlag(FLAGS_fake_hints);
+  RLWE_RETURN_IF_ERROR(server->Preprocess({.fake_hints = fake_hints}));
+  std::vector<std::unique_ptr<Client>> clients;
+  for (int i = 0; i < num_clients; ++i) {
+    RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Client> client,
+                          Client::Create(params, server->GetPublicParams()));
+    clients.push_back(std::move(client));
+  }
+
+  // Run the clients for the warm up and the measured duration.
+  absl::Time measure_start =
+      absl::Now() + absl::Seconds(absl::GetFlag(FLAGS_warmup_s));
+  std::atomic<bool> stop = false;
+  std::vector<ClientStats> stats(num_clients);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_clients; ++i) {
+    threads.emplace_back([&, i] {
+      RunClient(params, *server, *clients[i], batch_size,
+                /*check_records=*/!fake_hints, measure_start, stop, stats[i]);
+    });
+  }
+  absl::SleepFor(measure_start - absl::Now() +
+                 absl::Seconds(absl::GetFlag(FLAGS_duration_s)));
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Requests finishing after the stop count too, so the elapsed time ends now.
+  absl::Duration elapsed = absl::Now() - measure_start;
+
+  ClientStats total;
+  for (auto& client_stats : stats) {
+    total.latencies.insert(total.latencies.end(),
+                           client_stats.latencies.begin(),
+                           client_stats.latencies.end());
+    total.num_records += client_stats.num_records;
+    total.num_errors += client_stats.num_errors;
+    total.num_incorrect_records += client_stats.num_incorrect_records;
+  }
+  std::sort(total.latencies.begin(), total.latencies.end());
+
+  // Every request, or batch request, streams all data matrices once for D*u.
+  int64_t db_bytes = 0;
+  for (auto const& data_matrix : server->GetDatabase()->Data()) {
+    db_bytes += data_matrix.size() *
+                Database::RawMatrix::ColumnStride(
+                    data_matrix.NumBlocksPerColumn()) *
+                sizeof(Database::BlockType);
+  }
+  double seconds = absl::ToDoubleSeconds(elapsed);
+  double num_requests = total.latencies.size();
+  double bandwidth_gbps = db_bytes * num_requests / seconds / 1e9;
+
+  std::cout << absl::StrFormat(
+      "clients: %d, batch size: %d, server threads: %d\n"
+      "requests: %d, errors: %d, incorrect records: %d\n"
+      "throughput: %.2f requests/s, %.2f records/s\n"
+      "latency: p50 %.2f ms, p99 %.2f ms, p999 %.2f ms\n"
+      "database bandwidth: %.2f GB/s",
+      num_clients, batch_size, params.num_threads, total.latencies.size(),
+      total.num_errors, total.num_incorrect_records, num_requests / seconds,
+      total.num_records / seconds,
+      absl::ToDoubleMilliseconds(Percentile(total.latencies, 0.5)),
+      absl::ToDoubleMilliseconds(Percentile(total.latencies, 0.99)),
+      absl::ToDoubleMilliseconds(Percentile(total.latencies, 0.999)),
+      bandwidth_gbps);
+  double peak_bandwidth_gbps = absl::GetFlag(FLAGS_peak_bandwidth_gbps);
+  if (peak_bandwidth_gbps > 0) {
+    std::cout << absl::StrFormat(" (%.1f%% of peak)",
+                                 100 * bandwidth_gbps / peak_bandwidth_gbps);
+  }
+  std::cout << std::endl;
+  return absl::OkStatus();
+}
+
+}  // namespace
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  absl::Status status = hintless_pir::hintless_simplepir::RunLoad();
+  if (!status.ok()) {
+    std::cerr << status << std::endl;
+    return 1;
+  }
+  return 0;
+}
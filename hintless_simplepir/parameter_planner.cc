@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Picks the database shape and the LinPir block size for `--num_records`
+// records of `--record_bits` bits that minimize the estimated `--objective`,
+// one of "server_cpu", "client_cpu", "upload" or "download", and prints the
+// resulting `Parameters` with their estimated costs per request.
+//
+// The cost model defaults to rough figures, or to `--calibration_csv`, the
+// output of the protocol benchmarks on the host, e.g.
+//   bazel run -c opt //hintless_simplepir:protocol_benchmarks -- \
+//     --benchmark_format=csv > /tmp/protocol.csv
+//   bazel run -c opt //hintless_simplepir:parameter_planner -- \
+//     --num_records=1000000 --record_bits=256 --objective=download \
+//     --calibration_csv=/tmp/protocol.csv
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/planner.h"
+#include "hintless_simplepir/testing.h"
+#include "lwe/types.h"
+#include "shell_encryption/status_macros.h"
+
+ABSL_FLAG(int64_t, num_records, 1 << 20, "Number of records of the database.");
+ABSL_FLAG(int, record_bits, 8, "Bit size of every record.");
+ABSL_FLAG(std::string, objective, "server_cpu",
+          "The cost to minimize: server_cpu, client_cpu, upload or download.");
+ABSL_FLAG(int, lwe_secret_dim, 1408, "Dimension of the LWE secrets.");
+ABSL_FLAG(int, lwe_plaintext_bits, 8, "Bit size of the LWE plaintexts.");
+ABSL_FLAG(std::string, calibration_csv, "",
+          "Output of `protocol_benchmarks --benchmark_format=csv` to fit the "
+          "cost model to; the defaults below are used if empty.");
+ABSL_FLAG(double, server_ns_per_db_byte, 0.1,
+          "Server LWE product, ns per byte of the data matrices.");
+ABSL_FLAG(double, server_ns_per_rlwe_mac, 1,
+          "Server LinPir, ns per RLWE coefficient multiply-add.");
+ABSL_FLAG(double, client_ns_per_lwe_mac, 0.5,
+          "Client LWE query, ns per LWE multiply-add.");
+ABSL_FLAG(double, client_ns_per_ntt_butterfly, 2,
+          "Client LinPir decryption, ns per NTT butterfly.");
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace {
+
+// Returns `params` as the designated initializer that defines it in C++.
+std::string FormatParameters(const Parameters& params) {
+  const auto& linpir_params = params.linpir_params;
+  return absl::StrFormat(
+      "const Parameters kParameters{\n"
+      "    .db_rows = %d,\n"
+      "    .db_cols = %d,\n"
+      "    .db_record_bit_size = %d,\n"
+      "    .lwe_secret_dim = %d,\n"
+      "    .lwe_modulus_bit_size = %d,\n"
+      "    .lwe_plaintext_bit_size = %d,\n"
+      "    .lwe_error_variance = %g,\n"
+      "    .linpir_params =\n"
+      "        linpir::RlweParameters<RlweInteger>{\n"
+      "            .log_n = %d,\n"
+      "            .qs = {%s},\n"
+      "            .ts = {%s},\n"
+      "            .gadget_log_bs = {%s},\n"
+      "            .error_variance = %g,\n"
+      "            .prng_type = rlwe::PRNG_TYPE_HKDF,\n"
+      "            .rows_per_block = %d,\n"
+      "        },\n"
+      "    .prng_type = rlwe::PRNG_TYPE_HKDF,\n"
+      "};\n",
+      params.db_rows, params.db_cols, params.db_record_bit_size,
+      params.lwe_secret_dim, params.lwe_modulus_bit_size,
+      params.lwe_plaintext_bit_size, params.lwe_error_variance,
+      linpir_params.log_n, absl::StrJoin(linpir_params.qs, ", "),
+      absl::StrJoin(linpir_params.ts, ", "),
+      absl::StrJoin(linpir_params.gadget_log_bs, ", "),
+      linpir_params.error_variance, linpir_params.rows_per_block);
+}
+
+absl::Status RunPlanner() {
+  PlannerOptions options{
+      .num_records = absl::GetFlag(FLAGS_num_records),
+      .record_bit_size = absl::GetFlag(FLAGS_record_bits),
+      .base_params =
+          Parameters{
+              .lwe_secret_dim = absl::GetFlag(FLAGS_lwe_secret_dim),
+              .lwe_modulus_bit_size = lwe::kIntBitwidth,
+              .lwe_plaintext_bit_size =
+                  absl::GetFlag(FLAGS_lwe_plaintext_bits),
+              .lwe_error_variance = 8,
+              .linpir_params = testing::LinPirParameters90Bits(
+                  /*rows_per_block=*/1024),
+              .prng_type = rlwe::PRNG_TYPE_HKDF,
+          },
+      .cost_model =
+          CostModel{
+              .server_ns_per_db_byte =
+                  absl::GetFlag(FLAGS_server_ns_per_db_byte),
+              .server_ns_per_rlwe_mac =
+                  absl::GetFlag(FLAGS_server_ns_per_rlwe_mac),
+              .client_ns_per_lwe_mac =
+                  absl::GetFlag(FLAGS_client_ns_per_lwe_mac),
+              .client_ns_per_ntt_butterfly =
+                  absl::GetFlag(FLAGS_client_ns_per_ntt_butterfly),
+          },
+  };
+  RLWE_ASSIGN_OR_RETURN(options.objective,
+                        ParsePlannerObjective(absl::GetFlag(FLAGS_objective)));
+
+  std::string calibration_csv = absl::GetFlag(FLAGS_calibration_csv);
+  if (!calibration_csv.empty()) {
+    std::ifstream input(calibration_csv);
+    if (!input) {
+      return absl::NotFoundError(
+          absl::StrCat("Cannot open ", calibration_csv, "."));
+    }
+    std::stringstream csv;
+    csv << input.rdbuf();
+    RLWE_ASSIGN_OR_RETURN(
+        std::vector<CalibrationSample> samples,
+        ParseProtocolBenchmarkCsv(csv.str(), options.base_params));
+    RLWE_ASSIGN_OR_RETURN(options.cost_model, CalibrateCostModel(samples));
+    std::cout << absl::StrFormat(
+        "Calibrated on %d runs: %.3g ns/db byte, %.3g ns/rlwe mac, "
+        "%.3g ns/lwe mac, %.3g ns/ntt butterfly\n",
+        samples.size(), options.cost_model.server_ns_per_db_byte,
+        options.cost_model.server_ns_per_rlwe_mac,
+        options.cost_model.client_ns_per_lwe_mac,
+        options.cost_model.client_ns_per_ntt_butterfly);
+  }
+
+  RLWE_ASSIGN_OR_RETURN(Plan plan, PlanParameters(options));
+  std::cout << FormatParameters(plan.params)
+            << absl::StrFormat(
+                   "Estimated per request on one thread:\n"
+                   "  server: %.2f ms (LWE %.2f ms, LinPir %.2f ms)\n"
+                   "  client: %.2f ms (request %.2f ms, recover %.2f ms)\n"
+                   "  upload: %d bytes, download: %d bytes\n",
+                   plan.cost.ServerMs(), plan.cost.server_lwe_ms,
+                   plan.cost.server_linpir_ms, plan.cost.ClientMs(),
+                   plan.cost.client_request_ms, plan.cost.client_recover_ms,
+                   plan.cost.request_bytes, plan.cost.response_bytes);
+  return absl::OkStatus();
+}
+
+}  // namespace
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  absl::Status status = hintless_pir::hintless_simplepir::RunPlanner();
+  if (!status.ok()) {
+    std::cerr << status << std::endl;
+    return 1;
+  }
+  return 0;
+}
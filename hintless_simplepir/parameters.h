@@ -17,31 +17,90 @@
 #define HINTLESS_PIR_HINTLESS_SIMPLEPIR_PARAMETERS_H_
 
 #include <cstdint>
+#include <string>
 
 #include "linpir/parameters.h"
 #include "lwe/types.h"
 #include "shell_encryption/serialization.pb.h"
 
+// The bit width of the RLWE integers of the LinPir instances that compute the
+// products of the hints with the LWE secrets: 64 by default, or 32 when
+// building with `--define=rlwe_integer_bits=32`. The 32-bit Montgomery
+// arithmetic vectorizes about twice as well in the NTTs and the inner products
+// of LinPir, but needs more primes for the same ciphertext modulus, as every
+// prime in `linpir_params.qs` must then be less than 2^30.
+#ifndef HINTLESS_PIR_RLWE_INTEGER_BITS
+#define HINTLESS_PIR_RLWE_INTEGER_BITS 64
+#endif
+
 namespace hintless_pir {
 namespace hintless_simplepir {
 
 // Parameters of the hintless SimplePIR protocol.
 struct Parameters {
   using LweInteger = lwe::Integer;
+#if HINTLESS_PIR_RLWE_INTEGER_BITS == 64
   using RlweInteger = linpir::Uint64;
+#elif HINTLESS_PIR_RLWE_INTEGER_BITS == 32
+  using RlweInteger = linpir::Uint32;
+#else
+#error "HINTLESS_PIR_RLWE_INTEGER_BITS must be 32 or 64."
+#endif
 
   int64_t db_rows;
   int64_t db_cols;
   int db_record_bit_size;
 
   int lwe_secret_dim;
-  int lwe_modulus_bit_size;  // 32 or 64
+  // The bit size of the power-of-two LWE modulus, which must be the bit width
+  // of `LweInteger`: 32, or 64 for builds with `--define=lwe_integer_bits=64`.
+  // A 64-bit modulus supports larger `lwe_plaintext_bit_size`, and so fewer
+  // shards for large records, but its hints need the product of the LinPir
+  // plaintext moduli `linpir_params.ts` to be about 32 bits larger.
+  int lwe_modulus_bit_size;
   int lwe_plaintext_bit_size;
   double lwe_error_variance;
 
   linpir::RlweParameters<RlweInteger> linpir_params;
 
   rlwe::PrngType prng_type;
+
+  // The number of threads used by the server to compute the online products
+  // with the database. A value of 1 runs all computation on the calling thread.
+  int num_threads = 1;
+
+  // The number of NUMA nodes the data matrices are spread over for the online
+  // products, or -1 for all nodes of the host. Every node holds whole shards if
+  // there are enough of them, or else a range of the columns of every shard,
+  // with its pages bound to the node, and computes its part of the products on
+  // num_threads / num_numa_nodes workers pinned to its CPUs. At most
+  // num_threads nodes are used, and nodes beyond those of the host wrap around
+  // them. A value of 0 leaves placement to the OS.
+  int num_numa_nodes = 0;
+
+  // Whether the data matrices of all shards share one allocation, with the
+  // column j of every shard stored next to each other, so that the online
+  // products sweep the database once for all shards, multiplying every query
+  // value with the values of all shards in a row. This pays off with many
+  // shards, i.e. records much larger than lwe_plaintext_bit_size. Cannot be
+  // combined with num_numa_nodes; databases read by `Database::OpenMapped`
+  // keep the layout of their file, one shard after the other.
+  bool interleave_shards = false;
+
+  // When positive, the server switches the LWE responses to the modulus
+  // 2^lwe_response_bit_size before sending them, which shrinks them at the cost
+  // of a rounding error of up to 2^(lwe_modulus_bit_size - 1 -
+  // lwe_response_bit_size). Must then be larger than lwe_plaintext_bit_size and
+  // at most lwe_modulus_bit_size. A value of 0 sends the full coefficients.
+  int lwe_response_bit_size = 0;
+
+  // Whether the server micro-benchmarks the kernels of the online products on
+  // this host when it is created, and uses the fastest ones. The configurations
+  // picked are cached in the file at `autotune_cache_path` if not empty, e.g.
+  // shared by a fleet of hosts with different CPUs, so that servers with the
+  // same kind of CPU and database shape skip the benchmarks.
+  bool autotune_inner_product = false;
+  std::string autotune_cache_path;
 };
 
 }  // namespace hintless_simplepir
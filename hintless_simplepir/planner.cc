@@ -0,0 +1,400 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hintless_simplepir/planner.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/numeric/bits.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/types/span.h"
+#include "hintless_simplepir/database_hwy.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/utils.h"
+#include "lwe/types.h"
+#include "shell_encryption/status_macros.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+namespace {
+
+// The number of operations of every phase of an online request, the units of
+// the fields of `CostModel`.
+struct OperationCounts {
+  double db_bytes = 0;
+  double rlwe_macs = 0;
+  double lwe_macs = 0;
+  double ntt_butterflies = 0;
+};
+
+// Returns the number of bytes of a serialized polynomial mod `qs`.
+template <typename Integer>
+int64_t PolynomialBytes(int log_n, const std::vector<Integer>& qs) {
+  int64_t num_bytes = 0;
+  for (Integer q : qs) {
+    num_bytes += DivAndRoundUp(absl::bit_width(static_cast<uint64_t>(q)), 8);
+  }
+  return num_bytes << log_n;
+}
+
+OperationCounts CountOperations(const Parameters& params) {
+  const auto& linpir_params = params.linpir_params;
+  int64_t num_shards = DivAndRoundUp(params.db_record_bit_size,
+                                     params.lwe_plaintext_bit_size);
+  int64_t num_blocks = DivAndRoundUp<int64_t>(
+      params.db_rows, linpir_params.rows_per_block);
+  int64_t num_rotations = linpir_params.rows_per_block / 2;
+  int64_t num_moduli = linpir_params.ts.size();
+  int64_t num_coeffs = (int64_t{1} << linpir_params.log_n) *
+                       static_cast<int64_t>(linpir_params.qs.size());
+  int64_t num_digits = 0;
+  for (int i = 0; i < linpir_params.qs.size(); ++i) {
+    num_digits += DivAndRoundUp<int64_t>(
+        absl::bit_width(static_cast<uint64_t>(linpir_params.qs[i])),
+        linpir_params.gadget_log_bs[i]);
+  }
+
+  OperationCounts counts;
+  counts.db_bytes = static_cast<double>(num_shards) * params.db_rows *
+                    params.db_cols *
+                    Database::PackedValueBits(params.lwe_plaintext_bit_size) /
+                    8;
+  // Every rotation but the first key switches the query with all digits, and
+  // every block multiplies the rotations with its diagonals.
+  counts.rlwe_macs = static_cast<double>(num_moduli) * num_coeffs *
+                     ((num_rotations - 1) * num_digits +
+                      num_shards * num_blocks * num_rotations);
+  counts.lwe_macs = static_cast<double>(params.db_cols) * params.lwe_secret_dim;
+  // Decrypting every block takes one inverse NTT.
+  counts.ntt_butterflies = static_cast<double>(num_moduli) * num_shards *
+                           num_blocks * num_coeffs / 2 * linpir_params.log_n;
+  return counts;
+}
+
+// Returns the value of `cost` to minimize for `objective`.
+double ObjectiveValue(const PlanCost& cost, PlannerObjective objective) {
+  switch (objective) {
+    case PlannerObjective::kServerCpu:
+      return cost.ServerMs();
+    case PlannerObjective::kClientCpu:
+      return cost.ClientMs();
+    case PlannerObjective::kUpload:
+      return cost.request_bytes;
+    case PlannerObjective::kDownload:
+      return cost.response_bytes;
+  }
+  return cost.ServerMs();
+}
+
+// Returns the least squares fit of y = c * x through the origin.
+double FitSlope(absl::Span<const double> xs, absl::Span<const double> ys) {
+  double xy = 0;
+  double xx = 0;
+  for (int i = 0; i < xs.size(); ++i) {
+    xy += xs[i] * ys[i];
+    xx += xs[i] * xs[i];
+  }
+  return xy / xx;
+}
+
+}  // namespace
+
+PlanCost EstimateCost(const Parameters& params, const CostModel& cost_model) {
+  const auto& linpir_params = params.linpir_params;
+  OperationCounts counts = CountOperations(params);
+  PlanCost cost;
+  cost.server_lwe_ms = counts.db_bytes * cost_model.server_ns_per_db_byte / 1e6;
+  cost.server_linpir_ms =
+      counts.rlwe_macs * cost_model.server_ns_per_rlwe_mac / 1e6;
+  cost.client_request_ms =
+      counts.lwe_macs * cost_model.client_ns_per_lwe_mac / 1e6;
+  cost.client_recover_ms =
+      counts.ntt_butterflies * cost_model.client_ns_per_ntt_butterfly / 1e6;
+
+  // The request holds the LWE query and the "b" components of the LinPir
+  // queries, and the response holds the LWE responses of all shards and one
+  // LinPir ciphertext per block, shard and plaintext modulus.
+  int64_t num_shards = DivAndRoundUp(params.db_record_bit_size,
+                                     params.lwe_plaintext_bit_size);
+  int64_t num_blocks = DivAndRoundUp<int64_t>(
+      params.db_rows, linpir_params.rows_per_block);
+  int64_t num_moduli = linpir_params.ts.size();
+  int64_t polynomial_bytes =
+      PolynomialBytes(linpir_params.log_n, linpir_params.qs);
+  cost.request_bytes = params.db_cols * sizeof(lwe::Integer) +
+                       num_moduli * polynomial_bytes;
+  int lwe_response_bits = params.lwe_response_bit_size > 0
+                              ? params.lwe_response_bit_size
+                              : params.lwe_modulus_bit_size;
+  int64_t ciphertext_bytes =
+      linpir_params.response_bit_size > 0
+          ? 2 * DivAndRoundUp<int64_t>(
+                    linpir_params.response_bit_size << linpir_params.log_n, 8)
+          : 2 * polynomial_bytes;
+  cost.response_bytes =
+      num_shards *
+          DivAndRoundUp<int64_t>(params.db_rows * lwe_response_bits, 8) +
+      num_moduli * num_shards * num_blocks * ciphertext_bytes;
+  return cost;
+}
+
+absl::StatusOr<PlannerObjective> ParsePlannerObjective(absl::string_view name) {
+  if (name == "server_cpu") {
+    return PlannerObjective::kServerCpu;
+  } else if (name == "client_cpu") {
+    return PlannerObjective::kClientCpu;
+  } else if (name == "upload") {
+    return PlannerObjective::kUpload;
+  } else if (name == "download") {
+    return PlannerObjective::kDownload;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown planner objective `", name, "`."));
+}
+
+absl::Status CheckForValidLinPirParameters(const Parameters& params) {
+  const auto& linpir_params = params.linpir_params;
+  if (linpir_params.log_n < 1) {
+    return absl::InvalidArgumentError(
+        "`linpir_params.log_n` must be positive.");
+  }
+  if (linpir_params.qs.empty() || linpir_params.ts.empty()) {
+    return absl::InvalidArgumentError(
+        "`linpir_params.qs` and `linpir_params.ts` must not be empty.");
+  }
+  if (linpir_params.gadget_log_bs.size() != linpir_params.qs.size()) {
+    return absl::InvalidArgumentError(
+        "`linpir_params.gadget_log_bs` must have one base per modulus in "
+        "`linpir_params.qs`.");
+  }
+  for (size_t log_b : linpir_params.gadget_log_bs) {
+    if (log_b == 0) {
+      return absl::InvalidArgumentError(
+          "`linpir_params.gadget_log_bs` must be positive.");
+    }
+  }
+  // The hints have `lwe_secret_dim` columns, which must fit in a slot group,
+  // and their blocks of `rows_per_block` rows tile the slot groups.
+  int num_slots_per_group = 1 << (linpir_params.log_n - 1);
+  if (params.lwe_secret_dim < 1 ||
+      params.lwe_secret_dim > num_slots_per_group) {
+    return absl::InvalidArgumentError(
+        "`lwe_secret_dim` is larger than supported by `linpir_params`.");
+  }
+  int rows_per_block = linpir_params.rows_per_block;
+  if (rows_per_block < 2 || rows_per_block > num_slots_per_group ||
+      !absl::has_single_bit(static_cast<uint32_t>(rows_per_block))) {
+    return absl::InvalidArgumentError(
+        "`linpir_params.rows_per_block` must be a power of two between 2 and "
+        "2^(log_n - 1).");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<Plan> PlanParameters(const PlannerOptions& options) {
+  if (options.num_records < 1) {
+    return absl::InvalidArgumentError("`num_records` must be positive.");
+  }
+  if (options.record_bit_size < 1) {
+    return absl::InvalidArgumentError("`record_bit_size` must be positive.");
+  }
+  if (options.base_params.lwe_plaintext_bit_size < 1) {
+    return absl::InvalidArgumentError(
+        "`lwe_plaintext_bit_size` must be positive.");
+  }
+  Parameters params = options.base_params;
+  params.db_record_bit_size = options.record_bit_size;
+  params.linpir_params.rows_per_block = 2;
+  RLWE_RETURN_IF_ERROR(CheckForValidLinPirParameters(params));
+
+  // Every power of two of rows and the three quarter points up to the next.
+  std::vector<int64_t> candidate_rows;
+  for (int64_t rows = 1; rows <= options.num_records; rows *= 2) {
+    for (int64_t quarters : {4, 5, 6, 7}) {
+      int64_t candidate = rows * quarters / 4;
+      if (candidate <= options.num_records &&
+          (candidate_rows.empty() || candidate > candidate_rows.back())) {
+        candidate_rows.push_back(candidate);
+      }
+    }
+  }
+
+  int num_slots_per_group = 1 << (params.linpir_params.log_n - 1);
+  std::optional<Plan> best;
+  auto rank = [&](const PlanCost& cost) {
+    return std::make_tuple(ObjectiveValue(cost, options.objective),
+                           cost.ServerMs(),
+                           cost.request_bytes + cost.response_bytes);
+  };
+  for (int64_t rows : candidate_rows) {
+    params.db_rows = rows;
+    params.db_cols = DivAndRoundUp(options.num_records, rows);
+    for (int rows_per_block = 2; rows_per_block <= num_slots_per_group;
+         rows_per_block *= 2) {
+      params.linpir_params.rows_per_block = rows_per_block;
+      PlanCost cost = EstimateCost(params, options.cost_model);
+      if (!best.has_value() || rank(cost) < rank(best->cost)) {
+        best = Plan{.params = params, .cost = cost};
+      }
+      // Blocks taller than the database only add rotations.
+      if (rows_per_block >= rows) {
+        break;
+      }
+    }
+  }
+  return *std::move(best);
+}
+
+absl::StatusOr<std::vector<CalibrationSample>> ParseProtocolBenchmarkCsv(
+    absl::string_view csv, const Parameters& base_params) {
+  std::vector<absl::string_view> lines =
+      absl::StrSplit(csv, '\n', absl::SkipWhitespace());
+  auto header = lines.begin();
+  while (header != lines.end() && !absl::StartsWith(*header, "name,")) {
+    ++header;
+  }
+  if (header == lines.end()) {
+    return absl::InvalidArgumentError("`csv` has no header line.");
+  }
+
+  // Google Benchmark quotes the names of the runs and of the counters.
+  auto fields = [](absl::string_view line) {
+    std::vector<absl::string_view> fields = absl::StrSplit(line, ',');
+    for (absl::string_view& field : fields) {
+      absl::ConsumePrefix(&field, "\"");
+      absl::ConsumeSuffix(&field, "\"");
+    }
+    return fields;
+  };
+  absl::flat_hash_map<absl::string_view, int> columns;
+  std::vector<absl::string_view> header_fields = fields(*header);
+  for (int i = 0; i < header_fields.size(); ++i) {
+    columns[header_fields[i]] = i;
+  }
+  for (absl::string_view column :
+       {"name", "error_occurred", "server_lwe_ms", "server_linpir_ms",
+        "client_request_ms", "client_recover_ms"}) {
+    if (!columns.contains(column)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("`csv` has no column `", column, "`."));
+    }
+  }
+
+  std::vector<CalibrationSample> samples;
+  for (auto line = header + 1; line != lines.end(); ++line) {
+    std::vector<absl::string_view> values = fields(*line);
+    if (values.size() < header_fields.size()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Malformed line in `csv`: ", *line));
+    }
+    absl::string_view name = values[columns["name"]];
+    if (!absl::StartsWith(name, "BM_Protocol/") ||
+        values[columns["error_occurred"]] == "true") {
+      continue;
+    }
+    // Skips the aggregates of repeated runs.
+    if (absl::EndsWith(name, "_mean") || absl::EndsWith(name, "_median") ||
+        absl::EndsWith(name, "_stddev") || absl::EndsWith(name, "_cv")) {
+      continue;
+    }
+
+    CalibrationSample sample{.params = base_params};
+    Parameters& params = sample.params;
+    for (absl::string_view arg : absl::StrSplit(name, '/')) {
+      std::pair<absl::string_view, absl::string_view> key_value =
+          absl::StrSplit(arg, absl::MaxSplits(':', 1));
+      int64_t value = 0;
+      if (key_value.second.empty() ||
+          !absl::SimpleAtoi(key_value.second, &value)) {
+        continue;
+      }
+      if (key_value.first == "rows") {
+        params.db_rows = value;
+      } else if (key_value.first == "cols") {
+        params.db_cols = value;
+      } else if (key_value.first == "record_bits") {
+        params.db_record_bit_size = value;
+      } else if (key_value.first == "lwe_secret_dim") {
+        params.lwe_secret_dim = value;
+      } else if (key_value.first == "rows_per_block") {
+        params.linpir_params.rows_per_block = value;
+      } else if (key_value.first == "threads") {
+        params.num_threads = value;
+      }
+    }
+    if (params.num_threads != 1) {
+      continue;
+    }
+    if (!absl::SimpleAtod(values[columns["server_lwe_ms"]],
+                          &sample.server_lwe_ms) ||
+        !absl::SimpleAtod(values[columns["server_linpir_ms"]],
+                          &sample.server_linpir_ms) ||
+        !absl::SimpleAtod(values[columns["client_request_ms"]],
+                          &sample.client_request_ms) ||
+        !absl::SimpleAtod(values[columns["client_recover_ms"]],
+                          &sample.client_recover_ms)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Malformed line in `csv`: ", *line));
+    }
+    samples.push_back(std::move(sample));
+  }
+  return samples;
+}
+
+absl::StatusOr<CostModel> CalibrateCostModel(
+    absl::Span<const CalibrationSample> samples) {
+  if (samples.empty()) {
+    return absl::InvalidArgumentError("`samples` must not be empty.");
+  }
+  std::vector<double> db_bytes, rlwe_macs, lwe_macs, ntt_butterflies;
+  std::vector<double> server_lwe_ns, server_linpir_ns, client_request_ns,
+      client_recover_ns;
+  for (const CalibrationSample& sample : samples) {
+    RLWE_RETURN_IF_ERROR(CheckForValidLinPirParameters(sample.params));
+    OperationCounts counts = CountOperations(sample.params);
+    db_bytes.push_back(counts.db_bytes);
+    rlwe_macs.push_back(counts.rlwe_macs);
+    lwe_macs.push_back(counts.lwe_macs);
+    ntt_butterflies.push_back(counts.ntt_butterflies);
+    server_lwe_ns.push_back(sample.server_lwe_ms * 1e6);
+    server_linpir_ns.push_back(sample.server_linpir_ms * 1e6);
+    client_request_ns.push_back(sample.client_request_ms * 1e6);
+    client_recover_ns.push_back(sample.client_recover_ms * 1e6);
+  }
+  return CostModel{
+      .server_ns_per_db_byte = FitSlope(db_bytes, server_lwe_ns),
+      .server_ns_per_rlwe_mac = FitSlope(rlwe_macs, server_linpir_ns),
+      .client_ns_per_lwe_mac = FitSlope(lwe_macs, client_request_ns),
+      .client_ns_per_ntt_butterfly =
+          FitSlope(ntt_butterflies, client_recover_ns),
+  };
+}
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
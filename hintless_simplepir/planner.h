@@ -0,0 +1,146 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_PLANNER_H_
+#define HINTLESS_PIR_HINTLESS_SIMPLEPIR_PLANNER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "hintless_simplepir/parameters.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+// The costs of an online request, per request and on a single thread, that
+// the parameter planner estimates for a choice of parameters.
+struct PlanCost {
+  // The server computation: the LWE product with the database, and the LinPir
+  // rotations and inner products with the hints.
+  double server_lwe_ms = 0;
+  double server_linpir_ms = 0;
+
+  // The client computation: generating the request, dominated by the LWE
+  // product of the query pad with the secret, and recovering the record,
+  // dominated by decrypting the LinPir responses.
+  double client_request_ms = 0;
+  double client_recover_ms = 0;
+
+  // The sizes of the serialized request and response.
+  int64_t request_bytes = 0;
+  int64_t response_bytes = 0;
+
+  double ServerMs() const { return server_lwe_ms + server_linpir_ms; }
+  double ClientMs() const { return client_request_ms + client_recover_ms; }
+};
+
+// The cost of one operation of every phase in `PlanCost`, in nanoseconds on a
+// single thread. The defaults are rough figures for a recent x86 core; use
+// `CalibrateCostModel` to fit them to the protocol benchmarks of a host.
+struct CostModel {
+  // The LWE product of the server, per byte of the data matrices.
+  double server_ns_per_db_byte = 0.1;
+
+  // The LinPir server, per multiply-add of a coefficient mod a prime of `qs`.
+  double server_ns_per_rlwe_mac = 1;
+
+  // The LWE query of the client, per multiply-add of the query pad with the
+  // secret, including the expansion of the pad from its seed.
+  double client_ns_per_lwe_mac = 0.5;
+
+  // The LinPir decryption of the client, per NTT butterfly mod a prime of
+  // `qs`.
+  double client_ns_per_ntt_butterfly = 2;
+};
+
+// Returns the costs of an online request with `params` under `cost_model`.
+// The sizes of the request and response are exact up to the framing of the
+// serialized messages.
+PlanCost EstimateCost(const Parameters& params, const CostModel& cost_model);
+
+// The cost that the parameter planner minimizes.
+enum class PlannerObjective {
+  kServerCpu,  // `PlanCost::ServerMs`.
+  kClientCpu,  // `PlanCost::ClientMs`.
+  kUpload,     // `PlanCost::request_bytes`.
+  kDownload,   // `PlanCost::response_bytes`.
+};
+
+// Returns the objective named by `name`, one of "server_cpu", "client_cpu",
+// "upload" or "download".
+absl::StatusOr<PlannerObjective> ParsePlannerObjective(absl::string_view name);
+
+// The inputs of `PlanParameters`.
+struct PlannerOptions {
+  int64_t num_records = 0;
+  int record_bit_size = 0;
+  PlannerObjective objective = PlannerObjective::kServerCpu;
+
+  // The LWE and RLWE parameters to plan with. The planner picks `db_rows`,
+  // `db_cols` and `linpir_params.rows_per_block`, and keeps all other fields,
+  // whose security and correctness it does not model.
+  Parameters base_params;
+
+  CostModel cost_model;
+};
+
+// A choice of parameters and its estimated costs.
+struct Plan {
+  Parameters params;
+  PlanCost cost;
+};
+
+// Returns the parameters for `options.num_records` records that minimize the
+// estimated `options.objective`, breaking ties by the server cost and then by
+// the bandwidth. The database shapes searched have every power of two and the
+// three quarter points between them as `db_rows`, with the fewest columns that
+// hold all records, and every valid `rows_per_block`.
+absl::StatusOr<Plan> PlanParameters(const PlannerOptions& options);
+
+// Returns an error if the hints of `params` cannot be encoded into LinPir
+// databases, i.e. if `params` violates a constraint checked when creating
+// `linpir::Database` or encoding its blocks of diagonals.
+absl::Status CheckForValidLinPirParameters(const Parameters& params);
+
+// A run of the protocol benchmark with known parameters and the measured
+// times of its phases, per request on a single thread.
+struct CalibrationSample {
+  Parameters params;
+  double server_lwe_ms = 0;
+  double server_linpir_ms = 0;
+  double client_request_ms = 0;
+  double client_recover_ms = 0;
+};
+
+// Returns the samples in `csv`, the output of `protocol_benchmarks` with
+// `--benchmark_format=csv`. The parameters of every run are `base_params` with
+// the fields named by the arguments of the benchmark. Runs on more than one
+// thread and failed runs are skipped.
+absl::StatusOr<std::vector<CalibrationSample>> ParseProtocolBenchmarkCsv(
+    absl::string_view csv, const Parameters& base_params);
+
+// Returns the cost model whose estimates best fit the times of `samples` in
+// the least squares sense, one phase per field of `CostModel`.
+absl::StatusOr<CostModel> CalibrateCostModel(
+    absl::Span<const CalibrationSample> samples);
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_HINTLESS_SIMPLEPIR_PLANNER_H_
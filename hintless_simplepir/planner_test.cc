@@ -0,0 +1,231 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hintless_simplepir/planner.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/testing.h"
+#include "lwe/types.h"
+#include "shell_encryption/testing/status_matchers.h"
+#include "shell_encryption/testing/status_testing.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace {
+
+using ::rlwe::testing::StatusIs;
+using ::testing::DoubleNear;
+using ::testing::HasSubstr;
+
+const Parameters kBaseParameters{
+    .lwe_secret_dim = 1408,
+    .lwe_modulus_bit_size = lwe::kIntBitwidth,
+    .lwe_plaintext_bit_size = 8,
+    .lwe_error_variance = 8,
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/1024),
+    .prng_type = rlwe::PRNG_TYPE_HKDF,
+};
+
+PlannerOptions Options(PlannerObjective objective) {
+  return PlannerOptions{
+      .num_records = 1 << 20,
+      .record_bit_size = 64,
+      .objective = objective,
+      .base_params = kBaseParameters,
+  };
+}
+
+TEST(PlannerTest, PlanHoldsAllRecords) {
+  for (PlannerObjective objective :
+       {PlannerObjective::kServerCpu, PlannerObjective::kClientCpu,
+        PlannerObjective::kUpload, PlannerObjective::kDownload}) {
+    PlannerOptions options = Options(objective);
+    ASSERT_OK_AND_ASSIGN(Plan plan, PlanParameters(options));
+    EXPECT_GE(plan.params.db_rows * plan.params.db_cols, options.num_records);
+    EXPECT_EQ(plan.params.db_record_bit_size, options.record_bit_size);
+    EXPECT_EQ(plan.params.lwe_secret_dim, kBaseParameters.lwe_secret_dim);
+    EXPECT_OK(CheckForValidLinPirParameters(plan.params));
+  }
+}
+
+TEST(PlannerTest, PlanMinimizesTheObjective) {
+  ASSERT_OK_AND_ASSIGN(Plan plan,
+                       PlanParameters(Options(PlannerObjective::kServerCpu)));
+  Parameters square = kBaseParameters;
+  square.db_rows = 1024;
+  square.db_cols = 1024;
+  square.db_record_bit_size = 64;
+  EXPECT_LE(plan.cost.ServerMs(), EstimateCost(square, CostModel()).ServerMs());
+
+  // Small responses want short databases and small uploads wide ones.
+  ASSERT_OK_AND_ASSIGN(Plan download_plan,
+                       PlanParameters(Options(PlannerObjective::kDownload)));
+  ASSERT_OK_AND_ASSIGN(Plan upload_plan,
+                       PlanParameters(Options(PlannerObjective::kUpload)));
+  EXPECT_LT(download_plan.params.db_rows, upload_plan.params.db_rows);
+  EXPECT_LT(download_plan.cost.response_bytes,
+            upload_plan.cost.response_bytes);
+  EXPECT_LT(upload_plan.cost.request_bytes, download_plan.cost.request_bytes);
+}
+
+TEST(PlannerTest, PlanFailsIfInvalidOptions) {
+  PlannerOptions options = Options(PlannerObjective::kServerCpu);
+  options.num_records = 0;
+  EXPECT_THAT(PlanParameters(options),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`num_records` must be positive")));
+
+  options = Options(PlannerObjective::kServerCpu);
+  options.base_params.lwe_secret_dim = 4096;
+  EXPECT_THAT(PlanParameters(options),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`lwe_secret_dim` is larger")));
+}
+
+TEST(PlannerTest, CheckForValidLinPirParametersRejectsBlockSizes) {
+  Parameters params = kBaseParameters;
+  for (int rows_per_block : {0, 1, 768, 4096}) {
+    params.linpir_params.rows_per_block = rows_per_block;
+    EXPECT_THAT(CheckForValidLinPirParameters(params),
+                StatusIs(absl::StatusCode::kInvalidArgument,
+                         HasSubstr("`linpir_params.rows_per_block`")));
+  }
+  params.linpir_params.rows_per_block = 2048;
+  EXPECT_OK(CheckForValidLinPirParameters(params));
+}
+
+TEST(PlannerTest, EstimateCostCountsTheMessageSizes) {
+  Parameters params = kBaseParameters;
+  params.db_rows = 2048;
+  params.db_cols = 512;
+  params.db_record_bit_size = 16;
+  params.linpir_params.rows_per_block = 1024;
+  PlanCost cost = EstimateCost(params, CostModel());
+
+  // Two plaintext moduli, two shards and two blocks per shard.
+  int64_t polynomial_bytes = 0;
+  for (auto q : params.linpir_params.qs) {
+    polynomial_bytes += q < (uint64_t{1} << 32) ? 4 : 6;
+  }
+  polynomial_bytes <<= params.linpir_params.log_n;
+  EXPECT_EQ(cost.request_bytes,
+            512 * sizeof(lwe::Integer) + 2 * polynomial_bytes);
+  EXPECT_EQ(cost.response_bytes, 2 * 2048 * sizeof(lwe::Integer) +
+                                     2 * 2 * 2 * 2 * polynomial_bytes);
+
+  // The server streams two shards of 2048 x 512 bytes.
+  CostModel cost_model;
+  EXPECT_DOUBLE_EQ(cost.server_lwe_ms,
+                   2.0 * 2048 * 512 * cost_model.server_ns_per_db_byte / 1e6);
+}
+
+// Returns the output of the protocol benchmarks for the given runs, with the
+// times estimated under `cost_model`.
+std::string ProtocolBenchmarkCsv(const std::vector<Parameters>& runs,
+                                 const CostModel& cost_model) {
+  std::string csv =
+      "name,iterations,real_time,cpu_time,time_unit,bytes_per_second,"
+      "items_per_second,label,error_occurred,error_message,"
+      "\"client_recover_ms\",\"client_request_ms\",\"server_linpir_ms\","
+      "\"server_lwe_ms\"\n";
+  for (const Parameters& params : runs) {
+    PlanCost cost = EstimateCost(params, cost_model);
+    absl::StrAppend(
+        &csv, "\"BM_Protocol/rows:", params.db_rows, "/cols:", params.db_cols,
+        "/record_bits:", params.db_record_bit_size,
+        "/lwe_secret_dim:", params.lwe_secret_dim,
+        "/rows_per_block:", params.linpir_params.rows_per_block,
+        "/threads:", params.num_threads, "/real_time\",10,1,1,ms,,,,,,",
+        cost.client_recover_ms, ",", cost.client_request_ms, ",",
+        cost.server_linpir_ms, ",", cost.server_lwe_ms, "\n");
+  }
+  return csv;
+}
+
+TEST(PlannerTest, CalibrateCostModelFitsTheProtocolBenchmarks) {
+  const CostModel kCostModel{
+      .server_ns_per_db_byte = 0.05,
+      .server_ns_per_rlwe_mac = 1.5,
+      .client_ns_per_lwe_mac = 0.25,
+      .client_ns_per_ntt_butterfly = 3,
+  };
+  std::vector<Parameters> runs;
+  for (int64_t rows : {1024, 4096}) {
+    for (int rows_per_block : {512, 1024}) {
+      Parameters params = kBaseParameters;
+      params.db_rows = rows;
+      params.db_cols = 8192 / (rows / 1024);
+      params.db_record_bit_size = 8;
+      params.linpir_params.rows_per_block = rows_per_block;
+      params.num_threads = 1;
+      runs.push_back(params);
+    }
+  }
+  std::string csv = ProtocolBenchmarkCsv(runs, kCostModel);
+  // Runs on more threads and failed runs are skipped.
+  absl::StrAppend(&csv,
+                  "\"BM_Protocol/rows:1024/cols:1024/record_bits:8/"
+                  "lwe_secret_dim:1408/rows_per_block:512/threads:4/"
+                  "real_time\",10,1,1,ms,,,,,,1,1,1,1\n",
+                  "\"BM_Protocol/rows:1024/cols:1024/record_bits:8/"
+                  "lwe_secret_dim:1408/rows_per_block:512/threads:1/"
+                  "real_time\",0,0,0,ms,,,,true,\"error\",,,,\n");
+
+  ASSERT_OK_AND_ASSIGN(std::vector<CalibrationSample> samples,
+                       ParseProtocolBenchmarkCsv(csv, kBaseParameters));
+  ASSERT_EQ(samples.size(), runs.size());
+  EXPECT_EQ(samples[1].params.db_rows, 1024);
+  EXPECT_EQ(samples[1].params.db_cols, 8192);
+  EXPECT_EQ(samples[1].params.linpir_params.rows_per_block, 1024);
+
+  ASSERT_OK_AND_ASSIGN(CostModel cost_model, CalibrateCostModel(samples));
+  EXPECT_THAT(cost_model.server_ns_per_db_byte, DoubleNear(0.05, 1e-3));
+  EXPECT_THAT(cost_model.server_ns_per_rlwe_mac, DoubleNear(1.5, 1e-3));
+  EXPECT_THAT(cost_model.client_ns_per_lwe_mac, DoubleNear(0.25, 1e-3));
+  EXPECT_THAT(cost_model.client_ns_per_ntt_butterfly, DoubleNear(3, 1e-3));
+}
+
+TEST(PlannerTest, ParseProtocolBenchmarkCsvFailsWithoutTimes) {
+  EXPECT_THAT(ParseProtocolBenchmarkCsv("BM_Protocol/rows:1\n",
+                                        kBaseParameters),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("no header line")));
+  EXPECT_THAT(
+      ParseProtocolBenchmarkCsv("name,iterations,error_occurred\n",
+                                kBaseParameters),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               HasSubstr("no column `server_lwe_ms`")));
+}
+
+TEST(PlannerTest, ParsePlannerObjective) {
+  ASSERT_OK_AND_ASSIGN(PlannerObjective objective,
+                       ParsePlannerObjective("download"));
+  EXPECT_EQ(objective, PlannerObjective::kDownload);
+  EXPECT_THAT(ParsePlannerObjective("latency"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("Unknown planner objective")));
+}
+
+}  // namespace
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
@@ -0,0 +1,174 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the full HintlessPIR protocol over a sweep of parameters,
+// reporting the latency and the size of every phase as counters:
+//
+// - preprocess_hints_ms, preprocess_linpir_ms: computing the hints, and
+//   encoding them for and preprocessing the LinPir servers, once per epoch;
+// - client_request_ms, server_lwe_ms (D*u), server_linpir_ms (H*s), and
+//   client_recover_ms: the phases of every request;
+// - hint_bytes, request_bytes and response_bytes.
+//
+// The counters are averages per request, except for the preprocessing ones.
+// Pass --benchmark_format=json, or --benchmark_out=<file> with
+// --benchmark_out_format=json, for JSON output, and --benchmark_filter to run
+// a part of the sweep.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "hintless_simplepir/client.h"
+#include "hintless_simplepir/database_hwy.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/server.h"
+#include "hintless_simplepir/testing.h"
+#include "lwe/types.h"
+#include "util/metrics.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+namespace {
+
+
+const Parameters kParameters{
+    .db_rows = 1024,
+    .db_cols = 1024,
+    .db_record_bit_size = 8,
+    .lwe_secret_dim = 1408,
+    .lwe_modulus_bit_size = 32,
+    .lwe_plaintext_bit_size = 8,
+    .lwe_error_variance = 8,
+    .linpir_params = testing::LinPirParameters90Bits(/*rows_per_block=*/1024),
+    .prng_type = rlwe::PRNG_TYPE_HKDF,
+};
+
+// Returns the total latency of `phases` in `metrics` in milliseconds, divided
+// by `count`.
+double AverageMillis(const MetricsRecorder& metrics,
+                     std::vector<Phase> phases, int64_t count) {
+  absl::Duration total = absl::ZeroDuration();
+  for (Phase phase : phases) {
+    total += metrics.Get(phase).total_latency;
+  }
+  return absl::ToDoubleMilliseconds(total) / count;
+}
+
+// Runs the protocol for the parameters given by the arguments of `state`, in
+// the order of the argument names below.
+void BM_Protocol(benchmark::State& state) {
+  Parameters params = kParameters;
+  params.db_rows = state.range(0);
+  params.db_cols = state.range(1);
+  params.db_record_bit_size = state.range(2);
+  params.lwe_secret_dim = state.range(3);
+  params.linpir_params.rows_per_block = state.range(4);
+  params.num_threads = state.range(5);
+
+  auto server = Server::CreateWithRandomDatabaseRecords(params);
+  if (!server.ok()) {
+    state.SkipWithError(server.status().ToString().c_str());
+    return;
+  }
+  MetricsRecorder server_metrics;
+  (*server)->SetMetricsSink(&server_metrics);
+  if (absl::Status status = (*server)->Preprocess(); !status.ok()) {
+    state.SkipWithError(status.ToString().c_str());
+    return;
+  }
+  auto client = Client::Create(params, (*server)->GetPublicParams());
+  if (!client.ok()) {
+    state.SkipWithError(client.status().ToString().c_str());
+    return;
+  }
+  MetricsRecorder client_metrics;
+  (*client)->SetMetricsSink(&client_metrics);
+
+  // Preprocessing is reported once, and the request phases per request.
+  double preprocess_hints_ms =
+      AverageMillis(server_metrics, {Phase::kHintComputation}, 1);
+  double preprocess_linpir_ms =
+      AverageMillis(server_metrics, {Phase::kLinPirPreprocessing}, 1);
+  server_metrics.Reset();
+  client_metrics.Reset();
+
+  const Database* database = (*server)->GetDatabase();
+  const int64_t index = params.db_rows * params.db_cols / 2;
+  for (auto _ : state) {
+    auto request = (*client)->GenerateRequest(index);
+    if (!request.ok()) {
+      state.SkipWithError(request.status().ToString().c_str());
+      return;
+    }
+    auto response = (*server)->HandleRequest(*request);
+    if (!response.ok()) {
+      state.SkipWithError(response.status().ToString().c_str());
+      return;
+    }
+    auto record = (*client)->RecoverRecord(*response);
+    if (!record.ok()) {
+      state.SkipWithError(record.status().ToString().c_str());
+      return;
+    }
+    benchmark::DoNotOptimize(record);
+  }
+
+  // Sanity check on the correctness of the instantiation.
+  auto request = (*client)->GenerateRequest(index).value();
+  auto record =
+      (*client)->RecoverRecord((*server)->HandleRequest(request).value());
+  if (!record.ok() || *record != database->Record(index).value()) {
+    state.SkipWithError("Recovered an incorrect record.");
+    return;
+  }
+
+  int64_t num_requests = state.iterations() + 1;
+  state.counters["preprocess_hints_ms"] = preprocess_hints_ms;
+  state.counters["preprocess_linpir_ms"] = preprocess_linpir_ms;
+  state.counters["client_request_ms"] = AverageMillis(
+      client_metrics, {Phase::kClientRequestGeneration}, num_requests);
+  state.counters["server_lwe_ms"] =
+      AverageMillis(server_metrics, {Phase::kLweInnerProduct}, num_requests);
+  state.counters["server_linpir_ms"] = AverageMillis(
+      server_metrics,
+      {Phase::kLinPirRotations, Phase::kLinPirInnerProducts}, num_requests);
+  state.counters["client_recover_ms"] =
+      AverageMillis(client_metrics, {Phase::kClientDecode}, num_requests);
+  state.counters["hint_bytes"] = database->NumShards() * params.db_rows *
+                                 params.lwe_secret_dim * sizeof(lwe::Integer);
+  state.counters["request_bytes"] =
+      server_metrics.Get(Phase::kRequestDeserialization).bytes_in /
+      num_requests;
+  state.counters["response_bytes"] =
+      server_metrics.Get(Phase::kResponseSerialization).bytes_out /
+      num_requests;
+}
+BENCHMARK(BM_Protocol)
+    ->ArgNames({"rows", "cols", "record_bits", "lwe_secret_dim",
+                "rows_per_block", "threads"})
+    ->ArgsProduct({{1024, 4096}, {1024, 4096}, {8, 16}, {1024, 1408},
+                   {512, 1024}, {1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+BENCHMARK_MAIN();
@@ -16,26 +16,39 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "Eigen/Core"
+#include "absl/functional/function_ref.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/message_lite.h"
 #include "hintless_simplepir/database_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/serialization.pb.h"
 #include "hintless_simplepir/utils.h"
+#include "linpir/serialization.pb.h"
 #include "lwe/lwe_symmetric_encryption.h"
 #include "lwe/types.h"
 #include "shell_encryption/prng/single_thread_chacha_prng.h"
 #include "shell_encryption/prng/single_thread_hkdf_prng.h"
 #include "shell_encryption/status_macros.h"
+#include "util/metrics.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
@@ -51,13 +64,87 @@ inline absl::Status CheckForValidPrngType(const Parameters& params) {
   return absl::OkStatus();
 }
 
-}  // namespace
+// Returns an error if `params` asks for an invalid modulus of the responses.
+inline absl::Status CheckForValidResponseBitSize(const Parameters& params) {
+  if (params.lwe_response_bit_size != 0 &&
+      (params.lwe_response_bit_size <= params.lwe_plaintext_bit_size ||
+       params.lwe_response_bit_size > params.lwe_modulus_bit_size)) {
+    return absl::InvalidArgumentError(
+        "Invalid `lwe_response_bit_size` in `params`.");
+  }
+  return absl::OkStatus();
+}
 
-absl::StatusOr<std::unique_ptr<Server>> Server::Create(
-    const Parameters& params) {
-  RLWE_RETURN_IF_ERROR(CheckForValidPrngType(params));
+// Returns the LWE query pad "A" expanded from `prng_seed`.
+absl::StatusOr<lwe::Matrix> ExpandLweQueryPad(const Parameters& params,
+                                              absl::string_view prng_seed) {
+  if (params.prng_type == rlwe::PRNG_TYPE_HKDF) {
+    RLWE_ASSIGN_OR_RETURN(auto prng,
+                          rlwe::SingleThreadHkdfPrng::Create(prng_seed));
+    return lwe::ExpandPad(params.db_cols, params.lwe_secret_dim, prng.get());
+  } else {
+    RLWE_ASSIGN_OR_RETURN(auto prng,
+                          rlwe::SingleThreadChaChaPrng::Create(prng_seed));
+    return lwe::ExpandPad(params.db_cols, params.lwe_secret_dim, prng.get());
+  }
+}
 
-  // Create RLWE contexts, one per plaintext modulus in `ts`.
+// The version of the file format written by `Server::SaveState`.
+constexpr uint32_t kStateVersion = 2;
+
+// The bit width of the RLWE integers of this build, recorded in the state file.
+constexpr int kRlweIntBitwidth = 8 * sizeof(Parameters::RlweInteger);
+
+// The number of hint rows stored in one record of the state file.
+constexpr int64_t kHintRowsPerRecord = 1024;
+
+// The state file is a sequence of records, each a serialized proto message
+// prefixed by its size as a uint64_t.
+absl::Status WriteRecord(const google::protobuf::MessageLite& message,
+                         std::ofstream& output) {
+  std::string bytes;
+  if (!message.SerializeToString(&bytes)) {
+    return absl::InternalError("Failed to serialize server state.");
+  }
+  uint64_t size = bytes.size();
+  output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  output.write(bytes.data(), bytes.size());
+  if (!output) {
+    return absl::InternalError("Failed to write server state.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReadRecord(std::ifstream& input,
+                        google::protobuf::MessageLite& message) {
+  uint64_t size = 0;
+  input.read(reinterpret_cast<char*>(&size), sizeof(size));
+  if (!input) {
+    return absl::DataLossError("Server state file is truncated.");
+  }
+  std::string bytes(size, '\0');
+  input.read(bytes.data(), size);
+  if (!input) {
+    return absl::DataLossError("Server state file is truncated.");
+  }
+  if (!message.ParseFromString(bytes)) {
+    return absl::DataLossError("Server state file is corrupted.");
+  }
+  return absl::OkStatus();
+}
+
+// Tunes the online products of `database` if `params` asks for it.
+absl::Status MaybeAutotune(const Parameters& params, Database& database) {
+  if (!params.autotune_inner_product) {
+    return absl::OkStatus();
+  }
+  return database.AutotuneInnerProduct(params.autotune_cache_path).status();
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<std::unique_ptr<const Server::RlweRnsContext>>>
+Server::CreateRlweContexts(const Parameters& params) {
   auto const& rlwe_params = params.linpir_params;
   int num_linpir_instances = rlwe_params.ts.size();
   std::vector<std::unique_ptr<const RlweRnsContext>> rlwe_contexts;
@@ -70,254 +157,959 @@ absl::StatusOr<std::unique_ptr<Server>> Server::Create(
     rlwe_contexts.push_back(
         std::make_unique<const RlweRnsContext>(std::move(rlwe_context)));
   }
+  return rlwe_contexts;
+}
+
+absl::StatusOr<std::unique_ptr<Server>> Server::Create(
+    const Parameters& params) {
+  RLWE_RETURN_IF_ERROR(CheckForValidPrngType(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidLweModulusBitSize(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidResponseBitSize(params));
+
+  // Create RLWE contexts, one per plaintext modulus in `ts`.
+  RLWE_ASSIGN_OR_RETURN(auto rlwe_contexts, CreateRlweContexts(params));
 
   // Create a Database object holding the database and hint matrices.
   RLWE_ASSIGN_OR_RETURN(auto database, Database::Create(params));
+  RLWE_RETURN_IF_ERROR(MaybeAutotune(params, *database));
 
   return absl::WrapUnique(
       new Server(params, std::move(database), std::move(rlwe_contexts)));
 }
 
 absl::StatusOr<std::unique_ptr<Server>> Server::CreateWithRandomDatabaseRecords(
-    const Parameters& params) {
+    const Parameters& params, uint64_t seed) {
   RLWE_RETURN_IF_ERROR(CheckForValidPrngType(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidLweModulusBitSize(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidResponseBitSize(params));
 
   // Create RLWE contexts, one per plaintext modulus in `ts`.
-  auto const& rlwe_params = params.linpir_params;
-  int num_linpir_instances = rlwe_params.ts.size();
-  std::vector<std::unique_ptr<const RlweRnsContext>> rlwe_contexts;
-  rlwe_contexts.reserve(num_linpir_instances);
-  for (int i = 0; i < num_linpir_instances; ++i) {
-    RLWE_ASSIGN_OR_RETURN(
-        auto rlwe_context,
-        RlweRnsContext::CreateForBfvFiniteFieldEncoding(
-            rlwe_params.log_n, rlwe_params.qs, /*ps=*/{}, rlwe_params.ts[i]));
-    rlwe_contexts.push_back(
-        std::make_unique<const RlweRnsContext>(std::move(rlwe_context)));
-  }
+  RLWE_ASSIGN_OR_RETURN(auto rlwe_contexts, CreateRlweContexts(params));
 
   // Create a Databas holding random records.
-  RLWE_ASSIGN_OR_RETURN(auto database, Database::CreateRandom(params));
+  RLWE_ASSIGN_OR_RETURN(auto database, Database::CreateRandom(params, seed));
+  RLWE_RETURN_IF_ERROR(MaybeAutotune(params, *database));
+
+  return absl::WrapUnique(
+      new Server(params, std::move(database), std::move(rlwe_contexts)));
+}
+
+absl::StatusOr<std::unique_ptr<Server>> Server::CreateWithDatabase(
+    const Parameters& params, std::unique_ptr<Database> database) {
+  RLWE_RETURN_IF_ERROR(CheckForValidPrngType(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidLweModulusBitSize(params));
+  RLWE_RETURN_IF_ERROR(CheckForValidResponseBitSize(params));
+  if (database == nullptr) {
+    return absl::InvalidArgumentError("`database` must not be null.");
+  }
+  RLWE_RETURN_IF_ERROR(MaybeAutotune(params, *database));
+
+  // Create RLWE contexts, one per plaintext modulus in `ts`.
+  RLWE_ASSIGN_OR_RETURN(auto rlwe_contexts, CreateRlweContexts(params));
 
   return absl::WrapUnique(
       new Server(params, std::move(database), std::move(rlwe_contexts)));
 }
 
-absl::Status Server::GeneratePublicParams() {
-  int num_linpir_instances = params_.linpir_params.ts.size();
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
+absl::StatusOr<HintlessPirServerPublicParams> Server::GeneratePublicParams(
+    const Parameters& params) {
+  RLWE_RETURN_IF_ERROR(CheckForValidPrngType(params));
+  HintlessPirServerPublicParams public_params;
+  int num_linpir_instances = params.linpir_params.ts.size();
+  if (params.prng_type == rlwe::PRNG_TYPE_HKDF) {
     // Sample PRNG seeds for LWE "A" matrix and LinPIR.
-    RLWE_ASSIGN_OR_RETURN(prng_seed_lwe_query_pad_,
+    RLWE_ASSIGN_OR_RETURN(*public_params.mutable_prng_seed_lwe_query_pad(),
                           rlwe::SingleThreadHkdfPrng::GenerateSeed());
-    prng_seed_linpir_ct_pads_.clear();
-    prng_seed_linpir_ct_pads_.resize(num_linpir_instances);
     for (int i = 0; i < num_linpir_instances; ++i) {
-      RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_ct_pads_[i],
+      RLWE_ASSIGN_OR_RETURN(*public_params.add_prng_seed_linpir_ct_pads(),
                             rlwe::SingleThreadHkdfPrng::GenerateSeed());
     }
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_gk_pad_,
+    RLWE_ASSIGN_OR_RETURN(*public_params.mutable_prng_seed_linpir_gk_pad(),
                           rlwe::SingleThreadHkdfPrng::GenerateSeed());
-    // Generate the LWE "A" matrix.
-    RLWE_ASSIGN_OR_RETURN(auto prng, rlwe::SingleThreadHkdfPrng::Create(
-                                         prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        auto pad,
-        lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim, prng.get()));
-    lwe_query_pad_ = std::make_unique<const lwe::Matrix>(std::move(pad));
   } else {
-    RLWE_ASSIGN_OR_RETURN(prng_seed_lwe_query_pad_,
+    RLWE_ASSIGN_OR_RETURN(*public_params.mutable_prng_seed_lwe_query_pad(),
                           rlwe::SingleThreadChaChaPrng::GenerateSeed());
-    prng_seed_linpir_ct_pads_.clear();
-    prng_seed_linpir_ct_pads_.resize(num_linpir_instances);
     for (int i = 0; i < num_linpir_instances; ++i) {
-      RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_ct_pads_[i],
+      RLWE_ASSIGN_OR_RETURN(*public_params.add_prng_seed_linpir_ct_pads(),
                             rlwe::SingleThreadChaChaPrng::GenerateSeed());
     }
-    RLWE_ASSIGN_OR_RETURN(prng_seed_linpir_gk_pad_,
+    RLWE_ASSIGN_OR_RETURN(*public_params.mutable_prng_seed_linpir_gk_pad(),
                           rlwe::SingleThreadChaChaPrng::GenerateSeed());
+  }
+  if (params.lwe_response_bit_size > 0) {
+    public_params.set_lwe_response_bit_size(params.lwe_response_bit_size);
+  }
+  return public_params;
+}
 
-    RLWE_ASSIGN_OR_RETURN(auto prng, rlwe::SingleThreadChaChaPrng::Create(
-                                         prng_seed_lwe_query_pad_));
-    RLWE_ASSIGN_OR_RETURN(
-        auto pad,
-        lwe::ExpandPad(params_.db_cols, params_.lwe_secret_dim, prng.get()));
-    lwe_query_pad_ = std::make_unique<const lwe::Matrix>(std::move(pad));
+absl::StatusOr<std::unique_ptr<Server::Epoch>> Server::EpochFromPublicParams(
+    const HintlessPirServerPublicParams& public_params) const {
+  if (public_params.prng_seed_linpir_ct_pads_size() != rlwe_contexts_.size() ||
+      public_params.lwe_response_bit_size() != params_.lwe_response_bit_size) {
+    return absl::InvalidArgumentError(
+        "`public_params` does not match the server parameters.");
   }
-  return absl::OkStatus();
+  auto epoch = std::make_unique<Epoch>();
+  epoch->prng_seed_lwe_query_pad = public_params.prng_seed_lwe_query_pad();
+  epoch->prng_seed_linpir_ct_pads.assign(
+      public_params.prng_seed_linpir_ct_pads().begin(),
+      public_params.prng_seed_linpir_ct_pads().end());
+  epoch->prng_seed_linpir_gk_pad = public_params.prng_seed_linpir_gk_pad();
+
+  // Generate the LWE "A" matrix.
+  RLWE_ASSIGN_OR_RETURN(
+      auto pad, ExpandLweQueryPad(params_, epoch->prng_seed_lwe_query_pad));
+  epoch->lwe_query_pad = std::make_unique<const lwe::Matrix>(std::move(pad));
+  return epoch;
 }
 
 namespace {
 
-// Given `matrix` with mod-q entries, returns `matrix` mod p, where modular
-// numbers are in balanced representation.
+// Given `vector` with mod-2^q_bits entries, writes `vector` mod p to
+// `vector_mod_p`, where modular numbers are in balanced representation. The
+// conversion is computed on the wider of the LWE and RLWE integers.
+template <typename Integer>
+void EncodeLweVector(absl::Span<const lwe::Integer> vector, int q_bits,
+                     Integer p, absl::Span<Integer> vector_mod_p) {
+  using WideInteger = std::common_type_t<lwe::Integer, Integer>;
+  for (int j = 0; j < vector.size(); ++j) {
+    vector_mod_p[j] = static_cast<Integer>(ConvertFromPowerOfTwoModulus(
+        WideInteger{vector[j]}, q_bits, WideInteger{p}));
+  }
+}
+
+// Given `matrix` with mod-2^q_bits entries, returns `matrix` mod p, where
+// modular numbers are in balanced representation.
 template <typename Integer>
 std::vector<std::vector<Integer>> EncodeLweMatrix(
-    const Database::LweMatrix& matrix, Integer q, Integer p) {
-  Integer q_half = q >> 1;
+    absl::Span<const Database::LweVector> matrix, int q_bits, Integer p) {
   int num_rows = matrix.size();
   int num_cols = matrix[0].size();
-  std::vector<std::vector<Integer>> matrix_mod_p(num_rows);
+  std::vector<std::vector<Integer>> matrix_mod_p(
+      num_rows, std::vector<Integer>(num_cols));
   for (int i = 0; i < num_rows; ++i) {
-    matrix_mod_p[i].reserve(num_cols);
-    for (int j = 0; j < num_cols; ++j) {
-      Integer x = static_cast<Integer>(matrix[i][j]);
-      matrix_mod_p[i].push_back(ConvertModulus(x, q, p, q_half));
-    }
+    EncodeLweVector(matrix[i], q_bits, p, absl::MakeSpan(matrix_mod_p[i]));
   }
   return matrix_mod_p;
 }
 
 }  // namespace
 
-absl::Status Server::Preprocess() {
+absl::Status Server::Preprocess(const PreprocessOptions& options) {
+  RLWE_RETURN_IF_ERROR(PrepareNextEpoch(options));
+  RLWE_RETURN_IF_ERROR(ActivateNextEpoch());
+  RetirePreviousEpoch();
+  return absl::OkStatus();
+}
+
+absl::Status Server::PrepareNextEpoch(const PreprocessOptions& options) {
   // Refresh the PRNG seeds.
-  RLWE_RETURN_IF_ERROR(GeneratePublicParams());
-
-  // Make sure the hint is up to date.
-  RLWE_RETURN_IF_ERROR(database_->UpdateLweQueryPad(lwe_query_pad_.get()));
-#ifdef FAKE_RUN
-  RLWE_RETURN_IF_ERROR(database_->UpdateHintsFake());
-#else
-  RLWE_RETURN_IF_ERROR(database_->UpdateHints());
-#endif
-
-  RlweInteger lwe_modulus = RlweInteger{1} << params_.lwe_modulus_bit_size;
-  size_t num_shards = database_->NumShards();
-
-  // Create LinPir databases (holding the preprocessed hints) and servers.
-  linpir_servers_.clear();
-  linpir_servers_.resize(rlwe_contexts_.size());
-  linpir_databases_.clear();
-  linpir_databases_.resize(rlwe_contexts_.size());
-  for (int k = 0; k < rlwe_contexts_.size(); ++k) {
-    RlweInteger plaintext_modulus = rlwe_contexts_[k]->PlaintextModulus();
+  RLWE_ASSIGN_OR_RETURN(HintlessPirServerPublicParams public_params,
+                        GeneratePublicParams(params_));
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Epoch> epoch,
+                        EpochFromPublicParams(public_params));
+  return PrepareEpoch(std::move(epoch), /*epoch_id=*/0, options);
+}
 
-    // One LinPir database per shard, for the current plaintext modulus.
-    std::vector<std::unique_ptr<LinPirDatabase>> linpir_databases_mod_tk;
-    linpir_databases_mod_tk.reserve(num_shards);
-    for (const Database::LweMatrix& hint : database_->Hints()) {
-      std::vector<std::vector<RlweInteger>> hint_mod_tk =
-          EncodeLweMatrix(hint, lwe_modulus, plaintext_modulus);
-      RLWE_ASSIGN_OR_RETURN(
-          auto linpir_database,
-          LinPirDatabase::Create(params_.linpir_params, rlwe_contexts_[k].get(),
-                                 hint_mod_tk));
-      linpir_databases_mod_tk.push_back(std::move(linpir_database));
+absl::Status Server::PrepareNextEpoch(
+    const HintlessPirServerPublicParams& public_params) {
+  if (public_params.epoch_id() <= 0) {
+    return absl::InvalidArgumentError("`public_params` must have an epoch id.");
+  }
+  {
+    absl::MutexLock lock(&epoch_mutex_);
+    if (public_params.epoch_id() <= last_epoch_id_) {
+      return absl::InvalidArgumentError(
+          "`public_params` must have an epoch id larger than those of the "
+          "server.");
     }
-    std::vector<LinPirDatabase*> linpir_databases_ptrs;
-    std::transform(linpir_databases_mod_tk.begin(),
-                   linpir_databases_mod_tk.end(),
-                   std::back_inserter(linpir_databases_ptrs),
-                   [](auto& ptr) { return ptr.get(); });
-    RLWE_ASSIGN_OR_RETURN(
-        auto linpir_server_mod_tk,
-        LinPirServer::Create(params_.linpir_params, rlwe_contexts_[k].get(),
-                             linpir_databases_ptrs,
-                             prng_seed_linpir_ct_pads_[k],
-                             prng_seed_linpir_gk_pad_));
-    RLWE_RETURN_IF_ERROR(linpir_server_mod_tk->Preprocess());
+  }
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Epoch> epoch,
+                        EpochFromPublicParams(public_params));
+  return PrepareEpoch(std::move(epoch), public_params.epoch_id());
+}
 
-    linpir_databases_[k] = std::move(linpir_databases_mod_tk);
-    linpir_servers_[k] = std::move(linpir_server_mod_tk);
+absl::Status Server::PrepareEpoch(std::unique_ptr<Epoch> epoch,
+                                  int64_t epoch_id,
+                                  const PreprocessOptions& options) {
+  // Compute the hints for the new LWE query pad, leaving the ones of the
+  // current epoch in the database.
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kHintComputation);
+    if (options.fake_hints) {
+      epoch->hints = database_->ComputeHintsFake(options.fake_hints_seed);
+    } else {
+      RLWE_ASSIGN_OR_RETURN(epoch->hints,
+                            database_->ComputeHints(*epoch->lwe_query_pad));
+    }
+  }
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kLinPirPreprocessing);
+    RLWE_RETURN_IF_ERROR(CreateLinPirServers(*epoch));
   }
 
+  absl::MutexLock lock(&epoch_mutex_);
+  if (epoch_id == 0) {
+    epoch->id = ++last_epoch_id_;
+  } else if (epoch_id > last_epoch_id_) {
+    epoch->id = last_epoch_id_ = epoch_id;
+  } else {
+    return absl::InvalidArgumentError(
+        "`public_params` must have an epoch id larger than those of the "
+        "server.");
+  }
+  next_epoch_ = std::move(epoch);
   return absl::OkStatus();
 }
 
-absl::StatusOr<HintlessPirResponse> Server::HandleRequest(
-    const HintlessPirRequest& request) {
-  if (!IsPreprocessed()) {
+absl::Status Server::CreateLinPirServers(Epoch& epoch) const {
+  size_t num_shards = epoch.hints.size();
+
+  // Create LinPir databases (holding the preprocessed hints), one per plaintext
+  // modulus and shard. They are independent, so they are encoded concurrently.
+  int num_moduli = rlwe_contexts_.size();
+  std::vector<std::vector<std::unique_ptr<LinPirDatabase>>> linpir_databases(
+      num_moduli);
+  for (auto& linpir_databases_mod_tk : linpir_databases) {
+    linpir_databases_mod_tk.resize(num_shards);
+  }
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_moduli * num_shards, database_->GetThreadPool(),
+      [&](int64_t task_idx) -> absl::Status {
+        int k = task_idx / num_shards;
+        int shard = task_idx % num_shards;
+        // The hint rows are converted to mod t_k while encoding the blocks,
+        // so the hint is never copied in full.
+        absl::Span<const Database::LweVector> hint = epoch.hints[shard];
+        RlweInteger plaintext_modulus = rlwe_contexts_[k]->PlaintextModulus();
+        RLWE_ASSIGN_OR_RETURN(
+            linpir_databases[k][shard],
+            LinPirDatabase::CreateFromRowReader(
+                params_.linpir_params, rlwe_contexts_[k].get(), hint.size(),
+                hint[0].size(),
+                [&](int row_idx, absl::Span<RlweInteger> row) {
+                  EncodeLweVector(hint[row_idx], params_.lwe_modulus_bit_size,
+                                  plaintext_modulus, row);
+                },
+                database_->GetThreadPool()));
+        return absl::OkStatus();
+      }));
+
+  // Create and preprocess the LinPir servers, one per plaintext modulus.
+  std::vector<std::unique_ptr<LinPirServer>> linpir_servers(num_moduli);
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_moduli, database_->GetThreadPool(), [&](int64_t k) -> absl::Status {
+        std::vector<LinPirDatabase*> linpir_databases_ptrs;
+        std::transform(linpir_databases[k].begin(), linpir_databases[k].end(),
+                       std::back_inserter(linpir_databases_ptrs),
+                       [](auto& ptr) { return ptr.get(); });
+        RLWE_ASSIGN_OR_RETURN(
+            linpir_servers[k],
+            LinPirServer::Create(params_.linpir_params,
+                                 rlwe_contexts_[k].get(), linpir_databases_ptrs,
+                                 epoch.prng_seed_linpir_ct_pads[k],
+                                 epoch.prng_seed_linpir_gk_pad,
+                                 database_->GetThreadPool()));
+        linpir_servers[k]->SetMetricsSink(metrics_sink_);
+        return linpir_servers[k]->Preprocess();
+      }));
+
+  epoch.linpir_databases = std::move(linpir_databases);
+  epoch.linpir_servers = std::move(linpir_servers);
+  return absl::OkStatus();
+}
+
+absl::Status Server::ActivateNextEpoch() {
+  // The epoch before the previous one is destroyed outside of the lock.
+  std::shared_ptr<Epoch> retired_epoch;
+  absl::MutexLock lock(&epoch_mutex_);
+  if (next_epoch_ == nullptr) {
+    return absl::FailedPreconditionError("No epoch has been prepared.");
+  }
+  // The database only reads its hints and its LWE query pad when records
+  // change, so they can be swapped while requests are being handled.
+  RLWE_RETURN_IF_ERROR(
+      database_->UpdateLweQueryPad(next_epoch_->lwe_query_pad.get()));
+  RLWE_RETURN_IF_ERROR(database_->SetHints(std::move(next_epoch_->hints)));
+  next_epoch_->hints.clear();
+  retired_epoch = std::move(previous_epoch_);
+  previous_epoch_ = std::move(current_epoch_);
+  current_epoch_ = std::move(next_epoch_);
+  return absl::OkStatus();
+}
+
+void Server::RetirePreviousEpoch() {
+  std::shared_ptr<Epoch> previous_epoch;
+  {
+    absl::MutexLock lock(&epoch_mutex_);
+    previous_epoch = std::move(previous_epoch_);
+  }
+  // The epoch is destroyed here, outside of the lock, unless requests still
+  // hold on to it.
+}
+
+int64_t Server::CurrentEpochId() const {
+  std::shared_ptr<const Epoch> epoch = CurrentEpoch();
+  return epoch == nullptr ? 0 : epoch->id;
+}
+
+int64_t Server::NextEpochId() const {
+  absl::MutexLock lock(&epoch_mutex_);
+  return next_epoch_ == nullptr ? 0 : next_epoch_->id;
+}
+
+const lwe::Matrix* Server::LweQueryPad() const {
+  std::shared_ptr<const Epoch> epoch = CurrentEpoch();
+  return epoch == nullptr ? nullptr : epoch->lwe_query_pad.get();
+}
+
+Server::MemoryBreakdown Server::MemoryUsage() const {
+  MemoryBreakdown usage;
+  absl::MutexLock lock(&epoch_mutex_);
+  usage.database = database_->MemoryUsage();
+  for (const Epoch* epoch :
+       {current_epoch_.get(), previous_epoch_.get(), next_epoch_.get()}) {
+    if (epoch == nullptr) {
+      continue;
+    }
+    if (epoch->lwe_query_pad != nullptr) {
+      usage.lwe_query_pad_bytes +=
+          epoch->lwe_query_pad->size() * sizeof(lwe::Integer);
+    }
+    for (const Database::LweMatrix& hint : epoch->hints) {
+      for (const Database::LweVector& row : hint) {
+        usage.prepared_hint_bytes += row.size() * sizeof(lwe::Integer);
+      }
+    }
+    for (auto const& linpir_databases : epoch->linpir_databases) {
+      for (auto const& linpir_database : linpir_databases) {
+        auto database_usage = linpir_database->MemoryUsage();
+        usage.linpir_databases.diagonal_bytes += database_usage.diagonal_bytes;
+        usage.linpir_databases.pad_inner_product_bytes +=
+            database_usage.pad_inner_product_bytes;
+      }
+    }
+    for (auto const& linpir_server : epoch->linpir_servers) {
+      auto server_usage = linpir_server->MemoryUsage();
+      usage.linpir_servers.ct_pad_bytes += server_usage.ct_pad_bytes;
+      usage.linpir_servers.ct_sub_pad_digit_bytes +=
+          server_usage.ct_sub_pad_digit_bytes;
+      usage.linpir_servers.gk_pad_bytes += server_usage.gk_pad_bytes;
+    }
+  }
+  return usage;
+}
+
+void Server::ReleasePreprocessingState() {
+  absl::MutexLock lock(&epoch_mutex_);
+  if (current_epoch_ == nullptr) {
+    return;
+  }
+  // The database points to the LWE query pad of the current epoch, so it must
+  // forget it before the pad is released.
+  database_->ReleaseHints();
+  current_epoch_->lwe_query_pad.reset();
+  if (previous_epoch_ != nullptr) {
+    previous_epoch_->lwe_query_pad.reset();
+  }
+}
+
+absl::StatusOr<std::shared_ptr<const Server::Epoch>> Server::EpochWithId(
+    const HintlessPirRequest& request) const {
+  absl::MutexLock lock(&epoch_mutex_);
+  if (current_epoch_ == nullptr) {
     return absl::FailedPreconditionError("Server has not been preprocessed.");
   }
+  if (!request.has_epoch_id() || request.epoch_id() == current_epoch_->id) {
+    return current_epoch_;
+  }
+  if (previous_epoch_ != nullptr && request.epoch_id() == previous_epoch_->id) {
+    return previous_epoch_;
+  }
+  return absl::FailedPreconditionError(
+      "`request` is for an epoch that is no longer served.");
+}
 
-  double start, end;
-  start = currentDateTime();
-  HintlessPirResponse response;
-  // Handle the LWE part of the request.
-  Database::LweVector ct_query_vector =
-      DeserializeLweCiphertext(request.ct_query_vector());
-  RLWE_ASSIGN_OR_RETURN(std::vector<Database::LweVector> ct_records,
-                        database_->InnerProductWith(ct_query_vector));
-  for (auto& ct_record : ct_records) {
-    *response.add_ct_records() = SerializeLweCiphertext(ct_record);
-  }
-  end = currentDateTime();
-  std::cout << "[==> TIMER  <==] Server-only online D*u time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
-
-  start = currentDateTime();
-  // Handle the LinPIR requests.
-  int num_linpir_requests = request.linpir_ct_bs_size();
-  if (num_linpir_requests != linpir_servers_.size()) {
+absl::StatusOr<std::shared_ptr<const Server::Epoch>> Server::EpochForRequest(
+    const HintlessPirRequest& request) const {
+  RLWE_ASSIGN_OR_RETURN(std::shared_ptr<const Epoch> epoch,
+                        EpochWithId(request));
+  if (request.linpir_ct_bs_size() != epoch->linpir_servers.size()) {
     return absl::InvalidArgumentError(
         "`request` contains unexpected number of LinPir requests.");
   }
-  for (int k = 0; k < num_linpir_requests; ++k) {
-    RLWE_ASSIGN_OR_RETURN(LinPirResponse linpir_response,
-                          linpir_servers_[k]->HandleRequest(
-                              request.linpir_ct_bs(k), request.linpir_gk_bs()));
-    *response.add_linpir_responses() = std::move(linpir_response);
+  return epoch;
+}
+
+absl::Status Server::UpdateRecords(absl::Span<const int64_t> indices,
+                                   absl::Span<const std::string> records) {
+  if (IsPreprocessed() && database_->Hints().empty()) {
+    return absl::FailedPreconditionError(
+        "The hints have been released by `ReleasePreprocessingState`.");
+  }
+  RLWE_RETURN_IF_ERROR(database_->Update(indices, records));
+  std::shared_ptr<Epoch> epoch;
+  {
+    absl::MutexLock lock(&epoch_mutex_);
+    previous_epoch_.reset();
+    next_epoch_.reset();
+    epoch = current_epoch_;
   }
-  end = currentDateTime();
-  std::cout << "[==> TIMER  <==] Server-only online H*s time: " << (end-start) << " ms | " << (end-start)/1000 << " sec" << std::endl;
+  if (epoch == nullptr) {
+    return absl::OkStatus();
+  }
+
+  // Collect the LinPir blocks holding the changed hint rows.
+  int rows_per_block = params_.linpir_params.rows_per_block;
+  std::vector<int64_t> block_indices;
+  block_indices.reserve(indices.size());
+  for (int64_t index : indices) {
+    block_indices.push_back(database_->MatrixCoordinate(index).first /
+                            rows_per_block);
+  }
+  std::sort(block_indices.begin(), block_indices.end());
+  block_indices.erase(std::unique(block_indices.begin(), block_indices.end()),
+                      block_indices.end());
+
+  for (int k = 0; k < epoch->linpir_servers.size(); ++k) {
+    RlweInteger plaintext_modulus = rlwe_contexts_[k]->PlaintextModulus();
+    for (int shard = 0; shard < database_->NumShards(); ++shard) {
+      absl::Span<const Database::LweVector> hint = database_->Hints()[shard];
+      for (int64_t block_idx : block_indices) {
+        int64_t row_begin = block_idx * rows_per_block;
+        std::vector<std::vector<RlweInteger>> rows_mod_tk = EncodeLweMatrix(
+            hint.subspan(row_begin, rows_per_block),
+            params_.lwe_modulus_bit_size, plaintext_modulus);
+        RLWE_RETURN_IF_ERROR(epoch->linpir_servers[k]->UpdateDatabaseBlock(
+            shard, block_idx, rows_mod_tk));
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<LinPirResponse>> Server::HandleLinPirRequests(
+    const Epoch& epoch, const HintlessPirRequest& request,
+    absl::FunctionRef<absl::Status()> lwe_stage) const {
+  // Task 0 runs `lwe_stage`, and task k + 1 runs the k'th LinPir server. The
+  // LinPir servers share the workers for their own inner products.
+  int num_moduli = epoch.linpir_servers.size();
+  std::vector<LinPirResponse> linpir_responses(num_moduli);
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_moduli + 1, database_->GetThreadPool(),
+      [&](int64_t task_idx) -> absl::Status {
+        if (task_idx == 0) {
+          return lwe_stage();
+        }
+        int k = task_idx - 1;
+        RLWE_ASSIGN_OR_RETURN(linpir_responses[k],
+                              HandleLinPirRequest(epoch, request, k));
+        return absl::OkStatus();
+      }));
+  return linpir_responses;
+}
+
+absl::StatusOr<LinPirResponse> Server::HandleLinPirRequest(
+    const Epoch& epoch, const HintlessPirRequest& request, int k) const {
+  return epoch.linpir_servers[k]->HandleRequest(request.linpir_ct_bs(k),
+                                                request.linpir_gk_bs());
+}
+
+void Server::RecordMessageSizes(const HintlessPirRequest& request,
+                                const HintlessPirResponse& response) const {
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kRequestDeserialization,
+                               request.ByteSizeLong(), 0);
+    metrics_sink_->RecordBytes(Phase::kResponseSerialization, 0,
+                               response.ByteSizeLong());
+  }
+}
+
+SerializedLweCiphertext Server::SerializeLweRecord(
+    const Database::LweVector& ct_record) const {
+  if (params_.lwe_response_bit_size > 0) {
+    return SerializeLweCiphertextModSwitched(ct_record,
+                                             params_.lwe_response_bit_size);
+  }
+  return SerializeLweCiphertext(ct_record);
+}
+
+void Server::SetMetricsSink(MetricsSink* sink) {
+  metrics_sink_ = sink;
+  absl::MutexLock lock(&epoch_mutex_);
+  for (Epoch* epoch :
+       {current_epoch_.get(), previous_epoch_.get(), next_epoch_.get()}) {
+    if (epoch != nullptr) {
+      for (auto& linpir_server : epoch->linpir_servers) {
+        linpir_server->SetMetricsSink(sink);
+      }
+    }
+  }
+}
+
+std::vector<absl::Span<lwe::Integer>> Server::AddLweRecords(
+    HintlessPirResponse* response,
+    std::vector<Database::LweVector>& switch_buffers) const {
+  int num_shards = database_->NumShards();
+  std::vector<absl::Span<lwe::Integer>> ct_records;
+  ct_records.reserve(num_shards);
+  response->mutable_ct_records()->Reserve(num_shards);
+  if (params_.lwe_response_bit_size > 0) {
+    switch_buffers.assign(num_shards, Database::LweVector(params_.db_rows));
+  }
+  for (int i = 0; i < num_shards; ++i) {
+    SerializedLweCiphertext* ct_record = response->add_ct_records();
+    if (params_.lwe_response_bit_size > 0) {
+      ct_records.push_back(absl::MakeSpan(switch_buffers[i]));
+    } else {
+      ct_records.push_back(
+          MutableLweCiphertextCoeffs(ct_record, params_.db_rows));
+    }
+  }
+  return ct_records;
+}
 
+void Server::SerializeSwitchedLweRecords(
+    absl::Span<const Database::LweVector> switch_buffers,
+    HintlessPirResponse* response) const {
+  for (int i = 0; i < switch_buffers.size(); ++i) {
+    *response->mutable_ct_records(i) = SerializeLweRecord(switch_buffers[i]);
+  }
+}
+
+absl::StatusOr<HintlessPirResponse> Server::HandleRequest(
+    const HintlessPirRequest& request) const {
+  HintlessPirResponse response;
+  RLWE_RETURN_IF_ERROR(HandleRequestInto(request, &response));
   return response;
 }
 
-absl::StatusOr<HintlessPirResponse> Server::HandlePrepareRequest(
-    const HintlessPirRequest& request) {
+absl::StatusOr<HintlessPirResponse*> Server::HandleRequest(
+    const HintlessPirRequest& request, google::protobuf::Arena* arena) const {
+  auto* response = google::protobuf::Arena::Create<HintlessPirResponse>(arena);
+  absl::Status status = HandleRequestInto(request, response);
+  if (!status.ok()) {
+    if (arena == nullptr) {
+      delete response;
+    }
+    return status;
+  }
+  return response;
+}
+
+absl::Status Server::HandleRequestInto(const HintlessPirRequest& request,
+                                       HintlessPirResponse* response) const {
+  RLWE_ASSIGN_OR_RETURN(std::shared_ptr<const Epoch> epoch,
+                        EpochForRequest(request));
+
+  // Handle the LWE part of the request, concurrently with the LinPIR requests.
+  // The query vector is read in place from the request, and the products are
+  // written in place into the response unless they are modulus switched.
+  std::vector<Database::LweVector> switch_buffers;
+  std::vector<absl::Span<lwe::Integer>> ct_records =
+      AddLweRecords(response, switch_buffers);
+  RLWE_ASSIGN_OR_RETURN(
+      std::vector<LinPirResponse> linpir_responses,
+      HandleLinPirRequests(*epoch, request, [&]() -> absl::Status {
+        ScopedPhaseTimer timer(metrics_sink_, Phase::kLweInnerProduct);
+        return database_->InnerProductWithInto(
+            LweCiphertextCoeffs(request.ct_query_vector()), ct_records);
+      }));
+
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kResponseSerialization);
+    SerializeSwitchedLweRecords(switch_buffers, response);
+    response->mutable_linpir_responses()->Reserve(linpir_responses.size());
+    for (auto& linpir_response : linpir_responses) {
+      *response->add_linpir_responses() = std::move(linpir_response);
+    }
+  }
+  RecordMessageSizes(request, *response);
+  return absl::OkStatus();
+}
+
+absl::Status Server::HandleRequestStreamed(const HintlessPirRequest& request,
+                                           ResponseStream& stream) const {
+  RLWE_ASSIGN_OR_RETURN(std::shared_ptr<const Epoch> epoch,
+                        EpochForRequest(request));
+
+  // Task 0 computes and sends the LWE records, and task k + 1 streams the
+  // blocks of the k'th LinPir server, as in `HandleLinPirRequests`.
+  int num_moduli = epoch->linpir_servers.size();
+  return ParallelForWithStatus(
+      num_moduli + 1, database_->GetThreadPool(),
+      [&](int64_t task_idx) -> absl::Status {
+        if (task_idx == 0) {
+          HintlessPirResponse lwe_response;
+          std::vector<Database::LweVector> switch_buffers;
+          std::vector<absl::Span<lwe::Integer>> ct_records =
+              AddLweRecords(&lwe_response, switch_buffers);
+          {
+            ScopedPhaseTimer timer(metrics_sink_, Phase::kLweInnerProduct);
+            RLWE_RETURN_IF_ERROR(database_->InnerProductWithInto(
+                LweCiphertextCoeffs(request.ct_query_vector()), ct_records));
+          }
+          SerializeSwitchedLweRecords(switch_buffers, &lwe_response);
+          stream.OnLweRecords(std::move(lwe_response));
+          return absl::OkStatus();
+        }
+        int k = task_idx - 1;
+        auto on_block = [&](int database_idx, int block_idx,
+                            LinPirResponseBlock ct_block) {
+          stream.OnLinPirBlock(k, database_idx, block_idx, std::move(ct_block));
+        };
+        return epoch->linpir_servers[k]->HandleRequestStreamed(
+            request.linpir_ct_bs(k), request.linpir_gk_bs(), on_block);
+      });
+}
+
+void Server::HandleRequestAsync(HintlessPirRequest request,
+                                ResponseStream* stream) const {
+  auto handle_request = [this, request = std::move(request), stream]() {
+    stream->OnDone(HandleRequestStreamed(request, *stream));
+  };
+  ThreadPool* thread_pool = database_->GetThreadPool();
+  if (thread_pool == nullptr) {
+    handle_request();
+    return;
+  }
+  // The task helps with its own parallel loops, so it cannot deadlock even if
+  // all workers are busy with other requests.
+  thread_pool->Schedule(std::move(handle_request));
+}
+
+absl::StatusOr<std::vector<HintlessPirResponse>> Server::HandleRequestBatch(
+    absl::Span<const HintlessPirRequest> requests) const {
+  std::vector<const HintlessPirRequest*> request_ptrs;
+  request_ptrs.reserve(requests.size());
+  for (auto const& request : requests) {
+    request_ptrs.push_back(&request);
+  }
+  return HandleRequestPointers(request_ptrs);
+}
+
+absl::StatusOr<std::vector<HintlessPirResponse>> Server::HandleRequestPointers(
+    absl::Span<const HintlessPirRequest* const> requests) const {
   if (!IsPreprocessed()) {
     return absl::FailedPreconditionError("Server has not been preprocessed.");
   }
+  // The requests may have been generated for different epochs.
+  std::vector<std::shared_ptr<const Epoch>> epochs;
+  epochs.reserve(requests.size());
+  for (const HintlessPirRequest* request : requests) {
+    RLWE_ASSIGN_OR_RETURN(std::shared_ptr<const Epoch> epoch,
+                          EpochForRequest(*request));
+    epochs.push_back(std::move(epoch));
+  }
+
+  // Handle the LWE part of all requests together.
+  std::vector<Database::LweVector> ct_query_vectors;
+  ct_query_vectors.reserve(requests.size());
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kRequestDeserialization);
+    for (const HintlessPirRequest* request : requests) {
+      ct_query_vectors.push_back(
+          DeserializeLweCiphertext(request->ct_query_vector()));
+    }
+  }
+  std::vector<std::vector<Database::LweVector>> ct_records;
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kLweInnerProduct);
+    RLWE_ASSIGN_OR_RETURN(ct_records,
+                          database_->InnerProductWithBatch(ct_query_vectors));
+  }
+  std::vector<HintlessPirResponse> responses(requests.size());
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kResponseSerialization);
+    for (int i = 0; i < requests.size(); ++i) {
+      for (auto& ct_record : ct_records[i]) {
+        *responses[i].add_ct_records() = SerializeLweRecord(ct_record);
+      }
+    }
+  }
+
+  // Handle the LinPIR requests of all requests and plaintext moduli
+  // concurrently, each writing to its own slot in the responses.
+  int num_moduli = rlwe_contexts_.size();
+  for (auto& response : responses) {
+    for (int k = 0; k < num_moduli; ++k) {
+      response.add_linpir_responses();
+    }
+  }
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      requests.size() * num_moduli, database_->GetThreadPool(),
+      [&](int64_t task_idx) -> absl::Status {
+        int i = task_idx / num_moduli;
+        int k = task_idx % num_moduli;
+        RLWE_ASSIGN_OR_RETURN(
+            *responses[i].mutable_linpir_responses(k),
+            HandleLinPirRequest(*epochs[i], *requests[i], k));
+        return absl::OkStatus();
+      }));
+  for (int i = 0; i < requests.size(); ++i) {
+    RecordMessageSizes(*requests[i], responses[i]);
+  }
+  return responses;
+}
+
+absl::StatusOr<HintlessPirBatchResponse> Server::HandleBatchRequest(
+    const HintlessPirBatchRequest& batch_request) const {
+  std::vector<const HintlessPirRequest*> request_ptrs;
+  request_ptrs.reserve(batch_request.requests_size());
+  for (auto const& request : batch_request.requests()) {
+    request_ptrs.push_back(&request);
+  }
+  RLWE_ASSIGN_OR_RETURN(std::vector<HintlessPirResponse> responses,
+                        HandleRequestPointers(request_ptrs));
+  HintlessPirBatchResponse batch_response;
+  batch_response.mutable_responses()->Reserve(responses.size());
+  for (auto& response : responses) {
+    *batch_response.add_responses() = std::move(response);
+  }
+  return batch_response;
+}
+
+absl::StatusOr<HintlessPirResponse> Server::HandlePrepareRequest(
+    const HintlessPirRequest& request) const {
+  RLWE_ASSIGN_OR_RETURN(std::shared_ptr<const Epoch> epoch,
+                        EpochForRequest(request));
   HintlessPirResponse response;
 
   // Handle the LinPIR requests.
-  int num_linpir_requests = request.linpir_ct_bs_size();
-  if (num_linpir_requests != linpir_servers_.size()) {
-    return absl::InvalidArgumentError(
-        "`request` contains unexpected number of LinPir requests.");
-  }
-  for (int k = 0; k < num_linpir_requests; ++k) {
-    //std::cout<<"LinPir handle request"<<std::endl;
-    RLWE_ASSIGN_OR_RETURN(LinPirResponse linpir_response,
-                          linpir_servers_[k]->HandleRequest(
-                              request.linpir_ct_bs(k), request.linpir_gk_bs()));
+  RLWE_ASSIGN_OR_RETURN(
+      std::vector<LinPirResponse> linpir_responses,
+      HandleLinPirRequests(*epoch, request, [] { return absl::OkStatus(); }));
+  for (auto& linpir_response : linpir_responses) {
     *response.add_linpir_responses() = std::move(linpir_response);
   }
-
+  RecordMessageSizes(request, response);
   return response;
 }
 
+absl::StatusOr<HintlessPirBatchResponse> Server::HandlePrepareRequest(
+    const HintlessPirBatchRequest& batch_request) const {
+  HintlessPirBatchResponse batch_response;
+  batch_response.mutable_responses()->Reserve(batch_request.requests_size());
+  for (auto const& request : batch_request.requests()) {
+    RLWE_ASSIGN_OR_RETURN(*batch_response.add_responses(),
+                          HandlePrepareRequest(request));
+  }
+  return batch_response;
+}
+
 absl::StatusOr<HintlessPirResponse> Server::HandleRequestSkipLinPir(
-    const HintlessPirRequest& request) {
+    const HintlessPirRequest& request) const {
   if (!IsPreprocessed()) {
     return absl::FailedPreconditionError("Server has not been preprocessed.");
   }
 
+  // Handle the LWE part of the request, reading the query vector and writing
+  // the products in place as in `HandleRequest`.
   HintlessPirResponse response;
-  // Handle the LWE part of the request.
-  
-  Database::LweVector ct_query_vector =
-      DeserializeLweCiphertext(request.ct_query_vector());
-  
-  std::cout<<"Generic Inner product LWE"<<std::endl;
-  RLWE_ASSIGN_OR_RETURN(std::vector<Database::LweVector> ct_records,
-                        database_->InnerProductWith(ct_query_vector));
-  
-  //std::cout<<"Ser LWE ciphertext"<<std::endl;
-  for (auto& ct_record : ct_records) {
-    *response.add_ct_records() = SerializeLweCiphertext(ct_record);
+  std::vector<Database::LweVector> switch_buffers;
+  std::vector<absl::Span<lwe::Integer>> ct_records =
+      AddLweRecords(&response, switch_buffers);
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kLweInnerProduct);
+    RLWE_RETURN_IF_ERROR(database_->InnerProductWithInto(
+        LweCiphertextCoeffs(request.ct_query_vector()), ct_records));
   }
-
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kResponseSerialization);
+    SerializeSwitchedLweRecords(switch_buffers, &response);
+  }
+  RecordMessageSizes(request, response);
   return response;
 }
 
+absl::Status Server::SaveState(absl::string_view path) const {
+  std::shared_ptr<const Epoch> epoch = CurrentEpoch();
+  if (epoch == nullptr) {
+    return absl::FailedPreconditionError("Server has not been preprocessed.");
+  }
+  if (database_->Hints().empty()) {
+    return absl::FailedPreconditionError(
+        "The hints have been released by `ReleasePreprocessingState`.");
+  }
+  std::ofstream output(std::string(path), std::ios::binary | std::ios::trunc);
+  if (!output) {
+    return absl::InternalError(absl::StrCat("Cannot open ", path, "."));
+  }
+
+  int linpir_num_blocks = epoch->linpir_databases.empty() ||
+                                  epoch->linpir_databases[0].empty()
+                              ? 0
+                              : epoch->linpir_databases[0][0]->NumBlocks();
+  HintlessPirServerState header;
+  header.set_version(kStateVersion);
+  header.set_db_rows(params_.db_rows);
+  header.set_db_cols(params_.db_cols);
+  header.set_lwe_secret_dim(params_.lwe_secret_dim);
+  header.set_num_shards(database_->NumShards());
+  header.set_linpir_num_blocks(linpir_num_blocks);
+  header.set_lwe_integer_bits(lwe::kIntBitwidth);
+  header.set_rlwe_integer_bits(kRlweIntBitwidth);
+  *header.mutable_public_params() = PublicParams(*epoch);
+  RLWE_RETURN_IF_ERROR(WriteRecord(header, output));
+
+  // The hint matrices, in chunks of rows.
+  for (const Database::LweMatrix& hint : database_->Hints()) {
+    for (int64_t i = 0; i < params_.db_rows; i += kHintRowsPerRecord) {
+      int64_t end = std::min<int64_t>(i + kHintRowsPerRecord, params_.db_rows);
+      std::string values;
+      values.reserve((end - i) * params_.lwe_secret_dim *
+                     sizeof(lwe::Integer));
+      for (int64_t j = i; j < end; ++j) {
+        values.append(reinterpret_cast<const char*>(hint[j].data()),
+                      hint[j].size() * sizeof(lwe::Integer));
+      }
+      HintlessPirHintRows rows;
+      rows.set_values(std::move(values));
+      RLWE_RETURN_IF_ERROR(WriteRecord(rows, output));
+    }
+  }
+
+  // The LinPir servers, each followed by the blocks of its databases.
+  for (int k = 0; k < epoch->linpir_servers.size(); ++k) {
+    RLWE_ASSIGN_OR_RETURN(LinPirServerState linpir_state,
+                          epoch->linpir_servers[k]->SerializeState());
+    RLWE_RETURN_IF_ERROR(WriteRecord(linpir_state, output));
+    for (auto const& linpir_database : epoch->linpir_databases[k]) {
+      for (int i = 0; i < linpir_num_blocks; ++i) {
+        RLWE_ASSIGN_OR_RETURN(LinPirDatabaseBlock block,
+                              linpir_database->SerializeBlock(i));
+        RLWE_RETURN_IF_ERROR(WriteRecord(block, output));
+      }
+    }
+  }
+  output.close();
+  if (!output) {
+    return absl::InternalError("Failed to write server state.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Server::LoadState(absl::string_view path) {
+  std::ifstream input(std::string(path), std::ios::binary);
+  if (!input) {
+    return absl::NotFoundError(absl::StrCat("Cannot open ", path, "."));
+  }
+
+  HintlessPirServerState header;
+  RLWE_RETURN_IF_ERROR(ReadRecord(input, header));
+  if (header.version() != kStateVersion) {
+    return absl::InvalidArgumentError(
+        "Server state file has unsupported version.");
+  }
+  if (header.db_rows() != params_.db_rows ||
+      header.db_cols() != params_.db_cols ||
+      header.lwe_secret_dim() != params_.lwe_secret_dim ||
+      header.num_shards() != database_->NumShards() ||
+      header.lwe_integer_bits() != lwe::kIntBitwidth ||
+      header.rlwe_integer_bits() != kRlweIntBitwidth ||
+      header.public_params().prng_seed_linpir_ct_pads_size() !=
+          rlwe_contexts_.size()) {
+    return absl::InvalidArgumentError(
+        "Server state file does not match the server parameters.");
+  }
+  auto const& public_params = header.public_params();
+
+  // Read the hint matrices.
+  std::vector<Database::LweMatrix> hints(header.num_shards());
+  for (Database::LweMatrix& hint : hints) {
+    hint.reserve(params_.db_rows);
+    for (int64_t i = 0; i < params_.db_rows; i += kHintRowsPerRecord) {
+      int64_t end = std::min<int64_t>(i + kHintRowsPerRecord, params_.db_rows);
+      HintlessPirHintRows rows;
+      RLWE_RETURN_IF_ERROR(ReadRecord(input, rows));
+      size_t row_size = params_.lwe_secret_dim * sizeof(lwe::Integer);
+      if (rows.values().size() != (end - i) * row_size) {
+        return absl::DataLossError("Server state file is corrupted.");
+      }
+      for (int64_t j = 0; j < end - i; ++j) {
+        Database::LweVector row(params_.lwe_secret_dim);
+        std::memcpy(row.data(), rows.values().data() + j * row_size,
+                    row_size);
+        hint.push_back(std::move(row));
+      }
+    }
+  }
+
+  // Restore the LinPir databases and servers.
+  std::vector<std::vector<std::unique_ptr<LinPirDatabase>>> linpir_databases(
+      rlwe_contexts_.size());
+  std::vector<std::unique_ptr<LinPirServer>> linpir_servers(
+      rlwe_contexts_.size());
+  for (int k = 0; k < rlwe_contexts_.size(); ++k) {
+    LinPirServerState linpir_state;
+    RLWE_RETURN_IF_ERROR(ReadRecord(input, linpir_state));
+    std::vector<LinPirDatabase*> linpir_databases_ptrs;
+    for (int shard = 0; shard < header.num_shards(); ++shard) {
+      std::vector<LinPirDatabaseBlock> blocks(header.linpir_num_blocks());
+      for (auto& block : blocks) {
+        RLWE_RETURN_IF_ERROR(ReadRecord(input, block));
+      }
+      RLWE_ASSIGN_OR_RETURN(auto linpir_database,
+                            LinPirDatabase::CreateFromSerializedBlocks(
+                                params_.linpir_params, rlwe_contexts_[k].get(),
+                                blocks));
+      linpir_databases_ptrs.push_back(linpir_database.get());
+      linpir_databases[k].push_back(std::move(linpir_database));
+    }
+    RLWE_ASSIGN_OR_RETURN(
+        linpir_servers[k],
+        LinPirServer::CreateFromState(params_.linpir_params,
+                                      rlwe_contexts_[k].get(),
+                                      linpir_databases_ptrs, linpir_state,
+                                      database_->GetThreadPool()));
+    linpir_servers[k]->SetMetricsSink(metrics_sink_);
+  }
+
+  RLWE_ASSIGN_OR_RETURN(std::shared_ptr<Epoch> epoch,
+                        EpochFromPublicParams(public_params));
+  epoch->linpir_databases = std::move(linpir_databases);
+  epoch->linpir_servers = std::move(linpir_servers);
+
+  // The restored epoch replaces all epochs of the server.
+  absl::MutexLock lock(&epoch_mutex_);
+  RLWE_RETURN_IF_ERROR(
+      database_->UpdateLweQueryPad(epoch->lwe_query_pad.get()));
+  RLWE_RETURN_IF_ERROR(database_->SetHints(std::move(hints)));
+  // Keep the id of the saved epoch, so that clients holding its public
+  // parameters are still served, unless it was saved without one.
+  if (public_params.epoch_id() > 0) {
+    epoch->id = public_params.epoch_id();
+    last_epoch_id_ = std::max(last_epoch_id_, epoch->id);
+  } else {
+    epoch->id = ++last_epoch_id_;
+  }
+  current_epoch_ = std::move(epoch);
+  previous_epoch_.reset();
+  next_epoch_.reset();
+  return absl::OkStatus();
+}
+
 HintlessPirServerPublicParams Server::GetPublicParams() const {
+  std::shared_ptr<const Epoch> epoch = CurrentEpoch();
+  if (epoch == nullptr) {
+    return PublicParams(Epoch{});
+  }
+  return PublicParams(*epoch);
+}
+
+HintlessPirServerPublicParams Server::PublicParams(const Epoch& epoch) const {
   HintlessPirServerPublicParams output;
-  output.set_prng_seed_lwe_query_pad(prng_seed_lwe_query_pad_);
-  for (auto const& prng_seed : prng_seed_linpir_ct_pads_) {
+  output.set_prng_seed_lwe_query_pad(epoch.prng_seed_lwe_query_pad);
+  for (auto const& prng_seed : epoch.prng_seed_linpir_ct_pads) {
     *output.add_prng_seed_linpir_ct_pads() = prng_seed;
   }
-  output.set_prng_seed_linpir_gk_pad(prng_seed_linpir_gk_pad_);
+  output.set_prng_seed_linpir_gk_pad(epoch.prng_seed_linpir_gk_pad);
+  if (params_.lwe_response_bit_size > 0) {
+    output.set_lwe_response_bit_size(params_.lwe_response_bit_size);
+  }
+  if (epoch.id > 0) {
+    output.set_epoch_id(epoch.id);
+  }
   return output;
 }
 
@@ -16,57 +16,269 @@
 #ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_SERVER_H_
 #define HINTLESS_PIR_HINTLESS_SIMPLEPIR_SERVER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "hintless_simplepir/database_hwy.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/serialization.pb.h"
 #include "linpir/database.h"
+#include "linpir/serialization.pb.h"
 #include "linpir/server.h"
 #include "lwe/types.h"
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/rns/rns_context.h"
+#include "util/metrics.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 
+// Receives the parts of the response to a request handled by
+// `Server::HandleRequestStreamed` or `Server::HandleRequestAsync`, as soon as
+// each of them is computed. The methods may be called from several threads at
+// the same time, so implementations must be thread-safe.
+class ResponseStream {
+ public:
+  virtual ~ResponseStream() = default;
+
+  // Receives a response holding only the LWE records of all shards, once the
+  // product between the database and the query vector is done. Called once,
+  // typically well before the LinPir blocks are done.
+  virtual void OnLweRecords(HintlessPirResponse lwe_response) = 0;
+
+  // Receives the `block_idx`'th block of the `database_idx`'th inner product
+  // of the LinPir response for the `modulus_idx`'th plaintext modulus, i.e.
+  // `linpir_responses(modulus_idx).ct_inner_products(database_idx)
+  // .ct_blocks(block_idx)` of the full response, or of its
+  // `mod_switched_ct_blocks` if the LinPir responses are modulus switched; see
+  // `linpir::SetResponseBlock`. Blocks come in no particular order.
+  virtual void OnLinPirBlock(int modulus_idx, int database_idx, int block_idx,
+                             LinPirResponseBlock ct_block) = 0;
+
+  // Called last and exactly once by `Server::HandleRequestAsync`, with the
+  // status of the request. Parts received before an error must be discarded.
+  virtual void OnDone(absl::Status status) {}
+};
+
+// Options of `Server::Preprocess` and `Server::PrepareNextEpoch`.
+struct PreprocessOptions {
+  // Whether the hints are filled with random values expanded from
+  // `fake_hints_seed` instead of being computed from the database. The LinPir
+  // servers are built on them as usual, so requests are handled at full cost,
+  // but the records recovered by clients are garbage. This is only meant for
+  // capacity tests, where computing the hints of a large database would take
+  // longer than the test itself.
+  bool fake_hints = false;
+  uint64_t fake_hints_seed = 0;
+};
+
 // The server part of the HintlessPir protocol.
+//
+// The methods handling requests are const and thread-safe: once the server has
+// been preprocessed, any number of threads may handle requests at the same
+// time, sharing the database, the hints and the workers of one server. They
+// may also run concurrently with `PrepareNextEpoch`, `ActivateNextEpoch` and
+// `RetirePreviousEpoch`, but not with `UpdateRecords`, `LoadState` or
+// `SetMetricsSink`.
 class Server {
  public:
+  // The memory held by a server, in bytes, summed over its current, previous
+  // and prepared epochs.
+  struct MemoryBreakdown {
+    // The data and the hint matrices held by the database.
+    Database::MemoryBreakdown database;
+    // The LWE query pads.
+    int64_t lwe_query_pad_bytes = 0;
+    // The hints of the prepared epoch, until it is activated.
+    int64_t prepared_hint_bytes = 0;
+    // The hints encoded by the LinPir databases, and their preprocessed pads.
+    linpir::Database<Parameters::RlweInteger>::MemoryBreakdown
+        linpir_databases;
+    // The polynomials preprocessed by the LinPir servers.
+    linpir::Server<Parameters::RlweInteger>::MemoryBreakdown linpir_servers;
+
+    int64_t TotalBytes() const {
+      return database.TotalBytes() + lwe_query_pad_bytes +
+             prepared_hint_bytes + linpir_databases.TotalBytes() +
+             linpir_servers.TotalBytes();
+    }
+  };
+
   static absl::StatusOr<std::unique_ptr<Server>> Create(
       const Parameters& params);
 
-  // Creates a server holding a random database supporting the given parameters.
+  // Creates a server holding a random database supporting the given parameters,
+  // filled by `Database::CreateRandom` from `seed`.
   static absl::StatusOr<std::unique_ptr<Server>>
-  CreateWithRandomDatabaseRecords(const Parameters& params);
+  CreateWithRandomDatabaseRecords(const Parameters& params, uint64_t seed = 0);
+
+  // Creates a server holding `database`, e.g. a database opened by
+  // `Database::OpenMapped`. `database` must have been created for `params`.
+  static absl::StatusOr<std::unique_ptr<Server>> CreateWithDatabase(
+      const Parameters& params, std::unique_ptr<Database> database);
 
   // Refreshes the server's public parameters and preprocess the database and
   // LinPir servers. The server's public parameters are used by the clients to
   // generate their requests, accessible via `GetPublicParams()`. This should
   // be called before accepting client requests.
-  absl::Status Preprocess();
+  //
+  // This is the same as `PrepareNextEpoch`, `ActivateNextEpoch` and
+  // `RetirePreviousEpoch`, so requests for earlier public parameters fail.
+  absl::Status Preprocess(const PreprocessOptions& options = {});
+
+  // Builds a new epoch, i.e. fresh public parameters, the hints for them and
+  // the preprocessed LinPir servers, without changing the current epoch. This
+  // may be called from a background thread while requests are handled, which
+  // keep being answered under the current public parameters, but not
+  // concurrently with the other methods that change the server.
+  absl::Status PrepareNextEpoch(const PreprocessOptions& options = {});
+
+  // Same as above, but builds the epoch from the PRNG seeds and with the epoch
+  // id of `public_params`, e.g. those generated by `GeneratePublicParams` for
+  // all servers holding the rows of one database, so that they answer the
+  // same requests. Returns error if the epoch id is not larger than those of
+  // the epochs built before.
+  absl::Status PrepareNextEpoch(
+      const HintlessPirServerPublicParams& public_params);
+
+  // Returns public parameters with fresh PRNG seeds for `params`, and without
+  // an epoch id.
+  static absl::StatusOr<HintlessPirServerPublicParams> GeneratePublicParams(
+      const Parameters& params);
+
+  // Makes the epoch built by `PrepareNextEpoch` the current one, whose public
+  // parameters are returned by `GetPublicParams`. Requests that are being
+  // handled finish on the epoch they started with. The former current epoch
+  // keeps answering the requests generated for it, until the next activation
+  // or until `RetirePreviousEpoch` is called, e.g. after a grace period long
+  // enough for the clients to fetch the new public parameters.
+  absl::Status ActivateNextEpoch();
+
+  // Drops the previous epoch, if any, so that requests for it fail and its
+  // memory is released once the requests being handled on it finish.
+  void RetirePreviousEpoch();
+
+  // Returns the id of the current epoch, or 0 if the server has not been
+  // preprocessed.
+  int64_t CurrentEpochId() const;
+
+  // Returns the id of the epoch built by `PrepareNextEpoch` and not activated
+  // yet, or 0 if there is none.
+  int64_t NextEpochId() const;
+
+  // Replaces the records at `indices` by `records`. When the server has been
+  // preprocessed, only the hint rows of these records and the LinPir blocks
+  // holding them are updated, so that the server keeps accepting requests with
+  // the same public parameters, at a cost proportional to the number of
+  // changed LinPir blocks rather than the database size. The previous and the
+  // prepared next epoch, whose hints no longer match the records, are dropped.
+  absl::Status UpdateRecords(absl::Span<const int64_t> indices,
+                             absl::Span<const std::string> records);
 
   absl::StatusOr<HintlessPirResponse> HandleRequest(
-      const HintlessPirRequest& request);
+      const HintlessPirRequest& request) const;
 
+  // Same as above, but allocates the response on `arena`, which owns it. If
+  // `arena` is null, the response is allocated on the heap and the caller
+  // takes ownership of it. When `request` is also allocated on an arena that
+  // is reused across requests, handling a request allocates almost nothing on
+  // the heap beyond the LinPir computation.
+  absl::StatusOr<HintlessPirResponse*> HandleRequest(
+      const HintlessPirRequest& request, google::protobuf::Arena* arena) const;
+
+  // Handles `request` as `HandleRequest` does, but hands the parts of the
+  // response to `stream` as soon as they are computed instead of returning
+  // them all at once: the LWE records as soon as the product between the
+  // database and the query vector is done, and every LinPir block as soon as
+  // it is serialized. Does not call `stream->OnDone`.
+  absl::Status HandleRequestStreamed(const HintlessPirRequest& request,
+                                     ResponseStream& stream) const;
+
+  // Schedules `request` on the workers of the server and returns right away.
+  // The request is handled as by `HandleRequestStreamed`, then
+  // `stream->OnDone` is called with its status. Without workers, i.e. when
+  // `params.num_threads` <= 1, the request is handled before returning.
+  // `stream` and the server must outlive the call to `OnDone`.
+  void HandleRequestAsync(HintlessPirRequest request,
+                          ResponseStream* stream) const;
+
+  // Handles a batch of requests, returning one response per request in the same
+  // order. The LWE part of all requests is computed in a single pass over the
+  // database.
+  absl::StatusOr<std::vector<HintlessPirResponse>> HandleRequestBatch(
+      absl::Span<const HintlessPirRequest> requests) const;
+
+  // Handles a batch request generated by `Client::GenerateBatchRequest`, as
+  // `HandleRequestBatch` does for its requests.
+  absl::StatusOr<HintlessPirBatchResponse> HandleBatchRequest(
+      const HintlessPirBatchRequest& batch_request) const;
+
+  // Handles the offline part of a `Session` request, i.e. the LinPir requests
+  // computing hint * LWE secret. The response holds no LWE records.
   absl::StatusOr<HintlessPirResponse> HandlePrepareRequest(
-    const HintlessPirRequest& request);
+      const HintlessPirRequest& request) const;
+
+  // Handles the prepare request of a `Session`, returning one response per
+  // LWE secret to prepare.
+  absl::StatusOr<HintlessPirBatchResponse> HandlePrepareRequest(
+      const HintlessPirBatchRequest& batch_request) const;
 
+  // Handles the online part of a `Session` request, i.e. the product between
+  // the database and the LWE query vector. The response holds no LinPir
+  // responses.
   absl::StatusOr<HintlessPirResponse> HandleRequestSkipLinPir(
-    const HintlessPirRequest& request);
+      const HintlessPirRequest& request) const;
+
+  // Saves the preprocessed state of the server, i.e. the PRNG seeds, the hint
+  // matrices and the preprocessed LinPir databases and servers, to the file at
+  // `path`. Returns error if the server has not been preprocessed.
+  absl::Status SaveState(absl::string_view path) const;
+
+  // Restores the preprocessed state saved by `SaveState`, so that the server
+  // can accept requests without calling `Preprocess`. The state must have been
+  // saved by a server with the same parameters and database records. The
+  // current state of the server is unchanged if an error is returned.
+  absl::Status LoadState(absl::string_view path);
 
   // Returns the server's public parameters that are sent to the client.
   HintlessPirServerPublicParams GetPublicParams() const;
 
   Database* GetDatabase() const { return database_.get(); }
 
-  const lwe::Matrix* LweQueryPad() const { return lwe_query_pad_.get(); }
+  // Records the latencies and sizes of the request phases in `sink`, including
+  // those of the LinPir servers, and the latencies of computing the hints and
+  // preprocessing the LinPir servers of new epochs, or nothing if `sink` is
+  // null. Must not be called concurrently with handling requests or preparing
+  // epochs. Does not take ownership.
+  void SetMetricsSink(MetricsSink* sink);
+
+  // Returns the LWE query pad of the current epoch, or null if the server has
+  // not been preprocessed or the pad has been released.
+  const lwe::Matrix* LweQueryPad() const;
+
+  // Returns the memory held by the database and the epochs of the server. May
+  // be called concurrently with handling requests.
+  MemoryBreakdown MemoryUsage() const;
+
+  // Releases the state that is only needed to update records or to save the
+  // state once the LinPir servers are built: the LWE query pads of the current
+  // and the previous epochs, and the hint matrices held by the database, whose
+  // size is that of the LinPir databases before encoding. Requests are handled
+  // as before, but `UpdateRecords` and `SaveState` fail, and `LweQueryPad`
+  // returns null, until the next epoch is activated. Must not be called
+  // concurrently with `UpdateRecords`, `SaveState` or `LweQueryPad`.
+  void ReleasePreprocessingState();
 
  private:
   using RlweInteger = Parameters::RlweInteger;
@@ -74,6 +286,26 @@ class Server {
   using RlweRnsContext = rlwe::RnsContext<RlweModularInt>;
   using LinPirServer = linpir::Server<RlweInteger>;
   using LinPirDatabase = linpir::Database<RlweInteger>;
+  using RlwePolynomial = LinPirServer::RnsPolynomial;
+
+  // The state of the server for one set of public parameters: the PRNG seeds,
+  // the LWE query pad, and the LinPir databases and servers holding the hints.
+  struct Epoch {
+    int64_t id = 0;
+
+    std::string prng_seed_lwe_query_pad;
+    std::unique_ptr<const lwe::Matrix> lwe_query_pad;
+
+    std::vector<std::string> prng_seed_linpir_ct_pads;
+    std::string prng_seed_linpir_gk_pad;
+
+    // The hints for `lwe_query_pad` until the epoch is activated, after which
+    // the database holds them.
+    std::vector<Database::LweMatrix> hints;
+
+    std::vector<std::vector<std::unique_ptr<LinPirDatabase>>> linpir_databases;
+    std::vector<std::unique_ptr<LinPirServer>> linpir_servers;
+  };
 
   explicit Server(
       Parameters params, std::unique_ptr<Database> database,
@@ -82,12 +314,87 @@ class Server {
         database_(std::move(database)),
         rlwe_contexts_(std::move(rlwe_contexts)) {}
 
-  // Refreshes the server's public parameters.
-  // This is part of the preprocess steps.
-  absl::Status GeneratePublicParams();
+  // Creates the RLWE contexts, one per plaintext modulus in `params`.
+  static absl::StatusOr<std::vector<std::unique_ptr<const RlweRnsContext>>>
+  CreateRlweContexts(const Parameters& params);
+
+  // Records the sizes of `request` and `response` if there is a metrics sink.
+  void RecordMessageSizes(const HintlessPirRequest& request,
+                          const HintlessPirResponse& response) const;
+
+  // Implements `HandleRequest`, writing to `response`.
+  absl::Status HandleRequestInto(const HintlessPirRequest& request,
+                                 HintlessPirResponse* response) const;
+
+  // Adds one LWE record per shard to `response` and returns the spans the
+  // database products should be written to. These are the coefficients of the
+  // records, unless the responses are modulus switched, in which case they are
+  // `switch_buffers`, to be serialized by `SerializeSwitchedLweRecords`.
+  std::vector<absl::Span<lwe::Integer>> AddLweRecords(
+      HintlessPirResponse* response,
+      std::vector<Database::LweVector>& switch_buffers) const;
+
+  // Serializes the modulus switched records in `switch_buffers`, if any, into
+  // the records added by `AddLweRecords`.
+  void SerializeSwitchedLweRecords(
+      absl::Span<const Database::LweVector> switch_buffers,
+      HintlessPirResponse* response) const;
+
+  // Serializes the LWE response of a shard, switched to the modulus
+  // 2^lwe_response_bit_size if the parameters ask for it.
+  SerializedLweCiphertext SerializeLweRecord(
+      const Database::LweVector& ct_record) const;
+
+  // Implements `HandleRequestBatch` for requests that need not be contiguous.
+  absl::StatusOr<std::vector<HintlessPirResponse>> HandleRequestPointers(
+      absl::Span<const HintlessPirRequest* const> requests) const;
+
+  // Handles the LinPir requests in `request` on the LinPir servers of `epoch`,
+  // one per plaintext modulus, and runs `lwe_stage` concurrently with them on
+  // the workers of the database.
+  absl::StatusOr<std::vector<LinPirResponse>> HandleLinPirRequests(
+      const Epoch& epoch, const HintlessPirRequest& request,
+      absl::FunctionRef<absl::Status()> lwe_stage) const;
+
+  // Handles the LinPir request for the k'th plaintext modulus in `request`.
+  absl::StatusOr<LinPirResponse> HandleLinPirRequest(
+      const Epoch& epoch, const HintlessPirRequest& request, int k) const;
+
+  // Returns the epoch of the public parameters `request` was generated for.
+  absl::StatusOr<std::shared_ptr<const Epoch>> EpochWithId(
+      const HintlessPirRequest& request) const;
+
+  // Returns the epoch answering `request`, after checking that the request has
+  // one LinPir request per LinPir server of that epoch.
+  absl::StatusOr<std::shared_ptr<const Epoch>> EpochForRequest(
+      const HintlessPirRequest& request) const;
+
+  // Returns an epoch with the PRNG seeds of `public_params` and the LWE query
+  // pad expanded from them, but with neither hints nor LinPir servers yet.
+  absl::StatusOr<std::unique_ptr<Epoch>> EpochFromPublicParams(
+      const HintlessPirServerPublicParams& public_params) const;
+
+  // Computes the hints and the LinPir servers of `epoch` and makes it the next
+  // epoch, with id `epoch_id` or, if it is 0, the one after the last id.
+  absl::Status PrepareEpoch(std::unique_ptr<Epoch> epoch, int64_t epoch_id,
+                            const PreprocessOptions& options = {});
+
+  // Creates the LinPir databases holding `epoch.hints` and preprocesses the
+  // LinPir servers of `epoch`.
+  absl::Status CreateLinPirServers(Epoch& epoch) const;
+
+  // Returns the public parameters of `epoch`.
+  HintlessPirServerPublicParams PublicParams(const Epoch& epoch) const;
+
+  // Returns the current epoch, or null if the server has not been
+  // preprocessed.
+  std::shared_ptr<Epoch> CurrentEpoch() const {
+    absl::MutexLock lock(&epoch_mutex_);
+    return current_epoch_;
+  }
 
   // Returns if the server has been preprocessed to accept requests.
-  bool IsPreprocessed() const { return lwe_query_pad_ != nullptr; }
+  bool IsPreprocessed() const { return CurrentEpoch() != nullptr; }
 
   // The parameters of the SimplePIR protocol.
   const Parameters params_;
@@ -97,14 +404,19 @@ class Server {
 
   std::vector<std::unique_ptr<const RlweRnsContext>> rlwe_contexts_;
 
-  std::string prng_seed_lwe_query_pad_;
-  std::unique_ptr<const lwe::Matrix> lwe_query_pad_;
+  // The epochs are swapped under `epoch_mutex_`, and every request holds on to
+  // the epoch it started with, so an epoch is only destroyed once the last
+  // request using it has finished.
+  mutable absl::Mutex epoch_mutex_;
+  std::shared_ptr<Epoch> current_epoch_ ABSL_GUARDED_BY(epoch_mutex_);
+  std::shared_ptr<Epoch> previous_epoch_ ABSL_GUARDED_BY(epoch_mutex_);
+  std::unique_ptr<Epoch> next_epoch_ ABSL_GUARDED_BY(epoch_mutex_);
 
-  std::vector<std::string> prng_seed_linpir_ct_pads_;
-  std::string prng_seed_linpir_gk_pad_;
+  // The id of the last epoch generated.
+  int64_t last_epoch_id_ ABSL_GUARDED_BY(epoch_mutex_) = 0;
 
-  std::vector<std::vector<std::unique_ptr<LinPirDatabase>>> linpir_databases_;
-  std::vector<std::unique_ptr<LinPirServer>> linpir_servers_;
+  // Receives the server metrics; may be null. Does not own the object.
+  MetricsSink* metrics_sink_ = nullptr;
 };
 
 }  // namespace hintless_simplepir
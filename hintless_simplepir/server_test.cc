@@ -17,9 +17,11 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/log/check.h"
 #include "absl/status/status.h"
+#include "absl/types/span.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "hintless_simplepir/database_hwy.h"
@@ -85,6 +87,25 @@ TEST(Server, CreateFailsIfInvalidPrngType) {
                        HasSubstr("Invalid PRNG type")));
 }
 
+TEST(Server, CreateFailsIfInvalidLweModulusBitSize) {
+  Parameters params = kParameters;
+  params.lwe_modulus_bit_size = lwe::kIntBitwidth - 1;
+  EXPECT_THAT(Server::Create(params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`lwe_modulus_bit_size` must be")));
+}
+
+TEST(Server, CreateFailsIfInvalidResponseBitSize) {
+  for (int bit_size : {kParameters.lwe_plaintext_bit_size,
+                       kParameters.lwe_modulus_bit_size + 1}) {
+    Parameters params = kParameters;
+    params.lwe_response_bit_size = bit_size;
+    EXPECT_THAT(Server::Create(params),
+                StatusIs(absl::StatusCode::kInvalidArgument,
+                         HasSubstr("Invalid `lwe_response_bit_size`")));
+  }
+}
+
 TEST(Server, Create) {
   ASSERT_OK_AND_ASSIGN(auto server, Server::Create(kParameters));
   auto database = server->GetDatabase();
@@ -96,6 +117,19 @@ TEST(Server, Create) {
   ASSERT_EQ(database->NumRecords(), 0);
 }
 
+TEST(Server, CreateWithAutotuning) {
+  Parameters params = kParameters;
+  params.autotune_inner_product = true;
+  params.autotune_cache_path = ::testing::TempDir() + "/server_test.autotune";
+  ASSERT_OK_AND_ASSIGN(auto server, Server::Create(params));
+  internal::InnerProductConfig config =
+      server->GetDatabase()->GetInnerProductConfig();
+
+  // A second server reads the configuration from the cache.
+  ASSERT_OK_AND_ASSIGN(auto other_server, Server::Create(params));
+  EXPECT_EQ(other_server->GetDatabase()->GetInnerProductConfig(), config);
+}
+
 TEST_F(ServerTest, Preprocess) {
   // Check that the server's public parameters are generated and the database
   // structures are preprocessed.
@@ -138,6 +172,47 @@ TEST_F(ServerTest, Preprocess) {
   }
 }
 
+TEST_F(ServerTest, PreprocessWithFakeHints) {
+  ASSERT_OK(this->server_->Preprocess({.fake_hints = true}));
+  const Database* database = this->server_->GetDatabase();
+  ASSERT_OK_AND_ASSIGN(std::vector<Database::LweMatrix> hints,
+                       database->ComputeHints(*this->server_->LweQueryPad()));
+  EXPECT_NE(database->Hints(), absl::MakeConstSpan(hints));
+  std::vector<Database::LweMatrix> fake_hints = database->ComputeHintsFake();
+  EXPECT_EQ(database->Hints(), absl::MakeConstSpan(fake_hints));
+
+  // Preprocessing again computes the hints.
+  ASSERT_OK(this->server_->Preprocess());
+  ASSERT_OK_AND_ASSIGN(hints,
+                       database->ComputeHints(*this->server_->LweQueryPad()));
+  EXPECT_EQ(database->Hints(), absl::MakeConstSpan(hints));
+}
+
+TEST_F(ServerTest, PrepareNextEpochWithPublicParams) {
+  ASSERT_OK_AND_ASSIGN(HintlessPirServerPublicParams public_params,
+                       Server::GeneratePublicParams(kParameters));
+  EXPECT_FALSE(public_params.has_epoch_id());
+  EXPECT_THAT(this->server_->PrepareNextEpoch(public_params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must have an epoch id")));
+
+  // The epoch uses the given seeds and epoch id.
+  public_params.set_epoch_id(5);
+  ASSERT_OK(this->server_->PrepareNextEpoch(public_params));
+  ASSERT_OK(this->server_->ActivateNextEpoch());
+  EXPECT_EQ(this->server_->CurrentEpochId(), 5);
+  EXPECT_EQ(this->server_->GetPublicParams().SerializeAsString(),
+            public_params.SerializeAsString());
+
+  // Epoch ids must increase.
+  EXPECT_THAT(this->server_->PrepareNextEpoch(public_params),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("epoch id larger")));
+  ASSERT_OK(this->server_->PrepareNextEpoch());
+  ASSERT_OK(this->server_->ActivateNextEpoch());
+  EXPECT_EQ(this->server_->CurrentEpochId(), 6);
+}
+
 TEST_F(ServerTest, HandleRequestFailsIfNotPreprocessed) {
   // Handle a request without preprocessing the server.
   HintlessPirRequest request;
@@ -160,6 +235,130 @@ TEST_F(ServerTest, HandleRequestFailsIfIncorrectLinPirRequest) {
                        HasSubstr("unexpected number of LinPir requests")));
 }
 
+TEST_F(ServerTest, HandleRequestBatchFailsIfNotPreprocessed) {
+  HintlessPirRequest request;
+  *request.mutable_ct_query_vector() =
+      SerializeLweCiphertext(lwe::Vector::Zero(kParameters.db_cols));
+  std::vector<HintlessPirRequest> requests = {request, request};
+  EXPECT_THAT(this->server_->HandleRequestBatch(requests),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("Server has not been preprocessed")));
+}
+
+TEST_F(ServerTest, HandleRequestBatchFailsIfIncorrectLinPirRequest) {
+  ASSERT_OK(this->server_->Preprocess());
+  HintlessPirRequest request;
+  *request.mutable_ct_query_vector() =
+      SerializeLweCiphertext(lwe::Vector::Zero(kParameters.db_cols));
+  std::vector<HintlessPirRequest> requests = {request, request};
+  EXPECT_THAT(this->server_->HandleRequestBatch(requests),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("unexpected number of LinPir requests")));
+}
+
+TEST_F(ServerTest, MemoryUsageAndReleasePreprocessingState) {
+  Server::MemoryBreakdown usage = this->server_->MemoryUsage();
+  EXPECT_GT(usage.database.data_bytes, 0);
+  EXPECT_EQ(usage.lwe_query_pad_bytes, 0);
+  EXPECT_EQ(usage.linpir_databases.TotalBytes(), 0);
+
+  ASSERT_OK(this->server_->Preprocess());
+  usage = this->server_->MemoryUsage();
+  int64_t hint_bytes = this->server_->GetDatabase()->NumShards() *
+                       kParameters.db_rows * kParameters.lwe_secret_dim *
+                       sizeof(lwe::Integer);
+  EXPECT_EQ(usage.database.hint_bytes, hint_bytes);
+  EXPECT_EQ(usage.lwe_query_pad_bytes, kParameters.db_cols *
+                                           kParameters.lwe_secret_dim *
+                                           sizeof(lwe::Integer));
+  EXPECT_EQ(usage.prepared_hint_bytes, 0);
+  EXPECT_GT(usage.linpir_databases.diagonal_bytes, 0);
+  EXPECT_GT(usage.linpir_databases.pad_inner_product_bytes, 0);
+  EXPECT_GT(usage.linpir_servers.ct_pad_bytes, 0);
+  EXPECT_GT(usage.linpir_servers.ct_sub_pad_digit_bytes, 0);
+  EXPECT_GT(usage.linpir_servers.gk_pad_bytes, 0);
+
+  // The prepared epoch holds its own hints until it is activated.
+  ASSERT_OK(this->server_->PrepareNextEpoch());
+  EXPECT_EQ(this->server_->MemoryUsage().prepared_hint_bytes, hint_bytes);
+  ASSERT_OK(this->server_->ActivateNextEpoch());
+  this->server_->RetirePreviousEpoch();
+  EXPECT_EQ(this->server_->MemoryUsage().TotalBytes(), usage.TotalBytes());
+
+  this->server_->ReleasePreprocessingState();
+  Server::MemoryBreakdown released = this->server_->MemoryUsage();
+  EXPECT_EQ(released.database.hint_bytes, 0);
+  EXPECT_EQ(released.lwe_query_pad_bytes, 0);
+  EXPECT_EQ(released.TotalBytes(), usage.TotalBytes() - hint_bytes -
+                                       usage.lwe_query_pad_bytes);
+  EXPECT_EQ(this->server_->LweQueryPad(), nullptr);
+  EXPECT_THAT(this->server_->SaveState(::testing::TempDir() +
+                                       "/server_test_released.state"),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("released")));
+  std::vector<int64_t> indices = {3};
+  std::vector<std::string> records = {
+      testing::GenerateRandomRecord(kParameters)};
+  EXPECT_THAT(this->server_->UpdateRecords(indices, records),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("released")));
+
+  // The next epoch holds the hints again.
+  ASSERT_OK(this->server_->Preprocess());
+  EXPECT_EQ(this->server_->MemoryUsage().TotalBytes(), usage.TotalBytes());
+  ASSERT_OK(this->server_->UpdateRecords(indices, records));
+}
+
+TEST_F(ServerTest, SaveStateFailsIfNotPreprocessed) {
+  std::string path = ::testing::TempDir() + "/server_test_unprocessed.state";
+  EXPECT_THAT(this->server_->SaveState(path),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("Server has not been preprocessed")));
+}
+
+TEST_F(ServerTest, LoadStateFailsIfFileDoesNotExist) {
+  std::string path = ::testing::TempDir() + "/server_test_missing.state";
+  EXPECT_THAT(this->server_->LoadState(path),
+              StatusIs(absl::StatusCode::kNotFound, HasSubstr("Cannot open")));
+}
+
+TEST_F(ServerTest, SaveStateAndLoadState) {
+  ASSERT_OK(this->server_->Preprocess());
+  std::string path = ::testing::TempDir() + "/server_test.state";
+  ASSERT_OK(this->server_->SaveState(path));
+
+  // Restore the state in a server holding the same records.
+  ASSERT_OK_AND_ASSIGN(auto database, Database::Create(kParameters));
+  for (int64_t i = 0; i < kParameters.db_rows * kParameters.db_cols; ++i) {
+    ASSERT_OK_AND_ASSIGN(std::string record,
+                         this->server_->GetDatabase()->Record(i));
+    ASSERT_OK(database->Append(record));
+  }
+  ASSERT_OK_AND_ASSIGN(auto server,
+                       Server::CreateWithDatabase(kParameters,
+                                                  std::move(database)));
+  ASSERT_OK(server->LoadState(path));
+
+  EXPECT_EQ(server->GetPublicParams().SerializeAsString(),
+            this->server_->GetPublicParams().SerializeAsString());
+  ASSERT_NE(server->LweQueryPad(), nullptr);
+  EXPECT_EQ(*server->LweQueryPad(), *this->server_->LweQueryPad());
+  auto hints = server->GetDatabase()->Hints();
+  auto expected_hints = this->server_->GetDatabase()->Hints();
+  ASSERT_EQ(hints.size(), expected_hints.size());
+  for (int i = 0; i < hints.size(); ++i) {
+    EXPECT_EQ(hints[i], expected_hints[i]);
+  }
+
+  // The restored server accepts requests.
+  HintlessPirRequest request;
+  *request.mutable_ct_query_vector() =
+      SerializeLweCiphertext(lwe::Vector::Zero(kParameters.db_cols));
+  EXPECT_THAT(server->HandleRequest(request),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("unexpected number of LinPir requests")));
+}
+
 }  // namespace
 }  // namespace hintless_simplepir
 }  // namespace hintless_pir
@@ -0,0 +1,208 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hintless_simplepir/session.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "hintless_simplepir/client.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
+#include "lwe/types.h"
+#include "shell_encryption/status_macros.h"
+#include "util/metrics.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+namespace {
+
+// Returns true if the epoch, the LWE query pad, the LinPir pads and the LWE
+// response modulus of `a` and `b` are the same, i.e. if prepared secrets stay
+// valid.
+bool IsSameEpoch(const HintlessPirServerPublicParams& a,
+                 const HintlessPirServerPublicParams& b) {
+  if (a.epoch_id() != b.epoch_id() ||
+      a.prng_seed_lwe_query_pad() != b.prng_seed_lwe_query_pad() ||
+      a.prng_seed_linpir_gk_pad() != b.prng_seed_linpir_gk_pad() ||
+      a.lwe_response_bit_size() != b.lwe_response_bit_size() ||
+      a.prng_seed_linpir_ct_pads_size() != b.prng_seed_linpir_ct_pads_size()) {
+    return false;
+  }
+  for (int i = 0; i < a.prng_seed_linpir_ct_pads_size(); ++i) {
+    if (a.prng_seed_linpir_ct_pads(i) != b.prng_seed_linpir_ct_pads(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<Session>> Session::Create(
+    const Parameters& params,
+    const HintlessPirServerPublicParams& public_params,
+    Client::PadMode pad_mode) {
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Client> client,
+                        Client::Create(params, public_params, pad_mode));
+  return absl::WrapUnique(
+      new Session(params, pad_mode, public_params, std::move(client)));
+}
+
+absl::StatusOr<HintlessPirBatchRequest> Session::GeneratePrepareRequest(
+    int num_secrets) {
+  if (num_secrets <= 0) {
+    return absl::InvalidArgumentError("`num_secrets` must be positive.");
+  }
+
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientRequestGeneration);
+  std::vector<PendingSecret> pending_secrets;
+  pending_secrets.reserve(num_secrets);
+  HintlessPirBatchRequest batch_request;
+  for (int i = 0; i < num_secrets; ++i) {
+    RLWE_ASSIGN_OR_RETURN(Client::PrecomputedRequest precomputed,
+                          client_->GeneratePrecomputedRequest());
+    *batch_request.add_requests() = std::move(precomputed.linpir_request);
+    pending_secrets.push_back(PendingSecret{
+        .lwe_secret_key = std::move(precomputed.lwe_secret_key),
+        .pad_times_key = std::move(precomputed.pad_times_key),
+        .prng_seed_linpir_sk = std::move(precomputed.prng_seed_linpir_sk)});
+  }
+  pending_secrets_ = std::move(pending_secrets);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientRequestGeneration, 0,
+                               batch_request.ByteSizeLong());
+  }
+  return batch_request;
+}
+
+absl::Status Session::ProcessPrepareResponse(
+    const HintlessPirBatchResponse& batch_response) {
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientDecode);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientDecode,
+                               batch_response.ByteSizeLong(), 0);
+  }
+  if (pending_secrets_.empty()) {
+    return absl::FailedPreconditionError("No pending prepare request.");
+  }
+  if (batch_response.responses_size() != pending_secrets_.size()) {
+    return absl::InvalidArgumentError(
+        "`batch_response` has incorrect number of responses.");
+  }
+
+  // Recover all decryption parts before keeping any of them, so that a bad
+  // response leaves the session unchanged.
+  std::vector<std::vector<lwe::Vector>> decryption_parts;
+  decryption_parts.reserve(pending_secrets_.size());
+  for (int i = 0; i < pending_secrets_.size(); ++i) {
+    RLWE_ASSIGN_OR_RETURN(
+        std::vector<lwe::Vector> secret_decryption_parts,
+        client_->RecoverLweDecryptionParts(
+            batch_response.responses(i),
+            pending_secrets_[i].prng_seed_linpir_sk));
+    for (auto const& decryption_part : secret_decryption_parts) {
+      if (decryption_part.size() != params_.db_rows) {
+        return absl::InvalidArgumentError(
+            "`batch_response` has incorrect dimension.");
+      }
+    }
+    decryption_parts.push_back(std::move(secret_decryption_parts));
+  }
+  for (int i = 0; i < pending_secrets_.size(); ++i) {
+    prepared_secrets_.push_back(PreparedSecret{
+        .lwe_secret_key = std::move(pending_secrets_[i].lwe_secret_key),
+        .pad_times_key = std::move(pending_secrets_[i].pad_times_key),
+        .decryption_parts = std::move(decryption_parts[i])});
+  }
+  pending_secrets_.clear();
+  return absl::OkStatus();
+}
+
+absl::StatusOr<HintlessPirRequest> Session::GenerateRequest(int64_t index) {
+  if (index < 0 || index >= params_.db_rows * params_.db_cols) {
+    return absl::InvalidArgumentError("`index` out of range.");
+  }
+  if (prepared_secrets_.empty()) {
+    return absl::FailedPreconditionError("No prepared LWE secret left.");
+  }
+
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientRequestGeneration);
+  int64_t row_idx = index / params_.db_cols;
+  int64_t col_idx = index % params_.db_cols;
+
+  // The secret is removed from the pool even if the encryption fails, so that
+  // it is never used twice.
+  PreparedSecret secret = std::move(prepared_secrets_.front());
+  prepared_secrets_.pop_front();
+  HintlessPirRequest request;
+  RLWE_ASSIGN_OR_RETURN(
+      *request.mutable_ct_query_vector(),
+      client_->EncryptColumnSelection(col_idx, secret.lwe_secret_key,
+                                      secret.pad_times_key));
+  online_state_ =
+      OnlineState{.row_idx = row_idx,
+                  .decryption_parts = std::move(secret.decryption_parts)};
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientRequestGeneration, 0,
+                               request.ByteSizeLong());
+  }
+  return request;
+}
+
+absl::StatusOr<std::string> Session::RecoverRecord(
+    const HintlessPirResponse& response) {
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kClientDecode);
+  if (metrics_sink_ != nullptr) {
+    metrics_sink_->RecordBytes(Phase::kClientDecode, response.ByteSizeLong(),
+                               0);
+  }
+  if (!online_state_.has_value()) {
+    return absl::FailedPreconditionError("No pending online request.");
+  }
+
+  std::vector<lwe::Integer> row_decryption_parts;
+  row_decryption_parts.reserve(online_state_->decryption_parts.size());
+  for (auto const& decryption_part : online_state_->decryption_parts) {
+    row_decryption_parts.push_back(decryption_part[online_state_->row_idx]);
+  }
+  return client_->DecryptRecord(response, online_state_->row_idx,
+                                row_decryption_parts);
+}
+
+absl::Status Session::UpdatePublicParams(
+    const HintlessPirServerPublicParams& public_params) {
+  if (IsSameEpoch(public_params_, public_params)) {
+    return absl::OkStatus();
+  }
+  RLWE_ASSIGN_OR_RETURN(std::unique_ptr<Client> client,
+                        Client::Create(params_, public_params, pad_mode_));
+  client->SetMetricsSink(metrics_sink_);
+  client_ = std::move(client);
+  public_params_ = public_params;
+  pending_secrets_.clear();
+  prepared_secrets_.clear();
+  online_state_.reset();
+  return absl::OkStatus();
+}
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
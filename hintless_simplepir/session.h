@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_SESSION_H_
+#define HINTLESS_PIR_HINTLESS_SIMPLEPIR_SESSION_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "hintless_simplepir/client.h"
+#include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
+#include "lwe/lwe_symmetric_encryption.h"
+#include "lwe/types.h"
+#include "util/metrics.h"
+
+namespace hintless_pir {
+namespace hintless_simplepir {
+
+// An offline/online session of a HintlessPir client.
+//
+// In the offline phase, the session sends the LinPir part of the requests for
+// a pool of fresh LWE secrets to the server's `HandlePrepareRequest`, and
+// keeps the decryption parts hint * LWE secret recovered from the responses.
+// In the online phase, every query takes one prepared secret, so the request
+// only holds the LWE query vector and the server only computes the database
+// times the query vector in `HandleRequestSkipLinPir`.
+//
+// Every prepared secret is used by at most one query, since two queries under
+// the same secret would let the server learn the difference between their
+// selection vectors. The prepared secrets are only valid for the public
+// parameters they were prepared for, and are dropped when the server's public
+// parameters change.
+class Session {
+ public:
+  static absl::StatusOr<std::unique_ptr<Session>> Create(
+      const Parameters& params,
+      const HintlessPirServerPublicParams& public_params,
+      Client::PadMode pad_mode = Client::PadMode::kStreamed);
+
+  // Returns the request preparing `num_secrets` fresh LWE secrets. Its response
+  // must be passed to `ProcessPrepareResponse` before the next call.
+  absl::StatusOr<HintlessPirBatchRequest> GeneratePrepareRequest(
+      int num_secrets);
+
+  // Recovers hint * LWE secret from the response to the last prepare request,
+  // and adds its secrets to the prepared ones.
+  absl::Status ProcessPrepareResponse(
+      const HintlessPirBatchResponse& batch_response);
+
+  // Returns the number of prepared secrets not used by any query yet.
+  int NumPreparedSecrets() const { return prepared_secrets_.size(); }
+
+  // Returns the online request for accessing database[index], using one of the
+  // prepared secrets. Fails if there is none left.
+  absl::StatusOr<HintlessPirRequest> GenerateRequest(int64_t index);
+
+  // Returns the record retrieved from the response to the last online request.
+  absl::StatusOr<std::string> RecoverRecord(
+      const HintlessPirResponse& response);
+
+  // Switches to the server's new `public_params`. If they differ from the
+  // current ones, all prepared secrets, the pending prepare request and the
+  // pending online request are dropped.
+  absl::Status UpdatePublicParams(
+      const HintlessPirServerPublicParams& public_params);
+
+  // Records the latencies and sizes of generating requests and decoding
+  // responses in `sink`, or nothing if `sink` is null. Does not take ownership.
+  void SetMetricsSink(MetricsSink* sink) {
+    metrics_sink_ = sink;
+    client_->SetMetricsSink(sink);
+  }
+
+ private:
+  // An LWE secret whose LinPir request has been sent but not answered yet.
+  struct PendingSecret {
+    lwe::SymmetricLweKey lwe_secret_key;
+    lwe::Vector pad_times_key;
+    std::string prng_seed_linpir_sk;
+  };
+
+  // An LWE secret ready for one online query.
+  struct PreparedSecret {
+    lwe::SymmetricLweKey lwe_secret_key;
+    lwe::Vector pad_times_key;
+    // hint * LWE secret for every shard, one entry per database row.
+    std::vector<lwe::Vector> decryption_parts;
+  };
+
+  // The state of an online request until its response is received.
+  struct OnlineState {
+    int64_t row_idx;
+    std::vector<lwe::Vector> decryption_parts;
+  };
+
+  explicit Session(Parameters params, Client::PadMode pad_mode,
+                   HintlessPirServerPublicParams public_params,
+                   std::unique_ptr<Client> client)
+      : params_(std::move(params)),
+        pad_mode_(pad_mode),
+        public_params_(std::move(public_params)),
+        client_(std::move(client)) {}
+
+  const Parameters params_;
+  const Client::PadMode pad_mode_;
+
+  // The server's public parameters the secrets are prepared for.
+  HintlessPirServerPublicParams public_params_;
+
+  std::unique_ptr<Client> client_;
+
+  std::vector<PendingSecret> pending_secrets_;
+  std::deque<PreparedSecret> prepared_secrets_;
+  std::optional<OnlineState> online_state_;
+
+  // Receives the session metrics; may be null. Does not own the object.
+  MetricsSink* metrics_sink_ = nullptr;
+};
+
+}  // namespace hintless_simplepir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_HINTLESS_SIMPLEPIR_SESSION_H_
@@ -16,17 +16,43 @@
 #ifndef HINTLESS_PIR_HINTLESS_SIMPLEPIR_TESTING_H_
 #define HINTLESS_PIR_HINTLESS_SIMPLEPIR_TESTING_H_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include "absl/random/random.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/utils.h"
+#include "linpir/parameters.h"
+#include "shell_encryption/serialization.pb.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 namespace testing {
 
+// Returns the LinPir parameters of the end-to-end tests and benchmarks, with
+// RLWE dimension 2^12, a 90-bit ciphertext modulus and a 42-bit plaintext
+// modulus. The ciphertext modulus is the product of two 45-bit primes, or of
+// three 30-bit primes for 32-bit `Parameters::RlweInteger`.
+inline linpir::RlweParameters<Parameters::RlweInteger> LinPirParameters90Bits(
+    int rows_per_block) {
+  linpir::RlweParameters<Parameters::RlweInteger> params{
+      .log_n = 12,
+      .ts = {2056193, 1990657},
+      .error_variance = 8,
+      .prng_type = rlwe::PRNG_TYPE_HKDF,
+      .rows_per_block = rows_per_block,
+  };
+  if constexpr (sizeof(Parameters::RlweInteger) == sizeof(uint64_t)) {
+    params.qs = {35184371884033ULL, 35184371703809ULL};
+    params.gadget_log_bs = {16, 16};
+  } else {
+    params.qs = {1073692673, 1073668097, 1073651713};
+    params.gadget_log_bs = {16, 16, 16};
+  }
+  return params;
+}
+
 // Returns a random record of a database with the given parameters.
 inline static std::string GenerateRandomRecord(const Parameters& params) {
   int num_bytes = DivAndRoundUp(params.db_record_bit_size, 8);
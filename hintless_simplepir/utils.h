@@ -17,20 +17,23 @@
 #define HINTLESS_PIR_HINTLESS_SIMPLEPIR_UTILS_H_
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <type_traits>
 #include <vector>
-#include <chrono>
 
 #include "Eigen/Core"
+#include "absl/numeric/int128.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "hintless_simplepir/parameters.h"
 #include "hintless_simplepir/serialization.pb.h"
 #include "lwe/types.h"
-
-#ifndef FAKE_RUN
-//#define FAKE_RUN
-#endif
+#include "shell_encryption/status_macros.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
@@ -41,44 +44,33 @@ inline T DivAndRoundUp(T x, T y) {
   return (x + y - 1) / y;
 }
 
-// Splits `record` per `params.db_record_bit_size` bits, and returns the vector
-// that contains the resulting chunks of bits.
+// Splits `record` per `params.lwe_plaintext_bit_size` bits, and returns the
+// vector that contains the resulting chunks of bits. The chunks are taken from
+// the bits of `record` in little-endian order, so several of them may come from
+// the same byte when the plaintexts are smaller than a byte.
 inline std::vector<lwe::Integer> SplitRecord(absl::string_view record,
                                              const Parameters& params) {
   int num_shards =
       DivAndRoundUp(params.db_record_bit_size, params.lwe_plaintext_bit_size);
   std::vector<lwe::Integer> values(num_shards, 0);
-  lwe::Integer curr_bits{0};  // Buffer of bits for the current shard.
-  int shard_idx = 0;
-  int num_filled_ptxt_bits = 0;  // # plaintext bits currently filled in.
-  int num_remaining_bits = params.db_record_bit_size;
-  for (auto it = record.begin(); it != record.end(); ++it) {
-    // Fill in the remaining plaintext bits from the byte referenced by `it`.
-    int num_available_ptxt_bits =
-        std::min(8, params.lwe_plaintext_bit_size - num_filled_ptxt_bits);
-    int num_fill_bits = std::min(num_available_ptxt_bits, num_remaining_bits);
-    lwe::Integer mask = (lwe::Integer{1} << num_fill_bits) - 1;
-    curr_bits |= (static_cast<lwe::Integer>(*it) & mask)
-                 << num_filled_ptxt_bits;
-    num_filled_ptxt_bits += num_fill_bits;
-    num_remaining_bits -= num_fill_bits;
-
-    // We have used up all the plaintext bits for the current shard, or all the
-    // record bits are used.
-    if (num_filled_ptxt_bits >= params.lwe_plaintext_bit_size ||
-        num_remaining_bits == 0) {
-      values[shard_idx] = curr_bits;
-      shard_idx++;
-
-      // Extract the remaining bits in `*it` and use them for the next shard.
-      mask = (lwe::Integer{1} << 8) - mask;
-      curr_bits = (static_cast<lwe::Integer>(*it) & mask) >> num_fill_bits;
-      num_filled_ptxt_bits = 8 - num_fill_bits;
+  int bit_idx = 0;  // The index of the next bit of `record` to use.
+  for (int shard_idx = 0; shard_idx < num_shards; ++shard_idx) {
+    int num_shard_bits = std::min(params.lwe_plaintext_bit_size,
+                                  params.db_record_bit_size - bit_idx);
+    lwe::Integer value = 0;
+    for (int num_filled_bits = 0; num_filled_bits < num_shard_bits;) {
+      // Take the bits of the current byte that belong to this shard.
+      int bit_pos = bit_idx % 8;
+      int num_fill_bits =
+          std::min(8 - bit_pos, num_shard_bits - num_filled_bits);
+      lwe::Integer mask = (lwe::Integer{1} << num_fill_bits) - 1;
+      auto byte = static_cast<unsigned char>(record[bit_idx / 8]);
+      value |= ((static_cast<lwe::Integer>(byte) >> bit_pos) & mask)
+               << num_filled_bits;
+      num_filled_bits += num_fill_bits;
+      bit_idx += num_fill_bits;
     }
-  }
-  if (num_remaining_bits > 0) {
-    // This happens when the record size is not a multiple of plaintext space.
-    values[shard_idx] = curr_bits;
+    values[shard_idx] = value;
   }
   return values;
 }
@@ -125,12 +117,34 @@ inline std::string ReconstructRecord(absl::Span<const lwe::Integer> values,
   return record;
 }
 
+// Returns the field holding the coefficients of LWE ciphertexts that are not
+// modulus switched: `b_coeffs` for 32-bit LWE integers, and `b_coeffs64` for
+// 64-bit ones.
+template <typename Integer = lwe::Integer>
+inline const google::protobuf::RepeatedField<Integer>& LweCoeffsField(
+    const SerializedLweCiphertext& serialized) {
+  if constexpr (sizeof(Integer) == sizeof(uint64_t)) {
+    return serialized.b_coeffs64();
+  } else {
+    return serialized.b_coeffs();
+  }
+}
+template <typename Integer = lwe::Integer>
+inline google::protobuf::RepeatedField<Integer>* MutableLweCoeffsField(
+    SerializedLweCiphertext* serialized) {
+  if constexpr (sizeof(Integer) == sizeof(uint64_t)) {
+    return serialized->mutable_b_coeffs64();
+  } else {
+    return serialized->mutable_b_coeffs();
+  }
+}
+
 inline SerializedLweCiphertext SerializeLweCiphertext(
     const lwe::Vector& ct_vector) {
   SerializedLweCiphertext serialized;
-  serialized.mutable_b_coeffs()->Resize(ct_vector.size(), 0);
-  Eigen::Map<lwe::Vector> map(serialized.mutable_b_coeffs()->mutable_data(),
-                              ct_vector.size());
+  MutableLweCoeffsField(&serialized)->Resize(ct_vector.size(), 0);
+  Eigen::Map<lwe::Vector> map(
+      MutableLweCoeffsField(&serialized)->mutable_data(), ct_vector.size());
   map = ct_vector;
   return serialized;
 }
@@ -138,18 +152,158 @@ inline SerializedLweCiphertext SerializeLweCiphertext(
 inline SerializedLweCiphertext SerializeLweCiphertext(
     const std::vector<lwe::Integer>& ct_vector) {
   SerializedLweCiphertext serialized;
-  serialized.mutable_b_coeffs()->Reserve(ct_vector.size());
-  serialized.mutable_b_coeffs()->Add(ct_vector.begin(), ct_vector.end());
+  MutableLweCoeffsField(&serialized)->Reserve(ct_vector.size());
+  MutableLweCoeffsField(&serialized)->Add(ct_vector.begin(), ct_vector.end());
   return serialized;
 }
 
 inline std::vector<lwe::Integer> DeserializeLweCiphertext(
     const SerializedLweCiphertext& serialized) {
-  std::vector<lwe::Integer> vec(serialized.b_coeffs().begin(),
-                                serialized.b_coeffs().end());
+  std::vector<lwe::Integer> vec(LweCoeffsField(serialized).begin(),
+                                LweCoeffsField(serialized).end());
   return vec;
 }
 
+// Returns a view of the coefficients of `serialized`, which must not be modulus
+// switched, without copying them.
+inline absl::Span<const lwe::Integer> LweCiphertextCoeffs(
+    const SerializedLweCiphertext& serialized) {
+  return absl::MakeConstSpan(LweCoeffsField(serialized).data(),
+                             LweCoeffsField(serialized).size());
+}
+
+// Resizes the coefficients of `serialized` to `num_coeffs` and returns a view
+// of them, so that they can be written in place.
+inline absl::Span<lwe::Integer> MutableLweCiphertextCoeffs(
+    SerializedLweCiphertext* serialized, int64_t num_coeffs) {
+  MutableLweCoeffsField(serialized)->Resize(num_coeffs, 0);
+  return absl::MakeSpan(MutableLweCoeffsField(serialized)->mutable_data(),
+                        num_coeffs);
+}
+
+// Returns the LWE ciphertext `ct_vector` mod 2^kIntBitwidth switched to the
+// modulus 2^bit_size, rounding every coefficient to the nearest multiple of
+// 2^(kIntBitwidth - bit_size), and packed with `bit_size` bits per coefficient.
+inline SerializedLweCiphertext SerializeLweCiphertextModSwitched(
+    absl::Span<const lwe::Integer> ct_vector, int bit_size) {
+  int shift = lwe::kIntBitwidth - bit_size;
+  lwe::Integer half = shift > 0 ? lwe::Integer{1} << (shift - 1) : 0;
+  SerializedLweCiphertext serialized;
+  serialized.set_bit_size(bit_size);
+  serialized.set_num_coeffs(ct_vector.size());
+  std::string* packed = serialized.mutable_packed_coeffs();
+  packed->reserve(DivAndRoundUp<int64_t>(ct_vector.size() * bit_size, 8));
+  // Holds up to 7 + bit_size bits.
+  using Buffer = std::conditional_t<sizeof(lwe::Integer) == sizeof(uint64_t),
+                                    absl::uint128, uint64_t>;
+  Buffer buffer = 0;
+  int num_buffered_bits = 0;
+  for (lwe::Integer x : ct_vector) {
+    // Overflows in `x + half` wrap around mod 2^kIntBitwidth, i.e. to 0 mod
+    // 2^bit_size.
+    Buffer rounded = static_cast<lwe::Integer>(x + half) >> shift;
+    buffer |= rounded << num_buffered_bits;
+    num_buffered_bits += bit_size;
+    while (num_buffered_bits >= 8) {
+      packed->push_back(static_cast<char>(buffer & 0xFF));
+      buffer >>= 8;
+      num_buffered_bits -= 8;
+    }
+  }
+  if (num_buffered_bits > 0) {
+    packed->push_back(static_cast<char>(buffer & 0xFF));
+  }
+  return serialized;
+}
+
+// Returns the number of coefficients of the serialized LWE ciphertext, in
+// either encoding, or an error if a modulus switched ciphertext is malformed.
+inline absl::StatusOr<int64_t> LweCiphertextSize(
+    const SerializedLweCiphertext& serialized) {
+  if (!serialized.has_bit_size()) {
+    return LweCoeffsField(serialized).size();
+  }
+  int64_t num_coeffs = serialized.num_coeffs();
+  if (serialized.bit_size() < 1 ||
+      serialized.bit_size() > lwe::kIntBitwidth || num_coeffs < 0 ||
+      serialized.packed_coeffs().size() <
+          DivAndRoundUp<int64_t>(num_coeffs * serialized.bit_size(), 8)) {
+    return absl::InvalidArgumentError(
+        "Malformed modulus switched LWE ciphertext.");
+  }
+  return num_coeffs;
+}
+
+// Returns the coefficient at `index` of the serialized LWE ciphertext as an
+// integer mod 2^kIntBitwidth, without deserializing the other coefficients.
+// `index` must be less than `LweCiphertextSize(serialized)`.
+inline lwe::Integer LweCiphertextCoefficient(
+    const SerializedLweCiphertext& serialized, int64_t index) {
+  if (!serialized.has_bit_size()) {
+    return LweCoeffsField(serialized)[index];
+  }
+  int bit_size = serialized.bit_size();
+  const std::string& packed = serialized.packed_coeffs();
+  int64_t bit_begin = index * bit_size;
+  absl::uint128 value = 0;
+  int num_read_bits = 0;
+  for (int64_t byte_idx = bit_begin / 8; num_read_bits < bit_size + 8 &&
+                                         byte_idx < packed.size();
+       ++byte_idx) {
+    value |= absl::uint128{static_cast<uint8_t>(packed[byte_idx])}
+             << num_read_bits;
+    num_read_bits += 8;
+  }
+  value = (value >> (bit_begin % 8)) & ((absl::uint128{1} << bit_size) - 1);
+  return static_cast<lwe::Integer>(value << (lwe::kIntBitwidth - bit_size));
+}
+
+// Appends the coefficients of the serialized LWE ciphertext `part` to those of
+// `whole`, e.g. to assemble the response of a database from those of ranges of
+// its rows. Both must use the same encoding, unless `whole` is empty.
+inline absl::Status AppendLweCiphertext(const SerializedLweCiphertext& part,
+                                        SerializedLweCiphertext* whole) {
+  if (!whole->has_bit_size() && LweCoeffsField(*whole).empty()) {
+    *whole = part;
+    return absl::OkStatus();
+  }
+  if (part.has_bit_size() != whole->has_bit_size() ||
+      part.bit_size() != whole->bit_size()) {
+    return absl::InvalidArgumentError(
+        "`part` and `whole` must use the same encoding.");
+  }
+  if (!part.has_bit_size()) {
+    MutableLweCoeffsField(whole)->Add(LweCoeffsField(part).begin(),
+                                      LweCoeffsField(part).end());
+    return absl::OkStatus();
+  }
+  RLWE_ASSIGN_OR_RETURN(int64_t num_part_coeffs, LweCiphertextSize(part));
+  RLWE_ASSIGN_OR_RETURN(int64_t num_whole_coeffs, LweCiphertextSize(*whole));
+
+  // Shift the packed bits of `part` to start right after the last bit of
+  // `whole`, which may be in the middle of a byte.
+  int bit_size = part.bit_size();
+  int64_t num_whole_bits = num_whole_coeffs * bit_size;
+  int64_t num_part_bits = num_part_coeffs * bit_size;
+  int offset = num_whole_bits % 8;
+  std::string* packed = whole->mutable_packed_coeffs();
+  packed->resize(DivAndRoundUp<int64_t>(num_whole_bits, 8));
+  const std::string& part_packed = part.packed_coeffs();
+  for (int64_t i = 0; i < DivAndRoundUp<int64_t>(num_part_bits, 8); ++i) {
+    auto byte = static_cast<uint8_t>(part_packed[i]);
+    if (offset == 0) {
+      packed->push_back(static_cast<char>(byte));
+    } else {
+      packed->back() = static_cast<char>(
+          static_cast<uint8_t>(packed->back()) | (byte << offset));
+      packed->push_back(static_cast<char>(byte >> (8 - offset)));
+    }
+  }
+  packed->resize(DivAndRoundUp<int64_t>(num_whole_bits + num_part_bits, 8));
+  whole->set_num_coeffs(num_whole_coeffs + num_part_coeffs);
+  return absl::OkStatus();
+}
+
 // Given an integer `x` representing a mod-q number, returns `x` mod p, where
 // modular numbers are in balanced representation.
 template <typename Integer>
@@ -163,20 +317,35 @@ inline Integer ConvertModulus(const Integer& x, const Integer& q,
   }
 }
 
-inline double currentDateTime()
-{
-
-    std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-
-    time_t tnow = std::chrono::system_clock::to_time_t(now);
-    tm *date = localtime(&tnow); // todo: dperecated use localtime_s
-    date->tm_hour = 0;
-    date->tm_min = 0;
-    date->tm_sec = 0;
+// Returns `x` mod p, where `x` is an integer mod q = 2^`q_bits` and modular
+// numbers are in balanced representation. `q_bits` may be the bit width of
+// Integer, e.g. for a 64-bit LWE modulus, in which case q wraps around to 0
+// and q - x is still computed mod q.
+template <typename Integer>
+inline Integer ConvertFromPowerOfTwoModulus(const Integer& x, int q_bits,
+                                            const Integer& p) {
+  Integer q = q_bits < 8 * sizeof(Integer) ? Integer{1} << q_bits : Integer{0};
+  return ConvertModulus(x, q, p, Integer{1} << (q_bits - 1));
+}
 
-    auto midnight = std::chrono::system_clock::from_time_t(mktime(date));
+// Returns an error if `params.lwe_modulus_bit_size` is not the bit width of
+// `lwe::Integer`, whose arithmetic wraps around mod the LWE modulus.
+inline absl::Status CheckForValidLweModulusBitSize(const Parameters& params) {
+  if (params.lwe_modulus_bit_size != lwe::kIntBitwidth) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "`lwe_modulus_bit_size` must be ", lwe::kIntBitwidth,
+        ", the bit width of LWE integers in this build."));
+  }
+  return absl::OkStatus();
+}
 
-    return std::chrono::duration<double, std::milli>(now - midnight).count();
+// Returns the milliseconds elapsed on a monotonic clock since an unspecified
+// starting point, to measure time intervals in tests and benchmarks. Request
+// latencies are reported through `MetricsSink` instead.
+inline double currentDateTime() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
 }  // namespace hintless_simplepir
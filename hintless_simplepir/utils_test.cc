@@ -14,19 +14,28 @@
 
 #include "hintless_simplepir/utils.h"
 
+#include <cstdint>
+#include <cstdlib>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "hintless_simplepir/parameters.h"
+#include "hintless_simplepir/serialization.pb.h"
 #include "hintless_simplepir/testing.h"
 #include "lwe/types.h"
+#include "shell_encryption/testing/status_matchers.h"
+#include "shell_encryption/testing/status_testing.h"
 
 namespace hintless_pir {
 namespace hintless_simplepir {
 namespace {
 
+using ::rlwe::testing::StatusIs;
+
 const std::vector<Parameters> kTestParameters{
     Parameters{
         .db_record_bit_size = 8,
@@ -48,6 +57,18 @@ const std::vector<Parameters> kTestParameters{
         .db_record_bit_size = 128,
         .lwe_plaintext_bit_size = 8,
     },
+    Parameters{
+        .db_record_bit_size = 24,
+        .lwe_plaintext_bit_size = 4,
+    },
+    Parameters{
+        .db_record_bit_size = 23,
+        .lwe_plaintext_bit_size = 3,
+    },
+    Parameters{
+        .db_record_bit_size = 40,
+        .lwe_plaintext_bit_size = 12,
+    },
 };
 
 TEST(UtilsTest, SplitAndReconstruct) {
@@ -64,6 +85,103 @@ TEST(UtilsTest, SplitAndReconstruct) {
   }
 }
 
+TEST(UtilsTest, ModSwitchedLweCiphertextRoundsCoefficients) {
+  const std::vector<lwe::Integer> ct_vector = {
+      0, 1, 0x7FFF, 0x8000, 0x12345678, 0xFFFF7FFF, 0xFFFF8000, 0xFFFFFFFF};
+  for (int bit_size : {3, 12, 16, 31, 32}) {
+    SerializedLweCiphertext serialized =
+        SerializeLweCiphertextModSwitched(ct_vector, bit_size);
+    EXPECT_EQ(serialized.packed_coeffs().size(),
+              DivAndRoundUp<int64_t>(ct_vector.size() * bit_size, 8));
+    ASSERT_OK_AND_ASSIGN(int64_t size, LweCiphertextSize(serialized));
+    ASSERT_EQ(size, ct_vector.size());
+
+    // Every coefficient is rounded to the nearest multiple of 2^shift mod q.
+    int shift = lwe::kIntBitwidth - bit_size;
+    int64_t max_error = shift > 0 ? int64_t{1} << (shift - 1) : 0;
+    for (int i = 0; i < ct_vector.size(); ++i) {
+      lwe::Integer coeff = LweCiphertextCoefficient(serialized, i);
+      EXPECT_EQ(coeff % (int64_t{1} << shift), 0);
+      auto error =
+          static_cast<std::make_signed_t<lwe::Integer>>(coeff - ct_vector[i]);
+      EXPECT_LE(std::abs(static_cast<int64_t>(error)), max_error);
+    }
+  }
+}
+
+TEST(UtilsTest, LweCiphertextCoefficientOfFullCiphertext) {
+  const std::vector<lwe::Integer> ct_vector = {5, 0xFFFFFFFF, 42};
+  SerializedLweCiphertext serialized = SerializeLweCiphertext(ct_vector);
+  ASSERT_OK_AND_ASSIGN(int64_t size, LweCiphertextSize(serialized));
+  ASSERT_EQ(size, ct_vector.size());
+  for (int i = 0; i < ct_vector.size(); ++i) {
+    EXPECT_EQ(LweCiphertextCoefficient(serialized, i), ct_vector[i]);
+  }
+}
+
+TEST(UtilsTest, LweCiphertextCoeffsViewsTheSerializedBuffer) {
+  SerializedLweCiphertext serialized;
+  absl::Span<lwe::Integer> coeffs = MutableLweCiphertextCoeffs(&serialized, 3);
+  ASSERT_EQ(coeffs.size(), 3);
+  coeffs[0] = 7;
+  coeffs[2] = 0xFFFFFFFF;
+  EXPECT_EQ(DeserializeLweCiphertext(serialized),
+            std::vector<lwe::Integer>({7, 0, 0xFFFFFFFF}));
+
+  absl::Span<const lwe::Integer> view = LweCiphertextCoeffs(serialized);
+  EXPECT_EQ(view.data(), LweCoeffsField(serialized).data());
+  EXPECT_EQ(view.size(), 3);
+}
+
+TEST(UtilsTest, LweCiphertextSizeFailsIfMalformed) {
+  SerializedLweCiphertext serialized =
+      SerializeLweCiphertextModSwitched({1, 2, 3}, 12);
+  serialized.set_num_coeffs(4);
+  EXPECT_THAT(LweCiphertextSize(serialized),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       ::testing::HasSubstr("Malformed")));
+  serialized.set_num_coeffs(3);
+  serialized.set_bit_size(33);
+  EXPECT_THAT(LweCiphertextSize(serialized),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       ::testing::HasSubstr("Malformed")));
+}
+
+TEST(UtilsTest, AppendLweCiphertextConcatenatesCoefficients) {
+  const std::vector<lwe::Integer> ct_vector = {
+      0, 1, 0x7FFF, 0x8000, 0x12345678, 0xFFFF7FFF, 0xFFFF8000, 0xFFFFFFFF};
+  for (int bit_size : {0, 3, 12, 32}) {
+    auto serialize = [&](absl::Span<const lwe::Integer> coeffs) {
+      return bit_size == 0
+                 ? SerializeLweCiphertext(
+                       std::vector<lwe::Integer>(coeffs.begin(), coeffs.end()))
+                 : SerializeLweCiphertextModSwitched(coeffs, bit_size);
+    };
+    SerializedLweCiphertext expected = serialize(ct_vector);
+    for (int split : {1, 3, 5}) {
+      SerializedLweCiphertext whole;
+      absl::Span<const lwe::Integer> coeffs = ct_vector;
+      ASSERT_OK(AppendLweCiphertext(serialize(coeffs.subspan(0, split)),
+                                    &whole));
+      ASSERT_OK(AppendLweCiphertext(serialize(coeffs.subspan(split)), &whole));
+      EXPECT_EQ(whole.SerializeAsString(), expected.SerializeAsString());
+    }
+  }
+}
+
+TEST(UtilsTest, AppendLweCiphertextFailsWithDifferentEncodings) {
+  SerializedLweCiphertext whole = SerializeLweCiphertextModSwitched({1, 2}, 12);
+  EXPECT_THAT(AppendLweCiphertext(SerializeLweCiphertext(
+                                      std::vector<lwe::Integer>{3}),
+                                  &whole),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       ::testing::HasSubstr("same encoding")));
+  EXPECT_THAT(
+      AppendLweCiphertext(SerializeLweCiphertextModSwitched({3}, 16), &whole),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               ::testing::HasSubstr("same encoding")));
+}
+
 }  // namespace
 }  // namespace hintless_simplepir
 }  // namespace hintless_pir
@@ -16,18 +16,22 @@
 #include "linpir/client.h"
 
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
+#include "linpir/mod_switch.h"
 #include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/prng/prng.h"
 #include "shell_encryption/prng/single_thread_chacha_prng.h"
@@ -39,6 +43,17 @@
 namespace hintless_pir {
 namespace linpir {
 
+namespace {
+
+// Returns the number of blocks of `ct_inner_products`, in either encoding.
+int NumBlocks(const LinPirResponse::EncryptedInnerProduct& ct_inner_products) {
+  return ct_inner_products.mod_switched_ct_blocks_size() > 0
+             ? ct_inner_products.mod_switched_ct_blocks_size()
+             : ct_inner_products.ct_blocks_size();
+}
+
+}  // namespace
+
 template <typename RlweInteger>
 absl::StatusOr<std::unique_ptr<Client<RlweInteger>>>
 Client<RlweInteger>::Create(const RlweParameters<RlweInteger>& parameters,
@@ -80,6 +95,30 @@ template <typename RlweInteger>
 absl::StatusOr<rlwe::RnsBfvCiphertext<rlwe::MontgomeryInt<RlweInteger>>>
 Client<RlweInteger>::EncryptQuery(absl::Span<const RlweInteger> query_vector,
                                   absl::string_view prng_seed_sk) {
+  RLWE_ASSIGN_OR_RETURN(RnsSecretKey secret_key, SampleSecretKey(prng_seed_sk));
+  RLWE_ASSIGN_OR_RETURN(RnsCiphertext ct_query,
+                        EncryptQueryUnderSecretKey(query_vector, secret_key));
+
+  // Store the secret key
+  secret_key_ = std::make_unique<RnsSecretKey>(std::move(secret_key));
+
+  return ct_query;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<rlwe::RnsBfvCiphertext<rlwe::MontgomeryInt<RlweInteger>>>
+Client<RlweInteger>::EncryptQueryWithSeed(
+    absl::Span<const RlweInteger> query_vector,
+    absl::string_view prng_seed_sk) const {
+  RLWE_ASSIGN_OR_RETURN(RnsSecretKey secret_key, SampleSecretKey(prng_seed_sk));
+  return EncryptQueryUnderSecretKey(query_vector, secret_key);
+}
+
+template <typename RlweInteger>
+absl::StatusOr<rlwe::RnsBfvCiphertext<rlwe::MontgomeryInt<RlweInteger>>>
+Client<RlweInteger>::EncryptQueryUnderSecretKey(
+    absl::Span<const RlweInteger> query_vector,
+    const RnsSecretKey& secret_key) const {
   int num_slots_per_group = 1 << (params_.log_n - 1);
   if (query_vector.size() > num_slots_per_group) {
     return absl::InvalidArgumentError(
@@ -100,11 +139,9 @@ Client<RlweInteger>::EncryptQuery(absl::Span<const RlweInteger> query_vector,
     }
   }
 
-  // Create PRNGs for sampling RLWE secret key and encryption.
-  std::unique_ptr<rlwe::SecurePrng> prng_sk, prng_enc, prng_pad;
+  // Create PRNGs for encryption.
+  std::unique_ptr<rlwe::SecurePrng> prng_enc, prng_pad;
   if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(prng_sk,
-                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_sk));
     RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
                           rlwe::SingleThreadHkdfPrng::GenerateSeed());
     RLWE_ASSIGN_OR_RETURN(prng_enc,
@@ -112,8 +149,6 @@ Client<RlweInteger>::EncryptQuery(absl::Span<const RlweInteger> query_vector,
     RLWE_ASSIGN_OR_RETURN(
         prng_pad, rlwe::SingleThreadHkdfPrng::Create(prng_seed_ct_pad_));
   } else {
-    RLWE_ASSIGN_OR_RETURN(prng_sk,
-                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_sk));
     RLWE_ASSIGN_OR_RETURN(std::string prng_seed_enc,
                           rlwe::SingleThreadChaChaPrng::GenerateSeed());
     RLWE_ASSIGN_OR_RETURN(prng_enc,
@@ -122,22 +157,9 @@ Client<RlweInteger>::EncryptQuery(absl::Span<const RlweInteger> query_vector,
         prng_pad, rlwe::SingleThreadChaChaPrng::Create(prng_seed_ct_pad_));
   }
 
-  // Sample RLWE secret key
-  RLWE_ASSIGN_OR_RETURN(
-      RnsSecretKey secret_key,
-      RnsSecretKey::Sample(params_.log_n, params_.error_variance, rns_moduli_,
-                           prng_sk.get()));
-
   // Encrypt the query vector
-  RLWE_ASSIGN_OR_RETURN(RnsCiphertext ct_query,
-                        secret_key.template EncryptBfv<Encoder>(
-                            slots, &encoder_, &rns_error_params_,
-                            prng_enc.get(), prng_pad.get()));
-
-  // Store the secret key
-  secret_key_ = std::make_unique<RnsSecretKey>(std::move(secret_key));
-
-  return ct_query;
+  return secret_key.template EncryptBfv<Encoder>(
+      slots, &encoder_, &rns_error_params_, prng_enc.get(), prng_pad.get());
 }
 
 template <typename RlweInteger>
@@ -159,18 +181,7 @@ template <typename RlweInteger>
 absl::StatusOr<rlwe::RnsGaloisKey<rlwe::MontgomeryInt<RlweInteger>>>
 Client<RlweInteger>::GenerateGaloisKey(absl::string_view prng_seed_sk) const {
   // Sample RLWE secret key
-  std::unique_ptr<rlwe::SecurePrng> prng_sk;
-  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
-    RLWE_ASSIGN_OR_RETURN(prng_sk,
-                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_sk));
-  } else {
-    RLWE_ASSIGN_OR_RETURN(prng_sk,
-                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_sk));
-  }
-  RLWE_ASSIGN_OR_RETURN(
-      RnsSecretKey secret_key,
-      RnsSecretKey::Sample(params_.log_n, params_.error_variance, rns_moduli_,
-                           prng_sk.get()));
+  RLWE_ASSIGN_OR_RETURN(RnsSecretKey secret_key, SampleSecretKey(prng_seed_sk));
 
   // Create a Galois key with the given random pads.
   RLWE_ASSIGN_OR_RETURN(std::vector<RnsPolynomial> gk_pads,
@@ -208,45 +219,92 @@ Client<RlweInteger>::GenerateGaloisKey() const {
 }
 
 template <typename RlweInteger>
-absl::StatusOr<std::vector<std::vector<RlweInteger>>>
-Client<RlweInteger>::Recover(const LinPirResponse& response) {
-  if (secret_key_ == nullptr) {
-    return absl::InvalidArgumentError("Secret key not found.");
+absl::StatusOr<rlwe::RnsRlweSecretKey<rlwe::MontgomeryInt<RlweInteger>>>
+Client<RlweInteger>::SampleSecretKey(absl::string_view prng_seed_sk) const {
+  std::unique_ptr<rlwe::SecurePrng> prng_sk;
+  if (params_.prng_type == rlwe::PRNG_TYPE_HKDF) {
+    RLWE_ASSIGN_OR_RETURN(prng_sk,
+                          rlwe::SingleThreadHkdfPrng::Create(prng_seed_sk));
+  } else {
+    RLWE_ASSIGN_OR_RETURN(prng_sk,
+                          rlwe::SingleThreadChaChaPrng::Create(prng_seed_sk));
   }
+  return RnsSecretKey::Sample(params_.log_n, params_.error_variance,
+                              rns_moduli_, prng_sk.get());
+}
 
+template <typename RlweInteger>
+absl::StatusOr<typename Client<RlweInteger>::RnsCiphertext>
+Client<RlweInteger>::DeserializeBlock(
+    const LinPirResponse::EncryptedInnerProduct& ct_inner_products,
+    int block_idx) const {
+  if (ct_inner_products.mod_switched_ct_blocks_size() == 0) {
+    return RnsCiphertext::Deserialize(ct_inner_products.ct_blocks(block_idx),
+                                      rns_moduli_, &rns_error_params_);
+  }
+  // Switch the block back to the full modulus before decrypting it.
+  const ModSwitchedRlweCiphertext& serialized =
+      ct_inner_products.mod_switched_ct_blocks(block_idx);
+  RLWE_ASSIGN_OR_RETURN(
+      auto switcher,
+      ModulusSwitcher<RlweInteger>::Create(params_.qs, serialized.bit_size()));
+  return switcher.Deserialize(serialized, rns_moduli_, &rns_error_params_,
+                              rns_context_);
+}
+
+template <typename RlweInteger>
+absl::StatusOr<std::vector<RlweInteger>> Client<RlweInteger>::DecryptBlock(
+    const LinPirResponse::EncryptedInnerProduct& ct_inner_products,
+    int block_idx, const RnsSecretKey& secret_key) const {
+  RLWE_ASSIGN_OR_RETURN(auto ct_deserialized,
+                        DeserializeBlock(ct_inner_products, block_idx));
+  RnsCiphertext ct_block(std::move(ct_deserialized));
+  RLWE_ASSIGN_OR_RETURN(
+      auto slots, secret_key.template DecryptBfv<Encoder>(ct_block, &encoder_));
+  int num_slots_per_group = 1 << (params_.log_n - 1);
+  std::vector<RlweInteger> values(params_.rows_per_block, 0);
+  // First half of the block
+  for (int k = 0; k < num_slots_per_group; ++k) {
+    values[k % params_.rows_per_block] += slots[k];
+  }
+  // Second half of the block
+  for (int k = 0; k < num_slots_per_group; ++k) {
+    values[k % params_.rows_per_block] += slots[num_slots_per_group + k];
+  }
   RlweInteger plaintext_modulus = rns_context_->PlaintextModulus();
+  for (auto& value : values) {
+    value %= plaintext_modulus;
+  }
+  return values;
+}
 
+template <typename RlweInteger>
+absl::StatusOr<std::vector<std::vector<RlweInteger>>>
+Client<RlweInteger>::RecoverWithSecretKey(const LinPirResponse& response,
+                                          const RnsSecretKey& secret_key) const {
   std::vector<std::vector<RlweInteger>> results(
       response.ct_inner_products_size());
   for (int i = 0; i < response.ct_inner_products_size(); ++i) {
     const auto& ct_inner_products = response.ct_inner_products(i);
-    int num_slots_per_group = 1 << (params_.log_n - 1);
-    int num_blocks = ct_inner_products.ct_blocks_size();
+    int num_blocks = NumBlocks(ct_inner_products);
     results[i].reserve(num_blocks * params_.rows_per_block);
-
     for (int j = 0; j < num_blocks; ++j) {
-      RLWE_ASSIGN_OR_RETURN(
-          auto ct_deserialized,
-          RnsCiphertext::Deserialize(ct_inner_products.ct_blocks(j),
-                                     rns_moduli_, &rns_error_params_));
-      RnsCiphertext ct_block(std::move(ct_deserialized));
-      RLWE_ASSIGN_OR_RETURN(
-          auto slots,
-          secret_key_->template DecryptBfv<Encoder>(ct_block, &encoder_));
-      std::vector<RlweInteger> values(params_.rows_per_block, 0);
-      // First half of the block
-      for (int k = 0; k < num_slots_per_group; ++k) {
-        values[k % params_.rows_per_block] += slots[k];
-      }
-      // Second half of the block
-      for (int k = 0; k < num_slots_per_group; ++k) {
-        values[k % params_.rows_per_block] += slots[num_slots_per_group + k];
-      }
-      for (auto const& value : values) {
-        results[i].push_back(value % plaintext_modulus);
-      }
+      RLWE_ASSIGN_OR_RETURN(std::vector<RlweInteger> values,
+                            DecryptBlock(ct_inner_products, j, secret_key));
+      results[i].insert(results[i].end(), values.begin(), values.end());
     }
   }
+  return results;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<std::vector<std::vector<RlweInteger>>>
+Client<RlweInteger>::Recover(const LinPirResponse& response) {
+  if (secret_key_ == nullptr) {
+    return absl::InvalidArgumentError("Secret key not found.");
+  }
+  RLWE_ASSIGN_OR_RETURN(auto results,
+                        RecoverWithSecretKey(response, *secret_key_));
 
   // Clear the cached RLWE secret key.
   secret_key_ = nullptr;
@@ -254,6 +312,68 @@ Client<RlweInteger>::Recover(const LinPirResponse& response) {
   return results;
 }
 
+template <typename RlweInteger>
+absl::StatusOr<std::vector<std::vector<RlweInteger>>>
+Client<RlweInteger>::Recover(const LinPirResponse& response,
+                             absl::string_view prng_seed_sk) const {
+  RLWE_ASSIGN_OR_RETURN(RnsSecretKey secret_key, SampleSecretKey(prng_seed_sk));
+  return RecoverWithSecretKey(response, secret_key);
+}
+
+template <typename RlweInteger>
+absl::StatusOr<std::vector<RlweInteger>> Client<RlweInteger>::RecoverRow(
+    const LinPirResponse& response, absl::string_view prng_seed_sk,
+    int64_t row_idx) const {
+  RLWE_ASSIGN_OR_RETURN(
+      std::vector<std::vector<RlweInteger>> rows,
+      RecoverRows(response, prng_seed_sk, absl::MakeConstSpan(&row_idx, 1)));
+  std::vector<RlweInteger> results;
+  results.reserve(rows.size());
+  for (auto const& row : rows) {
+    results.push_back(row[0]);
+  }
+  return results;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<std::vector<std::vector<RlweInteger>>>
+Client<RlweInteger>::RecoverRows(const LinPirResponse& response,
+                                 absl::string_view prng_seed_sk,
+                                 absl::Span<const int64_t> row_indices) const {
+  for (int64_t row_idx : row_indices) {
+    if (row_idx < 0) {
+      return absl::InvalidArgumentError("`row_idx` must be non-negative.");
+    }
+  }
+  RLWE_ASSIGN_OR_RETURN(RnsSecretKey secret_key, SampleSecretKey(prng_seed_sk));
+  std::vector<std::vector<RlweInteger>> results;
+  results.reserve(response.ct_inner_products_size());
+  for (int i = 0; i < response.ct_inner_products_size(); ++i) {
+    const auto& ct_inner_products = response.ct_inner_products(i);
+    // Only the blocks holding the rows are decrypted, each of them once.
+    absl::flat_hash_map<int64_t, std::vector<RlweInteger>> blocks;
+    std::vector<RlweInteger> values;
+    values.reserve(row_indices.size());
+    for (int64_t row_idx : row_indices) {
+      int64_t block_idx = row_idx / params_.rows_per_block;
+      if (block_idx >= NumBlocks(ct_inner_products)) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("`response` has no block for row ", row_idx, "."));
+      }
+      auto it = blocks.find(block_idx);
+      if (it == blocks.end()) {
+        RLWE_ASSIGN_OR_RETURN(
+            std::vector<RlweInteger> block_values,
+            DecryptBlock(ct_inner_products, block_idx, secret_key));
+        it = blocks.emplace(block_idx, std::move(block_values)).first;
+      }
+      values.push_back(it->second[row_idx % params_.rows_per_block]);
+    }
+    results.push_back(std::move(values));
+  }
+  return results;
+}
+
 template class Client<Uint32>;
 template class Client<Uint64>;
 
@@ -16,6 +16,7 @@
 #ifndef HINTLESS_PIR_LINPIR_CLIENT_H_
 #define HINTLESS_PIR_LINPIR_CLIENT_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -74,6 +75,13 @@ class Client {
       absl::Span<const RlweInteger> query_vector,
       absl::string_view prng_seed_sk);
 
+  // Same as above, but does not cache the secret key, so the client is not
+  // changed and this may be called from multiple threads at the same time.
+  // The response must be recovered with the same PRNG seed.
+  absl::StatusOr<RnsCiphertext> EncryptQueryWithSeed(
+      absl::Span<const RlweInteger> query_vector,
+      absl::string_view prng_seed_sk) const;
+
   // Returns a Galois key based on the secret key that is sampled using the
   // given PRNG seed.
   absl::StatusOr<RnsGaloisKey> GenerateGaloisKey(
@@ -105,10 +113,32 @@ class Client {
     return GenerateRequest(ct_query, gk);
   }
 
-  // Recovers the inner products from `response`, one per database matrix.
+  // Recovers the inner products from `response`, one per database matrix,
+  // using the secret key cached by the last `EncryptQuery`, which is then
+  // cleared.
   absl::StatusOr<std::vector<std::vector<RlweInteger>>> Recover(
       const LinPirResponse& response);
 
+  // This variant decrypts `response` under the secret key sampled using the
+  // given PRNG seed, and does not use or change the cached secret key. This
+  // allows recovering responses of requests that were not the last one.
+  absl::StatusOr<std::vector<std::vector<RlweInteger>>> Recover(
+      const LinPirResponse& response, absl::string_view prng_seed_sk) const;
+
+  // Returns the inner product at `row_idx` of every database matrix, using the
+  // secret key sampled using the given PRNG seed. Only decrypts the block
+  // holding that row, so the cost does not grow with the number of rows.
+  absl::StatusOr<std::vector<RlweInteger>> RecoverRow(
+      const LinPirResponse& response, absl::string_view prng_seed_sk,
+      int64_t row_idx) const;
+
+  // Returns the inner products at `row_indices` of every database matrix,
+  // using the secret key sampled using the given PRNG seed. Every block holding
+  // some of the rows is decrypted once.
+  absl::StatusOr<std::vector<std::vector<RlweInteger>>> RecoverRows(
+      const LinPirResponse& response, absl::string_view prng_seed_sk,
+      absl::Span<const int64_t> row_indices) const;
+
   absl::string_view PrngSeedForCiphertextRandomPads() const {
     return prng_seed_ct_pad_;
   }
@@ -132,6 +162,31 @@ class Client {
         rns_error_params_(std::move(rns_error_params)),
         encoder_(std::move(encoder)) {}
 
+  // Returns a ciphertext encrypting `query_vector` under `secret_key`.
+  absl::StatusOr<RnsCiphertext> EncryptQueryUnderSecretKey(
+      absl::Span<const RlweInteger> query_vector,
+      const RnsSecretKey& secret_key) const;
+
+  // Samples the RLWE secret key expanded from `prng_seed_sk`.
+  absl::StatusOr<RnsSecretKey> SampleSecretKey(
+      absl::string_view prng_seed_sk) const;
+
+  // Returns the `block_idx`'th ciphertext of `ct_inner_products` at the full
+  // modulus, switching it back if it was sent at a smaller one.
+  absl::StatusOr<RnsCiphertext> DeserializeBlock(
+      const LinPirResponse::EncryptedInnerProduct& ct_inner_products,
+      int block_idx) const;
+
+  // Decrypts the `block_idx`'th ciphertext of `ct_inner_products`, and returns
+  // the inner products of the `rows_per_block` rows of its block.
+  absl::StatusOr<std::vector<RlweInteger>> DecryptBlock(
+      const LinPirResponse::EncryptedInnerProduct& ct_inner_products,
+      int block_idx, const RnsSecretKey& secret_key) const;
+
+  // Recovers all inner products from `response` under `secret_key`.
+  absl::StatusOr<std::vector<std::vector<RlweInteger>>> RecoverWithSecretKey(
+      const LinPirResponse& response, const RnsSecretKey& secret_key) const;
+
   const RlweParameters<RlweInteger> params_;
 
   // PRNG seeds generated by the server to sample the "a" polynomials.
@@ -207,6 +207,36 @@ TEST_F(ClientTest, EncryptQueryHasCorrectEncoding) {
   }
 }
 
+TEST_F(ClientTest, EncryptQueryWithSeedDoesNotCacheSecretKey) {
+  ASSERT_OK_AND_ASSIGN(
+      auto client,
+      Client<Integer>::Create(kRlweParameters, this->rns_context_.get(),
+                              /*prng_seed_ct_pad=*/kPrngSeed0,
+                              /*prng_seed_gk_pad=*/kPrngSeed1));
+
+  std::vector<Integer> query(kRlweParameters.rows_per_block, 1);
+  ASSERT_OK_AND_ASSIGN(RnsCiphertext ct_query,
+                       client->EncryptQueryWithSeed(query, kPrngSeed0));
+
+  // The query is encrypted under the secret key expanded from the seed.
+  ASSERT_OK_AND_ASSIGN(auto prng_sk, Prng::Create(kPrngSeed0));
+  ASSERT_OK_AND_ASSIGN(
+      RnsSecretKey secret_key,
+      RnsSecretKey::Sample(this->params_.log_n, this->params_.error_variance,
+                           this->moduli_, prng_sk.get()));
+  ASSERT_OK_AND_ASSIGN(
+      std::vector<Integer> slots,
+      secret_key.template DecryptBfv<Encoder>(ct_query, this->encoder_.get()));
+  for (int i = 0; i < kRlweParameters.rows_per_block; ++i) {
+    EXPECT_EQ(slots[i], query[i]);
+  }
+
+  // But the client keeps no secret key.
+  EXPECT_THAT(client->GenerateGaloisKey(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("Secret key not found")));
+}
+
 TEST_F(ClientTest, GenerateGaloisKeyFailsIfSecretKeyIsNotSet) {
   ASSERT_OK_AND_ASSIGN(
       auto client,
@@ -294,6 +324,68 @@ TEST_F(ClientTest, RecoverSucceeds) {
   EXPECT_EQ(results[0], expected);
 }
 
+TEST_F(ClientTest, RecoverRowMatchesRecover) {
+  ASSERT_OK_AND_ASSIGN(
+      auto client,
+      Client<Integer>::Create(kRlweParameters, this->rns_context_.get(),
+                              /*prng_seed_ct_pad=*/kPrngSeed0,
+                              /*prng_seed_gk_pad=*/kPrngSeed1));
+  ASSERT_OK_AND_ASSIGN(auto prng_sk, Prng::Create(kPrngSeed0));
+  ASSERT_OK_AND_ASSIGN(
+      RnsSecretKey secret_key,
+      RnsSecretKey::Sample(this->params_.log_n, this->params_.error_variance,
+                           this->moduli_, prng_sk.get()));
+
+  // A response of two database matrices with two blocks each.
+  int num_slots = 1 << kRlweParameters.log_n;
+  LinPirResponse response;
+  for (int i = 0; i < 2; ++i) {
+    LinPirResponse::EncryptedInnerProduct* inner_product =
+        response.add_ct_inner_products();
+    for (int j = 0; j < 2; ++j) {
+      std::vector<Integer> slots(num_slots, 0);
+      for (int k = 0; k < num_slots; ++k) {
+        slots[k] = (k + 3 * i + 5 * j) % 17;
+      }
+      ASSERT_OK_AND_ASSIGN(RnsCiphertext ct_block,
+                           secret_key.template EncryptBfv<Encoder>(
+                               slots, this->encoder_.get(),
+                               this->error_params_.get(), this->prng_.get()));
+      ASSERT_OK_AND_ASSIGN(*inner_product->add_ct_blocks(),
+                           ct_block.Serialize());
+    }
+  }
+
+  // Recovering with the PRNG seed does not need a cached secret key.
+  ASSERT_OK_AND_ASSIGN(std::vector<std::vector<Integer>> results,
+                       client->Recover(response, kPrngSeed0));
+  ASSERT_EQ(results.size(), 2);
+  for (int row : {0, kRlweParameters.rows_per_block - 1,
+                  kRlweParameters.rows_per_block + 1}) {
+    ASSERT_OK_AND_ASSIGN(std::vector<Integer> row_results,
+                         client->RecoverRow(response, kPrngSeed0, row));
+    ASSERT_EQ(row_results.size(), 2);
+    EXPECT_EQ(row_results[0], results[0][row]);
+    EXPECT_EQ(row_results[1], results[1][row]);
+  }
+
+  // Rows may repeat and come in any order.
+  const std::vector<int64_t> rows = {kRlweParameters.rows_per_block + 1, 3, 3};
+  ASSERT_OK_AND_ASSIGN(std::vector<std::vector<Integer>> rows_results,
+                       client->RecoverRows(response, kPrngSeed0, rows));
+  ASSERT_EQ(rows_results.size(), 2);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(rows_results[i].size(), rows.size());
+    for (int j = 0; j < rows.size(); ++j) {
+      EXPECT_EQ(rows_results[i][j], results[i][rows[j]]);
+    }
+  }
+  EXPECT_THAT(
+      client->RecoverRow(response, kPrngSeed0,
+                         2 * kRlweParameters.rows_per_block),
+      StatusIs(absl::StatusCode::kInvalidArgument, HasSubstr("no block")));
+}
+
 }  // namespace
 }  // namespace linpir
 }  // namespace hintless_pir
@@ -14,7 +14,10 @@
 
 #include "linpir/database.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -23,9 +26,11 @@
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/rns/rns_bfv_ciphertext.h"
 #include "shell_encryption/status_macros.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
@@ -41,7 +46,8 @@ absl::StatusOr<std::unique_ptr<Database<RlweInteger>>>
 Database<RlweInteger>::Create(
     const RlweParameters<RlweInteger>& rlwe_params,
     const RnsContext* rns_context,
-    const std::vector<std::vector<RlweInteger>>& data) {
+    const std::vector<std::vector<RlweInteger>>& data,
+    ThreadPool* thread_pool) {
   if (rns_context == nullptr) {
     return absl::InvalidArgumentError("`rns_context` must not be null.");
   }
@@ -49,9 +55,6 @@ Database<RlweInteger>::Create(
     return absl::InvalidArgumentError("`data` must not be empty.");
   }
 
-  std::vector<const PrimeModulus*> moduli = rns_context->MainPrimeModuli();
-  RLWE_ASSIGN_OR_RETURN(Encoder encoder, Encoder::Create(rns_context));
-
   int num_rows = data.size();
   int num_cols = data[0].size();
   int num_slots_per_group = 1 << (rlwe_params.log_n - 1);
@@ -59,55 +62,256 @@ Database<RlweInteger>::Create(
     return absl::InvalidArgumentError(
         "`data` has more columns than supported by RLWE parameters.");
   }
+  return CreateFromRowReader(
+      rlwe_params, rns_context, num_rows, num_cols,
+      [&data, num_cols](int row_idx, absl::Span<RlweInteger> row) {
+        std::copy_n(data[row_idx].begin(), num_cols, row.begin());
+      },
+      thread_pool);
+}
 
-  int num_slots = num_slots_per_group * 2;
-  int num_polynomials_per_block = rlwe_params.rows_per_block / 2;
+template <typename RlweInteger>
+absl::StatusOr<std::unique_ptr<Database<RlweInteger>>>
+Database<RlweInteger>::CreateFromRowReader(
+    const RlweParameters<RlweInteger>& rlwe_params,
+    const RnsContext* rns_context, int num_rows, int num_cols,
+    RowReader read_row, ThreadPool* thread_pool) {
+  if (rns_context == nullptr) {
+    return absl::InvalidArgumentError("`rns_context` must not be null.");
+  }
+  if (num_rows <= 0) {
+    return absl::InvalidArgumentError("`num_rows` must be positive.");
+  }
+  int num_slots_per_group = 1 << (rlwe_params.log_n - 1);
+  if (num_cols > num_slots_per_group) {
+    return absl::InvalidArgumentError(
+        "`num_cols` is larger than supported by RLWE parameters.");
+  }
+
+  std::vector<const PrimeModulus*> moduli = rns_context->MainPrimeModuli();
+  RLWE_ASSIGN_OR_RETURN(Encoder encoder, Encoder::Create(rns_context));
+
+  // The blocks are independent, and so are the diagonals of every block, so
+  // they are all encoded concurrently. Only the rows of the blocks being
+  // encoded are read into memory at any time.
   int num_blocks = DivAndRoundUp(num_rows, rlwe_params.rows_per_block);
   std::vector<std::vector<RnsPolynomial>> diagonals(num_blocks);
-  for (int i = 0; i < num_blocks; ++i) {
-    diagonals[i].reserve(num_polynomials_per_block);
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_blocks, thread_pool, [&](int64_t i) -> absl::Status {
+        int row_idx_begin = i * rlwe_params.rows_per_block;
+        int block_size =
+            std::min(rlwe_params.rows_per_block, num_rows - row_idx_begin);
+        std::vector<std::vector<RlweInteger>> rows(
+            block_size, std::vector<RlweInteger>(num_cols));
+        for (int j = 0; j < block_size; ++j) {
+          read_row(row_idx_begin + j, absl::MakeSpan(rows[j]));
+        }
+        RLWE_ASSIGN_OR_RETURN(
+            diagonals[i],
+            EncodeBlock(encoder, moduli, rlwe_params.log_n,
+                        rlwe_params.rows_per_block, rows, thread_pool));
+        return absl::OkStatus();
+      }));
+  return absl::WrapUnique(new Database<RlweInteger>(
+      rns_context, std::move(moduli), std::move(encoder),
+      rlwe_params.rows_per_block, std::move(diagonals)));
+}
 
-    // Each block is a rectangle matrix divided into square submatrices of
-    // dimension rows_per_block * rows_per_block, and there are rows_per_block
-    // many diagonals. Since we assume data has number of columns < number of
-    // slots per group, we pack diagonals 0..(rows_per_block/2 - 1) in the first
-    // slot group, and rows_per_block/2..rows_per_block in the second group.
-    //
-    // *--@--*--@-. <- first group starts with the diagonal *, and the second
-    // -*--@--*--@.    group starts with the diagonal @, where . means empty
-    // --*--@--*--.    positions when extending the block into multiple square
-    // @--*--@--*-.    matrices.
-    // -@--*--@--*.
-    int row_idx_begin = i * rlwe_params.rows_per_block;
-    // The j'th and rows_per_block/2 + j'th diagonals.
+template <typename RlweInteger>
+absl::StatusOr<
+    std::vector<rlwe::RnsPolynomial<rlwe::MontgomeryInt<RlweInteger>>>>
+Database<RlweInteger>::EncodeBlock(
+    const Encoder& encoder, const std::vector<const PrimeModulus*>& moduli,
+    int log_n, int rows_per_block,
+    absl::Span<const std::vector<RlweInteger>> rows, ThreadPool* thread_pool) {
+  int num_rows = rows.size();
+  int num_cols = rows.empty() ? 0 : rows[0].size();
+  int num_slots_per_group = 1 << (log_n - 1);
+  int num_slots = num_slots_per_group * 2;
+  int num_polynomials_per_block = rows_per_block / 2;
+  // Each block is a rectangle matrix divided into square submatrices of
+  // dimension rows_per_block * rows_per_block, and there are rows_per_block
+  // many diagonals. Since we assume data has number of columns < number of
+  // slots per group, we pack diagonals 0..(rows_per_block/2 - 1) in the first
+  // slot group, and rows_per_block/2..rows_per_block in the second group.
+  //
+  // *--@--*--@-. <- first group starts with the diagonal *, and the second
+  // -*--@--*--@.    group starts with the diagonal @, where . means empty
+  // --*--@--*--.    positions when extending the block into multiple square
+  // @--*--@--*-.    matrices.
+  // -@--*--@--*.
+  //
+  // Slot k of the j'th polynomial holds the entry at row k % rows_per_block
+  // and column (k + j) % num_slots_per_group, so for a fixed slot k the
+  // polynomials j = 0, 1, ... read consecutive entries of the same row. We
+  // therefore fill slot k of all polynomials at once, which reads the rows
+  // sequentially and only keeps one cache line per polynomial in use, instead
+  // of gathering every polynomial with a stride through all rows.
+  std::vector<std::vector<RlweInteger>> diag_values(
+      num_polynomials_per_block, std::vector<RlweInteger>(num_slots, 0));
+  for (int k = 0; k < num_slots_per_group; ++k) {
+    int row_idx = k % rows_per_block;
+    if (row_idx >= num_rows) {
+      continue;
+    }
+    const std::vector<RlweInteger>& row = rows[row_idx];
     for (int j = 0; j < num_polynomials_per_block; ++j) {
-      std::vector<RlweInteger> diag_values(num_slots, 0);
       // first group of slots
-      for (int k = 0; k < num_slots_per_group; ++k) {
-        int row_idx = row_idx_begin + (k % rlwe_params.rows_per_block);
-        int col_idx = (k + j) % num_slots_per_group;
-        if (row_idx < num_rows && col_idx < num_cols) {  // valid indices
-          diag_values[k] = data[row_idx][col_idx];
-        }
+      int col_idx = (k + j) % num_slots_per_group;
+      if (col_idx < num_cols) {
+        diag_values[j][k] = row[col_idx];
       }
       // second group of slots
-      for (int k = 0; k < num_slots_per_group; ++k) {
-        int row_idx = row_idx_begin + (k % rlwe_params.rows_per_block);
-        int col_idx =
-            (rlwe_params.rows_per_block / 2 + k + j) % num_slots_per_group;
-        if (row_idx < num_rows && col_idx < num_cols) {  // valid indices
-          diag_values[num_slots_per_group + k] = data[row_idx][col_idx];
-        }
+      col_idx = (rows_per_block / 2 + k + j) % num_slots_per_group;
+      if (col_idx < num_cols) {
+        diag_values[j][num_slots_per_group + k] = row[col_idx];
       }
-      RLWE_ASSIGN_OR_RETURN(
-          RnsPolynomial diagonal,
-          encoder.EncodeBfv(diag_values, moduli, /*is_scaled=*/false));
+    }
+  }
+
+  // Encode the polynomials concurrently.
+  std::vector<std::optional<RnsPolynomial>> encoded(num_polynomials_per_block);
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_polynomials_per_block, thread_pool, [&](int64_t j) -> absl::Status {
+        RLWE_ASSIGN_OR_RETURN(
+            encoded[j],
+            encoder.EncodeBfv(diag_values[j], moduli, /*is_scaled=*/false));
+        return absl::OkStatus();
+      }));
+  std::vector<RnsPolynomial> diagonals;
+  diagonals.reserve(num_polynomials_per_block);
+  for (auto& diagonal : encoded) {
+    diagonals.push_back(*std::move(diagonal));
+  }
+  return diagonals;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<std::unique_ptr<Database<RlweInteger>>>
+Database<RlweInteger>::CreateFromSerializedBlocks(
+    const RlweParameters<RlweInteger>& rlwe_params,
+    const RnsContext* rns_context,
+    absl::Span<const LinPirDatabaseBlock> blocks) {
+  if (rns_context == nullptr) {
+    return absl::InvalidArgumentError("`rns_context` must not be null.");
+  }
+  if (blocks.empty()) {
+    return absl::InvalidArgumentError("`blocks` must not be empty.");
+  }
+
+  std::vector<const PrimeModulus*> moduli = rns_context->MainPrimeModuli();
+  RLWE_ASSIGN_OR_RETURN(Encoder encoder, Encoder::Create(rns_context));
+
+  int num_polynomials_per_block = rlwe_params.rows_per_block / 2;
+  std::vector<std::vector<RnsPolynomial>> diagonals(blocks.size());
+  std::vector<RnsPolynomial> pad_inner_products;
+  pad_inner_products.reserve(blocks.size());
+  for (int i = 0; i < blocks.size(); ++i) {
+    if (blocks[i].diagonals_size() != num_polynomials_per_block) {
+      return absl::InvalidArgumentError(
+          "`blocks` contains incorrect number of diagonals.");
+    }
+    if (!blocks[i].has_pad_inner_product()) {
+      return absl::InvalidArgumentError(
+          "`blocks` must contain preprocessed pads.");
+    }
+    diagonals[i].reserve(num_polynomials_per_block);
+    for (auto const& serialized : blocks[i].diagonals()) {
+      RLWE_ASSIGN_OR_RETURN(RnsPolynomial diagonal,
+                            RnsPolynomial::Deserialize(serialized, moduli));
       diagonals[i].push_back(std::move(diagonal));
     }
+    RLWE_ASSIGN_OR_RETURN(
+        RnsPolynomial pad_inner_product,
+        RnsPolynomial::Deserialize(blocks[i].pad_inner_product(), moduli));
+    pad_inner_products.push_back(std::move(pad_inner_product));
+  }
+  auto database = absl::WrapUnique(new Database<RlweInteger>(
+      rns_context, std::move(moduli), std::move(encoder),
+      rlwe_params.rows_per_block, std::move(diagonals)));
+  database->pad_inner_products_ = std::move(pad_inner_products);
+  return database;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<rlwe::RnsPolynomial<rlwe::MontgomeryInt<RlweInteger>>>
+Database<RlweInteger>::PadInnerProduct(
+    int block_idx, absl::Span<const RnsPolynomial> pad_rotated_queries) const {
+  RLWE_ASSIGN_OR_RETURN(
+      RnsPolynomial pad_inner_product,
+      pad_rotated_queries[0].Mul(diagonals_[block_idx][0], moduli_));
+  for (int j = 1; j < pad_rotated_queries.size(); ++j) {
+    RLWE_RETURN_IF_ERROR(pad_inner_product.FusedMulAddInPlace(
+        pad_rotated_queries[j], diagonals_[block_idx][j], moduli_));
+  }
+  return pad_inner_product;
+}
+
+template <typename RlweInteger>
+absl::Status Database<RlweInteger>::UpdateBlock(
+    int block_idx, absl::Span<const std::vector<RlweInteger>> rows,
+    absl::Span<const RnsPolynomial> pad_rotated_queries) {
+  if (block_idx < 0 || block_idx >= diagonals_.size()) {
+    return absl::InvalidArgumentError("`block_idx` is out of range.");
+  }
+  if (rows.empty() || rows.size() > rows_per_block_) {
+    return absl::InvalidArgumentError("`rows` has incorrect number of rows.");
+  }
+  int num_slots_per_group = 1 << (rns_context_->LogN() - 1);
+  if (rows[0].size() > num_slots_per_group) {
+    return absl::InvalidArgumentError(
+        "`rows` has more columns than supported by RLWE parameters.");
+  }
+  if (IsPreprocessed() && pad_rotated_queries.size() != diagonals_[0].size()) {
+    return absl::InvalidArgumentError(
+        "`pad_rotated_queries` does not contain correct number of "
+        "polynomials.");
+  }
+
+  RLWE_ASSIGN_OR_RETURN(
+      std::vector<RnsPolynomial> diagonals,
+      EncodeBlock(encoder_, moduli_, rns_context_->LogN(), rows_per_block_,
+                  rows, /*thread_pool=*/nullptr));
+  diagonals_[block_idx] = std::move(diagonals);
+  if (IsPreprocessed()) {
+    RLWE_ASSIGN_OR_RETURN(pad_inner_products_[block_idx],
+                          PadInnerProduct(block_idx, pad_rotated_queries));
+  }
+  return absl::OkStatus();
+}
+
+template <typename RlweInteger>
+absl::StatusOr<LinPirDatabaseBlock> Database<RlweInteger>::SerializeBlock(
+    int block_idx) const {
+  if (!IsPreprocessed()) {
+    return absl::FailedPreconditionError("There is no preprocessed data.");
+  }
+  if (block_idx < 0 || block_idx >= diagonals_.size()) {
+    return absl::InvalidArgumentError("`block_idx` is out of range.");
+  }
+  LinPirDatabaseBlock block;
+  block.mutable_diagonals()->Reserve(diagonals_[block_idx].size());
+  for (auto const& diagonal : diagonals_[block_idx]) {
+    RLWE_ASSIGN_OR_RETURN(*block.add_diagonals(), diagonal.Serialize(moduli_));
+  }
+  RLWE_ASSIGN_OR_RETURN(*block.mutable_pad_inner_product(),
+                        pad_inner_products_[block_idx].Serialize(moduli_));
+  return block;
+}
+
+template <typename RlweInteger>
+typename Database<RlweInteger>::MemoryBreakdown
+Database<RlweInteger>::MemoryUsage() const {
+  MemoryBreakdown usage;
+  for (auto const& block : diagonals_) {
+    for (auto const& diagonal : block) {
+      usage.diagonal_bytes += PolynomialBytes(diagonal);
+    }
+  }
+  for (auto const& pad_inner_product : pad_inner_products_) {
+    usage.pad_inner_product_bytes += PolynomialBytes(pad_inner_product);
   }
-  return absl::WrapUnique(
-      new Database<RlweInteger>(rns_context, std::move(moduli),
-                                std::move(encoder), std::move(diagonals)));
+  return usage;
 }
 
 template <typename RlweInteger>
@@ -136,24 +340,26 @@ Database<RlweInteger>::InnerProductWith(
 
 template <typename RlweInteger>
 absl::Status Database<RlweInteger>::Preprocess(
-    absl::Span<const RnsPolynomial> pad_rotated_queries) {
+    absl::Span<const RnsPolynomial> pad_rotated_queries,
+    ThreadPool* thread_pool) {
   if (pad_rotated_queries.size() != diagonals_[0].size()) {
     return absl::InvalidArgumentError(
         "`pad_rotated_queries` does not contain correct number of "
         "polynomials.");
   }
 
+  std::vector<std::optional<RnsPolynomial>> pad_inner_products(
+      diagonals_.size());
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      diagonals_.size(), thread_pool, [&](int64_t i) -> absl::Status {
+        RLWE_ASSIGN_OR_RETURN(pad_inner_products[i],
+                              PadInnerProduct(i, pad_rotated_queries));
+        return absl::OkStatus();
+      }));
   pad_inner_products_.clear();
   pad_inner_products_.reserve(diagonals_.size());
-  for (int i = 0; i < diagonals_.size(); ++i) {
-    RLWE_ASSIGN_OR_RETURN(
-        RnsPolynomial pad_inner_product,
-        pad_rotated_queries[0].Mul(diagonals_[i][0], moduli_));
-    for (int j = 1; j < pad_rotated_queries.size(); ++j) {
-      RLWE_RETURN_IF_ERROR(pad_inner_product.FusedMulAddInPlace(
-          pad_rotated_queries[j], diagonals_[i][j], moduli_));
-    }
-    pad_inner_products_.push_back(std::move(pad_inner_product));
+  for (auto& pad_inner_product : pad_inner_products) {
+    pad_inner_products_.push_back(*std::move(pad_inner_product));
   }
   return absl::OkStatus();
 }
@@ -174,23 +380,43 @@ Database<RlweInteger>::InnerProductWithPreprocessedPads(
   std::vector<RnsCiphertext> ct_inner_products;
   ct_inner_products.reserve(diagonals_.size());
   for (int i = 0; i < diagonals_.size(); ++i) {
-    auto error_params = ct_rotated_queries[0].ErrorParams();
-    RnsCiphertext ct_inner_product(
-        RnsCiphertext::CreateZero(moduli_, error_params));
-    for (int j = 0; j < ct_rotated_queries.size(); ++j) {
-      RLWE_RETURN_IF_ERROR(
-          ct_inner_product.FusedAbsorbAddInPlaceWithoutPadLazily(
-              ct_rotated_queries[j], diagonals_[i][j]));
-    }
-    RLWE_RETURN_IF_ERROR(ct_inner_product.MergeLazyOperations());
-    RLWE_RETURN_IF_ERROR(
-        ct_inner_product.SetPadComponent(pad_inner_products_[i]));
+    RLWE_ASSIGN_OR_RETURN(
+        RnsCiphertext ct_inner_product,
+        BlockInnerProductWithPreprocessedPads(i, ct_rotated_queries));
     ct_inner_products.push_back(std::move(ct_inner_product));
   }
 
   return ct_inner_products;
 }
 
+template <typename RlweInteger>
+absl::StatusOr<rlwe::RnsBfvCiphertext<rlwe::MontgomeryInt<RlweInteger>>>
+Database<RlweInteger>::BlockInnerProductWithPreprocessedPads(
+    int block_idx, absl::Span<const RnsCiphertext> ct_rotated_queries) const {
+  if (pad_inner_products_.size() != diagonals_.size()) {
+    return absl::FailedPreconditionError("There is no preprocessed data.");
+  }
+  if (block_idx < 0 || block_idx >= diagonals_.size()) {
+    return absl::InvalidArgumentError("`block_idx` is out of range.");
+  }
+  if (ct_rotated_queries.size() != diagonals_[0].size()) {
+    return absl::InvalidArgumentError(
+        "`ct_rotated_queries` does not contain correct number of ciphertexts.");
+  }
+
+  auto error_params = ct_rotated_queries[0].ErrorParams();
+  RnsCiphertext ct_inner_product(
+      RnsCiphertext::CreateZero(moduli_, error_params));
+  for (int j = 0; j < ct_rotated_queries.size(); ++j) {
+    RLWE_RETURN_IF_ERROR(ct_inner_product.FusedAbsorbAddInPlaceWithoutPadLazily(
+        ct_rotated_queries[j], diagonals_[block_idx][j]));
+  }
+  RLWE_RETURN_IF_ERROR(ct_inner_product.MergeLazyOperations());
+  RLWE_RETURN_IF_ERROR(
+      ct_inner_product.SetPadComponent(pad_inner_products_[block_idx]));
+  return ct_inner_product;
+}
+
 template class Database<Uint32>;
 template class Database<Uint64>;
 
@@ -16,23 +16,37 @@
 #ifndef HINTLESS_PIR_LINPIR_DATABASE_H_
 #define HINTLESS_PIR_LINPIR_DATABASE_H_
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/rns/finite_field_encoder.h"
 #include "shell_encryption/rns/rns_bfv_ciphertext.h"
 #include "shell_encryption/rns/rns_context.h"
 #include "shell_encryption/rns/rns_modulus.h"
 #include "shell_encryption/rns/rns_polynomial.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
 
+// Returns the number of bytes held by the coefficients of `polynomial`.
+template <typename ModularInt>
+int64_t PolynomialBytes(const rlwe::RnsPolynomial<ModularInt>& polynomial) {
+  int64_t num_bytes = 0;
+  for (auto const& coeffs : polynomial.Coeffs()) {
+    num_bytes += coeffs.size() * sizeof(ModularInt);
+  }
+  return num_bytes;
+}
+
 // The database to the LinPIR scheme is a matrix arranged into blocks of
 // diagonals, such that the matrix-vector product with a query vector is
 // computed as the inner products between the diagonals and rotations of
@@ -47,14 +61,52 @@ class Database {
   using PrimeModulus = rlwe::PrimeModulus<ModularInt>;
   using Encoder = rlwe::FiniteFieldEncoder<ModularInt>;
 
+  // The memory held by a database, in bytes.
+  struct MemoryBreakdown {
+    // The encoded diagonals of all blocks.
+    int64_t diagonal_bytes = 0;
+    // The inner products between the diagonals and the pads of the rotated
+    // queries, computed by `Preprocess`.
+    int64_t pad_inner_product_bytes = 0;
+
+    int64_t TotalBytes() const {
+      return diagonal_bytes + pad_inner_product_bytes;
+    }
+  };
+
+  // Encodes the matrix `data` into blocks of diagonals. When `thread_pool` is
+  // not null, the diagonals are encoded concurrently on its workers.
   static absl::StatusOr<std::unique_ptr<Database>> Create(
       const RlweParameters<RlweInteger>& rlwe_params,
       const RnsContext* rns_context,
-      const std::vector<std::vector<RlweInteger>>& data);
+      const std::vector<std::vector<RlweInteger>>& data,
+      ThreadPool* thread_pool = nullptr);
+
+  // Writes the `row_idx`'th row of a matrix to `row`, which has one entry per
+  // column. May be called concurrently from several threads.
+  using RowReader =
+      absl::FunctionRef<void(int row_idx, absl::Span<RlweInteger> row)>;
+
+  // Same as `Create`, but for a matrix of dimension `num_rows` * `num_cols`
+  // whose rows are read by `read_row` while encoding the blocks, so that the
+  // matrix never needs to be held in memory at once.
+  static absl::StatusOr<std::unique_ptr<Database>> CreateFromRowReader(
+      const RlweParameters<RlweInteger>& rlwe_params,
+      const RnsContext* rns_context, int num_rows, int num_cols,
+      RowReader read_row, ThreadPool* thread_pool = nullptr);
+
+  // Creates a preprocessed database from the blocks serialized by
+  // `SerializeBlock`.
+  static absl::StatusOr<std::unique_ptr<Database>> CreateFromSerializedBlocks(
+      const RlweParameters<RlweInteger>& rlwe_params,
+      const RnsContext* rns_context,
+      absl::Span<const LinPirDatabaseBlock> blocks);
 
   // Preprocess the database with the given random pads to speedup inner product
-  // computation when query is available.
-  absl::Status Preprocess(absl::Span<const RnsPolynomial> pad_rotated_queries);
+  // computation when query is available. When `thread_pool` is not null, the
+  // blocks are preprocessed concurrently on its workers.
+  absl::Status Preprocess(absl::Span<const RnsPolynomial> pad_rotated_queries,
+                          ThreadPool* thread_pool = nullptr);
 
   // Compute the matrix-vector product with the encrypted query vector.
   absl::StatusOr<std::vector<RnsCiphertext>> InnerProductWith(
@@ -66,6 +118,29 @@ class Database {
   absl::StatusOr<std::vector<RnsCiphertext>> InnerProductWithPreprocessedPads(
       absl::Span<const RnsCiphertext> ct_rotated_queries) const;
 
+  // Compute the product between the `block_idx`'th block and the encrypted
+  // query vector when the database has been preprocessed. The blocks do not
+  // share any state, so they can be computed concurrently.
+  // Returns error if `Preprocess` has not been called.
+  absl::StatusOr<RnsCiphertext> BlockInnerProductWithPreprocessedPads(
+      int block_idx, absl::Span<const RnsCiphertext> ct_rotated_queries) const;
+
+  // Replaces the rows of the `block_idx`'th block of the matrix by `rows`,
+  // which holds at most `rows_per_block` rows, and re-encodes the diagonals of
+  // the block. When the database has been preprocessed, the inner product
+  // between the new diagonals and `pad_rotated_queries` is updated as well,
+  // which must be the random pads that were given to `Preprocess`.
+  absl::Status UpdateBlock(int block_idx,
+                           absl::Span<const std::vector<RlweInteger>> rows,
+                           absl::Span<const RnsPolynomial> pad_rotated_queries);
+
+  // Serializes the `block_idx`'th block of diagonals and its preprocessed pad.
+  // Returns error if `Preprocess` has not been called.
+  absl::StatusOr<LinPirDatabaseBlock> SerializeBlock(int block_idx) const;
+
+  // Returns the memory held by the diagonals and the preprocessed pads.
+  MemoryBreakdown MemoryUsage() const;
+
   // Accessors
   int NumBlocks() const { return diagonals_.size(); }
   int NumDiagonalsPerBlock() const { return diagonals_[0].size(); }
@@ -74,18 +149,34 @@ class Database {
  private:
   explicit Database(const RnsContext* rns_context,
                     std::vector<const PrimeModulus*> moduli, Encoder encoder,
+                    int rows_per_block,
                     std::vector<std::vector<RnsPolynomial>> diagonals)
       : rns_context_(rns_context),
         moduli_(std::move(moduli)),
         encoder_(std::move(encoder)),
+        rows_per_block_(rows_per_block),
         diagonals_(std::move(diagonals)) {}
 
+  // Encodes the diagonals of a block holding `rows`, concurrently when
+  // `thread_pool` is not null.
+  static absl::StatusOr<std::vector<RnsPolynomial>> EncodeBlock(
+      const Encoder& encoder, const std::vector<const PrimeModulus*>& moduli,
+      int log_n, int rows_per_block,
+      absl::Span<const std::vector<RlweInteger>> rows, ThreadPool* thread_pool);
+
+  // Returns the inner product between the diagonals of the `block_idx`'th
+  // block and `pad_rotated_queries`.
+  absl::StatusOr<RnsPolynomial> PadInnerProduct(
+      int block_idx, absl::Span<const RnsPolynomial> pad_rotated_queries) const;
+
   const RnsContext* rns_context_;
 
   const std::vector<const PrimeModulus*> moduli_;
 
   const Encoder encoder_;
 
+  const int rows_per_block_;
+
   // Database matrix arranged into blocks of sub-matrices, where each sub-matrix
   // is stored as a vector of diagonals packed in RnsPolynomial.
   std::vector<std::vector<RnsPolynomial>> diagonals_;
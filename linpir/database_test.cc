@@ -14,7 +14,9 @@
 
 #include "linpir/database.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -22,9 +24,11 @@
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
 #include "shell_encryption/montgomery.h"
 #include "shell_encryption/prng/single_thread_hkdf_prng.h"
 #include "shell_encryption/rns/finite_field_encoder.h"
@@ -38,6 +42,7 @@
 #include "shell_encryption/rns/rns_secret_key.h"
 #include "shell_encryption/testing/status_matchers.h"
 #include "shell_encryption/testing/status_testing.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
@@ -157,6 +162,44 @@ TEST_F(DatabaseTest, CreateDatabase) {
   EXPECT_EQ(database->NumDiagonalsPerBlock(), expected_num_diags_per_block);
 }
 
+TEST_F(DatabaseTest, CreateFromRowReaderMatchesCreate) {
+  auto data = SampleMatrix(kNumRows, kNumCols, 16);
+  ASSERT_OK_AND_ASSIGN(
+      auto expected_database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::CreateFromRowReader(
+          this->params_, this->rns_context_.get(), kNumRows, kNumCols,
+          [&data](int row_idx, absl::Span<Integer> row) {
+            std::copy(data[row_idx].begin(), data[row_idx].end(), row.begin());
+          }));
+  ASSERT_EQ(database->NumBlocks(), expected_database->NumBlocks());
+
+  // Compare the preprocessed blocks under all zero pads.
+  ASSERT_OK_AND_ASSIGN(
+      RnsPolynomial zero,
+      RnsPolynomial::CreateZero(this->params_.log_n, this->moduli_));
+  std::vector<RnsPolynomial> pads(database->NumDiagonalsPerBlock(), zero);
+  ASSERT_OK(database->Preprocess(pads));
+  ASSERT_OK(expected_database->Preprocess(pads));
+  for (int i = 0; i < database->NumBlocks(); ++i) {
+    ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock block,
+                         database->SerializeBlock(i));
+    ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock expected_block,
+                         expected_database->SerializeBlock(i));
+    EXPECT_EQ(block.SerializeAsString(), expected_block.SerializeAsString());
+  }
+}
+
+TEST_F(DatabaseTest, CreateFromRowReaderFailsIfNumRowsIsNotPositive) {
+  EXPECT_THAT(Database<Integer>::CreateFromRowReader(
+                  this->params_, this->rns_context_.get(), /*num_rows=*/0,
+                  kNumCols, [](int row_idx, absl::Span<Integer> row) {}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`num_rows` must be positive")));
+}
+
 TEST_F(DatabaseTest, InnerProductFailsIfIncorrectNumberOfQueryCiphertexts) {
   std::vector<Integer> row(1, 0);
   ASSERT_OK_AND_ASSIGN(auto database,
@@ -219,6 +262,137 @@ TEST_F(DatabaseTest, InnerProduct) {
   }
 }
 
+TEST_F(DatabaseTest, SerializeBlockFailsIfDatabaseIsNotPreprocessed) {
+  std::vector<Integer> row(1, 0);
+  ASSERT_OK_AND_ASSIGN(auto database,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), {row}));
+  EXPECT_THAT(database->SerializeBlock(0),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("no preprocessed data")));
+}
+
+TEST_F(DatabaseTest, CreateFromSerializedBlocksFailsIfBlockIsIncomplete) {
+  EXPECT_THAT(Database<Integer>::CreateFromSerializedBlocks(
+                  this->params_, this->rns_context_.get(), /*blocks=*/{}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("`blocks` must not be empty")));
+  EXPECT_THAT(Database<Integer>::CreateFromSerializedBlocks(
+                  this->params_, this->rns_context_.get(),
+                  {LinPirDatabaseBlock()}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect number of diagonals")));
+}
+
+TEST_F(DatabaseTest, UpdateBlockFailsIfBlockIsOutOfRange) {
+  std::vector<Integer> row(1, 0);
+  ASSERT_OK_AND_ASSIGN(auto database,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), {row}));
+  EXPECT_THAT(database->UpdateBlock(/*block_idx=*/1, {row},
+                                    /*pad_rotated_queries=*/{}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("out of range")));
+  EXPECT_THAT(database->UpdateBlock(/*block_idx=*/0, /*rows=*/{},
+                                    /*pad_rotated_queries=*/{}),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect number of rows")));
+}
+
+TEST_F(DatabaseTest, UpdateBlockMatchesCreate) {
+  auto data = SampleMatrix(kNumRows, kNumCols, 16);
+  auto new_data = data;
+  new_data[5] = SampleValues(kNumCols, 16);
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(auto expected_database,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), new_data));
+
+  // Preprocess both databases with the same random pads.
+  ASSERT_OK_AND_ASSIGN(auto prng, Prng::Create(kPrngSeed));
+  std::vector<RnsPolynomial> pads;
+  for (int i = 0; i < database->NumDiagonalsPerBlock(); ++i) {
+    ASSERT_OK_AND_ASSIGN(RnsPolynomial pad,
+                         RnsPolynomial::SampleUniform(
+                             this->params_.log_n, prng.get(), this->moduli_));
+    pads.push_back(std::move(pad));
+  }
+  ASSERT_OK(database->Preprocess(pads));
+  ASSERT_OK(expected_database->Preprocess(pads));
+
+  ASSERT_OK(database->UpdateBlock(/*block_idx=*/0, new_data, pads));
+  ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock block, database->SerializeBlock(0));
+  ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock expected_block,
+                       expected_database->SerializeBlock(0));
+  EXPECT_EQ(block.SerializeAsString(), expected_block.SerializeAsString());
+}
+
+TEST_F(DatabaseTest, MemoryUsage) {
+  this->params_.rows_per_block = 16;
+  auto data = SampleMatrix(kNumRows, kNumCols, 16);
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  int64_t polynomial_bytes =
+      this->moduli_.size() * (int64_t{1} << this->params_.log_n) *
+      sizeof(ModularInt);
+  auto usage = database->MemoryUsage();
+  EXPECT_EQ(usage.diagonal_bytes, database->NumBlocks() *
+                                      database->NumDiagonalsPerBlock() *
+                                      polynomial_bytes);
+  EXPECT_EQ(usage.pad_inner_product_bytes, 0);
+
+  ASSERT_OK_AND_ASSIGN(auto prng, Prng::Create(kPrngSeed));
+  std::vector<RnsPolynomial> pads;
+  for (int i = 0; i < database->NumDiagonalsPerBlock(); ++i) {
+    ASSERT_OK_AND_ASSIGN(RnsPolynomial pad,
+                         RnsPolynomial::SampleUniform(
+                             this->params_.log_n, prng.get(), this->moduli_));
+    pads.push_back(std::move(pad));
+  }
+  ASSERT_OK(database->Preprocess(pads));
+  usage = database->MemoryUsage();
+  EXPECT_EQ(usage.pad_inner_product_bytes,
+            database->NumBlocks() * polynomial_bytes);
+  EXPECT_EQ(usage.TotalBytes(),
+            usage.diagonal_bytes + usage.pad_inner_product_bytes);
+}
+
+TEST_F(DatabaseTest, MultiThreadedCreateAndPreprocessMatchSingleThreaded) {
+  // Use small blocks so that the database has several blocks.
+  this->params_.rows_per_block = 16;
+  auto data = SampleMatrix(kNumRows + 3, kNumCols, 16);
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ThreadPool thread_pool(3);
+  ASSERT_OK_AND_ASSIGN(auto mt_database,
+                       Database<Integer>::Create(this->params_,
+                                                 this->rns_context_.get(), data,
+                                                 &thread_pool));
+  ASSERT_EQ(mt_database->NumBlocks(), 3);
+
+  ASSERT_OK_AND_ASSIGN(auto prng, Prng::Create(kPrngSeed));
+  std::vector<RnsPolynomial> pads;
+  for (int i = 0; i < database->NumDiagonalsPerBlock(); ++i) {
+    ASSERT_OK_AND_ASSIGN(RnsPolynomial pad,
+                         RnsPolynomial::SampleUniform(
+                             this->params_.log_n, prng.get(), this->moduli_));
+    pads.push_back(std::move(pad));
+  }
+  ASSERT_OK(database->Preprocess(pads));
+  ASSERT_OK(mt_database->Preprocess(pads, &thread_pool));
+  for (int i = 0; i < database->NumBlocks(); ++i) {
+    ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock block,
+                         mt_database->SerializeBlock(i));
+    ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock expected_block,
+                         database->SerializeBlock(i));
+    EXPECT_EQ(block.SerializeAsString(), expected_block.SerializeAsString());
+  }
+}
+
 TEST_F(DatabaseTest, PreprocessFailsIfIncorrectNumberOfRandomPads) {
   std::vector<Integer> row(1, 0);
   ASSERT_OK_AND_ASSIGN(auto database,
@@ -148,6 +148,69 @@ TEST_F(LinPirTest, EndToEndTest) {
   }
 }
 
+TEST_F(LinPirTest, EndToEndModSwitchedResponseTest) {
+  int num_rows = 2048;
+  int num_cols = 1024;
+  RlweParameters<Integer> params = *this->params_;
+  params.response_bit_size = 40;
+
+  ASSERT_OK_AND_ASSIGN(std::string prng_seed_ct_pad, Prng::GenerateSeed());
+  ASSERT_OK_AND_ASSIGN(std::string prng_seed_gk_pad, Prng::GenerateSeed());
+  auto data = SampleMatrix(num_rows, num_cols, 8);
+  ASSERT_OK_AND_ASSIGN(auto database,
+                       Database<Integer>::Create(
+                           params, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(
+      auto server,
+      Server<Integer>::Create(params, this->rns_context_.get(),
+                              {database.get()}, prng_seed_ct_pad,
+                              prng_seed_gk_pad));
+  ASSERT_OK(server->Preprocess());
+  ASSERT_OK_AND_ASSIGN(
+      auto full_server,
+      Server<Integer>::Create(*this->params_, this->rns_context_.get(),
+                              {database.get()}, prng_seed_ct_pad,
+                              prng_seed_gk_pad));
+  ASSERT_OK(full_server->Preprocess());
+  ASSERT_OK_AND_ASSIGN(
+      auto client,
+      Client<Integer>::Create(params, this->rns_context_.get(),
+                              prng_seed_ct_pad, prng_seed_gk_pad));
+
+  std::vector<Integer> query = SampleValues(num_cols, 8);
+  ASSERT_OK_AND_ASSIGN(auto request, client->GenerateRequest(query));
+  ASSERT_OK_AND_ASSIGN(auto response, server->HandleRequest(request));
+  ASSERT_OK_AND_ASSIGN(auto full_response, full_server->HandleRequest(request));
+  ASSERT_EQ(response.ct_inner_products_size(), 1);
+  EXPECT_EQ(response.ct_inner_products(0).ct_blocks_size(), 0);
+  EXPECT_EQ(response.ct_inner_products(0).mod_switched_ct_blocks_size(), 2);
+  // 40 instead of 108 bits per coefficient.
+  EXPECT_LT(response.ByteSizeLong() * 2, full_response.ByteSizeLong());
+
+  ASSERT_OK_AND_ASSIGN(auto results, client->Recover(response));
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_GE(results[0].size(), num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    Integer expected = 0;
+    for (int j = 0; j < num_cols; ++j) {
+      expected = (expected + data[i][j] * query[j]) % this->params_->ts[0];
+    }
+    EXPECT_EQ(results[0][i], expected);
+  }
+}
+
+TEST_F(LinPirTest, InvalidResponseBitSize) {
+  RlweParameters<Integer> params = *this->params_;
+  params.response_bit_size = 64;
+  auto data = SampleMatrix(16, 16, 8);
+  ASSERT_OK_AND_ASSIGN(auto database,
+                       Database<Integer>::Create(
+                           params, this->rns_context_.get(), data));
+  EXPECT_FALSE(Server<Integer>::Create(params, this->rns_context_.get(),
+                                       {database.get()})
+                   .ok());
+}
+
 }  // namespace
 }  // namespace linpir
 }  // namespace hintless_pir
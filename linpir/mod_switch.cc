@@ -0,0 +1,260 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "linpir/mod_switch.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/numeric/int128.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
+#include "shell_encryption/rns/rns_polynomial.h"
+#include "shell_encryption/status_macros.h"
+
+namespace hintless_pir {
+namespace linpir {
+
+namespace {
+
+// The response ciphertexts of LinPir are (b, a).
+constexpr int kNumComponents = 2;
+
+// Returns (x * y) mod q, for x, y < q < 2^64.
+uint64_t MulMod(uint64_t x, uint64_t y, uint64_t q) {
+  return static_cast<uint64_t>(absl::uint128(x) * y % q);
+}
+
+// Returns x^-1 mod q for a prime q.
+uint64_t InvMod(uint64_t x, uint64_t q) {
+  uint64_t result = 1;
+  uint64_t base = x % q;
+  for (uint64_t e = q - 2; e > 0; e >>= 1) {
+    if (e & 1) {
+      result = MulMod(result, base, q);
+    }
+    base = MulMod(base, base, q);
+  }
+  return result;
+}
+
+}  // namespace
+
+template <typename RlweInteger>
+absl::StatusOr<ModulusSwitcher<RlweInteger>>
+ModulusSwitcher<RlweInteger>::Create(absl::Span<const RlweInteger> qs,
+                                     int bit_size) {
+  if (qs.empty()) {
+    return absl::InvalidArgumentError("`qs` must not be empty.");
+  }
+  absl::uint128 modulus = 1;
+  for (RlweInteger q : qs) {
+    if (q < 2 || modulus > (absl::Uint128Max() >> 1) / q) {
+      return absl::InvalidArgumentError(
+          "The product of `qs` must fit in 127 bits.");
+    }
+    modulus *= q;
+  }
+  if (bit_size <= 0 || bit_size >= 64 ||
+      absl::uint128(1) << bit_size >= modulus) {
+    return absl::InvalidArgumentError(
+        "`bit_size` must be positive, less than 64 and less than the bit size "
+        "of the ciphertext modulus.");
+  }
+
+  std::vector<absl::uint128> q_hats;
+  std::vector<RlweInteger> q_hat_invs;
+  q_hats.reserve(qs.size());
+  q_hat_invs.reserve(qs.size());
+  for (RlweInteger q : qs) {
+    absl::uint128 q_hat = modulus / q;
+    q_hats.push_back(q_hat);
+    q_hat_invs.push_back(static_cast<RlweInteger>(
+        InvMod(static_cast<uint64_t>(q_hat % q), q)));
+  }
+  return ModulusSwitcher(std::vector<RlweInteger>(qs.begin(), qs.end()),
+                         bit_size, modulus, std::move(q_hats),
+                         std::move(q_hat_invs));
+}
+
+template <typename RlweInteger>
+uint64_t ModulusSwitcher<RlweInteger>::SwitchDown(
+    absl::Span<const RlweInteger> residues) const {
+  // Reconstruct x = sum_i (r_i * q_hat_inv_i mod q_i) * q_hat_i mod Q. Every
+  // term is less than Q < 2^127, so the sums do not overflow.
+  absl::uint128 x = 0;
+  for (int i = 0; i < qs_.size(); ++i) {
+    x += MulMod(residues[i], q_hat_invs_[i], qs_[i]) * q_hats_[i];
+    if (x >= modulus_) {
+      x -= modulus_;
+    }
+  }
+
+  // Divide x * 2^bit_size by Q one bit at a time, as x * 2^bit_size may not
+  // fit in 128 bits, and round the quotient to the nearest.
+  uint64_t quotient = 0;
+  absl::uint128 remainder = x;
+  for (int j = 0; j < bit_size_; ++j) {
+    remainder <<= 1;
+    quotient <<= 1;
+    if (remainder >= modulus_) {
+      remainder -= modulus_;
+      quotient |= 1;
+    }
+  }
+  if (remainder >= modulus_ - remainder) {
+    ++quotient;
+  }
+  return quotient & ((uint64_t{1} << bit_size_) - 1);
+}
+
+template <typename RlweInteger>
+std::vector<RlweInteger> ModulusSwitcher<RlweInteger>::SwitchUp(
+    uint64_t y) const {
+  // With Q = Q_high * 2^bit_size + Q_low, y * Q / 2^bit_size is
+  // y * Q_high + y * Q_low / 2^bit_size, where y * Q_low < 2^(2 * bit_size).
+  absl::uint128 modulus_high = modulus_ >> bit_size_;
+  absl::uint128 modulus_low =
+      modulus_ & ((absl::uint128(1) << bit_size_) - 1);
+  absl::uint128 x =
+      modulus_high * y +
+      ((modulus_low * y + (absl::uint128(1) << (bit_size_ - 1))) >> bit_size_);
+  if (x >= modulus_) {
+    x -= modulus_;
+  }
+  std::vector<RlweInteger> residues;
+  residues.reserve(qs_.size());
+  for (RlweInteger q : qs_) {
+    residues.push_back(static_cast<RlweInteger>(x % q));
+  }
+  return residues;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<ModSwitchedRlweCiphertext>
+ModulusSwitcher<RlweInteger>::Serialize(
+    const RnsCiphertext& ct,
+    const std::vector<const PrimeModulus*>& moduli) const {
+  if (moduli.size() != qs_.size()) {
+    return absl::InvalidArgumentError("`moduli` must have the values of `qs`.");
+  }
+  ModSwitchedRlweCiphertext serialized;
+  serialized.set_bit_size(bit_size_);
+  serialized.set_num_components(kNumComponents);
+  std::string* packed = serialized.mutable_packed_coeffs();
+  absl::uint128 buffer = 0;
+  int num_buffered_bits = 0;
+  std::vector<RlweInteger> residues(qs_.size());
+  for (int c = 0; c < kNumComponents; ++c) {
+    RLWE_ASSIGN_OR_RETURN(auto component, ct.Component(c));
+    if (component.IsNttForm()) {
+      RLWE_RETURN_IF_ERROR(component.ConvertToCoeffForm(moduli));
+    }
+    if (c == 0) {
+      serialized.set_log_n(component.LogN());
+      int num_coeffs = 1 << component.LogN();
+      packed->reserve(
+          (int64_t{kNumComponents} * num_coeffs * bit_size_ + 7) / 8);
+    }
+    auto const& coeff_vectors = component.Coeffs();
+    for (int k = 0; k < coeff_vectors[0].size(); ++k) {
+      for (int i = 0; i < qs_.size(); ++i) {
+        residues[i] = coeff_vectors[i][k].ExportInt(moduli[i]->ModParams());
+      }
+      buffer |= absl::uint128(SwitchDown(residues)) << num_buffered_bits;
+      num_buffered_bits += bit_size_;
+      while (num_buffered_bits >= 8) {
+        packed->push_back(static_cast<char>(absl::Uint128Low64(buffer) & 0xFF));
+        buffer >>= 8;
+        num_buffered_bits -= 8;
+      }
+    }
+  }
+  if (num_buffered_bits > 0) {
+    packed->push_back(static_cast<char>(absl::Uint128Low64(buffer) & 0xFF));
+  }
+  return serialized;
+}
+
+template <typename RlweInteger>
+absl::StatusOr<typename ModulusSwitcher<RlweInteger>::RnsCiphertext>
+ModulusSwitcher<RlweInteger>::Deserialize(
+    const ModSwitchedRlweCiphertext& serialized,
+    const std::vector<const PrimeModulus*>& moduli,
+    const RnsErrorParams* error_params, const RnsContext* context) const {
+  if (moduli.size() != qs_.size()) {
+    return absl::InvalidArgumentError("`moduli` must have the values of `qs`.");
+  }
+  if (serialized.bit_size() != bit_size_ ||
+      serialized.num_components() != kNumComponents ||
+      serialized.log_n() <= 0 || serialized.log_n() >= 31) {
+    return absl::InvalidArgumentError(
+        "`serialized` has an unexpected modulus or dimension.");
+  }
+  int num_coeffs = 1 << serialized.log_n();
+  const std::string& packed = serialized.packed_coeffs();
+  if (packed.size() !=
+      (int64_t{kNumComponents} * num_coeffs * bit_size_ + 7) / 8) {
+    return absl::InvalidArgumentError(
+        "`serialized` has incorrect number of packed coefficients.");
+  }
+
+  uint64_t mask = (uint64_t{1} << bit_size_) - 1;
+  absl::uint128 buffer = 0;
+  int num_buffered_bits = 0;
+  int64_t next_byte = 0;
+  std::vector<rlwe::RnsPolynomial<ModularInt>> components;
+  components.reserve(kNumComponents);
+  for (int c = 0; c < kNumComponents; ++c) {
+    std::vector<std::vector<ModularInt>> coeff_vectors(qs_.size());
+    for (auto& coeff_vector : coeff_vectors) {
+      coeff_vector.reserve(num_coeffs);
+    }
+    for (int k = 0; k < num_coeffs; ++k) {
+      while (num_buffered_bits < bit_size_) {
+        buffer |= absl::uint128(static_cast<uint8_t>(packed[next_byte++]))
+                  << num_buffered_bits;
+        num_buffered_bits += 8;
+      }
+      uint64_t y = absl::Uint128Low64(buffer) & mask;
+      buffer >>= bit_size_;
+      num_buffered_bits -= bit_size_;
+      std::vector<RlweInteger> residues = SwitchUp(y);
+      for (int i = 0; i < qs_.size(); ++i) {
+        RLWE_ASSIGN_OR_RETURN(
+            ModularInt coeff,
+            ModularInt::ImportInt(residues[i], moduli[i]->ModParams()));
+        coeff_vectors[i].push_back(std::move(coeff));
+      }
+    }
+    RLWE_ASSIGN_OR_RETURN(auto component,
+                          rlwe::RnsPolynomial<ModularInt>::Create(
+                              std::move(coeff_vectors), /*is_ntt=*/false));
+    RLWE_RETURN_IF_ERROR(component.ConvertToNttForm(moduli));
+    components.push_back(std::move(component));
+  }
+  return RnsCiphertext(std::move(components), moduli, /*power_of_s=*/1,
+                       /*error=*/0, error_params, context);
+}
+
+template class ModulusSwitcher<Uint32>;
+template class ModulusSwitcher<Uint64>;
+
+}  // namespace linpir
+}  // namespace hintless_pir
@@ -0,0 +1,103 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_LINPIR_MOD_SWITCH_H_
+#define HINTLESS_PIR_LINPIR_MOD_SWITCH_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/numeric/int128.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "linpir/serialization.pb.h"
+#include "shell_encryption/montgomery.h"
+#include "shell_encryption/rns/rns_bfv_ciphertext.h"
+#include "shell_encryption/rns/rns_context.h"
+#include "shell_encryption/rns/rns_error_params.h"
+#include "shell_encryption/rns/rns_modulus.h"
+
+namespace hintless_pir {
+namespace linpir {
+
+// Switches RLWE ciphertexts from the RNS modulus Q = prod(qs) to the modulus
+// 2^bit_size, rounding every coefficient x to round(x * 2^bit_size / Q), and
+// back. Switching shrinks the serialized ciphertexts from log2(Q) to bit_size
+// bits per coefficient, at the cost of a rounding error of about
+// Q / 2^(bit_size + 1) times the norm of the secret key in the decryption, so
+// `bit_size` must leave room above the plaintext modulus for that error.
+template <typename RlweInteger>
+class ModulusSwitcher {
+ public:
+  using ModularInt = rlwe::MontgomeryInt<RlweInteger>;
+  using RnsCiphertext = rlwe::RnsBfvCiphertext<ModularInt>;
+  using RnsContext = rlwe::RnsContext<ModularInt>;
+  using RnsErrorParams = rlwe::RnsErrorParams<ModularInt>;
+  using PrimeModulus = rlwe::PrimeModulus<ModularInt>;
+
+  // Creates a switcher from the modulus prod(qs) to 2^bit_size. Returns error
+  // if prod(qs) does not fit in 127 bits or if `bit_size` is not in
+  // [1, min(63, log2(prod(qs)))).
+  static absl::StatusOr<ModulusSwitcher> Create(
+      absl::Span<const RlweInteger> qs, int bit_size);
+
+  // Returns the ciphertext `ct` over `moduli`, which must have the values of
+  // `qs`, switched to the modulus 2^bit_size and packed.
+  absl::StatusOr<ModSwitchedRlweCiphertext> Serialize(
+      const RnsCiphertext& ct,
+      const std::vector<const PrimeModulus*>& moduli) const;
+
+  // Returns the ciphertext over `moduli` closest to `serialized` switched back
+  // to the modulus prod(qs), in NTT form.
+  absl::StatusOr<RnsCiphertext> Deserialize(
+      const ModSwitchedRlweCiphertext& serialized,
+      const std::vector<const PrimeModulus*>& moduli,
+      const RnsErrorParams* error_params, const RnsContext* context) const;
+
+  // Returns round(x * 2^bit_size / Q) mod 2^bit_size, for x in [0, Q), given
+  // by its residues modulo `qs`.
+  uint64_t SwitchDown(absl::Span<const RlweInteger> residues) const;
+
+  // Returns round(y * Q / 2^bit_size) mod Q, for y in [0, 2^bit_size), as its
+  // residues modulo `qs`.
+  std::vector<RlweInteger> SwitchUp(uint64_t y) const;
+
+  int BitSize() const { return bit_size_; }
+
+ private:
+  explicit ModulusSwitcher(std::vector<RlweInteger> qs, int bit_size,
+                           absl::uint128 modulus,
+                           std::vector<absl::uint128> q_hats,
+                           std::vector<RlweInteger> q_hat_invs)
+      : qs_(std::move(qs)),
+        bit_size_(bit_size),
+        modulus_(modulus),
+        q_hats_(std::move(q_hats)),
+        q_hat_invs_(std::move(q_hat_invs)) {}
+
+  const std::vector<RlweInteger> qs_;
+  const int bit_size_;
+
+  // Q = prod(qs), and the CRT basis of Q: q_hats_[i] = Q / qs[i], and
+  // q_hat_invs_[i] = (Q / qs[i])^-1 mod qs[i].
+  const absl::uint128 modulus_;
+  const std::vector<absl::uint128> q_hats_;
+  const std::vector<RlweInteger> q_hat_invs_;
+};
+
+}  // namespace linpir
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_LINPIR_MOD_SWITCH_H_
@@ -0,0 +1,98 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "linpir/mod_switch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/numeric/int128.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "linpir/parameters.h"
+#include "shell_encryption/testing/status_matchers.h"
+#include "shell_encryption/testing/status_testing.h"
+
+namespace hintless_pir {
+namespace linpir {
+namespace {
+
+using ::rlwe::testing::StatusIs;
+
+const std::vector<Uint64> kQs = {18014398509309953ULL,
+                                 18014398509293569ULL};  // 108 bits
+
+// Returns x mod Q from its residues modulo the two primes of `kQs`.
+absl::uint128 Combine(const std::vector<Uint64>& residues) {
+  // x = r0 + q0 * ((r1 - r0) * q0^-1 mod q1), with q0^-1 = q0^(q1 - 2).
+  uint64_t q0 = kQs[0], q1 = kQs[1];
+  uint64_t q0_inv = 1, base = q0 % q1;
+  for (uint64_t e = q1 - 2; e > 0; e >>= 1) {
+    if (e & 1) {
+      q0_inv = static_cast<uint64_t>(absl::uint128(q0_inv) * base % q1);
+    }
+    base = static_cast<uint64_t>(absl::uint128(base) * base % q1);
+  }
+  uint64_t diff = (residues[1] + q1 - residues[0] % q1) % q1;
+  return residues[0] +
+         absl::uint128(q0) *
+             static_cast<uint64_t>(absl::uint128(diff) * q0_inv % q1);
+}
+
+TEST(ModulusSwitcher, RejectsInvalidBitSizes) {
+  EXPECT_THAT(ModulusSwitcher<Uint64>::Create(kQs, 0),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ModulusSwitcher<Uint64>::Create(kQs, 64),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ModulusSwitcher<Uint32>::Create({536813569}, 29),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ModulusSwitcher<Uint64>::Create({}, 20),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ModulusSwitcher, SwitchingBackHasRoundingError) {
+  int bit_size = 40;
+  ASSERT_OK_AND_ASSIGN(auto switcher,
+                       ModulusSwitcher<Uint64>::Create(kQs, bit_size));
+  absl::uint128 modulus = absl::uint128(kQs[0]) * kQs[1];
+  absl::BitGen bitgen;
+  for (int i = 0; i < 1000; ++i) {
+    absl::uint128 x = absl::MakeUint128(absl::Uniform<uint64_t>(bitgen),
+                                        absl::Uniform<uint64_t>(bitgen)) %
+                      modulus;
+    uint64_t y = switcher.SwitchDown(
+        {static_cast<Uint64>(x % kQs[0]), static_cast<Uint64>(x % kQs[1])});
+    ASSERT_LT(y, uint64_t{1} << bit_size);
+    absl::uint128 x_back = Combine(switcher.SwitchUp(y));
+    absl::uint128 error = x_back > x ? x_back - x : x - x_back;
+    error = std::min(error, modulus - error);
+    EXPECT_LE(error, (modulus >> (bit_size + 1)) + 1);
+  }
+}
+
+TEST(ModulusSwitcher, RoundsAroundZero) {
+  ASSERT_OK_AND_ASSIGN(auto switcher,
+                       ModulusSwitcher<Uint32>::Create({536813569}, 20));
+  EXPECT_EQ(switcher.SwitchDown({0}), 0);
+  // -1 mod q rounds up to 2^20, i.e. to 0.
+  EXPECT_EQ(switcher.SwitchDown({536813568}), 0);
+  EXPECT_EQ(switcher.SwitchUp(0), std::vector<Uint32>{0});
+}
+
+}  // namespace
+}  // namespace linpir
+}  // namespace hintless_pir
@@ -46,6 +46,10 @@ using Uint64 = rlwe::Uint64;
 // - prng_type: The type of PRNG to sample random polynomials.
 // - rows_per_block: the number of rows of the database matrix in every block
 //          of the database encoding.
+// - response_bit_size: if positive, the server switches the response
+//          ciphertexts to the modulus 2^response_bit_size before sending them,
+//          which shrinks them at the cost of a rounding error; see
+//          `ModulusSwitcher`. A value of 0 sends them at the full modulus.
 template <typename RlweInteger>
 struct RlweParameters {
   int log_n;
@@ -57,6 +61,8 @@ struct RlweParameters {
 
   // Encoding a matrix into blocks.
   int rows_per_block;
+
+  int response_bit_size = 0;
 };
 
 }  // namespace linpir
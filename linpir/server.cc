@@ -15,8 +15,11 @@
 
 #include "linpir/server.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -25,13 +28,18 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "google/protobuf/repeated_ptr_field.h"
 #include "linpir/database.h"
+#include "linpir/mod_switch.h"
 #include "linpir/parameters.h"
+#include "linpir/serialization.pb.h"
 #include "shell_encryption/prng/prng.h"
 #include "shell_encryption/prng/single_thread_chacha_prng.h"
 #include "shell_encryption/prng/single_thread_hkdf_prng.h"
 #include "shell_encryption/status_macros.h"
+#include "util/metrics.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
@@ -42,7 +50,8 @@ Server<RlweInteger>::Create(
     const RlweParameters<RlweInteger>& parameters,
     const RnsContext* rns_context,
     const std::vector<Database<RlweInteger>*>& databases,
-    absl::string_view prng_seed_ct_pad, absl::string_view prng_seed_gk_pad) {
+    absl::string_view prng_seed_ct_pad, absl::string_view prng_seed_gk_pad,
+    ThreadPool* thread_pool) {
   if (!(parameters.prng_type == rlwe::PRNG_TYPE_HKDF ||
         parameters.prng_type == rlwe::PRNG_TYPE_CHACHA)) {
     return absl::InvalidArgumentError("Invalid `prng_type`.");
@@ -67,11 +76,18 @@ Server<RlweInteger>::Create(
           parameters.log_n, rns_moduli, /*aux_moduli=*/{},
           std::log2(static_cast<double>(rns_context->PlaintextModulus())),
           std::sqrt(parameters.error_variance)));
+  std::optional<ModulusSwitcher<RlweInteger>> response_switcher;
+  if (parameters.response_bit_size != 0) {
+    RLWE_ASSIGN_OR_RETURN(response_switcher,
+                          ModulusSwitcher<RlweInteger>::Create(
+                              parameters.qs, parameters.response_bit_size));
+  }
 
   return absl::WrapUnique(new Server<RlweInteger>(
       parameters, std::string(prng_seed_ct_pad), std::string(prng_seed_gk_pad),
       rns_context, std::move(rns_moduli), std::move(rns_gadget),
-      std::move(rns_error_params), databases));
+      std::move(rns_error_params), std::move(response_switcher), databases,
+      thread_pool));
 }
 
 template <typename RlweInteger>
@@ -171,11 +187,120 @@ absl::Status Server<RlweInteger>::Preprocess() {
 
   // Preprocess the databases using the "a" part of Enc(s << i).
   for (auto const& database : databases_) {
-    RLWE_RETURN_IF_ERROR(database->Preprocess(ct_pads_));
+    RLWE_RETURN_IF_ERROR(database->Preprocess(ct_pads_, thread_pool_));
   }
   return absl::OkStatus();
 }
 
+template <typename RlweInteger>
+absl::StatusOr<std::unique_ptr<Server<RlweInteger>>>
+Server<RlweInteger>::CreateFromState(
+    const RlweParameters<RlweInteger>& parameters,
+    const RnsContext* rns_context,
+    const std::vector<Database<RlweInteger>*>& databases,
+    const LinPirServerState& state, ThreadPool* thread_pool) {
+  for (auto const& database : databases) {
+    if (database == nullptr || !database->IsPreprocessed()) {
+      return absl::InvalidArgumentError(
+          "`databases` must hold preprocessed databases.");
+    }
+  }
+  RLWE_ASSIGN_OR_RETURN(
+      std::unique_ptr<Server> server,
+      Server<RlweInteger>::Create(parameters, rns_context, databases,
+                                  state.prng_seed_ct_pad(),
+                                  state.prng_seed_gk_pad(), thread_pool));
+
+  int num_rotations = parameters.rows_per_block / 2;
+  if (state.ct_pads_size() != num_rotations ||
+      state.ct_sub_pad_digits_size() != num_rotations - 1 ||
+      state.gk_pads_size() != server->rns_gadget_.Dimension()) {
+    return absl::InvalidArgumentError(
+        "`state` contains incorrect number of polynomials.");
+  }
+  auto const& moduli = server->rns_moduli_;
+  server->ct_pads_.reserve(state.ct_pads_size());
+  for (auto const& serialized : state.ct_pads()) {
+    RLWE_ASSIGN_OR_RETURN(RnsPolynomial ct_pad,
+                          RnsPolynomial::Deserialize(serialized, moduli));
+    server->ct_pads_.push_back(std::move(ct_pad));
+  }
+  server->ct_sub_pad_digits_.reserve(state.ct_sub_pad_digits_size());
+  for (auto const& serialized_digits : state.ct_sub_pad_digits()) {
+    std::vector<RnsPolynomial> digits;
+    digits.reserve(serialized_digits.digits_size());
+    for (auto const& serialized : serialized_digits.digits()) {
+      RLWE_ASSIGN_OR_RETURN(RnsPolynomial digit,
+                            RnsPolynomial::Deserialize(serialized, moduli));
+      digits.push_back(std::move(digit));
+    }
+    server->ct_sub_pad_digits_.push_back(std::move(digits));
+  }
+  server->gk_pads_.reserve(state.gk_pads_size());
+  for (auto const& serialized : state.gk_pads()) {
+    RLWE_ASSIGN_OR_RETURN(RnsPolynomial gk_pad,
+                          RnsPolynomial::Deserialize(serialized, moduli));
+    server->gk_pads_.push_back(std::move(gk_pad));
+  }
+  return server;
+}
+
+template <typename RlweInteger>
+absl::Status Server<RlweInteger>::UpdateDatabaseBlock(
+    int database_idx, int block_idx,
+    absl::Span<const std::vector<RlweInteger>> rows) {
+  if (ct_pads_.empty()) {
+    return absl::FailedPreconditionError("Server has not been preprocessed.");
+  }
+  if (database_idx < 0 || database_idx >= databases_.size()) {
+    return absl::InvalidArgumentError("`database_idx` is out of range.");
+  }
+  return databases_[database_idx]->UpdateBlock(block_idx, rows, ct_pads_);
+}
+
+template <typename RlweInteger>
+absl::StatusOr<LinPirServerState> Server<RlweInteger>::SerializeState() const {
+  if (ct_pads_.empty()) {
+    return absl::FailedPreconditionError("Server has not been preprocessed.");
+  }
+  LinPirServerState state;
+  state.set_prng_seed_ct_pad(prng_seed_ct_pad_);
+  state.set_prng_seed_gk_pad(prng_seed_gk_pad_);
+  for (auto const& ct_pad : ct_pads_) {
+    RLWE_ASSIGN_OR_RETURN(*state.add_ct_pads(), ct_pad.Serialize(rns_moduli_));
+  }
+  for (auto const& digits : ct_sub_pad_digits_) {
+    LinPirServerState::PadDigits* serialized_digits =
+        state.add_ct_sub_pad_digits();
+    for (auto const& digit : digits) {
+      RLWE_ASSIGN_OR_RETURN(*serialized_digits->add_digits(),
+                            digit.Serialize(rns_moduli_));
+    }
+  }
+  for (auto const& gk_pad : gk_pads_) {
+    RLWE_ASSIGN_OR_RETURN(*state.add_gk_pads(), gk_pad.Serialize(rns_moduli_));
+  }
+  return state;
+}
+
+template <typename RlweInteger>
+typename Server<RlweInteger>::MemoryBreakdown
+Server<RlweInteger>::MemoryUsage() const {
+  MemoryBreakdown usage;
+  for (auto const& ct_pad : ct_pads_) {
+    usage.ct_pad_bytes += PolynomialBytes(ct_pad);
+  }
+  for (auto const& digits : ct_sub_pad_digits_) {
+    for (auto const& digit : digits) {
+      usage.ct_sub_pad_digit_bytes += PolynomialBytes(digit);
+    }
+  }
+  for (auto const& gk_pad : gk_pads_) {
+    usage.gk_pad_bytes += PolynomialBytes(gk_pad);
+  }
+  return usage;
+}
+
 template <typename RlweInteger>
 absl::StatusOr<LinPirResponse> Server<RlweInteger>::HandleRequest(
     const RnsCiphertext& ct_query, const RnsGaloisKey& gk) const {
@@ -196,71 +321,221 @@ absl::StatusOr<LinPirResponse> Server<RlweInteger>::HandleRequest(
     LinPirResponse::EncryptedInnerProduct inner_product;
     RLWE_ASSIGN_OR_RETURN(std::vector<RnsCiphertext> ct_blocks,
                           database->InnerProductWith(ct_rotated_queries));
-    for (auto const& ct : ct_blocks) {
-      RLWE_ASSIGN_OR_RETURN(*inner_product.add_ct_blocks(), ct.Serialize());
+    for (int i = 0; i < ct_blocks.size(); ++i) {
+      RLWE_ASSIGN_OR_RETURN(LinPirResponseBlock block,
+                            SerializeBlock(ct_blocks[i]));
+      SetResponseBlock(inner_product, i, std::move(block));
     }
     *response.add_ct_inner_products() = std::move(inner_product);
   }
   return response;
 }
 
+template <typename RlweInteger>
+absl::StatusOr<std::vector<typename Server<RlweInteger>::RnsPolynomial>>
+Server<RlweInteger>::DeserializeGaloisKey(
+    const google::protobuf::RepeatedPtrField<::rlwe::SerializedRnsPolynomial>&
+        proto_gk_key_bs) const {
+  if (ct_pads_.empty()) {
+    return absl::FailedPreconditionError("Server has not been preprocessed.");
+  }
+  if (proto_gk_key_bs.size() != gk_pads_.size()) {
+    return absl::InvalidArgumentError(
+        "`proto_gk_key_bs` has incorrect number of polynomials.");
+  }
+  // The Galois key parts are deserialized concurrently, as they are the bulk
+  // of the request.
+  std::vector<std::optional<RnsPolynomial>> gk_key_b_slots(
+      proto_gk_key_bs.size());
+  RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+      proto_gk_key_bs.size(), thread_pool_, [&](int64_t i) -> absl::Status {
+        RLWE_ASSIGN_OR_RETURN(
+            gk_key_b_slots[i],
+            RnsPolynomial::Deserialize(proto_gk_key_bs[i], rns_moduli_));
+        return absl::OkStatus();
+      }));
+  std::vector<RnsPolynomial> gk_key_bs;
+  gk_key_bs.reserve(proto_gk_key_bs.size());
+  for (auto& gk_key_b : gk_key_b_slots) {
+    gk_key_bs.push_back(*std::move(gk_key_b));
+  }
+  return gk_key_bs;
+}
+
 template <typename RlweInteger>
 absl::StatusOr<LinPirResponse> Server<RlweInteger>::HandleRequest(
     const ::rlwe::SerializedRnsPolynomial& proto_ct_query_b,
     const google::protobuf::RepeatedPtrField<::rlwe::SerializedRnsPolynomial>&
         proto_gk_key_bs) const {
-  // Deserialize the "b" components from request and build the query ciphertext
-  // and the Galois key.
+  RLWE_ASSIGN_OR_RETURN(std::vector<RnsPolynomial> gk_key_bs,
+                        DeserializeGaloisKey(proto_gk_key_bs));
+  return HandleRequest(proto_ct_query_b, gk_key_bs);
+}
+
+template <typename RlweInteger>
+absl::StatusOr<LinPirResponse> Server<RlweInteger>::HandleRequest(
+    const ::rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+    absl::Span<const RnsPolynomial> gk_key_bs) const {
+  // Every block is written to its own message in the response, which are all
+  // created upfront.
+  LinPirResponse response;
+  response.mutable_ct_inner_products()->Reserve(databases_.size());
+  for (auto const& database : databases_) {
+    LinPirResponse::EncryptedInnerProduct* inner_product =
+        response.add_ct_inner_products();
+    if (response_switcher_.has_value()) {
+      inner_product->mutable_mod_switched_ct_blocks()->Reserve(
+          database->NumBlocks());
+      for (int i = 0; i < database->NumBlocks(); ++i) {
+        inner_product->add_mod_switched_ct_blocks();
+      }
+    } else {
+      inner_product->mutable_ct_blocks()->Reserve(database->NumBlocks());
+      for (int i = 0; i < database->NumBlocks(); ++i) {
+        inner_product->add_ct_blocks();
+      }
+    }
+  }
+  RLWE_RETURN_IF_ERROR(HandleRequestStreamed(
+      proto_ct_query_b, gk_key_bs,
+      [&](int database_idx, int block_idx, LinPirResponseBlock ct_block) {
+        SetResponseBlock(*response.mutable_ct_inner_products(database_idx),
+                         block_idx, std::move(ct_block));
+      }));
+  return response;
+}
+
+template <typename RlweInteger>
+absl::Status Server<RlweInteger>::HandleRequestStreamed(
+    const ::rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+    const google::protobuf::RepeatedPtrField<::rlwe::SerializedRnsPolynomial>&
+        proto_gk_key_bs,
+    BlockCallback on_block) const {
+  RLWE_ASSIGN_OR_RETURN(std::vector<RnsPolynomial> gk_key_bs,
+                        DeserializeGaloisKey(proto_gk_key_bs));
+  return HandleRequestStreamed(proto_ct_query_b, gk_key_bs, on_block);
+}
+
+template <typename RlweInteger>
+absl::Status Server<RlweInteger>::HandleRequestStreamed(
+    const ::rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+    absl::Span<const RnsPolynomial> gk_key_bs, BlockCallback on_block) const {
+  if (ct_pads_.empty()) {
+    return absl::FailedPreconditionError("Server has not been preprocessed.");
+  }
+  if (gk_key_bs.size() != gk_pads_.size()) {
+    return absl::InvalidArgumentError(
+        "`gk_key_bs` has incorrect number of polynomials.");
+  }
+
+  // Deserialize the "b" component of the query ciphertext from the request.
   RLWE_ASSIGN_OR_RETURN(
       RnsPolynomial ct_query_b,
       RnsPolynomial::Deserialize(proto_ct_query_b, rns_moduli_));
-  RnsCiphertext ct_query({std::move(ct_query_b), ct_pads_[0]}, rns_moduli_,
-                         /*power_of_s=*/1, /*error=*/0, &rns_error_params_,
-                         rns_context_);
-
-  std::vector<RnsPolynomial> gk_key_bs;
-  gk_key_bs.reserve(proto_gk_key_bs.size());
-  for (int i = 0; i < proto_gk_key_bs.size(); ++i) {
-    RLWE_ASSIGN_OR_RETURN(
-        RnsPolynomial gk_key_b,
-        RnsPolynomial::Deserialize(proto_gk_key_bs[i], rns_moduli_));
-    gk_key_bs.push_back(std::move(gk_key_b));
+  if (!ct_query_b.IsNttForm()) {
+    RLWE_RETURN_IF_ERROR(ct_query_b.ConvertToNttForm(rns_moduli_));
   }
-  RLWE_ASSIGN_OR_RETURN(
-      RnsGaloisKey gk,
-      RnsGaloisKey::CreateFromKeyComponents(
-          gk_pads_, std::move(gk_key_bs), /*power=*/5, &rns_gadget_,
-          rns_moduli_, prng_seed_gk_pad_, params_.prng_type));
 
-  // Compute all rotations of the query vector.
+  // Compute all rotations of the query vector. Rotating ct[i-1] = (b, a) by
+  // the Galois key gk gives (b(X^5) + g^-1(a(X^5))^T * gk.b, ct_pads_[i]),
+  // where the gadget digits of a(X^5) were precomputed in `Preprocess`. So the
+  // key switching products do not depend on the previous rotation: they are
+  // hoisted out of the chain and computed concurrently, and the chain itself
+  // only substitutes and adds the "b" components.
   int num_rotations = params_.rows_per_block / 2;
   std::vector<RnsCiphertext> ct_rotated_queries;
   ct_rotated_queries.reserve(num_rotations);
-  ct_rotated_queries.push_back(std::move(ct_query));
-  for (int i = 1; i < num_rotations; ++i) {
-    RLWE_ASSIGN_OR_RETURN(RnsCiphertext ct_sub,
-                          ct_rotated_queries[i - 1].Substitute(5));
-    RLWE_ASSIGN_OR_RETURN(RnsCiphertext ct_rot,
-                          gk.ApplyToWithRandomPad(
-                              ct_sub, ct_sub_pad_digits_[i - 1], ct_pads_[i]));
-    ct_rotated_queries.push_back(std::move(ct_rot));
+  {
+    ScopedPhaseTimer timer(metrics_sink_, Phase::kLinPirRotations);
+    int log_n = rns_context_->LogN();
+    std::vector<RnsPolynomial> key_switched_digits;
+    key_switched_digits.reserve(num_rotations - 1);
+    for (int i = 1; i < num_rotations; ++i) {
+      RLWE_ASSIGN_OR_RETURN(
+          RnsPolynomial zero,
+          RnsPolynomial::CreateZero(log_n, rns_moduli_, /*is_ntt=*/true));
+      key_switched_digits.push_back(std::move(zero));
+    }
+    RLWE_RETURN_IF_ERROR(ParallelForWithStatus(
+        num_rotations - 1, thread_pool_, [&](int64_t i) -> absl::Status {
+          for (int k = 0; k < gk_key_bs.size(); ++k) {
+            RLWE_RETURN_IF_ERROR(key_switched_digits[i].FusedMulAddInPlace(
+                ct_sub_pad_digits_[i][k], gk_key_bs[k], rns_moduli_));
+          }
+          return absl::OkStatus();
+        }));
+
+    RnsPolynomial ct_rotated_b = ct_query_b;
+    ct_rotated_queries.push_back(RnsCiphertext(
+        {std::move(ct_query_b), ct_pads_[0]}, rns_moduli_, /*power_of_s=*/1,
+        /*error=*/0, &rns_error_params_, rns_context_));
+    for (int i = 1; i < num_rotations; ++i) {
+      RLWE_ASSIGN_OR_RETURN(ct_rotated_b,
+                            ct_rotated_b.Substitute(5, rns_moduli_));
+      RLWE_RETURN_IF_ERROR(
+          ct_rotated_b.AddInPlace(key_switched_digits[i - 1], rns_moduli_));
+      ct_rotated_queries.push_back(RnsCiphertext(
+          {ct_rotated_b, ct_pads_[i]}, rns_moduli_, /*power_of_s=*/1,
+          /*error=*/0, &rns_error_params_, rns_context_));
+    }
   }
 
-  // Compute inner products with the databases and serialize them.
-  LinPirResponse response;
-  response.mutable_ct_inner_products()->Reserve(databases_.size());
+  // Compute inner products with the blocks of all databases and serialize
+  // them. Every task works on one block, and hands it to `on_block` as soon as
+  // it is serialized.
+  ScopedPhaseTimer timer(metrics_sink_, Phase::kLinPirInnerProducts);
+  std::vector<int64_t> block_offsets;
+  block_offsets.reserve(databases_.size() + 1);
+  block_offsets.push_back(0);
   for (auto const& database : databases_) {
-    RLWE_ASSIGN_OR_RETURN(
-        std::vector<RnsCiphertext> ct_blocks,
-        database->InnerProductWithPreprocessedPads(ct_rotated_queries));
-    LinPirResponse::EncryptedInnerProduct inner_product;
-    inner_product.mutable_ct_blocks()->Reserve(ct_blocks.size());
-    for (auto const& ct : ct_blocks) {
-      RLWE_ASSIGN_OR_RETURN(*inner_product.add_ct_blocks(), ct.Serialize());
+    block_offsets.push_back(block_offsets.back() + database->NumBlocks());
+  }
+  return ParallelForWithStatus(
+      block_offsets.back(), thread_pool_,
+      [&](int64_t task_idx) -> absl::Status {
+        int database_idx = std::upper_bound(block_offsets.begin(),
+                                            block_offsets.end(), task_idx) -
+                           block_offsets.begin() - 1;
+        int block_idx = task_idx - block_offsets[database_idx];
+        RLWE_ASSIGN_OR_RETURN(
+            RnsCiphertext ct_block,
+            databases_[database_idx]->BlockInnerProductWithPreprocessedPads(
+                block_idx, ct_rotated_queries));
+        RLWE_ASSIGN_OR_RETURN(LinPirResponseBlock serialized,
+                              SerializeBlock(ct_block));
+        on_block(database_idx, block_idx, std::move(serialized));
+        return absl::OkStatus();
+      });
+}
+
+template <typename RlweInteger>
+absl::StatusOr<LinPirResponseBlock> Server<RlweInteger>::SerializeBlock(
+    const RnsCiphertext& ct_block) const {
+  LinPirResponseBlock block;
+  if (response_switcher_.has_value()) {
+    RLWE_ASSIGN_OR_RETURN(*block.mutable_mod_switched_ct(),
+                          response_switcher_->Serialize(ct_block, rns_moduli_));
+  } else {
+    RLWE_ASSIGN_OR_RETURN(*block.mutable_ct(), ct_block.Serialize());
+  }
+  return block;
+}
+
+void SetResponseBlock(LinPirResponse::EncryptedInnerProduct& inner_product,
+                      int block_idx, LinPirResponseBlock block) {
+  if (block.has_mod_switched_ct()) {
+    while (inner_product.mod_switched_ct_blocks_size() <= block_idx) {
+      inner_product.add_mod_switched_ct_blocks();
     }
-    *response.add_ct_inner_products() = std::move(inner_product);
+    *inner_product.mutable_mod_switched_ct_blocks(block_idx) =
+        std::move(*block.mutable_mod_switched_ct());
+  } else {
+    while (inner_product.ct_blocks_size() <= block_idx) {
+      inner_product.add_ct_blocks();
+    }
+    *inner_product.mutable_ct_blocks(block_idx) =
+        std::move(*block.mutable_ct());
   }
-  return response;
 }
 
 template class Server<Uint32>;
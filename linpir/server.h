@@ -16,16 +16,21 @@
 #ifndef HINTLESS_PIR_LINPIR_SERVER_H_
 #define HINTLESS_PIR_LINPIR_SERVER_H_
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "google/protobuf/repeated_ptr_field.h"
 #include "linpir/database.h"
+#include "linpir/mod_switch.h"
 #include "linpir/parameters.h"
 #include "linpir/serialization.pb.h"
 #include "shell_encryption/montgomery.h"
@@ -36,10 +41,17 @@
 #include "shell_encryption/rns/rns_galois_key.h"
 #include "shell_encryption/rns/rns_modulus.h"
 #include "shell_encryption/rns/rns_polynomial.h"
+#include "util/metrics.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
 
+// Sets the `block_idx`'th block of `inner_product` to `block`, in the field of
+// its encoding, adding empty blocks before it if needed.
+void SetResponseBlock(LinPirResponse::EncryptedInnerProduct& inner_product,
+                      int block_idx, LinPirResponseBlock block);
+
 // This class implements the server component of the LinPIR scheme, computing
 // homomorphically the matrix-vector product between the database and the
 // encrypted query vector.
@@ -47,6 +59,9 @@ namespace linpir {
 // Server per plaintext CRT modulus. Furthermore, all Server instances should
 // share the same PRNG seed for the Galois key but different PRNG seeds for the
 // ciphertext "a" component.
+// Once preprocessed, `HandleRequest` only reads the state of the server, so it
+// may be called from any number of threads at the same time, but not
+// concurrently with `Preprocess` or `UpdateDatabaseBlock`.
 template <typename RlweInteger>
 class Server {
  public:
@@ -59,6 +74,25 @@ class Server {
   using RnsErrorParams = rlwe::RnsErrorParams<ModularInt>;
   using PrimeModulus = rlwe::PrimeModulus<ModularInt>;
 
+  // The memory held by a server, in bytes, not counting its databases.
+  struct MemoryBreakdown {
+    // The pads of the rotated queries.
+    int64_t ct_pad_bytes = 0;
+    // The gadget digits of the pads of the query rotations.
+    int64_t ct_sub_pad_digit_bytes = 0;
+    // The pads of the Galois key.
+    int64_t gk_pad_bytes = 0;
+
+    int64_t TotalBytes() const {
+      return ct_pad_bytes + ct_sub_pad_digit_bytes + gk_pad_bytes;
+    }
+  };
+
+  // Receives the serialized ciphertext of the `block_idx`'th block of the
+  // inner product with the `database_idx`'th database.
+  using BlockCallback = absl::FunctionRef<void(
+      int database_idx, int block_idx, LinPirResponseBlock ct_block)>;
+
   // Creates a LinPIR server which holds the matrices stored in the databases.
   // The server holds freshly generated PRNG seeds for the "a" components of
   // query ciphertexts and Galois automorphism keys.
@@ -71,15 +105,41 @@ class Server {
   // when multiple LinPIR instances are sharing the same Galois automorphism
   // key and hence the relevant preprocessing data generated by the PRNG seeds,
   // where each instance works on a CRT modulus of the plaintext computation.
+  // When `thread_pool` is not null, the inner products between the blocks of
+  // all databases and the rotated queries are computed on its workers; it
+  // must outlive the server. Returns error if `response_bit_size` of
+  // `parameters` is invalid for its ciphertext moduli.
   static absl::StatusOr<std::unique_ptr<Server>> Create(
       const RlweParameters<RlweInteger>& parameters,
       const RnsContext* rns_context,
       const std::vector<Database<RlweInteger>*>& databases,
-      absl::string_view prng_seed_ct_pad, absl::string_view prng_seed_gk_pad);
+      absl::string_view prng_seed_ct_pad, absl::string_view prng_seed_gk_pad,
+      ThreadPool* thread_pool = nullptr);
+
+  // Creates a LinPIR server from a state returned by `SerializeState`, so that
+  // it is ready to handle requests without calling `Preprocess`. The databases
+  // must have been restored in the preprocessed form, e.g. by
+  // `Database::CreateFromSerializedBlocks`.
+  static absl::StatusOr<std::unique_ptr<Server>> CreateFromState(
+      const RlweParameters<RlweInteger>& parameters,
+      const RnsContext* rns_context,
+      const std::vector<Database<RlweInteger>*>& databases,
+      const LinPirServerState& state, ThreadPool* thread_pool = nullptr);
 
   // Preprocess the ciphertext automorphisms and database inner products.
   absl::Status Preprocess();
 
+  // Replaces the rows of the `block_idx`'th block of the `database_idx`'th
+  // database by `rows`, and updates the preprocessed data of that block only.
+  // Returns error if `Preprocess` has not been called.
+  absl::Status UpdateDatabaseBlock(
+      int database_idx, int block_idx,
+      absl::Span<const std::vector<RlweInteger>> rows);
+
+  // Returns the PRNG seeds and the preprocessed polynomials of this server.
+  // Returns error if `Preprocess` has not been called.
+  absl::StatusOr<LinPirServerState> SerializeState() const;
+
   // Process a serialized LinPir request.
   // This variant requires the server and the database are preprocessed.
   absl::StatusOr<LinPirResponse> HandleRequest(
@@ -94,12 +154,26 @@ class Server {
       const google::protobuf::RepeatedPtrField<rlwe::SerializedRnsPolynomial>&
           proto_gk_key_bs) const;
 
+  // Same as above, but hands every block of the response to `on_block` as soon
+  // as it is computed, instead of returning them once all are done. The blocks
+  // come in no particular order, and `on_block` may be called from several
+  // threads at the same time. Returns error if any block fails, in which case
+  // some blocks may have been passed to `on_block`.
+  absl::Status HandleRequestStreamed(
+      const rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+      const google::protobuf::RepeatedPtrField<rlwe::SerializedRnsPolynomial>&
+          proto_gk_key_bs,
+      BlockCallback on_block) const;
+
   // Process a LinPir request represented by a ciphertext encrypting the vector
   // and a Galois automorphism key.
   // This variant does not require preprocessing.
   absl::StatusOr<LinPirResponse> HandleRequest(const RnsCiphertext& ct_query,
                                                const RnsGaloisKey& gk) const;
 
+  // Returns the memory held by the polynomials preprocessed by `Preprocess`.
+  MemoryBreakdown MemoryUsage() const;
+
   // Accessors to the PRNG seeds for generating a LinPir request.
   absl::string_view PrngSeedForCiphertextRandomPads() const {
     return prng_seed_ct_pad_;
@@ -108,13 +182,20 @@ class Server {
     return prng_seed_gk_pad_;
   }
 
+  // Records the latencies of the query rotations and the inner products of
+  // preprocessed requests in `sink`, or nothing if `sink` is null. Must not be
+  // called concurrently with `HandleRequest`. Does not take ownership.
+  void SetMetricsSink(MetricsSink* sink) { metrics_sink_ = sink; }
+
  private:
   explicit Server(RlweParameters<RlweInteger> params,
                   std::string prng_seed_ct_pad, std::string prng_seed_gk_pad,
                   const RnsContext* rns_context,
                   std::vector<const PrimeModulus*> rns_moduli,
                   RnsGadget rns_gadget, RnsErrorParams rns_error_params,
-                  std::vector<Database<RlweInteger>*> databases)
+                  std::optional<ModulusSwitcher<RlweInteger>> response_switcher,
+                  std::vector<Database<RlweInteger>*> databases,
+                  ThreadPool* thread_pool)
       : params_(std::move(params)),
         prng_seed_ct_pad_(std::move(prng_seed_ct_pad)),
         prng_seed_gk_pad_(std::move(prng_seed_gk_pad)),
@@ -122,7 +203,28 @@ class Server {
         rns_moduli_(std::move(rns_moduli)),
         rns_error_params_(std::move(rns_error_params)),
         rns_gadget_(std::move(rns_gadget)),
-        databases_(std::move(databases)) {}
+        response_switcher_(std::move(response_switcher)),
+        databases_(std::move(databases)),
+        thread_pool_(thread_pool) {}
+
+  // Serializes a block of the response, switching its modulus if configured.
+  absl::StatusOr<LinPirResponseBlock> SerializeBlock(
+      const RnsCiphertext& ct_block) const;
+
+  // Returns the "b" components of the Galois key in a request, checking that
+  // there is one per gadget digit. Requires the server to be preprocessed.
+  absl::StatusOr<std::vector<RnsPolynomial>> DeserializeGaloisKey(
+      const google::protobuf::RepeatedPtrField<rlwe::SerializedRnsPolynomial>&
+          proto_gk_key_bs) const;
+
+  // Same as the public overloads, with the "b" components of the Galois key
+  // returned by `DeserializeGaloisKey` for the request.
+  absl::StatusOr<LinPirResponse> HandleRequest(
+      const rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+      absl::Span<const RnsPolynomial> gk_key_bs) const;
+  absl::Status HandleRequestStreamed(
+      const rlwe::SerializedRnsPolynomial& proto_ct_query_b,
+      absl::Span<const RnsPolynomial> gk_key_bs, BlockCallback on_block) const;
 
   const RlweParameters<RlweInteger> params_;
 
@@ -134,9 +236,21 @@ class Server {
   const RnsGadget rns_gadget_;
   const RnsErrorParams rns_error_params_;
 
+  // Switches the response ciphertexts to 2^response_bit_size; empty if they
+  // are sent at the full modulus.
+  const std::optional<ModulusSwitcher<RlweInteger>> response_switcher_;
+
   // Holding the matrices via mutable pointers to perform preprocessing tasks.
   std::vector<Database<RlweInteger>*> databases_;
 
+  // Workers for the inner products in `HandleRequest`; null if running on a
+  // single thread. Does not own the object.
+  ThreadPool* thread_pool_;
+
+  // Receives the metrics of `HandleRequest`; may be null. Does not own the
+  // object.
+  MetricsSink* metrics_sink_ = nullptr;
+
   // Preprocessed polynomials to be used in `HandleRequest`.
   std::vector<RnsPolynomial> ct_pads_;
   std::vector<std::vector<RnsPolynomial>> ct_sub_pad_digits_;
@@ -15,6 +15,7 @@
 #include "linpir/server.h"
 
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -41,6 +42,7 @@
 #include "shell_encryption/serialization.pb.h"
 #include "shell_encryption/testing/status_matchers.h"
 #include "shell_encryption/testing/status_testing.h"
+#include "util/thread_pool.h"
 
 namespace hintless_pir {
 namespace linpir {
@@ -349,6 +351,196 @@ TEST_F(ServerTest, HandleRequestWithPreprocessing) {
   }
 }
 
+TEST_F(ServerTest, HandleRequestFailsWithIncorrectNumberOfGaloisKeyParts) {
+  auto data =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(auto server, Server<Integer>::Create(
+                                        this->params_, this->rns_context_.get(),
+                                        {database.get()}));
+  RnsSecretKey secret_key = this->GenerateSecretKey();
+  RnsGaloisKey gk = this->GenerateGaloisKey(
+      secret_key, server->PrngSeedForGaloisKeyRandomPads());
+  std::vector<Integer> slots = SampleValues(1 << this->params_.log_n, 2);
+  ASSERT_OK_AND_ASSIGN(
+      auto prng_pad, Prng::Create(server->PrngSeedForCiphertextRandomPads()));
+  ASSERT_OK_AND_ASSIGN(
+      RnsCiphertext ct_query,
+      secret_key.template EncryptBfv<Encoder>(
+          slots, this->encoder_.get(), this->error_params_.get(),
+          this->prng_.get(), prng_pad.get()));
+  LinPirRequest request = this->SerializeLinPirRequest(ct_query, gk);
+  EXPECT_THAT(server->HandleRequest(request),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("Server has not been preprocessed")));
+
+  ASSERT_OK(server->Preprocess());
+  request.mutable_gk_key_bs()->RemoveLast();
+  EXPECT_THAT(server->HandleRequest(request),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("incorrect number of polynomials")));
+}
+
+TEST_F(ServerTest, SerializeStateFailsIfNotPreprocessed) {
+  auto data =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(auto server, Server<Integer>::Create(
+                                        this->params_, this->rns_context_.get(),
+                                        {database.get()}));
+  EXPECT_THAT(server->SerializeState(),
+              StatusIs(absl::StatusCode::kFailedPrecondition,
+                       HasSubstr("Server has not been preprocessed")));
+}
+
+TEST_F(ServerTest, MemoryUsage) {
+  auto data =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(auto server, Server<Integer>::Create(
+                                        this->params_, this->rns_context_.get(),
+                                        {database.get()}));
+  EXPECT_EQ(server->MemoryUsage().TotalBytes(), 0);
+
+  ASSERT_OK(server->Preprocess());
+  int64_t polynomial_bytes =
+      this->moduli_.size() * (int64_t{1} << this->params_.log_n) *
+      sizeof(ModularInt);
+  int num_rotations = this->params_.rows_per_block / 2;
+  int gadget_dim = this->gadget_->Dimension();
+  auto usage = server->MemoryUsage();
+  EXPECT_EQ(usage.ct_pad_bytes, num_rotations * polynomial_bytes);
+  EXPECT_EQ(usage.ct_sub_pad_digit_bytes,
+            (num_rotations - 1) * gadget_dim * polynomial_bytes);
+  EXPECT_EQ(usage.gk_pad_bytes, gadget_dim * polynomial_bytes);
+}
+
+TEST_F(ServerTest, CreateFromStateFailsIfDatabaseIsNotPreprocessed) {
+  auto data =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  EXPECT_THAT(Server<Integer>::CreateFromState(this->params_,
+                                               this->rns_context_.get(),
+                                               {database.get()},
+                                               LinPirServerState()),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("must hold preprocessed databases")));
+}
+
+TEST_F(ServerTest, HandleRequestWithRestoredState) {
+  auto data =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(
+      auto database,
+      Database<Integer>::Create(this->params_, this->rns_context_.get(), data));
+  ASSERT_OK_AND_ASSIGN(auto server, Server<Integer>::Create(
+                                        this->params_, this->rns_context_.get(),
+                                        {database.get()}));
+  ASSERT_OK(server->Preprocess());
+
+  // Restore the database and the server from their serialized state.
+  std::vector<LinPirDatabaseBlock> blocks;
+  for (int i = 0; i < database->NumBlocks(); ++i) {
+    ASSERT_OK_AND_ASSIGN(LinPirDatabaseBlock block,
+                         database->SerializeBlock(i));
+    blocks.push_back(std::move(block));
+  }
+  ASSERT_OK_AND_ASSIGN(auto restored_database,
+                       Database<Integer>::CreateFromSerializedBlocks(
+                           this->params_, this->rns_context_.get(), blocks));
+  ASSERT_OK_AND_ASSIGN(LinPirServerState state, server->SerializeState());
+  ASSERT_OK_AND_ASSIGN(
+      auto restored_server,
+      Server<Integer>::CreateFromState(this->params_, this->rns_context_.get(),
+                                       {restored_database.get()}, state));
+  EXPECT_EQ(restored_server->PrngSeedForCiphertextRandomPads(),
+            server->PrngSeedForCiphertextRandomPads());
+  EXPECT_EQ(restored_server->PrngSeedForGaloisKeyRandomPads(),
+            server->PrngSeedForGaloisKeyRandomPads());
+
+  // Both servers should compute the same response.
+  RnsSecretKey secret_key = this->GenerateSecretKey();
+  RnsGaloisKey gk = this->GenerateGaloisKey(
+      secret_key, server->PrngSeedForGaloisKeyRandomPads());
+  std::vector<Integer> slots = SampleValues(1 << this->params_.log_n, 2);
+  ASSERT_OK_AND_ASSIGN(
+      auto prng_pad, Prng::Create(server->PrngSeedForCiphertextRandomPads()));
+  ASSERT_OK_AND_ASSIGN(
+      RnsCiphertext ct_query,
+      secret_key.template EncryptBfv<Encoder>(
+          slots, this->encoder_.get(), this->error_params_.get(),
+          this->prng_.get(), prng_pad.get()));
+  LinPirRequest request = this->SerializeLinPirRequest(ct_query, gk);
+  ASSERT_OK_AND_ASSIGN(LinPirResponse expected, server->HandleRequest(request));
+  ASSERT_OK_AND_ASSIGN(LinPirResponse response,
+                       restored_server->HandleRequest(request));
+  EXPECT_EQ(response.SerializeAsString(), expected.SerializeAsString());
+}
+
+TEST_F(ServerTest, MultiThreadedHandleRequest) {
+  // Use small blocks so that each database has several blocks.
+  this->params_.rows_per_block = 16;
+  auto data0 =
+      SampleMatrix(kNumRows, kNumCols, rns_context_->PlaintextModulus());
+  auto data1 =
+      SampleMatrix(kNumRows + 8, kNumCols, rns_context_->PlaintextModulus());
+  ASSERT_OK_AND_ASSIGN(auto database0,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), data0));
+  ASSERT_OK_AND_ASSIGN(auto database1,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), data1));
+  ASSERT_OK_AND_ASSIGN(auto server, Server<Integer>::Create(
+                                        this->params_, this->rns_context_.get(),
+                                        {database0.get(), database1.get()}));
+  ASSERT_OK(server->Preprocess());
+
+  // A server with the same seeds but on its own copies of the databases.
+  ASSERT_OK_AND_ASSIGN(auto mt_database0,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), data0));
+  ASSERT_OK_AND_ASSIGN(auto mt_database1,
+                       Database<Integer>::Create(
+                           this->params_, this->rns_context_.get(), data1));
+  ThreadPool thread_pool(3);
+  ASSERT_OK_AND_ASSIGN(
+      auto mt_server,
+      Server<Integer>::Create(this->params_, this->rns_context_.get(),
+                              {mt_database0.get(), mt_database1.get()},
+                              server->PrngSeedForCiphertextRandomPads(),
+                              server->PrngSeedForGaloisKeyRandomPads(),
+                              &thread_pool));
+  ASSERT_OK(mt_server->Preprocess());
+
+  RnsSecretKey secret_key = this->GenerateSecretKey();
+  RnsGaloisKey gk = this->GenerateGaloisKey(
+      secret_key, server->PrngSeedForGaloisKeyRandomPads());
+  std::vector<Integer> slots = SampleValues(1 << this->params_.log_n, 2);
+  ASSERT_OK_AND_ASSIGN(
+      auto prng_pad, Prng::Create(server->PrngSeedForCiphertextRandomPads()));
+  ASSERT_OK_AND_ASSIGN(
+      RnsCiphertext ct_query,
+      secret_key.template EncryptBfv<Encoder>(
+          slots, this->encoder_.get(), this->error_params_.get(),
+          this->prng_.get(), prng_pad.get()));
+  LinPirRequest request = this->SerializeLinPirRequest(ct_query, gk);
+  ASSERT_OK_AND_ASSIGN(LinPirResponse expected, server->HandleRequest(request));
+  ASSERT_OK_AND_ASSIGN(LinPirResponse response,
+                       mt_server->HandleRequest(request));
+  ASSERT_EQ(response.ct_inner_products_size(), 2);
+  EXPECT_EQ(response.ct_inner_products(0).ct_blocks_size(), 2);
+  EXPECT_EQ(response.ct_inner_products(1).ct_blocks_size(), 3);
+  EXPECT_EQ(response.SerializeAsString(), expected.SerializeAsString());
+}
+
 }  // namespace
 }  // namespace linpir
 }  // namespace hintless_pir
@@ -16,6 +16,9 @@
 #ifndef HINTLESS_PIR_LWE_SYMMETRIC_ENCRYPTION_H_
 #define HINTLESS_PIR_LWE_SYMMETRIC_ENCRYPTION_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
 #include <utility>
 
 #include "Eigen/Core"
@@ -46,6 +49,107 @@ static absl::StatusOr<Matrix> ExpandPad(int num_rows, int num_cols,
   return SampleUniformMatrix(num_rows, num_cols, encryption_prng);
 }
 
+namespace internal {
+
+// The size of the pad chunks generated at a time by `ExpandPadAndMultiply`,
+// small enough for a chunk to stay in the L1 cache while it is multiplied.
+inline constexpr int kPadChunkBytes = 16 * 1024;
+
+// Returns whether all coefficients of `key` are in {-1, 0, 1} mod 2^32.
+inline bool IsTernary(const Vector& key) {
+  for (int i = 0; i < key.size(); ++i) {
+    if (key[i] != 0 && key[i] != 1 && key[i] != static_cast<Integer>(-1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the masks selecting the +1 and the -1 coefficients of the ternary
+// `key`, i.e. all ones where the coefficient has that value and 0 elsewhere.
+inline std::pair<Vector, Vector> TernaryMasks(const Vector& key) {
+  Vector plus_mask(key.size());
+  Vector minus_mask(key.size());
+  for (int i = 0; i < key.size(); ++i) {
+    plus_mask[i] = -static_cast<Integer>(key[i] == 1);
+    minus_mask[i] = -static_cast<Integer>(key[i] == static_cast<Integer>(-1));
+  }
+  return std::make_pair(std::move(plus_mask), std::move(minus_mask));
+}
+
+// Returns the inner product between `row` and the ternary key given by its
+// masks. Only uses ands, adds and subtractions, without branching on the key,
+// so that the loop is vectorized by the compiler and runs in constant time.
+inline Integer TernaryDot(const Integer* row, const Integer* plus_mask,
+                          const Integer* minus_mask, int num_coeffs) {
+  Integer plus = 0;
+  Integer minus = 0;
+  for (int j = 0; j < num_coeffs; ++j) {
+    plus += row[j] & plus_mask[j];
+    minus += row[j] & minus_mask[j];
+  }
+  return plus - minus;
+}
+
+// Returns pad * key for the ternary key given by its masks. The pad is stored
+// by columns, so the columns are added to or subtracted from the result.
+inline Vector TernaryProduct(const Matrix& pad, const Vector& plus_mask,
+                             const Vector& minus_mask) {
+  int num_rows = pad.rows();
+  Vector result = Vector::Zero(num_rows);
+  Integer* out = result.data();
+  for (int j = 0; j < pad.cols(); ++j) {
+    const Integer* col = pad.data() + static_cast<int64_t>(j) * num_rows;
+    Integer plus = plus_mask[j];
+    Integer minus = minus_mask[j];
+    for (int i = 0; i < num_rows; ++i) {
+      out[i] += (col[i] & plus) - (col[i] & minus);
+    }
+  }
+  return result;
+}
+
+}  // namespace internal
+
+// Returns pad * key for the ternary `key`, where pad is the `num_rows` x
+// `key.size()` matrix that `ExpandPad` returns for the same PRNG state. The pad
+// is generated in chunks of rows that are multiplied while still in cache, and
+// is never held in memory as a whole.
+template <typename Prng = rlwe::SingleThreadHkdfPrng>
+static absl::StatusOr<Vector> ExpandPadAndMultiply(int num_rows,
+                                                   const Vector& key,
+                                                   Prng* encryption_prng) {
+  if (num_rows < 1) {
+    return absl::InvalidArgumentError("The number of rows must be positive.");
+  } else if (key.size() < 1) {
+    return absl::InvalidArgumentError("The key must not be empty.");
+  } else if (!internal::IsTernary(key)) {
+    return absl::InvalidArgumentError("The key must be ternary.");
+  } else if (encryption_prng == nullptr) {
+    return absl::InvalidArgumentError("The prng must not be null.");
+  }
+  const int num_cols = key.size();
+  const auto [plus_mask, minus_mask] = internal::TernaryMasks(key);
+  const int rows_per_chunk = std::max<int>(
+      1, internal::kPadChunkBytes / (sizeof(Integer) * num_cols));
+
+  // Consecutive rows of the pad are consecutive outputs of the PRNG, so a
+  // chunk of rows is sampled as one vector, stored by rows.
+  Vector result(num_rows);
+  Vector chunk;
+  for (int row_begin = 0; row_begin < num_rows; row_begin += rows_per_chunk) {
+    int chunk_rows = std::min(rows_per_chunk, num_rows - row_begin);
+    chunk.resize(static_cast<int64_t>(chunk_rows) * num_cols);
+    RLWE_RETURN_IF_ERROR(SampleUniformVectorInPlace(chunk, encryption_prng));
+    for (int i = 0; i < chunk_rows; ++i) {
+      result[row_begin + i] = internal::TernaryDot(
+          chunk.data() + static_cast<int64_t>(i) * num_cols, plus_mask.data(),
+          minus_mask.data(), num_cols);
+    }
+  }
+  return result;
+}
+
 // This file implements the somewhat homomorphic symmetric-key encryption scheme
 // used in SimplePIR
 // https://eprint.iacr.org/2022/949
@@ -60,7 +164,7 @@ static absl::StatusOr<Matrix> ExpandPad(int num_rows, int num_cols,
 // Each ciphertext comprises a pair [pad, b], where
 // * b \in Z_q^m, and
 // * pad \in \Z_q^{m \times n}
-// * for q = 2^32.
+// * for q = 2^kIntBitwidth, i.e. 2^32 or 2^64.
 // and
 // b := pad*s + e + \Delta * m for
 // * s, e centered binomial vectors (see `hintless_simplepir/sample_error.h`)
@@ -159,7 +263,7 @@ class SymmetricLweKey {
     // Samples the Centered binomial and adds it to the (encoded) plaintext
     RLWE_RETURN_IF_ERROR(SampleAndAddCenteredBinomialInPlace(plaintext, prng));
     // Adds pad * s to the encoded vector \Delta * m + e
-    plaintext += pad * key_;
+    plaintext += MultiplyPad(pad);
     return absl::OkStatus();
   }
 
@@ -189,9 +293,12 @@ class SymmetricLweKey {
 
   template <typename Prng = rlwe::SingleThreadHkdfPrng>
   absl::StatusOr<Vector> MultiplySkWithA(const Matrix& pad) const {
-    
-    auto res = pad * key_;
-    return res;
+    if (Len() != pad.cols()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The key length, ", Len(),
+          ", does not match the number of cols of the pad, ", pad.cols()));
+    }
+    return MultiplyPad(pad);
   }
 
   // Encrypts the plaintext using learning-with-errors (LWE) encryption.
@@ -222,7 +329,7 @@ class SymmetricLweKey {
           "The key length, ", Len(),
           ", does not match the number of cols of A, ", pad.cols()));
     }
-    b -= pad * key_;
+    b -= MultiplyPad(pad);
     return b;
   }
 
@@ -241,10 +348,21 @@ class SymmetricLweKey {
 
  private:
   // A constructor. Does not take ownership of params.
-  explicit SymmetricLweKey(Vector key) : key_(std::move(key)) {}
+  explicit SymmetricLweKey(Vector key) : key_(std::move(key)) {
+    std::tie(plus_mask_, minus_mask_) = internal::TernaryMasks(key_);
+  }
+
+  // Returns pad * key_, where the dimensions must have been validated.
+  Vector MultiplyPad(const Matrix& pad) const {
+    return internal::TernaryProduct(pad, plus_mask_, minus_mask_);
+  }
 
   // The contents of the key itself.
   Vector key_;
+
+  // The masks of the +1 and -1 coefficients of the ternary `key_`.
+  Vector plus_mask_;
+  Vector minus_mask_;
 };
 
 }  // namespace lwe
@@ -16,6 +16,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Eigen/Core"
@@ -71,6 +72,36 @@ TEST_F(SymmetricLweEncryptionTest, ExpansionTest) {
   EXPECT_EQ(pad.cols(), num_cols_);
 }
 
+// Tests that the streamed product matches the product with the expanded pad,
+// including when the pad spans several chunks and the last one is partial.
+TEST_F(SymmetricLweEncryptionTest, ExpandPadAndMultiplyTest) {
+  for (auto [num_rows, num_cols] : {std::pair<int, int>{num_rows_, num_cols_},
+                                    std::pair<int, int>{300, 64}}) {
+    std::string pad_seed = Prng::GenerateSeed().value();
+    ASSERT_OK_AND_ASSIGN(auto key,
+                         SymmetricLweKey::Sample(num_cols, prng_.get()));
+    ASSERT_OK_AND_ASSIGN(auto pad_prng, Prng::Create(pad_seed));
+    ASSERT_OK_AND_ASSIGN(Matrix pad,
+                         ExpandPad(num_rows, num_cols, pad_prng.get()));
+    ASSERT_OK_AND_ASSIGN(auto stream_prng, Prng::Create(pad_seed));
+    ASSERT_OK_AND_ASSIGN(
+        Vector product,
+        ExpandPadAndMultiply(num_rows, key.Key(), stream_prng.get()));
+    Vector expected = pad * key.Key();
+    EXPECT_EQ(product, expected);
+    ASSERT_OK_AND_ASSIGN(Vector multiplied, key.MultiplySkWithA(pad));
+    EXPECT_EQ(multiplied, expected);
+  }
+}
+
+TEST_F(SymmetricLweEncryptionTest, ExpandPadAndMultiplyNonTernaryKeyTest) {
+  Vector key = Vector::Zero(num_cols_);
+  key[0] = 2;
+  EXPECT_THAT(ExpandPadAndMultiply(num_rows_, key, prng_.get()),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       testing::HasSubstr("ternary")));
+}
+
 // Tests that Encoding + adding noise + Decoding gets the plaintext back
 TEST_F(SymmetricLweEncryptionTest, ErrorCorrectionTest) {
   Vector actual_ptxt = Vector::Zero(num_rows_);
@@ -17,29 +17,57 @@
 #define HINTLESS_PIR_LWE_SAMPLE_ERROR_H_
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
-#include <vector>
 
 #include "Eigen/Core"
 #include "absl/log/check.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "lwe/types.h"
-#include "shell_encryption/bits_util.h"
 #include "shell_encryption/prng/single_thread_hkdf_prng.h"
 #include "shell_encryption/status_macros.h"
 
 namespace hintless_pir {
 namespace lwe {
 
-// Takes as input a uint32_t buffer, and adds an i.i.d. Centered Binomial
+namespace internal {
+
+// The number of random words drawn from the PRNG at a time by the samplers.
+inline constexpr int kNumRandomWordsPerChunk = 256;
+
+// Fills `words` with random 64-bit words drawn from `prng`. The samplers draw
+// all the words of a chunk first, and then convert them in a separate loop
+// that does not call the PRNG, so that the compiler can vectorize it.
+template <typename Prng>
+absl::Status FillRandomWords(absl::Span<uint64_t> words, Prng* prng) {
+  for (uint64_t& word : words) {
+    RLWE_ASSIGN_OR_RETURN(word, prng->Rand64());
+  }
+  return absl::OkStatus();
+}
+
+// Returns the number of ones in each of the four 16-bit lanes of `x`, stored
+// in the same lane.
+inline uint64_t CountOnes16x4(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (x + (x >> 8)) & 0x00FF00FF00FF00FFULL;
+}
+
+}  // namespace internal
+
+// Takes as input a buffer of LWE integers, and adds an i.i.d. Centered Binomial
 // (of Variance 8) to each coordinate of the buffer.
 //
 // These are distributed according to
 // \sum_{i=1}^16 B_i-B_i' for i.i.d. random coinflips B_i, B_i'.
 //
-// We sample (B_i, B_i') during each loop iteration for efficiency.
+// We sample (B_i, B_i') for two coefficients from every 64-bit random word,
+// and count the ones of the four 16-bit groups of a word at once.
 template <typename Prng = rlwe::SingleThreadHkdfPrng>
 static absl::Status SampleAndAddCenteredBinomialInPlace(Vector& buffer,
                                                         Prng* prng) {
@@ -54,16 +82,26 @@ static absl::Status SampleAndAddCenteredBinomialInPlace(Vector& buffer,
   }
 
   // Optimizes that the variance = 8 exactly
-  // so we need one PRNG call per pair of two coefficients (32 bits each).
-  // Masks for extracting 4 groups of 16 bits from 64 bits.
+  // so we need one random word per pair of two coefficients (32 bits each).
   constexpr uint64_t mask = 0xFFFF;
-  for (unsigned int i = 0; i < num_coeffs; i += 2) {
-    // Computing \sum_i=1^16 B_i - B_i' for i and i+1 in parallel
-    RLWE_ASSIGN_OR_RETURN(uint64_t r64, prng->Rand64());
-    buffer[i] += rlwe::internal::CountOnes64(r64 & mask);
-    buffer[i] -= rlwe::internal::CountOnes64(r64 & (mask << 16));
-    buffer[i + 1] += rlwe::internal::CountOnes64(r64 & mask << 32);
-    buffer[i + 1] -= rlwe::internal::CountOnes64(r64 & (mask << 48));
+  std::array<uint64_t, internal::kNumRandomWordsPerChunk> words;
+  Integer* coeffs = buffer.data();
+  int num_words = num_coeffs / 2;
+  for (int begin = 0; begin < num_words;
+       begin += internal::kNumRandomWordsPerChunk) {
+    int num_chunk_words =
+        std::min(num_words - begin, internal::kNumRandomWordsPerChunk);
+    RLWE_RETURN_IF_ERROR(internal::FillRandomWords(
+        absl::MakeSpan(words.data(), num_chunk_words), prng));
+    Integer* chunk_coeffs = coeffs + 2 * begin;
+    for (int i = 0; i < num_chunk_words; ++i) {
+      // Computing \sum_i=1^16 B_i - B_i' for both coefficients in parallel
+      uint64_t counts = internal::CountOnes16x4(words[i]);
+      chunk_coeffs[2 * i] += static_cast<Integer>(counts & mask) -
+                             static_cast<Integer>((counts >> 16) & mask);
+      chunk_coeffs[2 * i + 1] += static_cast<Integer>((counts >> 32) & mask) -
+                                 static_cast<Integer>(counts >> 48);
+    }
   }
   return absl::OkStatus();
 }
@@ -101,40 +139,35 @@ static absl::StatusOr<Vector> SampleUniformTernary(int num_coeffs, Prng* prng) {
   // by Pierre Karpman, https://hal.archives-ouvertes.fr/hal-03777885
   // An element from {-1, 0, 1} is represented using two bits: 0 as (0,0), 1 as
   // (1,0), and -1 as (1,1). The algorithm samples in batches two uniformly
-  // random 8-bit integers, r0 and r1, and uses a mask to indicate if a certain
-  // bit in r0 and r1 is the invalid representation (0,1) and needs re-sample.
-  Integer plus = 1;
-  Integer minus = -plus;
-  std::vector<Integer> coeffs;
-  coeffs.reserve(num_coeffs);
-  while (num_coeffs > 0) {
-    int num_filled_coeffs = std::min(num_coeffs, 8);
+  // random 64-bit integers, r0 and r1, and uses a mask to indicate if a
+  // certain bit in r0 and r1 is the invalid representation (0,1) and needs
+  // re-sample.
+  Vector output(num_coeffs);
+  Integer* coeffs = output.data();
+  for (int begin = 0; begin < num_coeffs; begin += 64) {
+    int num_filled_coeffs = std::min(num_coeffs - begin, 64);
     // The mask to indicate if a bit index requires re-sampling.
-    uint8_t missing_bits =
-        num_filled_coeffs < 8 ? (1 << num_filled_coeffs) - 1 : ~0;
-    uint8_t encoding_bits0 = 0;
-    uint8_t encoding_bits1 = 0;
+    uint64_t missing_bits = num_filled_coeffs < 64
+                                ? (uint64_t{1} << num_filled_coeffs) - 1
+                                : ~uint64_t{0};
+    uint64_t encoding_bits0 = 0;
+    uint64_t encoding_bits1 = 0;
     while (missing_bits != 0) {
-      RLWE_ASSIGN_OR_RETURN(uint8_t rand_bits0, prng->Rand8());
-      RLWE_ASSIGN_OR_RETURN(uint8_t rand_bits1, prng->Rand8());
+      RLWE_ASSIGN_OR_RETURN(uint64_t rand_bits0, prng->Rand64());
+      RLWE_ASSIGN_OR_RETURN(uint64_t rand_bits1, prng->Rand64());
       encoding_bits0 ^= (rand_bits0 & missing_bits);
       encoding_bits1 ^= (rand_bits1 & missing_bits);
       missing_bits = ~encoding_bits0 & encoding_bits1;
     }
 
+    // (0,0) -> 0, (1,0) -> 1 and (1,1) -> -1 mod q, without branches.
     for (int i = 0; i < num_filled_coeffs; ++i) {
-      uint8_t mask = 1 << i;
-      bool bit0 = ((encoding_bits0 & mask) > 0);
-      bool bit1 = ((encoding_bits1 & mask) > 0);
-      Integer is_plus = -static_cast<Integer>(bit0 && !bit1);
-      Integer is_minus = -static_cast<Integer>(bit0 && bit1);
-      Integer value = (is_plus & plus) | (is_minus & minus);
-      coeffs.push_back(value);
+      Integer bit0 = (encoding_bits0 >> i) & 1;
+      Integer bit1 = (encoding_bits1 >> i) & 1;
+      coeffs[begin + i] = bit0 | -(bit0 & bit1);
     }
-    num_coeffs -= num_filled_coeffs;
   }
-  Eigen::Map<Vector> map(coeffs.data(), coeffs.size());
-  return map;
+  return output;
 }
 
 // Samples a vector of uniforms without allocating
@@ -148,6 +181,12 @@ static absl::Status SampleUniformVectorInPlace(Vector& buffer, Prng* prng) {
   if (prng == nullptr) {
     return absl::InvalidArgumentError("prng must not be null.");
   }
+  if constexpr (sizeof(Integer) == sizeof(uint64_t)) {
+    for (int i = 0; i < num_coeffs; ++i) {
+      RLWE_ASSIGN_OR_RETURN(buffer[i], prng->Rand64());
+    }
+    return absl::OkStatus();
+  }
   constexpr uint64_t low_mask = 0x00000000ffffffff;
   for (int i = 0; i < num_coeffs; i += 2) {
     RLWE_ASSIGN_OR_RETURN(uint64_t sample, prng->Rand64());
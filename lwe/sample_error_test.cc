@@ -21,6 +21,8 @@
 
 #include "lwe/sample_error.h"
 
+#include <bitset>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -65,7 +67,7 @@ TEST(SampleErrorTest, CheckUpperBoundOnNoise) {
 
 TEST(SampleErrorTest, CheckUniformTernary) {
   const std::vector<int> k_num_coeffs = {1200, 1024, 2};
-  constexpr Integer k_lwe_modulus_half = 1 << (kIntBitwidth / 2);
+  constexpr Integer k_lwe_modulus_half = Integer{1} << (kIntBitwidth / 2);
   constexpr Integer plus = 1;
   constexpr Integer minus = -plus;
 
@@ -75,7 +77,7 @@ TEST(SampleErrorTest, CheckUniformTernary) {
     for (auto num_coeffs : k_num_coeffs) {
       ASSERT_OK_AND_ASSIGN(Vector error,
                            SampleUniformTernary(num_coeffs, prng.get()));
-      // Check that each coefficient is in {-1, 0, 1} mod 2^32.
+      // Check that each coefficient is in {-1, 0, 1} mod 2^kIntBitwidth.
       for (int k = 0; k < num_coeffs; k++) {
         if (error[k] > k_lwe_modulus_half) {
           EXPECT_EQ(error[k], minus);
@@ -87,6 +89,47 @@ TEST(SampleErrorTest, CheckUniformTernary) {
   }
 }
 
+// Tests that the bulk sampler adds the same binomials as counting the ones of
+// every 16-bit group of the random words one by one.
+TEST(SampleErrorTest, CenteredBinomialMatchesBitCounts) {
+  constexpr int kNumCoeffs = 1200;
+  auto prng = std::make_unique<TestingPrng>(0);
+  auto reference_prng = std::make_unique<TestingPrng>(0);
+  Vector buffer = Vector::Constant(kNumCoeffs, 7);
+  ASSERT_OK(SampleAndAddCenteredBinomialInPlace(buffer, prng.get()));
+  for (int k = 0; k < kNumCoeffs; k += 2) {
+    ASSERT_OK_AND_ASSIGN(uint64_t r64, reference_prng->Rand64());
+    auto count_ones = [r64](int group) {
+      return static_cast<Integer>(std::bitset<16>(r64 >> (16 * group)).count());
+    };
+    EXPECT_EQ(buffer[k], 7 + count_ones(0) - count_ones(1));
+    EXPECT_EQ(buffer[k + 1], 7 + count_ones(2) - count_ones(3));
+  }
+}
+
+TEST(SampleErrorTest, UniformTernaryIsBalanced) {
+  constexpr Integer plus = 1;
+  constexpr Integer minus = -plus;
+  auto prng = std::make_unique<TestingPrng>(0);
+  // Sizes that are not multiples of the 64 coefficients sampled at a time.
+  for (int num_coeffs : {1, 63, 65, 30001}) {
+    ASSERT_OK_AND_ASSIGN(Vector ternary,
+                         SampleUniformTernary(num_coeffs, prng.get()));
+    ASSERT_EQ(ternary.size(), num_coeffs);
+    int num_plus = 0, num_minus = 0;
+    for (int k = 0; k < num_coeffs; ++k) {
+      ASSERT_TRUE(ternary[k] == 0 || ternary[k] == plus || ternary[k] == minus);
+      num_plus += ternary[k] == plus;
+      num_minus += ternary[k] == minus;
+    }
+    if (num_coeffs > 10000) {
+      // Each value should appear about a third of the time.
+      EXPECT_NEAR(num_plus, num_coeffs / 3, num_coeffs / 30);
+      EXPECT_NEAR(num_minus, num_coeffs / 3, num_coeffs / 30);
+    }
+  }
+}
+
 TEST(SampleErrorTest, BinomialNegCoeffsTest) {
   auto prng = std::make_unique<TestingPrng>(0);
   auto status = SampleCenteredBinomial(-1, prng.get());
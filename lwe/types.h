@@ -25,15 +25,31 @@
 namespace hintless_pir {
 namespace lwe {
 
-// Unsigned integer type to store an LWE ciphertext element. Either uint32_t or
-// uint64_t for practical LWE parameters.
+// The bit width of LWE integers, i.e. of the power-of-two LWE modulus: 32 by
+// default, or 64 when building with `--define=lwe_integer_bits=64`. A 64-bit
+// modulus leaves room for larger plaintexts per LWE ciphertext, and so fewer
+// shards for large records, at twice the size of the LWE queries, responses
+// and hints.
+#ifndef HINTLESS_PIR_LWE_INTEGER_BITS
+#define HINTLESS_PIR_LWE_INTEGER_BITS 32
+#endif
+
+// Unsigned integer type to store an LWE ciphertext element. Arithmetic on it
+// wraps around mod the LWE modulus.
+#if HINTLESS_PIR_LWE_INTEGER_BITS == 64
+using Integer = uint64_t;
+#elif HINTLESS_PIR_LWE_INTEGER_BITS == 32
 using Integer = uint32_t;
+#else
+#error "HINTLESS_PIR_LWE_INTEGER_BITS must be 32 or 64."
+#endif
 using Matrix = Eigen::Matrix<Integer, Eigen::Dynamic, Eigen::Dynamic>;
 using Vector = Eigen::Vector<Integer, Eigen::Dynamic>;
 
 // Unsigned integer type to store an LWE plaintext element. This will be the
 // type of the database element. Either uint8_t or uint16_t for practical LWE
-// parameters.
+// parameters. The highway database picks its own packing from the plaintext
+// bit size, storing plaintexts of up to 4 bits two per byte.
 using PlainInteger = uint8_t;
 
 // Required to use Eigen without templates, see
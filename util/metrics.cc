@@ -0,0 +1,91 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/metrics.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace hintless_pir {
+
+absl::string_view PhaseName(Phase phase) {
+  switch (phase) {
+    case Phase::kRequestDeserialization:
+      return "request_deserialization";
+    case Phase::kLweInnerProduct:
+      return "lwe_inner_product";
+    case Phase::kLinPirRotations:
+      return "linpir_rotations";
+    case Phase::kLinPirInnerProducts:
+      return "linpir_inner_products";
+    case Phase::kResponseSerialization:
+      return "response_serialization";
+    case Phase::kClientPadExpansion:
+      return "client_pad_expansion";
+    case Phase::kClientRequestGeneration:
+      return "client_request_generation";
+    case Phase::kClientDecode:
+      return "client_decode";
+    case Phase::kHintComputation:
+      return "hint_computation";
+    case Phase::kLinPirPreprocessing:
+      return "linpir_preprocessing";
+  }
+  return "unknown";
+}
+
+int MetricsRecorder::LatencyBucket(absl::Duration latency) {
+  int64_t micros = absl::ToInt64Microseconds(latency);
+  if (micros <= 0) {
+    return 0;
+  }
+  // The bucket of `micros` in [2^(i-1), 2^i) is i = bit_width(micros).
+  int bucket = absl::bit_width(static_cast<uint64_t>(micros));
+  return std::min(bucket, kNumLatencyBuckets - 1);
+}
+
+void MetricsRecorder::RecordLatency(Phase phase, absl::Duration latency) {
+  int bucket = LatencyBucket(latency);
+  absl::MutexLock lock(&mutex_);
+  PhaseMetrics& metrics = metrics_[static_cast<int>(phase)];
+  metrics.count++;
+  metrics.total_latency += latency;
+  metrics.max_latency = std::max(metrics.max_latency, latency);
+  metrics.latency_buckets[bucket]++;
+}
+
+void MetricsRecorder::RecordBytes(Phase phase, int64_t bytes_in,
+                                  int64_t bytes_out) {
+  absl::MutexLock lock(&mutex_);
+  PhaseMetrics& metrics = metrics_[static_cast<int>(phase)];
+  metrics.bytes_in += bytes_in;
+  metrics.bytes_out += bytes_out;
+}
+
+MetricsRecorder::PhaseMetrics MetricsRecorder::Get(Phase phase) const {
+  absl::MutexLock lock(&mutex_);
+  return metrics_[static_cast<int>(phase)];
+}
+
+void MetricsRecorder::Reset() {
+  absl::MutexLock lock(&mutex_);
+  metrics_.fill(PhaseMetrics{});
+}
+
+}  // namespace hintless_pir
@@ -0,0 +1,141 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_UTIL_METRICS_H_
+#define HINTLESS_PIR_UTIL_METRICS_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace hintless_pir {
+
+// The phases of handling a PIR request whose latencies and sizes are recorded.
+enum class Phase {
+  // Server: deserializing the request.
+  kRequestDeserialization = 0,
+  // Server: the LWE product between the database and the query vector (D*u).
+  kLweInnerProduct,
+  // Server: the chain of LinPir query rotations.
+  kLinPirRotations,
+  // Server: the LinPir inner products with the rotated queries, including
+  // serializing the resulting ciphertexts.
+  kLinPirInnerProducts,
+  // Server: serializing the response.
+  kResponseSerialization,
+  // Client: expanding the LWE query pad from its PRNG seed.
+  kClientPadExpansion,
+  // Client: generating a request, i.e. the LWE and LinPir encryptions.
+  kClientRequestGeneration,
+  // Client: recovering the record from a response.
+  kClientDecode,
+  // Server: computing the hints for the LWE query pad of a new epoch.
+  kHintComputation,
+  // Server: encoding the hints in LinPir databases and preprocessing the
+  // LinPir servers of a new epoch.
+  kLinPirPreprocessing,
+};
+
+inline constexpr int kNumPhases =
+    static_cast<int>(Phase::kLinPirPreprocessing) + 1;
+
+// Returns a human readable name of `phase`, e.g. for exporting metrics.
+absl::string_view PhaseName(Phase phase);
+
+// Receives the metrics recorded by the servers and the clients. Phases may be
+// recorded from multiple threads at the same time, so implementations must be
+// thread-safe.
+class MetricsSink {
+ public:
+  virtual ~MetricsSink() = default;
+
+  // Records one occurrence of `phase` that took `latency`.
+  virtual void RecordLatency(Phase phase, absl::Duration latency) = 0;
+
+  // Records the number of bytes consumed and produced by one occurrence of
+  // `phase`.
+  virtual void RecordBytes(Phase phase, int64_t bytes_in,
+                           int64_t bytes_out) = 0;
+};
+
+// Measures the time between its construction and destruction on a monotonic
+// clock, and records it as the latency of `phase` in `sink`. Does nothing,
+// not even reading the clock, when `sink` is null.
+class ScopedPhaseTimer {
+ public:
+  ScopedPhaseTimer(MetricsSink* sink, Phase phase)
+      : sink_(sink), phase_(phase) {
+    if (sink_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedPhaseTimer() {
+    if (sink_ != nullptr) {
+      sink_->RecordLatency(
+          phase_, absl::FromChrono(std::chrono::steady_clock::now() - start_));
+    }
+  }
+
+  ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+  ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+
+ private:
+  MetricsSink* const sink_;
+  const Phase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// A thread-safe `MetricsSink` that aggregates the latencies of every phase in
+// a histogram, and sums up the bytes.
+class MetricsRecorder : public MetricsSink {
+ public:
+  // Bucket 0 counts latencies below 1 microsecond, and bucket i > 0 counts
+  // latencies in [2^(i-1), 2^i) microseconds. The last bucket is unbounded.
+  static constexpr int kNumLatencyBuckets = 32;
+
+  struct PhaseMetrics {
+    int64_t count = 0;
+    absl::Duration total_latency = absl::ZeroDuration();
+    absl::Duration max_latency = absl::ZeroDuration();
+    std::array<int64_t, kNumLatencyBuckets> latency_buckets = {};
+    int64_t bytes_in = 0;
+    int64_t bytes_out = 0;
+  };
+
+  void RecordLatency(Phase phase, absl::Duration latency) override;
+  void RecordBytes(Phase phase, int64_t bytes_in, int64_t bytes_out) override;
+
+  // Returns a snapshot of the metrics recorded for `phase`.
+  PhaseMetrics Get(Phase phase) const;
+
+  // Clears all recorded metrics.
+  void Reset();
+
+  // Returns the index of the histogram bucket counting `latency`.
+  static int LatencyBucket(absl::Duration latency);
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::array<PhaseMetrics, kNumPhases> metrics_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_UTIL_METRICS_H_
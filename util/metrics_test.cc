@@ -0,0 +1,91 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/metrics.h"
+
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "util/thread_pool.h"
+
+namespace hintless_pir {
+namespace {
+
+TEST(MetricsRecorder, LatencyBuckets) {
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::ZeroDuration()), 0);
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::Nanoseconds(999)), 0);
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::Microseconds(1)), 1);
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::Microseconds(3)), 2);
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::Microseconds(4)), 3);
+  EXPECT_EQ(MetricsRecorder::LatencyBucket(absl::Hours(1000)),
+            MetricsRecorder::kNumLatencyBuckets - 1);
+}
+
+TEST(MetricsRecorder, RecordsPerPhase) {
+  MetricsRecorder recorder;
+  recorder.RecordLatency(Phase::kLweInnerProduct, absl::Microseconds(5));
+  recorder.RecordLatency(Phase::kLweInnerProduct, absl::Microseconds(100));
+  recorder.RecordBytes(Phase::kRequestDeserialization, 42, 0);
+  recorder.RecordBytes(Phase::kRequestDeserialization, 8, 1);
+
+  MetricsRecorder::PhaseMetrics lwe = recorder.Get(Phase::kLweInnerProduct);
+  EXPECT_EQ(lwe.count, 2);
+  EXPECT_EQ(lwe.total_latency, absl::Microseconds(105));
+  EXPECT_EQ(lwe.max_latency, absl::Microseconds(100));
+  EXPECT_EQ(lwe.latency_buckets[3], 1);
+  EXPECT_EQ(lwe.latency_buckets[7], 1);
+  EXPECT_EQ(lwe.bytes_in, 0);
+
+  MetricsRecorder::PhaseMetrics deserialization =
+      recorder.Get(Phase::kRequestDeserialization);
+  EXPECT_EQ(deserialization.count, 0);
+  EXPECT_EQ(deserialization.bytes_in, 50);
+  EXPECT_EQ(deserialization.bytes_out, 1);
+
+  recorder.Reset();
+  EXPECT_EQ(recorder.Get(Phase::kLweInnerProduct).count, 0);
+  EXPECT_EQ(recorder.Get(Phase::kRequestDeserialization).bytes_in, 0);
+}
+
+TEST(MetricsRecorder, IsThreadSafe) {
+  MetricsRecorder recorder;
+  ThreadPool pool(4);
+  ParallelFor(1000, &pool, [&](int64_t /*i*/) {
+    ScopedPhaseTimer timer(&recorder, Phase::kClientDecode);
+    recorder.RecordBytes(Phase::kClientDecode, 1, 2);
+  });
+  MetricsRecorder::PhaseMetrics metrics = recorder.Get(Phase::kClientDecode);
+  EXPECT_EQ(metrics.count, 1000);
+  EXPECT_EQ(metrics.bytes_in, 1000);
+  EXPECT_EQ(metrics.bytes_out, 2000);
+}
+
+TEST(ScopedPhaseTimer, DoesNothingWithoutSink) {
+  // Must not crash when no sink is attached.
+  ScopedPhaseTimer timer(nullptr, Phase::kLweInnerProduct);
+}
+
+TEST(PhaseName, IsDistinctForEveryPhase) {
+  for (int i = 0; i < kNumPhases; ++i) {
+    for (int j = i + 1; j < kNumPhases; ++j) {
+      EXPECT_NE(PhaseName(static_cast<Phase>(i)),
+                PhaseName(static_cast<Phase>(j)));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace hintless_pir
@@ -0,0 +1,156 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/numa.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hintless_pir {
+
+namespace {
+
+#ifdef __linux__
+constexpr absl::string_view kNodeDir = "/sys/devices/system/node/";
+
+// From <linux/mempolicy.h>, which is not always installed.
+constexpr int kMpolBind = 2;
+constexpr unsigned kMpolMfMove = 1 << 1;
+
+// Returns the first line of the file at `path`, or an empty string if it
+// cannot be read.
+std::string ReadLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+#endif
+
+}  // namespace
+
+absl::StatusOr<std::vector<int>> ParseCpuList(absl::string_view cpu_list) {
+  std::vector<int> cpus;
+  for (absl::string_view range :
+       absl::StrSplit(cpu_list, ',', absl::SkipWhitespace())) {
+    std::vector<absl::string_view> bounds = absl::StrSplit(range, '-');
+    int first, last;
+    if (bounds.size() > 2 || !absl::SimpleAtoi(bounds[0], &first) ||
+        !absl::SimpleAtoi(bounds.back(), &last) || first < 0 ||
+        last < first) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU range `", range, "`."));
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<NumaNode> NumaNodes() {
+  std::vector<NumaNode> nodes;
+#ifdef __linux__
+  absl::StatusOr<std::vector<int>> node_ids =
+      ParseCpuList(ReadLine(absl::StrCat(kNodeDir, "online")));
+  if (node_ids.ok()) {
+    for (int id : *node_ids) {
+      absl::StatusOr<std::vector<int>> cpus = ParseCpuList(
+          ReadLine(absl::StrCat(kNodeDir, "node", id, "/cpulist")));
+      // Nodes holding only memory are left out, as no worker can run there.
+      if (cpus.ok() && !cpus->empty()) {
+        nodes.push_back(NumaNode{.id = id, .cpus = *std::move(cpus)});
+      }
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    nodes.push_back(NumaNode{.id = 0, .cpus = {}});
+  }
+  return nodes;
+}
+
+absl::Status PinCurrentThreadToCpus(absl::Span<const int> cpus) {
+  if (cpus.empty()) {
+    return absl::OkStatus();
+  }
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(absl::StrCat("Invalid CPU ", cpu, "."));
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (error != 0) {
+    return absl::InternalError(
+        absl::StrCat("Failed to set the CPU affinity: error ", error, "."));
+  }
+  return absl::OkStatus();
+#else
+  return absl::UnimplementedError("CPU affinity is not supported.");
+#endif
+}
+
+absl::Status BindToNumaNode(const void* data, size_t num_bytes, int node_id) {
+#if defined(__linux__) && defined(SYS_mbind)
+  constexpr int kBitsPerWord = 8 * sizeof(unsigned long);  // NOLINT
+  if (node_id < 0 || node_id >= 64 * kBitsPerWord) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid NUMA node ", node_id, "."));
+  }
+  // mbind takes page aligned ranges, so the partial pages at both ends are
+  // left out.
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + num_bytes;
+  begin = (begin + page_size - 1) / page_size * page_size;
+  end = end / page_size * page_size;
+  if (begin >= end) {
+    return absl::OkStatus();
+  }
+  std::vector<unsigned long> node_mask(node_id / kBitsPerWord + 1, 0);  // NOLINT
+  node_mask[node_id / kBitsPerWord] = 1UL << (node_id % kBitsPerWord);
+  if (syscall(SYS_mbind, begin, end - begin, kMpolBind, node_mask.data(),
+              node_mask.size() * kBitsPerWord + 1, kMpolMfMove) != 0) {
+    return absl::InternalError(
+        absl::StrCat("Failed to bind memory to NUMA node ", node_id, "."));
+  }
+  return absl::OkStatus();
+#else
+  return absl::UnimplementedError("NUMA memory binding is not supported.");
+#endif
+}
+
+}  // namespace hintless_pir
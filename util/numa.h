@@ -0,0 +1,54 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_UTIL_NUMA_H_
+#define HINTLESS_PIR_UTIL_NUMA_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace hintless_pir {
+
+// A NUMA node of the host, and the CPUs attached to it.
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Returns the NUMA nodes of the host that have CPUs, ordered by id. Returns a
+// single node 0 without CPUs if the topology cannot be read, e.g. on hosts
+// other than Linux, in which case pinning to its CPUs does nothing.
+std::vector<NumaNode> NumaNodes();
+
+// Parses a Linux CPU list such as "0-3,8,10-11".
+absl::StatusOr<std::vector<int>> ParseCpuList(absl::string_view cpu_list);
+
+// Restricts the calling thread to run on `cpus`. Does nothing if `cpus` is
+// empty, and returns an error if the affinity cannot be set.
+absl::Status PinCurrentThreadToCpus(absl::Span<const int> cpus);
+
+// Binds the memory pages fully inside [data, data + num_bytes) to the NUMA
+// node `node_id`, moving the pages already allocated elsewhere. Returns an
+// error if binding is not supported or not permitted, in which case the pages
+// stay where the first thread touching them put them.
+absl::Status BindToNumaNode(const void* data, size_t num_bytes, int node_id);
+
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_UTIL_NUMA_H_
@@ -0,0 +1,62 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/numa.h"
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "shell_encryption/testing/status_testing.h"
+
+namespace hintless_pir {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(Numa, ParsesCpuLists) {
+  ASSERT_OK_AND_ASSIGN(std::vector<int> cpus, ParseCpuList("0-2,5,7-8\n"));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 5, 7, 8));
+  ASSERT_OK_AND_ASSIGN(cpus, ParseCpuList(""));
+  EXPECT_THAT(cpus, IsEmpty());
+  EXPECT_FALSE(ParseCpuList("3-1").ok());
+  EXPECT_FALSE(ParseCpuList("1-2-3").ok());
+  EXPECT_FALSE(ParseCpuList("a").ok());
+}
+
+TEST(Numa, HasAtLeastOneNode) {
+  std::vector<NumaNode> nodes = NumaNodes();
+  ASSERT_FALSE(nodes.empty());
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    EXPECT_LT(nodes[i - 1].id, nodes[i].id);
+  }
+}
+
+TEST(Numa, PinsToTheCpusOfANode) {
+  std::vector<NumaNode> nodes = NumaNodes();
+  EXPECT_OK(PinCurrentThreadToCpus(nodes[0].cpus));
+  EXPECT_OK(PinCurrentThreadToCpus({}));
+}
+
+TEST(Numa, BindingIgnoresPartialPages) {
+  // A range within a single page has no full page to bind.
+  alignas(64) char buffer[64];
+  EXPECT_OK(BindToNumaNode(buffer, sizeof(buffer), NumaNodes()[0].id));
+  EXPECT_FALSE(BindToNumaNode(buffer, sizeof(buffer), -1).ok());
+}
+
+}  // namespace
+}  // namespace hintless_pir
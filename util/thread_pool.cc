@@ -0,0 +1,231 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "util/numa.h"
+
+namespace hintless_pir {
+
+ThreadPool::ThreadPool(int num_threads, std::vector<int> cpus)
+    : ThreadPool(num_threads, std::vector<std::vector<int>>{std::move(cpus)}) {}
+
+ThreadPool::ThreadPool(int num_threads,
+                       std::vector<std::vector<int>> cpus_per_group)
+    : cpus_per_group_(std::move(cpus_per_group)) {
+  int num_groups = std::max<int>(cpus_per_group_.size(), 1);
+  num_threads = std::max(num_threads, num_groups);
+  {
+    absl::MutexLock lock(&mutex_);
+    group_tasks_.resize(num_groups);
+  }
+  threads_.reserve(num_threads);
+  for (int g = 0; g < num_groups; ++g) {
+    num_threads_per_group_.push_back(num_threads * (g + 1) / num_groups -
+                                     num_threads * g / num_groups);
+    for (int i = 0; i < num_threads_per_group_[g]; ++i) {
+      threads_.emplace_back([this, g] { WorkLoop(g); });
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock lock(&mutex_);
+    is_shutting_down_ = true;
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Schedule(absl::AnyInvocable<void() &&> task) {
+  absl::MutexLock lock(&mutex_);
+  tasks_.push_back(std::move(task));
+}
+
+void ThreadPool::ScheduleOnGroup(int group,
+                                 absl::AnyInvocable<void() &&> task) {
+  absl::MutexLock lock(&mutex_);
+  group_tasks_[group].push_back(std::move(task));
+}
+
+void ThreadPool::WorkLoop(int group) {
+  // Pinning is only an optimization, so workers run anywhere if it fails.
+  if (group < static_cast<int>(cpus_per_group_.size())) {
+    PinCurrentThreadToCpus(cpus_per_group_[group]).IgnoreError();
+  }
+  Worker worker{.pool = this, .group = group};
+  while (true) {
+    absl::AnyInvocable<void() &&> task;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(&ThreadPool::HasTaskOrIsShuttingDown,
+                                   &worker));
+      // The tasks of the group come first, as only its workers can run them.
+      std::deque<absl::AnyInvocable<void() &&>>& tasks =
+          group_tasks_[group].empty() ? tasks_ : group_tasks_[group];
+      if (tasks.empty()) {
+        return;  // Shutting down, and all tasks have been run.
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    std::move(task)();
+  }
+}
+
+namespace {
+
+// The state shared by the calling thread and the helper tasks of ParallelFor.
+// Helper tasks may start after all indices have been processed, so the state
+// is reference counted, and `fn` is only called for claimed indices.
+class ParallelForState {
+ public:
+  ParallelForState(int64_t num_tasks, absl::FunctionRef<void(int64_t)> fn)
+      : num_tasks_(num_tasks), fn_(fn) {}
+
+  // Claims and runs task indices until there is none left.
+  void RunTasks() {
+    int64_t num_finished = 0;
+    for (int64_t i = next_task_.fetch_add(1); i < num_tasks_;
+         i = next_task_.fetch_add(1)) {
+      fn_(i);
+      ++num_finished;
+    }
+    if (num_finished > 0) {
+      absl::MutexLock lock(&mutex_);
+      num_finished_ += num_finished;
+    }
+  }
+
+  // Blocks until all tasks have finished.
+  void Wait() {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &ParallelForState::IsDone));
+  }
+
+ private:
+  bool IsDone() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return num_finished_ == num_tasks_;
+  }
+
+  const int64_t num_tasks_;
+  const absl::FunctionRef<void(int64_t)> fn_;
+  std::atomic<int64_t> next_task_{0};
+
+  absl::Mutex mutex_;
+  int64_t num_finished_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// Runs `fn` for all indices in [0, num_tasks) on the calling thread and on up
+// to `max_num_helpers` helper tasks scheduled by `schedule`.
+void ParallelForOnHelpers(
+    int64_t num_tasks, int max_num_helpers,
+    absl::FunctionRef<void(absl::AnyInvocable<void() &&>)> schedule,
+    absl::FunctionRef<void(int64_t)> fn) {
+  if (num_tasks <= 0) {
+    return;
+  }
+  if (max_num_helpers == 0 || num_tasks == 1) {
+    for (int64_t i = 0; i < num_tasks; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  auto state = std::make_shared<ParallelForState>(num_tasks, fn);
+  int64_t num_helpers = std::min<int64_t>(num_tasks - 1, max_num_helpers);
+  for (int64_t i = 0; i < num_helpers; ++i) {
+    schedule([state] { state->RunTasks(); });
+  }
+  // The calling thread also works on the tasks, so that the loop makes
+  // progress even if all workers are busy, e.g. when called from a worker.
+  state->RunTasks();
+  state->Wait();
+}
+
+absl::Status ParallelForWithStatusOnHelpers(
+    int64_t num_tasks, int max_num_helpers,
+    absl::FunctionRef<void(absl::AnyInvocable<void() &&>)> schedule,
+    absl::FunctionRef<absl::Status(int64_t)> fn) {
+  std::vector<absl::Status> statuses(std::max<int64_t>(num_tasks, 0));
+  ParallelForOnHelpers(num_tasks, max_num_helpers, schedule,
+                       [&](int64_t i) { statuses[i] = fn(i); });
+  for (auto& status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+void ParallelFor(int64_t num_tasks, ThreadPool* pool,
+                 absl::FunctionRef<void(int64_t)> fn) {
+  ParallelForOnHelpers(
+      num_tasks, pool == nullptr ? 0 : pool->NumThreads(),
+      [&](absl::AnyInvocable<void() &&> task) {
+        pool->Schedule(std::move(task));
+      },
+      fn);
+}
+
+absl::Status ParallelForWithStatus(
+    int64_t num_tasks, ThreadPool* pool,
+    absl::FunctionRef<absl::Status(int64_t)> fn) {
+  return ParallelForWithStatusOnHelpers(
+      num_tasks, pool == nullptr ? 0 : pool->NumThreads(),
+      [&](absl::AnyInvocable<void() &&> task) {
+        pool->Schedule(std::move(task));
+      },
+      fn);
+}
+
+void ParallelFor(int64_t num_tasks, ThreadPool* pool, int group,
+                 absl::FunctionRef<void(int64_t)> fn) {
+  ParallelForOnHelpers(
+      num_tasks, pool == nullptr ? 0 : pool->NumThreadsInGroup(group),
+      [&](absl::AnyInvocable<void() &&> task) {
+        pool->ScheduleOnGroup(group, std::move(task));
+      },
+      fn);
+}
+
+absl::Status ParallelForWithStatus(
+    int64_t num_tasks, ThreadPool* pool, int group,
+    absl::FunctionRef<absl::Status(int64_t)> fn) {
+  return ParallelForWithStatusOnHelpers(
+      num_tasks, pool == nullptr ? 0 : pool->NumThreadsInGroup(group),
+      [&](absl::AnyInvocable<void() &&> task) {
+        pool->ScheduleOnGroup(group, std::move(task));
+      },
+      fn);
+}
+
+}  // namespace hintless_pir
@@ -0,0 +1,124 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HINTLESS_PIR_UTIL_THREAD_POOL_H_
+#define HINTLESS_PIR_UTIL_THREAD_POOL_H_
+
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace hintless_pir {
+
+// A fixed-size pool of worker threads that run scheduled tasks in FIFO order.
+// The workers may be split into groups, e.g. one per NUMA node, that also run
+// the tasks scheduled on their group only.
+class ThreadPool {
+ public:
+  // Creates a pool with `num_threads` workers, and at least one worker.
+  explicit ThreadPool(int num_threads)
+      : ThreadPool(num_threads, std::vector<int>()) {}
+
+  // Same as above, but every worker is pinned to run on `cpus` only, e.g. the
+  // CPUs of a NUMA node, if the host supports it. Not pinned if empty.
+  ThreadPool(int num_threads, std::vector<int> cpus);
+
+  // Creates a pool with `num_threads` workers split evenly into one group per
+  // entry of `cpus_per_group`, with the workers of group g pinned to
+  // `cpus_per_group[g]` as above. Every group has at least one worker.
+  ThreadPool(int num_threads, std::vector<std::vector<int>> cpus_per_group);
+
+  // Waits for all scheduled tasks to finish and joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Schedules `task` to be run by one of the workers.
+  void Schedule(absl::AnyInvocable<void() &&> task);
+
+  // Schedules `task` to be run by one of the workers of group `group`.
+  void ScheduleOnGroup(int group, absl::AnyInvocable<void() &&> task);
+
+  int NumThreads() const { return static_cast<int>(threads_.size()); }
+
+  int NumGroups() const {
+    return static_cast<int>(num_threads_per_group_.size());
+  }
+
+  int NumThreadsInGroup(int group) const {
+    return num_threads_per_group_[group];
+  }
+
+ private:
+  // The arguments of the wait condition of a worker.
+  struct Worker {
+    ThreadPool* pool;
+    int group;
+  };
+
+  void WorkLoop(int group);
+
+  static bool HasTaskOrIsShuttingDown(Worker* worker)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker->pool->mutex_) {
+    ThreadPool* pool = worker->pool;
+    return !pool->tasks_.empty() ||
+           !pool->group_tasks_[worker->group].empty() ||
+           pool->is_shutting_down_;
+  }
+
+  absl::Mutex mutex_;
+  // The tasks to be run by any worker, and by the workers of every group.
+  std::deque<absl::AnyInvocable<void() &&>> tasks_ ABSL_GUARDED_BY(mutex_);
+  std::vector<std::deque<absl::AnyInvocable<void() &&>>> group_tasks_
+      ABSL_GUARDED_BY(mutex_);
+  bool is_shutting_down_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // The CPUs the workers of every group are pinned to; empty if not pinned.
+  const std::vector<std::vector<int>> cpus_per_group_;
+  std::vector<int> num_threads_per_group_;
+  std::vector<std::thread> threads_;
+};
+
+// Calls `fn(i)` for every i in [0, num_tasks), and returns once all calls have
+// returned. The calls are spread over the workers of `pool` and the calling
+// thread, so it is safe to call this function from within a task of `pool`.
+// When `pool` is null, all calls are made sequentially by the calling thread.
+void ParallelFor(int64_t num_tasks, ThreadPool* pool,
+                 absl::FunctionRef<void(int64_t)> fn);
+
+// Same as above, but `fn` returns a status. All calls are made regardless of
+// failures, and the returned status is the error of the smallest failing task
+// index, or OK if all calls succeeded.
+absl::Status ParallelForWithStatus(int64_t num_tasks, ThreadPool* pool,
+                                   absl::FunctionRef<absl::Status(int64_t)> fn);
+
+// Same as the above two functions, but the calls are spread over the workers
+// of group `group` of `pool` and the calling thread only.
+void ParallelFor(int64_t num_tasks, ThreadPool* pool, int group,
+                 absl::FunctionRef<void(int64_t)> fn);
+absl::Status ParallelForWithStatus(int64_t num_tasks, ThreadPool* pool,
+                                   int group,
+                                   absl::FunctionRef<absl::Status(int64_t)> fn);
+
+}  // namespace hintless_pir
+
+#endif  // HINTLESS_PIR_UTIL_THREAD_POOL_H_
@@ -0,0 +1,142 @@
+// Copyright 2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "shell_encryption/testing/status_testing.h"
+#include "util/numa.h"
+
+namespace hintless_pir {
+namespace {
+
+TEST(ThreadPool, RunsAllScheduledTasks) {
+  std::atomic<int> num_runs{0};
+  {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.NumThreads(), 4);
+    absl::BlockingCounter counter(100);
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule([&] {
+        num_runs.fetch_add(1);
+        counter.DecrementCount();
+      });
+    }
+    counter.Wait();
+  }
+  EXPECT_EQ(num_runs.load(), 100);
+}
+
+TEST(ThreadPool, HasAtLeastOneThread) {
+  ThreadPool pool(0);
+  EXPECT_EQ(pool.NumThreads(), 1);
+}
+
+TEST(ThreadPool, RunsTasksOnPinnedWorkers) {
+  std::vector<NumaNode> nodes = NumaNodes();
+  ThreadPool pool(2, nodes[0].cpus);
+  EXPECT_EQ(pool.NumThreads(), 2);
+  std::atomic<int> num_runs{0};
+  ParallelFor(10, &pool, [&](int64_t /*i*/) { num_runs.fetch_add(1); });
+  EXPECT_EQ(num_runs.load(), 10);
+}
+
+TEST(ThreadPool, SplitsWorkersIntoGroups) {
+  std::vector<NumaNode> nodes = NumaNodes();
+  ThreadPool pool(5, {nodes[0].cpus, nodes[0].cpus});
+  EXPECT_EQ(pool.NumThreads(), 5);
+  ASSERT_EQ(pool.NumGroups(), 2);
+  EXPECT_EQ(pool.NumThreadsInGroup(0), 2);
+  EXPECT_EQ(pool.NumThreadsInGroup(1), 3);
+
+  std::atomic<int> num_runs{0};
+  absl::BlockingCounter counter(30);
+  for (int i = 0; i < 10; ++i) {
+    for (int group = 0; group < 2; ++group) {
+      pool.ScheduleOnGroup(group, [&] {
+        num_runs.fetch_add(1);
+        counter.DecrementCount();
+      });
+    }
+    pool.Schedule([&] {
+      num_runs.fetch_add(1);
+      counter.DecrementCount();
+    });
+  }
+  counter.Wait();
+  EXPECT_EQ(num_runs.load(), 30);
+}
+
+TEST(ThreadPool, HasAtLeastOneThreadPerGroup) {
+  ThreadPool pool(1, std::vector<std::vector<int>>(3));
+  EXPECT_EQ(pool.NumThreads(), 3);
+  for (int group = 0; group < 3; ++group) {
+    EXPECT_EQ(pool.NumThreadsInGroup(group), 1);
+  }
+}
+
+TEST(ParallelFor, VisitsEveryIndexOnce) {
+  ThreadPool pool(3);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    std::vector<int> visits(1000, 0);
+    ParallelFor(visits.size(), p, [&](int64_t i) { visits[i]++; });
+    for (int v : visits) {
+      EXPECT_EQ(v, 1);
+    }
+  }
+}
+
+TEST(ParallelFor, NestedCallsDoNotDeadlock) {
+  ThreadPool pool(2);
+  std::atomic<int> num_runs{0};
+  ParallelFor(8, &pool, [&](int64_t) {
+    ParallelFor(8, &pool, [&](int64_t) { num_runs.fetch_add(1); });
+  });
+  EXPECT_EQ(num_runs.load(), 64);
+}
+
+TEST(ParallelFor, VisitsEveryIndexOnceOnGroup) {
+  ThreadPool pool(4, std::vector<std::vector<int>>(2));
+  for (int group = 0; group < 2; ++group) {
+    std::vector<int> visits(1000, 0);
+    ParallelFor(visits.size(), &pool, group, [&](int64_t i) { visits[i]++; });
+    for (int v : visits) {
+      EXPECT_EQ(v, 1);
+    }
+  }
+}
+
+TEST(ParallelForWithStatus, ReturnsFirstError) {
+  ThreadPool pool(4);
+  EXPECT_OK(ParallelForWithStatus(
+      16, &pool, [](int64_t) { return absl::OkStatus(); }));
+  absl::Status status = ParallelForWithStatus(16, &pool, [](int64_t i) {
+    if (i == 5 || i == 11) {
+      return absl::InternalError(absl::StrCat("task ", i));
+    }
+    return absl::OkStatus();
+  });
+  EXPECT_EQ(status, absl::InternalError("task 5"));
+}
+
+}  // namespace
+}  // namespace hintless_pir